@@ -136,17 +136,6 @@ namespace RF
 
         void* pData = GDALCreateAspectData(useAngeAsAzimuth);
 
-        GDALGeneric3x3ProcessingAlg pfnAlg = NULL;
-
-        if ( aspectAlgorithim == RF::SlopeAlgType::THORNE)
-        {
-            pfnAlg = GDALAspectAlg;
-        }
-        else if (aspectAlgorithim == RF::SlopeAlgType::ZEVTHORNE)
-        {
-            pfnAlg = GDALAspectZevenbergenThorneAlg;
-        }
-
         outputGDALDataset = GDALCreate ( GDALGetDatasetDriver(gDALDataset),
                             outputRasterFilename.toLocal8Bit().constData(),
                             GDALGetRasterXSize(gDALDataset),
@@ -161,7 +150,16 @@ namespace RF
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
 
-        GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+        GDALAspectAlgData& aspectData = *(GDALAspectAlgData*)pData;
+        if (aspectAlgorithim == RF::SlopeAlgType::THORNE)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALAspectKernel(aspectData), computeEdges);
+        }
+        else if (aspectAlgorithim == RF::SlopeAlgType::ZEVTHORNE)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALAspectZevenbergenThorneKernel(aspectData), computeEdges);
+        }
+        CPLFree(pData);
         
 
         return true;
@@ -0,0 +1,502 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+  Timings for the raster engines on synthetic grids, one section per run:
+    volcano_bench kernels [cells]   3x3 kernels, function pointer against functor, cells per second
+    volcano_bench basins [cells]    upslope area on a multi-catchment DEM for each thread count
+    volcano_bench memory [cells]    peak memory of the UpslopeArea path, fails over budget (100M cells by default)
+    volcano_bench memory-window [cells]  the same check for the window kernel flow algebra
+    volcano_bench iverson [cells]   Iverson failure depth, scan and root search, 50 depths (10M cells by default)
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <qstring.h>
+#include <qelapsedtimer.h>
+
+#include "gdal.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "volcanoutils.h"
+#include "erosionutils.h"
+
+
+//Cell size of the synthetic grids in metres
+#define BENCH_CELL_SIZE 10.0
+
+//Valleys in the synthetic DEM, each its own drainage basin
+#define BENCH_CATCHMENTS 48
+
+/*
+Upslope area working set per cell on one thread: flow directions and output (8), receiver table (12),
+topological order (4), donor bits (1) and the ready stack (up to 4), plus the written output band (4).
+The leaked per cell windows this guards against added 40 or more bytes a cell.
+*/
+#define BENCH_MEMORY_BYTES_PER_CELL 48
+
+//Depths tested through the deposit by the Iverson failure depth timings
+#define BENCH_DEPTH_INCREMENTS 50
+
+/*
+CreateSyntheticDEM: An in memory DEM of nCatchments parallel valleys draining south, split by ridges that
+fall between cells so no flow crosses them. A little deterministic noise keeps the kernels off flat ground.
+*/
+static GDALDatasetH CreateSyntheticDEM(int nXSize, int nYSize, int nCatchments)
+{
+    GDALDatasetH dem = GDALCreate(GDALGetDriverByName("MEM"), "", nXSize, nYSize, 1, GDT_Float32, NULL);
+    double transform[6] = {0, BENCH_CELL_SIZE, 0, nYSize*BENCH_CELL_SIZE, 0, -BENCH_CELL_SIZE};
+    GDALSetGeoTransform(dem, transform);
+    GDALRasterBandH band = GDALGetRasterBand(dem, 1);
+    GDALSetRasterNoDataValue(band, -9999);
+
+    double period = (double) nXSize/MAX(nCatchments, 1);
+    float* row = new float[nXSize];
+    for (int i = 0; i < nYSize; ++i)
+    {
+        for (int j = 0; j < nXSize; ++j)
+        {
+            unsigned int hash = (unsigned int) (i*73856093) ^ (unsigned int) (j*19349663);
+            double noise = ((hash % 1000)/1000.0 - 0.5)*0.01;
+            row[j] = (float) (0.1*(nYSize - i) + 50*fabs(sin(M_PI*(j + 0.5)/period)) + noise);
+        }
+        GDALRasterIO(band, GF_Write, 0, i, nXSize, 1, row, nXSize, 1, GDT_Float32, 0, 0);
+    }
+    delete[] row;
+    return dem;
+}
+
+//Empty in memory band the size of the source
+static GDALDatasetH CreateLike(GDALDatasetH src)
+{
+    GDALDatasetH dst = GDALCreate(GDALGetDriverByName("MEM"), "", GDALGetRasterXSize(src), GDALGetRasterYSize(src),
+                                  1, GDT_Float32, NULL);
+    double transform[6];
+    GDALGetGeoTransform(src, transform);
+    GDALSetGeoTransform(dst, transform);
+    GDALSetRasterNoDataValue(GDALGetRasterBand(dst, 1), -9999);
+    return dst;
+}
+
+//Grid edge for about nCells cells
+static int GridEdge(double nCells)
+{
+    return MAX((int) sqrt(nCells), 3);
+}
+
+/***************************************
+KERNELS
+***************************************/
+
+//One kernel through the function pointer processor, then as a functor on one thread and on every core
+template <class Kernel>
+static void BenchKernel(const char* name, GDALRasterBandH srcBand, GDALRasterBandH dstBand,
+                        GDALGeneric3x3ProcessingAlg pfnAlg, void* pData, const Kernel& kernel)
+{
+    double nCells = (double) GDALGetRasterBandXSize(srcBand)*GDALGetRasterBandYSize(srcBand);
+    QElapsedTimer timer;
+
+    timer.start();
+    GDALGeneric3x3Processing(srcBand, dstBand, pfnAlg, pData, true);
+    double pointerTime = timer.nsecsElapsed()/1.0e9;
+
+    timer.restart();
+    GDALGeneric3x3KernelProcessing(srcBand, dstBand, kernel, true, 1);
+    double kernelTime = timer.nsecsElapsed()/1.0e9;
+
+    timer.restart();
+    GDALGeneric3x3KernelProcessing(srcBand, dstBand, kernel, true, 0);
+    double threadedTime = timer.nsecsElapsed()/1.0e9;
+
+    std::cout << QString("%1 %2 %3 %4 %5")
+        .arg(name, -22)
+        .arg(nCells/pointerTime/1.0e6, 14, 'f', 1)
+        .arg(nCells/kernelTime/1.0e6, 14, 'f', 1)
+        .arg(pointerTime/kernelTime, 8, 'f', 2)
+        .arg(nCells/threadedTime/1.0e6, 14, 'f', 1) + "\n";
+}
+
+static int BenchKernels(double nCells)
+{
+    int nEdge = GridEdge(nCells);
+    GDALDatasetH dem = CreateSyntheticDEM(nEdge, nEdge, BENCH_CATCHMENTS);
+    GDALDatasetH dst = CreateLike(dem);
+    GDALRasterBandH srcBand = GDALGetRasterBand(dem, 1);
+    GDALRasterBandH dstBand = GDALGetRasterBand(dst, 1);
+
+    double transform[6];
+    GDALGetGeoTransform(dem, transform);
+
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+
+    std::cout << QString("3x3 kernels on %1 x %2 cells, million cells per second").arg(nEdge).arg(nEdge) + "\n";
+    std::cout << QString("%1 %2 %3 %4 %5")
+        .arg("kernel", -22)
+        .arg("pointer", 14)
+        .arg("functor", 14)
+        .arg("speedup", 8)
+        .arg(QString("%1 threads").arg(nThreads), 14) + "\n";
+
+    void* pSlopeData = GDALCreateSlopeData(transform, 1.0, 1);
+    const GDALSlopeAlgData& slopeData = *(GDALSlopeAlgData*) pSlopeData;
+    BenchKernel("Slope Horn", srcBand, dstBand, GDALSlopeHornAlg, pSlopeData, GDALSlopeHornKernel(slopeData));
+    BenchKernel("Slope ZT", srcBand, dstBand, GDALSlopeZevenbergenThorneAlg, pSlopeData, GDALSlopeZevenbergenThorneKernel(slopeData));
+    CPLFree(pSlopeData);
+
+    void* pAspectData = GDALCreateAspectData(true);
+    const GDALAspectAlgData& aspectData = *(GDALAspectAlgData*) pAspectData;
+    BenchKernel("Aspect Horn", srcBand, dstBand, GDALAspectAlg, pAspectData, GDALAspectKernel(aspectData));
+    BenchKernel("Aspect ZT", srcBand, dstBand, GDALAspectZevenbergenThorneAlg, pAspectData, GDALAspectZevenbergenThorneKernel(aspectData));
+    CPLFree(pAspectData);
+
+    void* pCurvatureData = GDALCreateCurvatureData(transform);
+    const GDALCurvatureAlgData& curvatureData = *(GDALCurvatureAlgData*) pCurvatureData;
+    BenchKernel("Curvature profile", srcBand, dstBand, GDALCurvatureProfileAlg, pCurvatureData, GDALCurvatureProfileKernel(curvatureData));
+    BenchKernel("Curvature contour", srcBand, dstBand, GDALCurvatureContourAlg, pCurvatureData, GDALCurvatureContourKernel(curvatureData));
+    BenchKernel("Curvature tangential", srcBand, dstBand, GDALCurvatureTangentAlg, pCurvatureData, GDALCurvatureTangentKernel(curvatureData));
+    CPLFree(pCurvatureData);
+
+    void* pFlowData = GDALCreateFlowDirectionData(transform);
+    const GDALFlowDirAlgData& flowData = *(GDALFlowDirAlgData*) pFlowData;
+    BenchKernel("Flow direction D8", srcBand, dstBand, GDALFlowDirection8Alg, pFlowData, GDALFlowDirection8Kernel(flowData));
+    BenchKernel("Flow direction D-inf", srcBand, dstBand, GDALFlowDirectionInfAlg, pFlowData, GDALFlowDirectionInfKernel(flowData));
+    CPLFree(pFlowData);
+
+    GDALClose(dst);
+    GDALClose(dem);
+    return 0;
+}
+
+//D-inf flow directions of the synthetic DEM
+static GDALDatasetH CreateSyntheticFlowDirections(int nXSize, int nYSize)
+{
+    GDALDatasetH dem = CreateSyntheticDEM(nXSize, nYSize, BENCH_CATCHMENTS);
+    GDALDatasetH flow = CreateLike(dem);
+
+    double transform[6];
+    GDALGetGeoTransform(dem, transform);
+    void* pFlowData = GDALCreateFlowDirectionData(transform);
+    GDALGeneric3x3KernelProcessing(GDALGetRasterBand(dem, 1), GDALGetRasterBand(flow, 1),
+                                   GDALFlowDirectionInfKernel(*(GDALFlowDirAlgData*) pFlowData), true);
+    CPLFree(pFlowData);
+    GDALClose(dem);
+    return flow;
+}
+
+/***************************************
+BASINS
+***************************************/
+
+//Upslope area for 1, 2, 4... threads up to every core, each checked against the one thread result
+static int BenchBasins(double nCells)
+{
+    int nEdge = GridEdge(nCells);
+    GDALDatasetH flow = CreateSyntheticFlowDirections(nEdge, nEdge);
+    GDALDatasetH dst = CreateLike(flow);
+    GDALRasterBandH flowBand = GDALGetRasterBand(flow, 1);
+    GDALRasterBandH dstBand = GDALGetRasterBand(dst, 1);
+
+    double transform[6];
+    GDALGetGeoTransform(flow, transform);
+
+    int nMaxThreads = 1;
+#ifdef _OPENMP
+    nMaxThreads = omp_get_max_threads();
+#endif
+
+    size_t nGridCells = (size_t) nEdge*nEdge;
+    std::vector<float> serial(nGridCells);
+    std::vector<float> threaded(nGridCells);
+    QElapsedTimer timer;
+
+    std::cout << QString("Upslope area on %1 x %2 cells in %3 valleys").arg(nEdge).arg(nEdge).arg(BENCH_CATCHMENTS) + "\n";
+
+    void* pData = RecursiveCreateInputData(transform);
+    timer.start();
+    GenericRecursiveFlowAlgebraProcessor(flowBand, dstBand, transform, RecursiveUpstreamFlowAlg, pData);
+    double genericTime = timer.nsecsElapsed()/1.0e9;
+    CPLFree(pData);
+
+    double serialTime = 0;
+    for (int nThreads = 1; ; nThreads = MIN(nThreads*2, nMaxThreads))
+    {
+        timer.restart();
+        UpstreamAccumulationProcessor(flowBand, NULL, dstBand, transform, UPSTREAM_AREA, nThreads);
+        double time = timer.nsecsElapsed()/1.0e9;
+
+        float* result = nThreads == 1 ? &serial[0] : &threaded[0];
+        GDALRasterIO(dstBand, GF_Read, 0, 0, nEdge, nEdge, result, nEdge, nEdge, GDT_Float32, 0, 0);
+        double maxDiff = 0;
+        if (nThreads == 1)
+        {
+            serialTime = time;
+            std::cout << QString("window kernels (one thread) %1 s").arg(genericTime, 0, 'f', 3) + "\n";
+        }
+        else
+        {
+            for (size_t k = 0; k < nGridCells; ++k)
+            {
+                maxDiff = MAX(maxDiff, fabs((double) threaded[k] - serial[k]));
+            }
+        }
+        std::cout << QString("%1 threads %2 s, %3x one thread, max difference %4")
+            .arg(nThreads, 3).arg(time, 0, 'f', 3).arg(serialTime/time, 0, 'f', 2).arg(maxDiff) + "\n";
+
+        if (nThreads == nMaxThreads)
+        {
+            break;
+        }
+    }
+
+    GDALClose(dst);
+    GDALClose(flow);
+    return 0;
+}
+
+/***************************************
+MEMORY
+***************************************/
+
+//Resident memory of the process in bytes, the peak so far or the current, 0 if unknown
+static double ResidentBytes(bool peak)
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return (double) (peak ? counters.PeakWorkingSetSize : counters.WorkingSetSize);
+    }
+    return 0;
+#else
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status)
+    {
+        const char* key = peak ? "VmHWM:" : "VmRSS:";
+        char line[256];
+        double kB = 0;
+        while (fgets(line, sizeof(line), status))
+        {
+            if (strncmp(line, key, strlen(key)) == 0)
+            {
+                kB = atof(line + strlen(key));
+                break;
+            }
+        }
+        fclose(status);
+        return kB*1024;
+    }
+    //No current figure without /proc, the peak makes the check conservative
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (double) usage.ru_maxrss;
+#else
+    return (double) usage.ru_maxrss*1024;
+#endif
+#endif
+}
+
+//Peak memory of one upslope area run over what was resident before it, fails if it is over budget
+static int BenchMemory(double nCells, bool windowKernels)
+{
+    int nEdge = GridEdge(nCells);
+    GDALDatasetH flow = CreateSyntheticFlowDirections(nEdge, nEdge);
+    GDALDatasetH dst = CreateLike(flow);
+    GDALRasterBandH flowBand = GDALGetRasterBand(flow, 1);
+    GDALRasterBandH dstBand = GDALGetRasterBand(dst, 1);
+
+    double transform[6];
+    GDALGetGeoTransform(flow, transform);
+
+    double before = ResidentBytes(false);
+    if (windowKernels)
+    {
+        void* pData = RecursiveCreateInputData(transform);
+        GenericRecursiveFlowAlgebraProcessor(flowBand, dstBand, transform, RecursiveUpstreamFlowAlg, pData);
+        CPLFree(pData);
+    }
+    else
+    {
+        //As UpslopeArea runs it
+        UpstreamAccumulationProcessor(flowBand, NULL, dstBand, transform, UPSTREAM_AREA, 1);
+    }
+    double peak = ResidentBytes(true);
+
+    GDALClose(dst);
+    GDALClose(flow);
+
+    double nGridCells = (double) nEdge*nEdge;
+    double bytesPerCell = (peak - before)/nGridCells;
+    std::cout << QString("%1 path on %2 x %3 cells, peak %4 MB over %5 MB resident, %6 bytes per cell (budget %7)")
+        .arg(windowKernels ? "Window kernel" : "UpslopeArea op").arg(nEdge).arg(nEdge)
+        .arg(peak/1048576, 0, 'f', 0).arg(before/1048576, 0, 'f', 0)
+        .arg(bytesPerCell, 0, 'f', 1).arg(BENCH_MEMORY_BYTES_PER_CELL) + "\n";
+
+    if (peak <= 0)
+    {
+        std::cout << QString("WARNING: Cannot read the resident memory of this process, not checked") + "\n";
+        return 0;
+    }
+    if (bytesPerCell > BENCH_MEMORY_BYTES_PER_CELL)
+    {
+        std::cout << QString("ERROR: Upslope area used more memory per cell than the budget") + "\n";
+        return 1;
+    }
+    return 0;
+}
+
+/***************************************
+IVERSON
+***************************************/
+
+/*
+Failure depth of every cell of a synthetic slope grid (10 to 50 degrees, 3 m deposit, water table at 2 m after
+24 h, 12 h of rain) solved as IversonFailureVolume does it, rows in parallel. tolerance 0 is the depth scan,
+otherwise the root search. Returns the time taken
+*/
+static double IversonPass(const std::vector<float>& slopeAngle, int nXSize, int nYSize, double tolerance,
+                          int nThreads, std::vector<float>& failureDepth)
+{
+    const double depositThickness = 3.0;
+    const double waterTable = 2.0;
+    const double frictionAngleRad = degreesToRadians(30.0);
+    const double cohesion = 4000;
+    const double satSoilWeight = 20000;
+    const double waterWeight = 9810;
+    const double hydraulicDiffusivity = 5.0e-5;
+    const double izKsat = 0.5;
+    const double duration = 12*3600.0;
+    const double time = 24*3600.0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int j = 0; j < nYSize; ++j)
+    {
+        IversonCellTerms terms;
+        for (int i = j*nXSize; i < (j+1)*nXSize; ++i)
+        {
+            IversonCellSetup(degreesToRadians(slopeAngle[i]), frictionAngleRad, cohesion, satSoilWeight, waterWeight,
+                             hydraulicDiffusivity, izKsat, terms);
+            if (tolerance > 0)
+            {
+                failureDepth[i] = IversonFailureDepthRoot(terms, depositThickness, waterTable, BENCH_DEPTH_INCREMENTS,
+                                                          tolerance, time, duration);
+            }
+            else
+            {
+                failureDepth[i] = IversonFailureDepthScan(terms, depositThickness, waterTable, BENCH_DEPTH_INCREMENTS,
+                                                          time, duration);
+            }
+        }
+    }
+    return timer.nsecsElapsed()/1.0e9;
+}
+
+//Cell setup plus the depth scan and the root search, on one thread and on every core
+static int BenchIverson(double nCells)
+{
+    int nEdge = GridEdge(nCells);
+    size_t nGridCells = (size_t) nEdge*nEdge;
+
+    std::vector<float> slopeAngle(nGridCells);
+    for (int i = 0; i < nEdge; ++i)
+    {
+        for (int j = 0; j < nEdge; ++j)
+        {
+            unsigned int hash = (unsigned int) (i*73856093) ^ (unsigned int) (j*19349663);
+            slopeAngle[(size_t) i*nEdge + j] = (float) (30 + 15*sin(i*0.01)*cos(j*0.013) + (hash % 1000)/200.0);
+        }
+    }
+    std::vector<float> failureDepth(nGridCells);
+
+    int nMaxThreads = 1;
+#ifdef _OPENMP
+    nMaxThreads = omp_get_max_threads();
+#endif
+
+    std::cout << QString("Iverson failure depth on %1 x %2 cells, %3 depth increments, million cells per second")
+        .arg(nEdge).arg(nEdge).arg(BENCH_DEPTH_INCREMENTS) + "\n";
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        double tolerance = pass == 0 ? 0 : 0.01;
+        double serialTime = IversonPass(slopeAngle, nEdge, nEdge, tolerance, 1, failureDepth);
+        double threadedTime = IversonPass(slopeAngle, nEdge, nEdge, tolerance, nMaxThreads, failureDepth);
+
+        size_t nFailed = 0;
+        for (size_t k = 0; k < nGridCells; ++k)
+        {
+            if (failureDepth[k] > 0)
+            {
+                ++nFailed;
+            }
+        }
+        std::cout << QString("%1 one thread %2, %3 threads %4, %5% of cells fail")
+            .arg(pass == 0 ? "scan" : "root", -5)
+            .arg(nGridCells/serialTime/1.0e6, 0, 'f', 2)
+            .arg(nMaxThreads).arg(nGridCells/threadedTime/1.0e6, 0, 'f', 2)
+            .arg(100.0*nFailed/nGridCells, 0, 'f', 1) + "\n";
+    }
+    return 0;
+}
+
+
+static void Usage()
+{
+    std::cout << QString("Usage: volcano_bench kernels|basins|memory|memory-window|iverson [cells]") + "\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        Usage();
+        return 1;
+    }
+
+    GDALAllRegister();
+
+    const char* section = argv[1];
+    double nCells = argc > 2 ? atof(argv[2]) : 0;
+
+    if (EQUAL(section, "kernels"))
+    {
+        return BenchKernels(nCells > 0 ? nCells : 16.0e6);
+    }
+    if (EQUAL(section, "basins"))
+    {
+        return BenchBasins(nCells > 0 ? nCells : 16.0e6);
+    }
+    if (EQUAL(section, "memory") || EQUAL(section, "memory-window"))
+    {
+        return BenchMemory(nCells > 0 ? nCells : 100.0e6, EQUAL(section, "memory-window"));
+    }
+    if (EQUAL(section, "iverson"))
+    {
+        return BenchIverson(nCells > 0 ? nCells : 10.0e6);
+    }
+
+    Usage();
+    return 1;
+}
@@ -10,6 +10,7 @@
 */
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
 
@@ -20,10 +21,8 @@
 #include "Workspace/DataExecution/InputOutput/output.h"
 #include "Workspace/DataExecution/Operations/typedoperationfactory.h"
 
-//OpenCV stuff
-#include "opencv2/imgproc/imgproc.hpp"
-
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "boxfilter.h"
 
 
@@ -44,6 +43,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataInputDataset_;
         CSIRO::DataExecution::TypedObject< QString >       dataOutputDatasetFilename_;
         CSIRO::DataExecution::TypedObject< double >        dataKernelSize_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataOutputDataset_;
 
 
@@ -51,6 +51,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputInputDataset_;
         CSIRO::DataExecution::InputScalar inputOutputDatasetFilename_;
         CSIRO::DataExecution::InputScalar inputKernelSize_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputOutputDataset_;
 
 
@@ -69,16 +70,19 @@ namespace RF
         dataInputDataset_(),
         dataOutputDatasetFilename_(),
         dataKernelSize_(5),
+        dataNumThreads_(0),
         dataOutputDataset_(),
         inputInputDataset_("Input Dataset", dataInputDataset_, op_),
         inputOutputDatasetFilename_("Output dataset filename", dataOutputDatasetFilename_, op_),
         inputKernelSize_("Kernel size", dataKernelSize_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputOutputDataset_("Output Dataset", dataOutputDataset_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
         // large data structure as input, you may wish to remove this call and replace it
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
+        inputNumThreads_.setDescription(tr("Tiles are smoothed in parallel (0 uses all cores)"));
         
     }
 
@@ -95,27 +99,20 @@ namespace RF
         
         GDALRasterBandH hBand = GDALGetRasterBand(inputDataset, 1);
 
-        float *data;
-        data = new float[GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand)];
+        int kSize = (int) kernelSize;
+        if (kSize <= 0 || !(kSize & 1))
+        {
+            std::cout << QString("ERROR: Kernel size must be a positive odd number, is %1").arg(kernelSize) + "\n";
+            return false;
+        }
+
+        //Box filter, every cell of the window has the same weight
+        std::vector<float> weights(kSize, 1.0f);
 
-        GDALRasterIO( hBand, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            data,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            GDT_Float32,
-            0,0);
-        
         int srcNoData;
         float srcNoDataValue;
 
         srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
-        
-        //Convert float array to an openCV mat (assuming rows = Y)
-        cv::Mat dataToMat(GDALGetRasterBandYSize(hBand),GDALGetRasterBandXSize(hBand), CV_32F, data);
-        cv::Mat blurredData = dataToMat.clone();
-
-        cv::blur(dataToMat, blurredData, cv::Size(kernelSize, kernelSize), cv::Point(-1,-1));
 
         outputDataset = GDALCreate( GDALGetDatasetDriver(inputDataset),
                                 outputDatasetFilename.toLocal8Bit().constData(),
@@ -130,13 +127,14 @@ namespace RF
         GDALSetProjection(outputDataset, GDALGetProjectionRef(inputDataset));
         GDALSetRasterNoDataValue(destBand, srcNoDataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        blurredData.data,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        GDT_Float32,
-                        0,0);
+        //Streamed in tiles, no data cells are left out of their neighbours' averages
+        CPLErr eErr = GDALNormalisedConvolution(hBand, destBand, &weights[0], &weights[0], kSize,
+                                                srcNoDataValue, *dataNumThreads_);
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not smooth dataset") + "\n";
+            return false;
+        }
 
         return true;
     }
@@ -123,21 +123,6 @@ namespace RF
 
         pData = GDALCreateCurvatureData(transform);
 
-        GDALGeneric3x3ProcessingAlg pfnAlg = NULL;
-
-        if (curvatureType == RF::CurvatureType::PROFILE)
-        {
-            pfnAlg = GDALCurvatureProfileAlg;
-        }
-        else if (curvatureType == RF::CurvatureType::CONTOUR)
-        {
-            pfnAlg = GDALCurvatureContourAlg;
-        }
-        else if (curvatureType == RF::CurvatureType::TANGENTIAL)
-        {
-            pfnAlg = GDALCurvatureTangentAlg;
-        }
-
         slopeRaster = GDALCreate (GDALGetDatasetDriver(gDALDataset),
                                     slopeName.toLocal8Bit().constData(),
                                     GDALGetRasterXSize(gDALDataset),
@@ -150,7 +135,20 @@ namespace RF
         GDALSetProjection(slopeRaster, GDALGetProjectionRef(gDALDataset));
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-        GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+        GDALCurvatureAlgData& curvatureData = *(GDALCurvatureAlgData*)pData;
+        if (curvatureType == RF::CurvatureType::PROFILE)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALCurvatureProfileKernel(curvatureData), computeEdges);
+        }
+        else if (curvatureType == RF::CurvatureType::CONTOUR)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALCurvatureContourKernel(curvatureData), computeEdges);
+        }
+        else if (curvatureType == RF::CurvatureType::TANGENTIAL)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALCurvatureTangentKernel(curvatureData), computeEdges);
+        }
+        CPLFree(pData);
 
 
         return true;
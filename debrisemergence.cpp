@@ -153,7 +153,7 @@ namespace RF
         GDALSetProjection(outputRaster, GDALGetProjectionRef(gDALDataset));
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-        GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);            
+        GDALGeneric3x3TiledProcessing(hBand, destBand, pfnAlg, pData, computeEdges);            
 
         return true;
     }
@@ -0,0 +1,202 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+  
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+#include <cassert>
+#include <iostream>
+
+#include <qstring.h>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+#include "volcanoplugin.h"
+#include "volcanoutils.h"
+#include "denoiseraster.h"
+
+
+namespace RF
+{
+    /**
+     * \internal
+     */
+    class DenoiseRasterImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::DenoiseRasterImpl)
+
+    public:
+        DenoiseRaster&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataInputDataset_;
+        CSIRO::DataExecution::TypedObject< QString >       dataOutputDatasetFilename_;
+        CSIRO::DataExecution::TypedObject< int >           dataKernelSize_;
+        CSIRO::DataExecution::TypedObject< double >        dataSpatialSigma_;
+        CSIRO::DataExecution::TypedObject< double >        dataRangeSigma_;
+        CSIRO::DataExecution::TypedObject< int >           dataBandNumber_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataOutputDataset_;
+
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputInputDataset_;
+        CSIRO::DataExecution::InputScalar inputOutputDatasetFilename_;
+        CSIRO::DataExecution::InputScalar inputKernelSize_;
+        CSIRO::DataExecution::InputScalar inputSpatialSigma_;
+        CSIRO::DataExecution::InputScalar inputRangeSigma_;
+        CSIRO::DataExecution::InputScalar inputBandNumber_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
+        CSIRO::DataExecution::Output      outputOutputDataset_;
+
+
+        DenoiseRasterImpl(DenoiseRaster& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    DenoiseRasterImpl::DenoiseRasterImpl(DenoiseRaster& op) :
+        op_(op),
+        dataInputDataset_(),
+        dataOutputDatasetFilename_(),
+        dataKernelSize_(5),
+        dataSpatialSigma_(0.0),
+        dataRangeSigma_(1.0),
+        dataBandNumber_(1),
+        dataNumThreads_(0),
+        dataOutputDataset_(),
+        inputInputDataset_("Input dataset", dataInputDataset_, op_),
+        inputOutputDatasetFilename_("Output dataset filename", dataOutputDatasetFilename_, op_),
+        inputKernelSize_("Kernel size", dataKernelSize_, op_),
+        inputSpatialSigma_("Spatial sigma", dataSpatialSigma_, op_),
+        inputRangeSigma_("Range sigma", dataRangeSigma_, op_),
+        inputBandNumber_("Band number", dataBandNumber_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
+        outputOutputDataset_("Output dataset", dataOutputDataset_, op_)
+    {
+        // Make sure all of our inputs have data by default. If your operation accepts a
+        // large data structure as input, you may wish to remove this call and replace it
+        // with constructors for each input in the initialisation list above.
+        op_.ensureHasData();
+
+        inputKernelSize_.setDescription(tr("Width of the filter window in cells, should be odd"));
+        inputSpatialSigma_.setDescription(tr("Standard deviation of the distance weighting in cells, 0 works it out from the kernel size as OpenCV does"));
+        inputRangeSigma_.setDescription(tr("Standard deviation of the value weighting in data units (m for a DEM). Steps much larger than this are kept, noise smaller than it is smoothed"));
+        inputNumThreads_.setDescription(tr("Tiles are denoised in parallel (0 uses all cores)"));
+    }
+
+
+    /**
+     *
+     */
+    bool DenoiseRasterImpl::execute()
+    {
+        GDALDatasetH& inputDataset          = *dataInputDataset_;
+        QString&      outputDatasetFilename = *dataOutputDatasetFilename_;
+        int&          kernelSize            = *dataKernelSize_;
+        double        spatialSigma          = *dataSpatialSigma_;
+        double&       rangeSigma            = *dataRangeSigma_;
+        GDALDatasetH& outputDataset         = *dataOutputDataset_;
+
+        if (kernelSize <= 0 || !(kernelSize & 1))
+        {
+            std::cout << QString("ERROR: Kernel size must be a positive odd number, is %1").arg(kernelSize) + "\n";
+            return false;
+        }
+        if (rangeSigma <= 0.0)
+        {
+            std::cout << QString("ERROR: Range sigma must be positive, is %1").arg(rangeSigma) + "\n";
+            return false;
+        }
+        if (*dataBandNumber_ < 1 || *dataBandNumber_ > GDALGetRasterCount(inputDataset))
+        {
+            std::cout << QString("ERROR: Band %1 does not exist, dataset has %2 bands").arg(*dataBandNumber_).arg(GDALGetRasterCount(inputDataset)) + "\n";
+            return false;
+        }
+        if (spatialSigma <= 0.0)
+        {
+            spatialSigma = 0.3*((kernelSize - 1)*0.5 - 1) + 0.8;
+        }
+
+        GDALRasterBandH hBand = GDALGetRasterBand(inputDataset, *dataBandNumber_);
+
+        int srcNoData;
+        float srcNoDataValue;
+
+        srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
+
+        outputDataset = GDALCreate( GDALGetDatasetDriver(inputDataset),
+                                outputDatasetFilename.toLocal8Bit().constData(),
+                                GDALGetRasterXSize(inputDataset), GDALGetRasterYSize(inputDataset),
+                                1,
+                                GDT_Float32, NULL);
+        double transform[6];
+        GDALGetGeoTransform(inputDataset,transform);
+
+        GDALRasterBandH destBand = GDALGetRasterBand(outputDataset, 1);
+        GDALSetGeoTransform(outputDataset, transform);
+        GDALSetProjection(outputDataset, GDALGetProjectionRef(inputDataset));
+        GDALSetRasterNoDataValue(destBand, srcNoDataValue);
+
+        CPLErr eErr = GDALBilateralFilter(hBand, destBand, kernelSize, spatialSigma, rangeSigma,
+                                          srcNoDataValue, *dataNumThreads_);
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not denoise dataset") + "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     *
+     */
+    DenoiseRaster::DenoiseRaster() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< DenoiseRaster >::getInstance(),
+            tr("Denoise raster"))
+    {
+        pImpl_ = new DenoiseRasterImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    DenoiseRaster::~DenoiseRaster()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  DenoiseRaster::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(DenoiseRaster, 
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
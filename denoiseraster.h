@@ -0,0 +1,60 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+  
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_DENOISERASTER_H
+#define RF_DENOISERASTER_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class DenoiseRasterImpl;
+
+    /**
+     * \brief Edge preserving denoising of float rasters.
+     *
+     * Bilateral filter that smooths noise such as LiDAR striping while keeping
+     * breaks of slope, skipping no data cells. Streams the raster in tiles on
+     * several threads and keeps the georeferencing, so it can run before
+     * slope and curvature.
+     */
+    class RF_API DenoiseRaster : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::DenoiseRaster)
+
+        DenoiseRasterImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        DenoiseRaster(const DenoiseRaster&);
+        DenoiseRaster& operator=(const DenoiseRaster&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        DenoiseRaster();
+        virtual ~DenoiseRaster();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::DenoiseRaster, RF_API)
+
+#endif
+
@@ -11,8 +11,10 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
+#include <qvector.h>
 
 #include "Workspace/Application/LanguageUtils/streamqstring.h"
 #include "Workspace/DataExecution/DataObjects/typedobject.h"
@@ -50,6 +52,10 @@ namespace RF
         CSIRO::DataExecution::TypedObject< QString >       dataOutputRasterName_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataOutputRaster_;
         CSIRO::DataExecution::TypedObject< int >           dataRasterBand_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataSourceMask_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataSourceXLocations_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataSourceYLocations_;
+        CSIRO::DataExecution::TypedObject< bool >          dataGeodesic_;
 
 
         // Inputs and outputs
@@ -61,6 +67,10 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputOutputRasterName_;
         CSIRO::DataExecution::Output      outputOutputRaster_;
         CSIRO::DataExecution::InputScalar inputRasterBand_;
+        CSIRO::DataExecution::InputScalar inputSourceMask_;
+        CSIRO::DataExecution::InputScalar inputSourceXLocations_;
+        CSIRO::DataExecution::InputScalar inputSourceYLocations_;
+        CSIRO::DataExecution::InputScalar inputGeodesic_;
 
 
         EnergyConeImpl(EnergyCone& op);
@@ -83,6 +93,10 @@ namespace RF
         dataOutputRasterName_(),
         dataOutputRaster_(),
         dataRasterBand_(1),
+        dataSourceMask_(),
+        dataSourceXLocations_(),
+        dataSourceYLocations_(),
+        dataGeodesic_(false),
         inputElevationDataset_("Elevation Dataset", dataElevationDataset_, op_),
         inputMultiplier_("Multiplier", dataMultiplier_, op_),
         inputAddHeight_("Additional height", dataAddHeight_, op_),
@@ -90,8 +104,15 @@ namespace RF
         inputYLocation_("Y location", dataYLocation_, op_),
         inputOutputRasterName_("Output Raster name", dataOutputRasterName_, op_),
         outputOutputRaster_("Output Raster", dataOutputRaster_, op_),
-        inputRasterBand_("Raster Band", dataRasterBand_, op_)
+        inputRasterBand_("Raster Band", dataRasterBand_, op_),
+        inputSourceMask_("(Optional) Source mask dataset", dataSourceMask_, op_),
+        inputSourceXLocations_("Source X locations", dataSourceXLocations_, op_),
+        inputSourceYLocations_("Source Y locations", dataSourceYLocations_, op_),
+        inputGeodesic_("Geodesic distance", dataGeodesic_, op_)
     {
+        inputSourceMask_.setDescription(tr("Non-zero cells are cone apexes (e.g. a crater rim or fissure), the cone is the envelope over all of them"));
+        inputSourceXLocations_.setDescription(tr("Apexes as points, with the source mask or instead of it. Without either the apex is the highest cell"));
+        inputGeodesic_.setDescription(tr("Measure the horizontal path length around the terrain instead of the straight line, cells the energy line meets at or below the ground block it"));
     }
 
 
@@ -124,6 +145,8 @@ namespace RF
         }
 
         hBand = GDALGetRasterBand(elevationDataset, rasterBand);
+        int nXSize = GDALGetRasterBandXSize(hBand);
+        int nYSize = GDALGetRasterBandYSize(hBand);
 
         double transform[6], invTransform[6];
         GDALGetGeoTransform(elevationDataset, transform);
@@ -135,33 +158,84 @@ namespace RF
         dstNodataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNodata);
         std::cout << QString("Input nodata value for energy cone is %1").arg(dstNodataValue) + "\n";
 
-        float * elevation;
-        elevation = new float [GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand)];
-
-        GDALRasterIO(hBand, GF_Read,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand),GDALGetRasterBandYSize(hBand),
-                        elevation,
-                        GDALGetRasterBandXSize(hBand),GDALGetRasterBandYSize(hBand),
-                        GDT_Float32,
-                        0,0);
-
-
-        float * energyCone;
-        energyCone = new float [GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand)];
-
-        float maxElev = elevation[0];//first value
-        int cells[2];
+        //Find max cell and the lowest cell, and any source cells, a line at a time
+        float * elevationLine = new float [nXSize];
+        float maxElev = 0;
+        float minElev = 0;
+        int cells[2] = {-1, -1};
+
+        //Sources as cells with their apex heights
+        std::vector<int> sourceCells;
+        std::vector<float> sourceHeights;
+
+        bool useSourceMask = inputSourceMask_.connected();
+        GDALRasterBandH maskBand = NULL;
+        float * maskLine = NULL;
+        int maskNoData = 0;
+        float maskNoDataValue = 0;
+        if (useSourceMask)
+        {
+            if (GDALGetRasterXSize(*dataSourceMask_) != nXSize || GDALGetRasterYSize(*dataSourceMask_) != nYSize)
+            {
+                std::cout << QString("ERROR: Source mask is %1 x %2 cells, elevation is %3 x %4").arg(GDALGetRasterXSize(*dataSourceMask_))
+                    .arg(GDALGetRasterYSize(*dataSourceMask_)).arg(nXSize).arg(nYSize) + "\n";
+                delete[] elevationLine;
+                return false;
+            }
+            maskBand = GDALGetRasterBand(*dataSourceMask_, 1);
+            maskNoDataValue = (float) GDALGetRasterNoDataValue(maskBand, &maskNoData);
+            maskLine = new float [nXSize];
+        }
 
-        //Find max cell
-        for (int i = 1; i < GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand); ++i)
+        for (int y = 0; y < nYSize; ++y)
         {
-            if (elevation[i] > maxElev && elevation[i] != dstNodataValue)
+            GDALRasterIO(hBand, GF_Read,
+                            0,y,
+                            nXSize,1,
+                            elevationLine,
+                            nXSize,1,
+                            GDT_Float32,
+                            0,0);
+            if (useSourceMask)
             {
-                maxElev = elevation[i];
-                cells[1] = floorf(i/GDALGetRasterBandXSize(hBand));
-                cells[0] = i - (cells[1]*GDALGetRasterBandXSize(hBand));
+                GDALRasterIO(maskBand, GF_Read,
+                                0,y,
+                                nXSize,1,
+                                maskLine,
+                                nXSize,1,
+                                GDT_Float32,
+                                0,0);
             }
+            for (int x = 0; x < nXSize; ++x)
+            {
+                if (elevationLine[x] == dstNodataValue)
+                {
+                    continue;
+                }
+                if (useSourceMask && maskLine[x] != 0 && !(maskNoData && maskLine[x] == maskNoDataValue))
+                {
+                    sourceCells.push_back((y*nXSize) + x);
+                    sourceHeights.push_back(elevationLine[x] + *dataAddHeight_);
+                }
+                if (cells[0] < 0 || elevationLine[x] < minElev)
+                {
+                    minElev = elevationLine[x];
+                }
+                if (cells[0] < 0 || elevationLine[x] > maxElev)
+                {
+                    maxElev = elevationLine[x];
+                    cells[0] = x;
+                    cells[1] = y;
+                }
+            }
+        }
+        delete[] elevationLine;
+        delete[] maskLine;
+
+        if (cells[0] < 0)
+        {
+            std::cout << QString("ERROR: Elevation dataset has no data") + "\n";
+            return false;
         }
 
         std::cout << QString("Max elevation is %1 at cell %2, %3").arg(maxElev).arg(cells[0]).arg(cells[1]) + "\n";
@@ -171,19 +245,127 @@ namespace RF
 		int pixelX = (int)floor(invTransform[0] + invTransform[1] * *dataXLocation_ + invTransform[2] * *dataYLocation_);
 		int pixelY = (int)floor(invTransform[3] + invTransform[4] * *dataXLocation_ + invTransform[5] * *dataYLocation_);
 
-		if (xLocation >= 0.0 && yLocation >= 0.0)
+		if (xLocation >= 0.0 && yLocation >= 0.0 &&
+            pixelX >= 0 && pixelX < nXSize && pixelY >= 0 && pixelY < nYSize)
 		{
-			float * maxElev = getRasterData(elevationDataset, dstNodataValue, pixelX, pixelY,
-				1, 1);  
-            std::cout << QString("Elevation is %1 m").arg(*maxElev) + "\n";
+			float pixElev;
+			GDALRasterIO(hBand, GF_Read, pixelX, pixelY, 1, 1, &pixElev, 1, 1, GDT_Float32, 0, 0);
+            std::cout << QString("Elevation is %1 m").arg(pixElev) + "\n";
         }
        
         maxElev = maxElev + *dataAddHeight_;
 
-        for (int i = 0; i < GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand); ++i)
+        //Point sources
+        const QVector<double>& sourceXLocations = *dataSourceXLocations_;
+        const QVector<double>& sourceYLocations = *dataSourceYLocations_;
+        if (sourceXLocations.size() != sourceYLocations.size())
+        {
+            std::cout << QString("ERROR: %1 source X locations but %2 source Y locations").arg(sourceXLocations.size()).arg(sourceYLocations.size()) + "\n";
+            return false;
+        }
+        for (int k = 0; k < (int) sourceXLocations.size(); ++k)
         {
-            int y = floorf(i/GDALGetRasterBandXSize(hBand));
-            int x = i - (y*GDALGetRasterBandXSize(hBand));
+            int sourceX = (int)floor(invTransform[0] + invTransform[1] * sourceXLocations[k] + invTransform[2] * sourceYLocations[k]);
+            int sourceY = (int)floor(invTransform[3] + invTransform[4] * sourceXLocations[k] + invTransform[5] * sourceYLocations[k]);
+            float sourceElev;
+            if (sourceX < 0 || sourceX >= nXSize || sourceY < 0 || sourceY >= nYSize ||
+                GDALRasterIO(hBand, GF_Read, sourceX, sourceY, 1, 1, &sourceElev, 1, 1, GDT_Float32, 0, 0) != CE_None ||
+                sourceElev == dstNodataValue)
+            {
+                std::cout << QString("WARNING: Source (%1, %2) is not on the elevation dataset, skipping it").arg(sourceXLocations[k]).arg(sourceYLocations[k]) + "\n";
+                continue;
+            }
+            sourceCells.push_back((sourceY*nXSize) + sourceX);
+            sourceHeights.push_back(sourceElev + *dataAddHeight_);
+        }
+
+        bool multiSource = useSourceMask || sourceXLocations.size() > 0;
+        if (multiSource && sourceCells.empty())
+        {
+            std::cout << QString("ERROR: No energy cone sources on the elevation dataset") + "\n";
+            return false;
+        }
+        if (!multiSource)
+        {
+            sourceCells.push_back((cells[1]*nXSize) + cells[0]);
+            sourceHeights.push_back(maxElev);
+        }
+        std::cout << QString("Energy cone from %1 sources").arg(sourceCells.size()) + "\n";
+
+        bool geodesic = *dataGeodesic_;
+        if (geodesic && multiplier <= 0)
+        {
+            std::cout << QString("ERROR: A geodesic energy cone needs a positive multiplier") + "\n";
+            return false;
+        }
+
+        /*
+        The cone is above the ground only while the horizontal distance x multiplier is
+        under the drop to the lowest cell, so only the window within that radius of the sources is computed
+        */
+        int window[4] = {0, 0, nXSize, nYSize};
+        if (multiplier > 0)
+        {
+            int sourceBounds[4] = {nXSize, nYSize, -1, -1};
+            float highestSource = sourceHeights[0];
+            for (int k = 0; k < (int) sourceCells.size(); ++k)
+            {
+                sourceBounds[0] = MIN(sourceBounds[0], sourceCells[k] % nXSize);
+                sourceBounds[1] = MIN(sourceBounds[1], sourceCells[k] / nXSize);
+                sourceBounds[2] = MAX(sourceBounds[2], sourceCells[k] % nXSize);
+                sourceBounds[3] = MAX(sourceBounds[3], sourceCells[k] / nXSize);
+                highestSource = MAX(highestSource, sourceHeights[k]);
+            }
+            double radius = (highestSource - minElev) / multiplier;
+            int radiusX = (int) MIN((double) nXSize, ceil(radius / fabs(transform[1])) + 1);
+            int radiusY = (int) MIN((double) nYSize, ceil(radius / fabs(transform[5])) + 1);
+            window[0] = MAX(0, sourceBounds[0] - radiusX);
+            window[1] = MAX(0, sourceBounds[1] - radiusY);
+            window[2] = MIN(nXSize, sourceBounds[2] + radiusX + 1) - window[0];
+            window[3] = MIN(nYSize, sourceBounds[3] + radiusY + 1) - window[1];
+        }
+        int nWindowCells = window[2] * window[3];
+
+        float * elevation;
+        elevation = new float [nWindowCells];
+
+        GDALRasterIO(hBand, GF_Read,
+                        window[0],window[1],
+                        window[2],window[3],
+                        elevation,
+                        window[2],window[3],
+                        GDT_Float32,
+                        0,0);
+
+        float * energyCone;
+        energyCone = new float [nWindowCells];
+
+        //Sources in window cells
+        std::vector<int> windowSources(sourceCells.size());
+        for (int k = 0; k < (int) sourceCells.size(); ++k)
+        {
+            windowSources[k] = (((sourceCells[k] / nXSize) - window[1])*window[2]) + ((sourceCells[k] % nXSize) - window[0]);
+        }
+
+        if (geodesic)
+        {
+            //The path around the terrain is never shorter than the straight line, so the window holds
+            energyConeGeodesic(elevation, window[2], window[3], srcNodata, dstNodataValue,
+                               fabs(transform[1]), fabs(transform[5]), multiplier,
+                               windowSources, sourceHeights, energyCone);
+        }
+        else if (multiSource)
+        {
+            //Envelope of the cones
+            energyConeEnvelope(elevation, window[2], window[3], srcNodata, dstNodataValue,
+                               fabs(transform[1]), fabs(transform[5]), multiplier,
+                               windowSources, sourceHeights, energyCone);
+        }
+
+        for (int i = 0; i < nWindowCells && !multiSource && !geodesic; ++i)
+        {
+            int y = window[1] + (i / window[2]);
+            int x = window[0] + (i % window[2]);
             if ((cells[0]-x)+(cells[1]-y)+(maxElev-elevation[i]) <= 0)
             {
                 energyCone[i] = 0.0;//dstNodataValue;
@@ -231,14 +413,20 @@ namespace RF
           
         GDALSetRasterNoDataValue(destBand, dstNodataValue);
 
+        //Outside the window the cone is below the ground
+        GDALFillRaster(destBand, 0.0, 0.0);
+
         GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
+                        window[0],window[1],
+                        window[2],window[3],
                         energyCone,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
+                        window[2],window[3],
                         GDT_Float32,
                         0,0);
 
+        delete[] elevation;
+        delete[] energyCone;
+
         return true;
     }
 
@@ -27,7 +27,7 @@ namespace RF
     class EnergyConeImpl;
 
     /**
-     * \brief Calculates Sheridan's energy cone.
+     * \brief Calculates Sheridan's energy cone, from one apex or as the envelope over many.
      *
      */
     class RF_API EnergyCone : public CSIRO::DataExecution::Operation
@@ -11,8 +11,10 @@ as endorsement.
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
+#include <qelapsedtimer.h>
 
 #include "Workspace/Application/LanguageUtils/streamqstring.h"
 #include "Workspace/DataExecution/DataObjects/typedobject.h"
@@ -27,6 +29,9 @@ as endorsement.
 #include "energyconoid.h"
 #include "volcanoutils.h"
 
+//Slope table resolution, entries per degree
+#define CONOID_SLOPE_STEPS 100
+
 
 namespace RF
 {
@@ -62,6 +67,8 @@ namespace RF
 		CSIRO::DataExecution::TypedObject< int >           dataRasterBand_;
 		CSIRO::DataExecution::TypedObject< double >		   dataReducedGravity_;
 		CSIRO::DataExecution::TypedObject< double >		   dataImax_;
+		CSIRO::DataExecution::TypedObject< double >		   dataComputeTime_;
+		CSIRO::DataExecution::TypedObject< bool >		   dataGeodesic_;
 
 		// Inputs and outputs
 		CSIRO::DataExecution::InputScalar inputElevationDataset_;
@@ -82,8 +89,10 @@ namespace RF
 		CSIRO::DataExecution::Output	  outputDyPressure_;
 		CSIRO::DataExecution::Output	  outputDepositMass_;
 		CSIRO::DataExecution::InputScalar inputRasterBand_;
+		CSIRO::DataExecution::InputScalar inputGeodesic_;
 		CSIRO::DataExecution::Output	  outputReducedGravity_;
 		CSIRO::DataExecution::Output	  outputImax_;
+		CSIRO::DataExecution::Output	  outputComputeTime_;
 
         EnergyConoidImpl(EnergyConoid& op);
 
@@ -117,6 +126,8 @@ namespace RF
 		dataRasterBand_(1),
 		dataReducedGravity_(),
 		dataImax_(),
+		dataComputeTime_(0.0),
+		dataGeodesic_(false),
 		inputElevationDataset_("Elevation Dataset", dataElevationDataset_, op_),
 		inputSlopeDataset_("(Optional) Slope dataset", dataSlopeDataset_, op_),
 		inputSettlingVelocity_("Settling velocity", dataSettlingVelocity_, op_),
@@ -136,7 +147,9 @@ namespace RF
 		outputDepositMass_("Deposit mass", dataDepositMass_, op_),
 		outputReducedGravity_("Reduced gravity", dataReducedGravity_, op_),
 		outputImax_("Maximum runout", dataImax_, op_),
-		inputRasterBand_("Raster Band", dataRasterBand_, op_)
+		inputRasterBand_("Raster Band", dataRasterBand_, op_),
+		inputGeodesic_("Geodesic distance", dataGeodesic_, op_),
+		outputComputeTime_("Compute time", dataComputeTime_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
         // large data structure as input, you may wish to remove this call and replace it
@@ -146,6 +159,8 @@ namespace RF
 		inputRotation_.setDescription(tr("Numer of collapse sectors radially, volume per \
 					sector will be calculated as Vol/(2pi/N), where N is the number of sectors"));
 		inputSlopeDataset_.setDescription(tr("Slope angle dataset for energy conoid on a slope"));
+		inputGeodesic_.setDescription(tr("Measure the path length around the terrain instead of the straight line, cells the current cannot climb block it"));
+		outputComputeTime_.setDescription(tr("Milliseconds spent evaluating the conoid over the cells, excluding raster I/O"));
         // Recommend setting a description of the operation and each input / output here:
         // op_.setDescription(tr("My operation does this, that and this other thing."));
         // input1_.input_.setDescription(tr("Used for such and such."));
@@ -157,38 +172,67 @@ namespace RF
      *
      */
 
-	float ecludianDistance2D(float X, float Y, float x, float y)
+	//Everything in the conoid that does not depend on distance, for one reduced gravity
+	typedef struct
+	{
+		double lmax;
+		double hScale; //h_max_cyl(g, C, lmax, x) = hScale*(1 - x^4)/x^2
+		double lambda_c;
+	} ConoidConstants;
+
+	static ConoidConstants conoidConstants(double gravity, double ws, double fr, double phi,
+		double rho_p, double rho_a, double A, bool axisymmetric)
 	{
-		return sqrt(pow(fabs(X - x), 2) + pow(fabs(Y - y), 2));
+		ConoidConstants constants;
+		double gp = ((rho_p - rho_a) / rho_a)*gravity;
+		//C, a decay constant
+		//Eq. 13 in Esposito Ongaro
+		double C = pow(ws, 1.0 / 3.0)*pow(fr, 2.0 / 3.0)*pow(phi, 1.0 / 3.0)*pow(gp, 1.0 / 3.0);
+		constants.lmax = l_max(phi, fr, A, ws, gp, axisymmetric);
+		constants.hScale = (C*C*pow(constants.lmax, 2.0 / 3.0)) / (8 * gravity);
+		constants.lambda_c = ws / (fr*sqrt(pow(2 * A, 3.0)*gp));
+		return constants;
 	}
 
-	double l_max(double phi, double fr, double A, double w_s, double g_p, bool axisymmetric = true)
+	//Constants for a cell, slopes outside 0-90 degrees (nodata) are treated as flat
+	static inline const ConoidConstants& cellConstants(const float* slope, int i,
+		const ConoidConstants& flatConstants, const std::vector<ConoidConstants>& slopeConstants)
 	{
-		if (axisymmetric)
+		if (slope && slope[i] >= 0 && slope[i] <= 90)
 		{
-			return{
-				pow((8 * sqrt(phi)) /
-				(pow(fr*sqrt(g_p*pow(2 * A,3.0)),-1.0)*w_s), 1.0/4.0)
-			};
-		}
-		else
-		{
-			return{
-				pow((5 * sqrt(phi)) /
-				(pow(fr*sqrt(g_p*pow(A,3.0)),-1.0)*w_s), 2.0 / 5.0)
-			};
+			return slopeConstants[(int) ((slope[i] * CONOID_SLOPE_STEPS) + 0.5)];
 		}
+		return flatConstants;
 	}
 
-	double h_max_cyl(double grav, double C, double linf, double x) //Cylindrical h_max
+	//The current stops past its runout and where the conoid does not reach the ground
+	struct ConoidBlocked
 	{
-		return{
-			(1 / (2 * grav))*
-			pow(0.5*C*pow(linf, 1.0 / 3.0)*(sqrt(1 - pow(x,4.0)) / x)
-				,2.0)
-		};
-	}
-	
+		const float* elevation;
+		const float* slope;
+		int srcNoData;
+		float srcNoDataValue;
+		float ventElevation;
+		const ConoidConstants* flatConstants;
+		const std::vector<ConoidConstants>* slopeConstants;
+
+		inline bool operator()(int cell, float distance) const
+		{
+			if (srcNoData && elevation[cell] == srcNoDataValue)
+			{
+				return true;
+			}
+			const ConoidConstants& constants = cellConstants(slope, cell, *flatConstants, *slopeConstants);
+			double dist = distance / constants.lmax;
+			if (!(dist <= 1.0))
+			{
+				return true;
+			}
+			double dist2 = dist*dist;
+			return (constants.hScale*(1 - (dist2*dist2)) / dist2) + ventElevation - elevation[cell] <= 0;
+		}
+	};
+
     bool EnergyConoidImpl::execute()
     {
 		GDALDatasetH& elevationDataset = *dataElevationDataset_;
@@ -197,15 +241,18 @@ namespace RF
 		int&          rasterBand = *dataRasterBand_;
 
 		GDALAllRegister();
-		
-		float dstNodataValue;
-		float * elevation = getRasterData(elevationDataset, dstNodataValue);
 
-		float * slope;
-		if (inputSlopeDataset_.connected())
+		if (rasterBand > GDALGetRasterCount(elevationDataset))
 		{
-			slope = getRasterData(*dataSlopeDataset_, dstNodataValue);
+			std::cout << QString("ERROR: Not enough raster bands, number of bands is %1, band selected is %2").arg(GDALGetRasterCount(elevationDataset)).arg(rasterBand) + "\n";
+			return false;
 		}
+
+		GDALRasterBandH elevationBand = GDALGetRasterBand(elevationDataset, rasterBand);
+		int nXSize = GDALGetRasterXSize(elevationDataset);
+		int nYSize = GDALGetRasterYSize(elevationDataset);
+		int srcNoData;
+		float dstNodataValue = (float) GDALGetRasterNoDataValue(elevationBand, &srcNoData);
 		
 		/*START - Get constants for energy conoid model (Imax, C, gp', \lambda)
 		From Esposti Ongaro et al. (2016) 'A fast, calibrated model for pyroclastic 
@@ -227,10 +274,6 @@ namespace RF
 
 		double A = *dataVolume_ / ((2 * M_PI) / *dataRotation_);
 
-		//C, a decay constant
-		//Eq. 13 in Esposito Ongaro	
-		double C = pow(*dataSettlingVelocity_, 1.0 / 3.0)*pow(*dataFroude_, 2.0 / 3.0)*pow(*dataConcentration_, 1.0 / 3.0)*pow(gp, 1.0 / 3.0);
-
 		//Calculate lmax
 		double lmax = l_max(*dataConcentration_, *dataFroude_, A, *dataSettlingVelocity_, gp, *dataAxisymmetric_);
 
@@ -242,18 +285,6 @@ namespace RF
 		STOP - Get constants for energy conoid model
 		*/
 
-		/*
-		Loop through cells in the raster, calculating hmax (eq. 12 in Esposito Ongaro)
-		*/
-		float * energyConoid;
-		energyConoid = new float[GDALGetRasterXSize(elevationDataset)*GDALGetRasterYSize(elevationDataset)];
-		float * elevDiff;
-		elevDiff = new float[GDALGetRasterXSize(elevationDataset)*GDALGetRasterYSize(elevationDataset)];
-		float * dyPressure;
-		dyPressure = new float[GDALGetRasterXSize(elevationDataset)*GDALGetRasterYSize(elevationDataset)];
-		float * depositMass;
-		depositMass = new float[GDALGetRasterXSize(elevationDataset)*GDALGetRasterYSize(elevationDataset)];
-
 		//Get geotransform to convert from cellspace (P,L) to geographical space
 		//Xp = padfTransform[0] + P*padfTransform[1] + L*padfTransform[2]; 
 		//Yp = padfTransform[3] + P*padfTransform[4] + L*padfTransform[5];
@@ -267,52 +298,149 @@ namespace RF
 		int pixelX = (int)floor(invTransform[0] + invTransform[1] * *dataXLocation_ + invTransform[2] * *dataYLocation_);
 		int pixelY = (int)floor(invTransform[3] + invTransform[4] * *dataXLocation_ + invTransform[5] * *dataYLocation_);
 		
-		float * pixElev = getRasterData(elevationDataset, dstNodataValue, pixelX, pixelY,
-			1, 1);
+		float pixElev;
+		if (pixelX < 0 || pixelX >= nXSize || pixelY < 0 || pixelY >= nYSize ||
+			GDALRasterIO(elevationBand, GF_Read, pixelX, pixelY, 1, 1, &pixElev, 1, 1, GDT_Float32, 0, 0) != CE_None)
+		{
+			std::cout << QString("ERROR: Initiation point (%1, %2) is outside the elevation dataset").arg(*dataXLocation_).arg(*dataYLocation_) + "\n";
+			return false;
+		}
 
-		std::cout << QString("Elevation at initiation point is %1 metres.").arg(*pixElev) + "\n";
+		std::cout << QString("Elevation at initiation point is %1 metres.").arg(pixElev) + "\n";
 
-		for (int i = 0; i < GDALGetRasterXSize(elevationDataset)*GDALGetRasterYSize(elevationDataset); ++i)
+		/*
+		Nothing reaches past lmax (the slope only shortens it, cos(slope) <= 1),
+		so only the window around it is read and computed
+		*/
+		int window[4] = {0, 0, 0, 0};
+		if (!getRadiusWindow(transform, nXSize, nYSize, *dataXLocation_, *dataYLocation_, lmax, window))
 		{
-			int L = floorf(i / GDALGetRasterXSize(elevationDataset));
-			int P = i - (L*GDALGetRasterXSize(elevationDataset));
+			std::cout << QString("WARNING: Maximum runout does not reach any cell") + "\n";
+		}
+		int nWindowCells = window[2] * window[3];
 
-			double xl = transform[0] + P*transform[1] + L*transform[2];
-			double yl = transform[3] + P*transform[4] + L*transform[5];
+		float * elevation = new float[nWindowCells];
+		float * slope = NULL;
+		if (nWindowCells > 0)
+		{
+			GDALRasterIO(elevationBand, GF_Read,
+				window[0], window[1], window[2], window[3],
+				elevation,
+				window[2], window[3],
+				GDT_Float32,
+				0, 0);
 
-			//Distance (x/lmax)
-			double dist = ecludianDistance2D(*dataXLocation_, *dataYLocation_, xl, yl) / lmax;
-			
 			if (inputSlopeDataset_.connected())
 			{
-				gp = ((*dataParticleDensity_ - *dataAtmosphereDensity_) / *dataAtmosphereDensity_)*(gravity*cos(slope[i]*DEG2RAD));
-				C = pow(*dataSettlingVelocity_, 1.0 / 3.0)*pow(*dataFroude_, 2.0 / 3.0)*pow(*dataConcentration_, 1.0 / 3.0)*pow(gp, 1.0 / 3.0);
+				slope = new float[nWindowCells];
+				GDALRasterIO(GDALGetRasterBand(*dataSlopeDataset_, 1), GF_Read,
+					window[0], window[1], window[2], window[3],
+					slope,
+					window[2], window[3],
+					GDT_Float32,
+					0, 0);
+			}
+		}
+
+		/*
+		Constants for the flat current and, with a slope, for every CONOID_SLOPE_STEPS'th
+		of a degree: only gravity changes (g cos(slope)), so the cells just look them up
+		*/
+		QElapsedTimer timer;
+		timer.start();
+
+		ConoidConstants flatConstants = conoidConstants(gravity, *dataSettlingVelocity_, *dataFroude_, *dataConcentration_,
+			*dataParticleDensity_, *dataAtmosphereDensity_, A, *dataAxisymmetric_);
+		std::vector<ConoidConstants> slopeConstants;
+		if (slope)
+		{
+			slopeConstants.resize((90 * CONOID_SLOPE_STEPS) + 1);
+			for (int k = 0; k < (int) slopeConstants.size(); ++k)
+			{
+				slopeConstants[k] = conoidConstants(gravity*cos(((double) k / CONOID_SLOPE_STEPS)*DEG2RAD),
+					*dataSettlingVelocity_, *dataFroude_, *dataConcentration_,
+					*dataParticleDensity_, *dataAtmosphereDensity_, A, *dataAxisymmetric_);
+			}
+		}
+		double tableTime = timer.nsecsElapsed() / 1.0e6;
+
+		//Path lengths around the terrain from the vent, never shorter than the straight line so the window holds
+		std::vector<float> geodesicDistance;
+		if (*dataGeodesic_ && nWindowCells > 0)
+		{
+			geodesicDistance.resize(nWindowCells);
+			std::vector<int> vent(1, ((pixelY - window[1])*window[2]) + (pixelX - window[0]));
+			std::vector<float> ventDistance(1, 0.0f);
+			ConoidBlocked blocked = {elevation, slope, srcNoData, dstNodataValue, pixElev, &flatConstants, &slopeConstants};
+			GeodesicDistance(window[2], window[3], fabs(transform[1]), fabs(transform[5]),
+				vent, ventDistance, blocked, &geodesicDistance[0]);
+		}
 
-				//Calculate lmax
-				lmax = l_max(*dataConcentration_, *dataFroude_, A, *dataSettlingVelocity_, gp, *dataAxisymmetric_);
+		double mixtureDensity = (*dataConcentration_* *dataParticleDensity_) + ((1 - *dataConcentration_) * *dataAtmosphereDensity_);
+		double sqrtConcentration = sqrt(*dataConcentration_);
 
-				energyConoid[i] = h_max_cyl(gravity*cos(slope[i]*DEG2RAD), C, lmax, dist);
+		/*
+		Loop through cells in the window, calculating hmax (eq. 12 in Esposito Ongaro)
+		*/
+		float * energyConoid;
+		energyConoid = new float[nWindowCells];
+		float * elevDiff;
+		elevDiff = new float[nWindowCells];
+		float * dyPressure;
+		dyPressure = new float[nWindowCells];
+		float * depositMass;
+		depositMass = new float[nWindowCells];
+
+		for (int i = 0; i < nWindowCells; ++i)
+		{
+			int L = window[1] + (i / window[2]);
+			int P = window[0] + (i % window[2]);
+
+			const ConoidConstants* constants = &cellConstants(slope, i, flatConstants, slopeConstants);
+
+			//Distance (x/lmax), unreached cells are past the runout
+			double dist;
+			if (!geodesicDistance.empty())
+			{
+				dist = geodesicDistance[i] < 0 ? 2.0 : geodesicDistance[i] / constants->lmax;
 			}
-			else {
-				energyConoid[i] = h_max_cyl(gravity, C, lmax, dist);
+			else
+			{
+				double dx = *dataXLocation_ - (transform[0] + P*transform[1] + L*transform[2]);
+				double dy = *dataYLocation_ - (transform[3] + P*transform[4] + L*transform[5]);
+				dist = sqrt((dx*dx) + (dy*dy)) / constants->lmax;
 			}
-			elevDiff[i] = std::max((float) 0.0, energyConoid[i] + *pixElev - elevation[i]);
+			
+			//Past the runout, the same as outside the window
+			if (!(dist <= 1.0))
+			{
+				energyConoid[i] = dstNodataValue;
+				elevDiff[i] = 0.0;
+				dyPressure[i] = 0.0;
+				depositMass[i] = 0.0;
+				continue;
+			}
+
+			double dist2 = dist*dist;
+			energyConoid[i] = constants->hScale*(1 - (dist2*dist2)) / dist2;
+			elevDiff[i] = std::max((float) 0.0, energyConoid[i] + pixElev - elevation[i]);
 			//Dynamic Pressure (Eq. 10 Esposti Ongaro)
-			//((*dataConcentration_* *dataParticleDensity_)+((1-*dataConcentration_) * *dataAtmosphereDensity_))*gravity*std::max((float) 0.0, energyConoid[i]);
-			dyPressure[i] = (std::max((float) 0.0, energyConoid[i]) * 2 * gravity) * 0.5 * ((*dataConcentration_* *dataParticleDensity_) +
-				((1 - *dataConcentration_) * *dataAtmosphereDensity_));
+			dyPressure[i] = (std::max((float) 0.0, energyConoid[i]) * 2 * gravity) * 0.5 * mixtureDensity;
 
 			//Deposit mass for axisymmetric currents, eq. B.10 Esposti Ongaro
-			double lambda_c = *dataSettlingVelocity_ / (*dataFroude_*sqrt(pow(2 * A, 3.0)*gp));
-			depositMass[i] = pow(sqrt(*dataConcentration_) - (0.125*lambda_c*pow(std::min(dist, 1.0)*lmax, 4.0))
-				, 2.0);
-
+			double runout2 = dist2*constants->lmax*constants->lmax;
+			double mass = sqrtConcentration - (0.125*constants->lambda_c*runout2*runout2);
+			depositMass[i] = mass*mass;
 		}
+
+		double cellTime = (timer.nsecsElapsed() / 1.0e6) - tableTime;
+		*dataComputeTime_ = tableTime + cellTime;
+		std::cout << QString("Energy conoid over %1 cells: constants %2 ms, cells %3 ms").arg(nWindowCells).arg(tableTime).arg(cellTime) + "\n";
 		
 		outputRaster = GDALCreate(GDALGetDatasetDriver(elevationDataset),
 			outputRasterName.toLocal8Bit().constData(),
-			GDALGetRasterXSize(elevationDataset),
-			GDALGetRasterYSize(elevationDataset),
+			nXSize,
+			nYSize,
 			1,
 			GDT_Float32,
 			NULL);
@@ -320,8 +448,8 @@ namespace RF
 		GDALDatasetH& massRaster = *dataDepositMass_;
 		massRaster = GDALCreate(GDALGetDatasetDriver(elevationDataset),
 			"deposit_mass",
-			GDALGetRasterXSize(elevationDataset),
-			GDALGetRasterYSize(elevationDataset),
+			nXSize,
+			nYSize,
 			1,
 			GDT_Float32,
 			NULL);
@@ -329,8 +457,8 @@ namespace RF
 		GDALDatasetH& conoidRaster = *dataEnergyConoid_;
 		conoidRaster = GDALCreate(GDALGetDatasetDriver(elevationDataset),
 			"energy_conoid",
-			GDALGetRasterXSize(elevationDataset),
-			GDALGetRasterYSize(elevationDataset),
+			nXSize,
+			nYSize,
 			1,
 			GDT_Float32,
 			NULL);
@@ -339,8 +467,8 @@ namespace RF
 
 		dynamicPressureRaster = GDALCreate(GDALGetDatasetDriver(elevationDataset),
 			"dynamic_pressure",
-			GDALGetRasterXSize(elevationDataset),
-			GDALGetRasterYSize(elevationDataset),
+			nXSize,
+			nYSize,
 			1,
 			GDT_Float32,
 			NULL);
@@ -409,37 +537,49 @@ namespace RF
 		GDALSetRasterNoDataValue(dyPressureBand, dstNodataValue);
 		GDALSetRasterNoDataValue(depositMassBand, dstNodataValue);
 
-		GDALRasterIO(depositMassBand, GF_Write,
-			0, 0,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset),
-			depositMass,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset),
-			GDT_Float32,
-			0, 0);
-
-		GDALRasterIO(destBand, GF_Write,
-			0, 0,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset),
-			elevDiff,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset), 
-			GDT_Float32,
-			0, 0);
+		//Outside the window the current never arrives: no conoid, no pressure or deposit
+		GDALFillRaster(depositMassBand, 0.0, 0.0);
+		GDALFillRaster(destBand, 0.0, 0.0);
+		GDALFillRaster(conoidDestBand, dstNodataValue, 0.0);
+		GDALFillRaster(dyPressureBand, 0.0, 0.0);
 
-		GDALRasterIO(conoidDestBand, GF_Write,
-			0, 0,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset), 
-			energyConoid,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset), 
-			GDT_Float32,
-			0, 0);
+		if (nWindowCells > 0)
+		{
+			GDALRasterIO(depositMassBand, GF_Write,
+				window[0], window[1], window[2], window[3],
+				depositMass,
+				window[2], window[3],
+				GDT_Float32,
+				0, 0);
+
+			GDALRasterIO(destBand, GF_Write,
+				window[0], window[1], window[2], window[3],
+				elevDiff,
+				window[2], window[3],
+				GDT_Float32,
+				0, 0);
+
+			GDALRasterIO(conoidDestBand, GF_Write,
+				window[0], window[1], window[2], window[3],
+				energyConoid,
+				window[2], window[3],
+				GDT_Float32,
+				0, 0);
+
+			GDALRasterIO(dyPressureBand, GF_Write,
+				window[0], window[1], window[2], window[3],
+				dyPressure,
+				window[2], window[3],
+				GDT_Float32,
+				0, 0);
+		}
 
-		GDALRasterIO(dyPressureBand, GF_Write,
-			0, 0,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset),
-			dyPressure,
-			GDALGetRasterXSize(elevationDataset), GDALGetRasterYSize(elevationDataset),
-			GDT_Float32,
-			0, 0);
+		delete[] elevation;
+		delete[] slope;
+		delete[] energyConoid;
+		delete[] elevDiff;
+		delete[] dyPressure;
+		delete[] depositMass;
  
         return true;
     }
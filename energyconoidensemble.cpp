@@ -0,0 +1,413 @@
+/*
+Created by: Stuart Mead
+Creation date: 2017-01-20
+
+Released under BSD 3 clause.
+Use it however you want, but I cannot guarantee it is right.
+Also don't use my name, the name of collaborators and my/their affiliations
+as endorsement.
+
+*/
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <qstring.h>
+#include <qvector.h>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+#include "volcanoplugin.h"
+#include "energyconoidensemble.h"
+#include "volcanoutils.h"
+
+//Rows of the aggregate rasters held and written at a time
+#define ENSEMBLE_BLOCK_ROWS 256
+
+namespace RF
+{
+    /**
+     * \internal
+     */
+    class EnergyConoidEnsembleImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::EnergyConoidEnsembleImpl)
+
+    public:
+        EnergyConoidEnsemble&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataElevationDataset_;
+        CSIRO::DataExecution::TypedObject< int >              dataRasterBand_;
+        CSIRO::DataExecution::TypedObject< double >           dataSettlingVelocity_;
+        CSIRO::DataExecution::TypedObject< double >           dataFroude_;
+        CSIRO::DataExecution::TypedObject< double >           dataConcentration_;
+        CSIRO::DataExecution::TypedObject< double >           dataParticleDensity_;
+        CSIRO::DataExecution::TypedObject< double >           dataAtmosphereDensity_;
+        CSIRO::DataExecution::TypedObject< bool >             dataAxisymmetric_;
+        CSIRO::DataExecution::TypedObject< double >           dataRotation_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataXLocations_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataYLocations_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataVolumes_;
+        CSIRO::DataExecution::TypedObject< double >           dataPressureThreshold_;
+        CSIRO::DataExecution::TypedObject< int >              dataNumThreads_;
+        CSIRO::DataExecution::TypedObject< QString >          dataOutputRasterName_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataHazardRaster_;
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputElevationDataset_;
+        CSIRO::DataExecution::InputScalar inputRasterBand_;
+        CSIRO::DataExecution::InputScalar inputSettlingVelocity_;
+        CSIRO::DataExecution::InputScalar inputFroude_;
+        CSIRO::DataExecution::InputScalar inputConcentration_;
+        CSIRO::DataExecution::InputScalar inputParticleDensity_;
+        CSIRO::DataExecution::InputScalar inputAtmosphereDensity_;
+        CSIRO::DataExecution::InputScalar inputAxisymmetric_;
+        CSIRO::DataExecution::InputScalar inputRotation_;
+        CSIRO::DataExecution::InputScalar inputXLocations_;
+        CSIRO::DataExecution::InputScalar inputYLocations_;
+        CSIRO::DataExecution::InputScalar inputVolumes_;
+        CSIRO::DataExecution::InputScalar inputPressureThreshold_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
+        CSIRO::DataExecution::InputScalar inputOutputRasterName_;
+        CSIRO::DataExecution::Output      outputHazardRaster_;
+
+        EnergyConoidEnsembleImpl(EnergyConoidEnsemble& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    EnergyConoidEnsembleImpl::EnergyConoidEnsembleImpl(EnergyConoidEnsemble& op) :
+        op_(op),
+        dataElevationDataset_(),
+        dataRasterBand_(1),
+        dataSettlingVelocity_(0.25),
+        dataFroude_(1.18),
+        dataConcentration_(0.015),
+        dataParticleDensity_(800.0),
+        dataAtmosphereDensity_(1.225),
+        dataAxisymmetric_(true),
+        dataRotation_(1.0),
+        dataXLocations_(),
+        dataYLocations_(),
+        dataVolumes_(),
+        dataPressureThreshold_(0.0),
+        dataNumThreads_(0),
+        dataOutputRasterName_(),
+        dataHazardRaster_(),
+        inputElevationDataset_("Elevation Dataset", dataElevationDataset_, op_),
+        inputRasterBand_("Raster Band", dataRasterBand_, op_),
+        inputSettlingVelocity_("Settling velocity", dataSettlingVelocity_, op_),
+        inputFroude_("Froude number", dataFroude_, op_),
+        inputConcentration_("Particle concentration", dataConcentration_, op_),
+        inputParticleDensity_("Particle density", dataParticleDensity_, op_),
+        inputAtmosphereDensity_("Atmosphere density", dataAtmosphereDensity_, op_),
+        inputAxisymmetric_("Axisymmetric current", dataAxisymmetric_, op_),
+        inputRotation_("Number of collapse sectors", dataRotation_, op_),
+        inputXLocations_("Scenario X locations", dataXLocations_, op_),
+        inputYLocations_("Scenario Y locations", dataYLocations_, op_),
+        inputVolumes_("Scenario volumes", dataVolumes_, op_),
+        inputPressureThreshold_("Dynamic pressure threshold", dataPressureThreshold_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
+        inputOutputRasterName_("Output Raster name", dataOutputRasterName_, op_),
+        outputHazardRaster_("Ensemble hazard", dataHazardRaster_, op_)
+    {
+        inputXLocations_.setDescription(tr("Vent X location of each scenario, the same length as the Y locations and volumes"));
+        inputVolumes_.setDescription(tr("Total volume of released material for each scenario"));
+        inputPressureThreshold_.setDescription(tr("A cell counts towards the exceedance probability when a scenario reaches it above this dynamic pressure"));
+        inputNumThreads_.setDescription(tr("Threads to run the ensemble on, 0 uses all cores"));
+        outputHazardRaster_.setDescription(tr("Band 1 exceedance probability, band 2 maximum and band 3 mean dynamic pressure over the ensemble"));
+    }
+
+
+    //One vent and volume with its constants
+    typedef struct
+    {
+        double x;
+        double y;
+        double lmax;
+        float ventElevation;
+    } EnergyConoidScenario;
+
+
+    /**
+     *
+     */
+    bool EnergyConoidEnsembleImpl::execute()
+    {
+        GDALDatasetH& elevationDataset = *dataElevationDataset_;
+        int&          rasterBand       = *dataRasterBand_;
+        QString&      outputRasterName = *dataOutputRasterName_;
+        GDALDatasetH& hazardRaster     = *dataHazardRaster_;
+
+        const QVector<double>& xLocations = *dataXLocations_;
+        const QVector<double>& yLocations = *dataYLocations_;
+        const QVector<double>& volumes    = *dataVolumes_;
+
+        GDALAllRegister();
+
+        if (xLocations.size() != yLocations.size() || xLocations.size() != volumes.size())
+        {
+            std::cout << QString("ERROR: Scenario tables differ in length, %1 X, %2 Y and %3 volumes").arg(xLocations.size()).arg(yLocations.size()).arg(volumes.size()) + "\n";
+            return false;
+        }
+
+        if (rasterBand > GDALGetRasterCount(elevationDataset))
+        {
+            std::cout << QString("ERROR: Not enough raster bands, number of bands is %1, band selected is %2").arg(GDALGetRasterCount(elevationDataset)).arg(rasterBand) + "\n";
+            return false;
+        }
+
+        GDALRasterBandH elevationBand = GDALGetRasterBand(elevationDataset, rasterBand);
+        int nXSize = GDALGetRasterXSize(elevationDataset);
+        int nYSize = GDALGetRasterYSize(elevationDataset);
+
+        int srcNoData;
+        float srcNoDataValue = (float) GDALGetRasterNoDataValue(elevationBand, &srcNoData);
+
+        //The DEM is read once for every scenario
+        float* elevation = new float[nXSize*nYSize];
+        if (GDALRasterIO(elevationBand, GF_Read,
+            0, 0,
+            nXSize, nYSize,
+            elevation,
+            nXSize, nYSize,
+            GDT_Float32,
+            0, 0) != CE_None)
+        {
+            std::cout << QString("ERROR: Could not read elevation dataset") + "\n";
+            delete[] elevation;
+            return false;
+        }
+
+        double transform[6];
+        GDALGetGeoTransform(elevationDataset, transform);
+        double invTransform[6];
+        GDALInvGeoTransform(transform, invTransform);
+        bool northUp = transform[2] == 0 && transform[4] == 0;
+
+        //Constants shared by all scenarios, see EnergyConoid
+        double gravity = 9.807;
+        double gp = ((*dataParticleDensity_ - *dataAtmosphereDensity_) / *dataAtmosphereDensity_)*gravity;
+        double C = pow(*dataSettlingVelocity_, 1.0 / 3.0)*pow(*dataFroude_, 2.0 / 3.0)*pow(*dataConcentration_, 1.0 / 3.0)*pow(gp, 1.0 / 3.0);
+        double mixtureDensity = (*dataConcentration_* *dataParticleDensity_) + ((1 - *dataConcentration_) * *dataAtmosphereDensity_);
+        float pressureThreshold = (float) *dataPressureThreshold_;
+
+        std::vector<EnergyConoidScenario> scenarios;
+        scenarios.reserve(xLocations.size());
+        for (int s = 0; s < (int) xLocations.size(); ++s)
+        {
+            int pixelX = (int)floor(invTransform[0] + invTransform[1] * xLocations[s] + invTransform[2] * yLocations[s]);
+            int pixelY = (int)floor(invTransform[3] + invTransform[4] * xLocations[s] + invTransform[5] * yLocations[s]);
+            if (pixelX < 0 || pixelX >= nXSize || pixelY < 0 || pixelY >= nYSize ||
+                (srcNoData && elevation[(pixelY*nXSize) + pixelX] == srcNoDataValue))
+            {
+                std::cout << QString("WARNING: Scenario %1 vent (%2, %3) is outside the DEM, skipping it").arg(s).arg(xLocations[s]).arg(yLocations[s]) + "\n";
+                continue;
+            }
+
+            EnergyConoidScenario scenario;
+            scenario.x = xLocations[s];
+            scenario.y = yLocations[s];
+            scenario.lmax = l_max(*dataConcentration_, *dataFroude_, volumes[s] / ((2 * M_PI) / *dataRotation_),
+                                  *dataSettlingVelocity_, gp, *dataAxisymmetric_);
+            scenario.ventElevation = elevation[(pixelY*nXSize) + pixelX];
+            scenarios.push_back(scenario);
+        }
+
+        if (scenarios.empty())
+        {
+            std::cout << QString("ERROR: No scenarios with a vent on the DEM") + "\n";
+            delete[] elevation;
+            return false;
+        }
+        int nScenarios = (int) scenarios.size();
+        std::cout << QString("Running %1 energy conoid scenarios").arg(nScenarios) + "\n";
+
+        hazardRaster = GDALCreate(GDALGetDatasetDriver(elevationDataset),
+            outputRasterName.toLocal8Bit().constData(),
+            nXSize, nYSize,
+            3,
+            GDT_Float32,
+            NULL);
+        GDALSetGeoTransform(hazardRaster, transform);
+        GDALSetProjection(hazardRaster, GDALGetProjectionRef(elevationDataset));
+
+        GDALRasterBandH hazardBands[3];
+        const char* bandNames[3] = {"exceedance_probability", "max_dynamic_pressure", "mean_dynamic_pressure"};
+        for (int b = 0; b < 3; ++b)
+        {
+            hazardBands[b] = GDALGetRasterBand(hazardRaster, b + 1);
+            GDALSetDescription(hazardBands[b], bandNames[b]);
+            GDALSetRasterNoDataValue(hazardBands[b], srcNoDataValue);
+        }
+
+        int nThreads = *dataNumThreads_;
+#ifdef _OPENMP
+        if (nThreads <= 0)
+        {
+            nThreads = omp_get_max_threads();
+        }
+#endif
+
+        //Aggregates are only held for a block of rows, never per scenario
+        int nBlockRows = MIN(ENSEMBLE_BLOCK_ROWS, nYSize);
+        std::vector<float> probability(nBlockRows*nXSize);
+        std::vector<float> maxPressure(nBlockRows*nXSize);
+        std::vector<float> meanPressure(nBlockRows*nXSize);
+
+        CPLErr eErr = CE_None;
+        for (int blockRow = 0; blockRow < nYSize && eErr == CE_None; blockRow += nBlockRows)
+        {
+            int nRows = MIN(nBlockRows, nYSize - blockRow);
+
+            #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+            for (int L = blockRow; L < blockRow + nRows; ++L)
+            {
+                const float* elevRow = elevation + ((size_t) L*nXSize);
+                float* probRow = &probability[(L - blockRow)*nXSize];
+                float* maxRow = &maxPressure[(L - blockRow)*nXSize];
+                float* meanRow = &meanPressure[(L - blockRow)*nXSize];
+                std::vector<int> exceedCount(nXSize, 0);
+                std::vector<double> pressureSum(nXSize, 0.0);
+                std::fill(maxRow, maxRow + nXSize, 0.0f);
+
+                for (int s = 0; s < nScenarios; ++s)
+                {
+                    const EnergyConoidScenario& scenario = scenarios[s];
+
+                    //Only the columns within the runout of this vent
+                    int P0 = 0;
+                    int P1 = nXSize - 1;
+                    if (northUp)
+                    {
+                        double dy = scenario.y - (transform[3] + L*transform[5]);
+                        if (fabs(dy) >= scenario.lmax)
+                        {
+                            continue;
+                        }
+                        double halfWidth = sqrt((scenario.lmax*scenario.lmax) - (dy*dy));
+                        double Pa = (scenario.x - halfWidth - transform[0]) / transform[1];
+                        double Pb = (scenario.x + halfWidth - transform[0]) / transform[1];
+                        P0 = MAX(0, (int) floor(MIN(Pa, Pb)));
+                        P1 = MIN(nXSize - 1, (int) ceil(MAX(Pa, Pb)));
+                    }
+
+                    for (int P = P0; P <= P1; ++P)
+                    {
+                        if (srcNoData && elevRow[P] == srcNoDataValue)
+                        {
+                            continue;
+                        }
+                        double xl = transform[0] + P*transform[1] + L*transform[2];
+                        double yl = transform[3] + P*transform[4] + L*transform[5];
+                        double dist = sqrt(((scenario.x - xl)*(scenario.x - xl)) + ((scenario.y - yl)*(scenario.y - yl))) / scenario.lmax;
+                        if (dist >= 1.0)
+                        {
+                            continue;
+                        }
+
+                        float energyConoid = h_max_cyl(gravity, C, scenario.lmax, dist);
+                        if (energyConoid + scenario.ventElevation - elevRow[P] <= 0)
+                        {
+                            continue;//Terrain is above the energy line
+                        }
+
+                        //Dynamic Pressure (Eq. 10 Esposti Ongaro)
+                        float dyPressure = (std::max((float) 0.0, energyConoid) * 2 * gravity) * 0.5 * mixtureDensity;
+                        if (dyPressure > pressureThreshold)
+                        {
+                            ++exceedCount[P];
+                        }
+                        maxRow[P] = std::max(maxRow[P], dyPressure);
+                        pressureSum[P] += dyPressure;
+                    }
+                }
+
+                for (int P = 0; P < nXSize; ++P)
+                {
+                    if (srcNoData && elevRow[P] == srcNoDataValue)
+                    {
+                        probRow[P] = maxRow[P] = meanRow[P] = srcNoDataValue;
+                    }
+                    else
+                    {
+                        probRow[P] = (float) exceedCount[P] / nScenarios;
+                        meanRow[P] = (float) (pressureSum[P] / nScenarios);
+                    }
+                }
+            }
+
+            float* aggregates[3] = {&probability[0], &maxPressure[0], &meanPressure[0]};
+            for (int b = 0; b < 3 && eErr == CE_None; ++b)
+            {
+                eErr = GDALRasterIO(hazardBands[b], GF_Write,
+                    0, blockRow,
+                    nXSize, nRows,
+                    aggregates[b],
+                    nXSize, nRows,
+                    GDT_Float32,
+                    0, 0);
+            }
+        }
+
+        delete[] elevation;
+
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not write ensemble hazard raster") + "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     *
+     */
+    EnergyConoidEnsemble::EnergyConoidEnsemble() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< EnergyConoidEnsemble >::getInstance(),
+            tr("Box model energy cone ensemble"))
+    {
+        pImpl_ = new EnergyConoidEnsembleImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    EnergyConoidEnsemble::~EnergyConoidEnsemble()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  EnergyConoidEnsemble::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(EnergyConoidEnsemble,
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
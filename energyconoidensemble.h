@@ -0,0 +1,60 @@
+/*
+Created by: Stuart Mead
+Creation date: 2017-01-20
+
+Released under BSD 3 clause.
+Use it however you want, but I cannot guarantee it is right.
+Also don't use my name, the name of collaborators and my/their affiliations
+as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_ENERGYCONOIDENSEMBLE_H
+#define RF_ENERGYCONOIDENSEMBLE_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class EnergyConoidEnsembleImpl;
+
+    /**
+     * \brief Box model energy cone over an ensemble of vents and volumes
+     *
+     * Loads the DEM once and evaluates every scenario (X, Y, volume),
+     * writing only the aggregate hazard: the probability a cell is reached
+     * above a dynamic pressure threshold and the maximum and mean dynamic
+     * pressure over the ensemble.
+     */
+    class RF_API EnergyConoidEnsemble : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::EnergyConoidEnsemble)
+
+        EnergyConoidEnsembleImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        EnergyConoidEnsemble(const EnergyConoidEnsemble&);
+        EnergyConoidEnsemble& operator=(const EnergyConoidEnsemble&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        EnergyConoidEnsemble();
+        virtual ~EnergyConoidEnsemble();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::EnergyConoidEnsemble, RF_API)
+
+#endif
+
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <vector>
+#include <algorithm>
 
 #include "gdal.h"
 #include "gdal_priv.h"
@@ -128,31 +129,10 @@ float upstreamProportion(float* flowWindow, int neighBour, int* ijlookup, int nX
 }
 
 
-/*
-ComputeFlowAlgebraValues: Compute the value using the processing algorithims
-*/
-void ComputeFlowAlgebraValues(float srcNoDataValue, float dstNoDataValue,
-                                        int i, int j, int nXSize, int nYSize,
-                                        float* flowDirections,
-                                        float* algData,
-                                        bool* algCalc,
-                                        double* transform,
-                                        GenericRecursiveFlowAlgebraAlg pfnAlg,
-                                        void* pData)
+//Proportion of the flow out of neighbour (0-7, the 3x3 window without the centre) that goes into cell i,j
+float NeighbourInflowProportion(float* flowDirections, int i, int j, int neighbour, int nXSize, int nYSize, float srcNoDataValue)
 {
-        //Get cell Index
-        int cellIndex = (i*nXSize) + j;
-        //Check it hasnt been calculated
-        if(!algCalc[cellIndex])
-        {
-            if (flowDirections[cellIndex] == srcNoDataValue)
-            {
-                algCalc[cellIndex] = true;
-                algData[cellIndex] = 0;
-            }
-            else
-            {
-                int algDataIJLookup[8][2] = {i-1,j-1,
+    int algDataIJLookup[8][2] = {i-1,j-1,
                         i-1,j,
                         i-1,j+1,
                         i,j-1,
@@ -160,123 +140,193 @@ void ComputeFlowAlgebraValues(float srcNoDataValue, float dstNoDataValue,
                         i+1,j-1,
                         i+1,j,
                         i+1,j+1};
-                for (int neighbourCell = 0; neighbourCell < 8; ++neighbourCell)
-                {
-                    if (checkOutofBounds(algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1], nXSize, nYSize))
-                    {
-                        float flowProp = upstreamProportion(flowDirections, neighbourCell, *algDataIJLookup, nXSize, nYSize, srcNoDataValue);
-                        if (flowProp > 0)
-                        {
-                            ComputeFlowAlgebraValues(srcNoDataValue, dstNoDataValue, algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1],
-                                                        nXSize, nYSize, flowDirections, algData, algCalc, transform, pfnAlg, pData);
-                        }
-                    }
-                }
-                float algValue = pfnAlg(i, j, nXSize, nYSize, flowDirections, algData, dstNoDataValue, srcNoDataValue, pData); 
-                algData[cellIndex] = algValue;
-                algCalc[cellIndex] = true;
-            }
-        }
+    return upstreamProportion(flowDirections, neighbour, *algDataIJLookup, nXSize, nYSize, srcNoDataValue);
 }
 
-void ComputeFailureAlgebraValues(float srcNoDataValue, float dstNoDataValue,
-                                        int i, int j, int nXSize, int nYSize,
-                                        float* flowDirections,
-                                        float* failureDepth,
-                                        float* algData,
-                                        bool* algCalc,
-                                        double* transform,
-                                        GenericRecursiveFailureAlgebraAlg pfnAlg,
-                                        void* pData)
+//Neighbour offsets (0-7, the 3x3 window without the centre), neighbour 7 - n is the opposite of n
+static const int flowNbrI[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+static const int flowNbrJ[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+
+/*
+BuildFlowReceiverTable: Turns the D-inf angles into where each cell's flow goes, done once so the flow algebra
+needs no angle comparisons. The proportions are the ones upstreamProportion gives, nodata and out of raster
+cells never receive flow.
+*/
+void BuildFlowReceiverTable(float* flowDirections, int nXSize, int nYSize, float srcNoDataValue, std::vector<FlowReceivers>& receivers)
 {
-        
-		//Get cell Index
-        int cellIndex = (i*nXSize) + j;
-        //Check it hasnt been calculated
-        if(!algCalc[cellIndex])
+    receivers.resize(nXSize*nYSize);
+    for (int i = 0; i < nYSize; ++i)
+    {
+        for (int j = 0; j < nXSize; ++j)
         {
+            int cellIndex = (i*nXSize) + j;
+            FlowReceivers& cell = receivers[cellIndex];
+            cell.neighbour[0] = cell.neighbour[1] = -1;
+            cell.proportion[0] = cell.proportion[1] = 0;
             if (flowDirections[cellIndex] == srcNoDataValue)
             {
-                algCalc[cellIndex] = true;
-                algData[cellIndex] = 0;
+                continue;
             }
-            else
+
+            int nReceivers = 0;
+            for (int n = 0; n < 8 && nReceivers < 2; ++n)
             {
-                int algDataIJLookup[8][2] = {i-1,j-1,
-                        i-1,j,
-                        i-1,j+1,
-                        i,j-1,
-                        i,j+1,
-                        i+1,j-1,
-                        i+1,j,
-                        i+1,j+1};
-                for (int neighbourCell = 0; neighbourCell < 8; ++neighbourCell)
+                int ri = i + flowNbrI[n];
+                int rj = j + flowNbrJ[n];
+                if (!checkOutofBounds(ri, rj, nXSize, nYSize) || flowDirections[(ri*nXSize) + rj] == srcNoDataValue)
                 {
-                    if (checkOutofBounds(algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1], nXSize, nYSize))
-                    {
-                        float flowProp = upstreamProportion(flowDirections, neighbourCell, *algDataIJLookup, nXSize, nYSize, srcNoDataValue);
-                        if (flowProp > 0)
-                        {
-                            ComputeFailureAlgebraValues(srcNoDataValue, dstNoDataValue, algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1],
-                                                        nXSize, nYSize, flowDirections, failureDepth, algData, algCalc, transform, pfnAlg, pData);
-                        }
-                    }
+                    continue;
+                }
+                //This cell is neighbour 7 - n of the receiver
+                float proportion = NeighbourInflowProportion(flowDirections, ri, rj, 7 - n, nXSize, nYSize, srcNoDataValue);
+                if (proportion > 0)
+                {
+                    cell.neighbour[nReceivers] = (signed char) n;
+                    cell.proportion[nReceivers] = proportion;
+                    ++nReceivers;
                 }
-                float algValue = pfnAlg(i, j, nXSize, nYSize, flowDirections, failureDepth, algData, dstNoDataValue, srcNoDataValue, pData); 
-                algData[cellIndex] = algValue;
-                algCalc[cellIndex] = true;
             }
         }
+    }
 }
 
-void ComputePropertyAlgebraValues(float srcNoDataValue, float dstNoDataValue,
-                                        int i, int j, int nXSize, int nYSize,
-                                        float* flowDirections,
-                                        float* upstreamProperty,
-                                        float* algData,
-                                        bool* algCalc,
-                                        double* transform,
-                                        GenericRecursivePropertyAlgebraAlg pfnAlg,
-                                        void* pData)
+/*
+GetTopologicalFlowOrder: Orders the cells so each one comes after all the cells that flow into it (its donors).
+Each cell keeps a bit per donor neighbour, cells with none (ridges and nodata) start the queue, and finishing
+a cell clears its bit in the cells it flows into - O(n) with no recursion. Cells on flow loops never run out
+of donors, they are put at the end in raster order and the number of them is returned.
+If pBasins is given every cell also gets the number of its drainage basin (cells joined by any flow, -1 for
+nodata). D-inf splits flow between two receivers, so basins are merged with a union-find as cells are released.
+*/
+
+//Union-find root of a cell, halving the path on the way
+static int FindBasinRoot(std::vector<int>& parent, int cellIndex)
 {
-        
-        //Get cell Index
-        int cellIndex = (i*nXSize) + j;
-        //Check it hasnt been calculated
-        if(!algCalc[cellIndex])
+    while (parent[cellIndex] != cellIndex)
+    {
+        parent[cellIndex] = parent[parent[cellIndex]];
+        cellIndex = parent[cellIndex];
+    }
+    return cellIndex;
+}
+
+//Join the basins of two cells, the lowest cell index is the root
+static void MergeBasins(std::vector<int>& parent, int a, int b)
+{
+    a = FindBasinRoot(parent, a);
+    b = FindBasinRoot(parent, b);
+    if (a != b)
+    {
+        parent[MAX(a, b)] = MIN(a, b);
+    }
+}
+
+int GetTopologicalFlowOrder(float* flowDirections, const std::vector<FlowReceivers>& receivers, int nXSize, int nYSize,
+                            float srcNoDataValue, std::vector<int>& order, std::vector<int>* pBasins)
+{
+    int nCells = nXSize*nYSize;
+    std::vector<unsigned char> donors(nCells, 0); //Bit n set while neighbour n has not been ordered
+    std::vector<int> ready;
+
+    std::vector<int> parent;
+
+    order.clear();
+    order.reserve(nCells);
+
+    if (pBasins)
+    {
+        parent.resize(nCells);
+        for (int cellIndex = 0; cellIndex < nCells; ++cellIndex)
         {
-            if (flowDirections[cellIndex] == srcNoDataValue)
+            parent[cellIndex] = cellIndex;
+        }
+    }
+
+    for (int cellIndex = 0; cellIndex < nCells; ++cellIndex)
+    {
+        const FlowReceivers& cell = receivers[cellIndex];
+        for (int k = 0; k < 2 && cell.neighbour[k] >= 0; ++k)
+        {
+            int n = cell.neighbour[k];
+            donors[cellIndex + (flowNbrI[n]*nXSize) + flowNbrJ[n]] |= (1 << (7 - n));
+        }
+    }
+    for (int cellIndex = 0; cellIndex < nCells; ++cellIndex)
+    {
+        if (donors[cellIndex] == 0)
+        {
+            ready.push_back(cellIndex);
+        }
+    }
+
+    while (!ready.empty())
+    {
+        int cellIndex = ready.back();
+        ready.pop_back();
+        order.push_back(cellIndex);
+
+        const FlowReceivers& cell = receivers[cellIndex];
+        for (int k = 0; k < 2 && cell.neighbour[k] >= 0; ++k)
+        {
+            int n = cell.neighbour[k];
+            int receiverIndex = cellIndex + (flowNbrI[n]*nXSize) + flowNbrJ[n];
+            //This cell is neighbour 7 - n of the receiver
+            donors[receiverIndex] &= ~(1 << (7 - n));
+            if (pBasins)
             {
-                algCalc[cellIndex] = true;
-                algData[cellIndex] = 0;
+                MergeBasins(parent, cellIndex, receiverIndex);
             }
-            else
+            if (donors[receiverIndex] == 0)
             {
-                int algDataIJLookup[8][2] = {i-1,j-1,
-                        i-1,j,
-                        i-1,j+1,
-                        i,j-1,
-                        i,j+1,
-                        i+1,j-1,
-                        i+1,j,
-                        i+1,j+1};
-                for (int neighbourCell = 0; neighbourCell < 8; ++neighbourCell)
+                ready.push_back(receiverIndex);
+            }
+        }
+    }
+
+    int nLoopCells = nCells - (int) order.size();
+    if (nLoopCells > 0)
+    {
+        for (int cellIndex = 0; cellIndex < nCells; ++cellIndex)
+        {
+            if (donors[cellIndex] > 0)
+            {
+                order.push_back(cellIndex);
+                if (pBasins)
                 {
-                    if (checkOutofBounds(algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1], nXSize, nYSize))
+                    //Flow between loop cells was never released, join them here
+                    for (int n = 0; n < 8; ++n)
                     {
-                        float flowProp = upstreamProportion(flowDirections, neighbourCell, *algDataIJLookup, nXSize, nYSize, srcNoDataValue);
-                        if (flowProp > 0)
+                        if (donors[cellIndex] & (1 << n))
                         {
-                            ComputePropertyAlgebraValues(srcNoDataValue, dstNoDataValue, algDataIJLookup[neighbourCell][0], algDataIJLookup[neighbourCell][1],
-                                                        nXSize, nYSize, flowDirections, upstreamProperty, algData, algCalc, transform, pfnAlg, pData);
+                            MergeBasins(parent, cellIndex, cellIndex + (flowNbrI[n]*nXSize) + flowNbrJ[n]);
                         }
                     }
                 }
-                float algValue = pfnAlg(i, j, nXSize, nYSize, flowDirections, upstreamProperty, algData, dstNoDataValue, srcNoDataValue, pData); 
-                algData[cellIndex] = algValue;
-                algCalc[cellIndex] = true;
             }
         }
+    }
+
+    if (pBasins)
+    {
+        //Number the basins in raster order of their first cell (the root)
+        std::vector<int>& basins = *pBasins;
+        basins.assign(nCells, -1);
+        int nBasins = 0;
+        for (int cellIndex = 0; cellIndex < nCells; ++cellIndex)
+        {
+            if (flowDirections[cellIndex] == srcNoDataValue)
+            {
+                continue;
+            }
+            int root = FindBasinRoot(parent, cellIndex);
+            if (basins[root] < 0)
+            {
+                basins[root] = nBasins++;
+            }
+            basins[cellIndex] = basins[root];
+        }
+    }
+    return nLoopCells;
 }
 
 //Utility program
@@ -292,45 +342,292 @@ std::vector<float> FloatArraytoVector(float* fIn)
 
 void GenericGetIJWindow(int i, int j, int nXsize, int nYsize, float* inputData, float* outputWindow)
 {
-    //Use a 3x3 window over each cell for calcs
+    //Use a 3x3 window over each cell for calcs, written to the caller's 9 floats (nothing is allocated)
     //Middle cell is [4]
     //  
     //  0 1 2
     //  3 4 5
     //  6 7 8
-    int algDataIJLookup[9][2] = {i-1,j-1,//0
-                        i-1,j,//1
-                        i-1,j+1,//2
-                        i,j-1,//3
-                        i,j,//4
-                        i,j+1,//5
-                        i+1,j-1,//6
-                        i+1,j,//7
-                        i+1,j+1};//8
+    int cell = 0;
+    for (int wi = i - 1; wi <= i + 1; ++wi)
+    {
+        for (int wj = j - 1; wj <= j + 1; ++wj, ++cell)
+        {
+            if (checkOutofBounds(wi, wj, nXsize, nYsize))
+            {
+                outputWindow[cell] = inputData[(wi*nXsize) + wj];
+            }
+            else
+            {
+                outputWindow[cell] = 0;
+            }
+        }
+    }
+}
 
-    for (int cell = 0; cell < 9; ++cell)
+/*
+Flow algebra in topological order. With one thread the cells are done in order, otherwise the drainage
+basins are labelled and each basin (cells in their topological order) goes to a thread - no flow crosses
+between basins so they never wait on each other. nThreads <= 0 uses all cores.
+The cell functors store their own results, nodata cells are skipped (the outputs start as 0).
+*/
+
+//The per cell call of each kind of generic flow algebra
+struct FlowAlgebraCell
+{
+    GenericRecursiveFlowAlgebraAlg pfnAlg;
+    float* flowDirection;
+    float* algData;
+    int nXSize, nYSize;
+    float dstNoDataValue, srcNoDataValue;
+    void* pData;
+    void operator()(int cellIndex) const
     {
-        if (checkOutofBounds(algDataIJLookup[cell][0],algDataIJLookup[cell][1], nXsize, nYsize))
+        algData[cellIndex] = pfnAlg(cellIndex / nXSize, cellIndex % nXSize, nXSize, nYSize, flowDirection, algData,
+                                    dstNoDataValue, srcNoDataValue, pData);
+    }
+};
+
+struct FailureAlgebraCell
+{
+    GenericRecursiveFailureAlgebraAlg pfnAlg;
+    float* flowDirection;
+    float* failureDepth;
+    float* algData;
+    int nXSize, nYSize;
+    float dstNoDataValue, srcNoDataValue;
+    void* pData;
+    void operator()(int cellIndex) const
+    {
+        algData[cellIndex] = pfnAlg(cellIndex / nXSize, cellIndex % nXSize, nXSize, nYSize, flowDirection, failureDepth, algData,
+                                    dstNoDataValue, srcNoDataValue, pData);
+    }
+};
+
+struct PropertyAlgebraCell
+{
+    GenericRecursivePropertyAlgebraAlg pfnAlg;
+    float* flowDirection;
+    float* upstreamProperty;
+    float* algData;
+    int nXSize, nYSize;
+    float dstNoDataValue, srcNoDataValue;
+    void* pData;
+    void operator()(int cellIndex) const
+    {
+        algData[cellIndex] = pfnAlg(cellIndex / nXSize, cellIndex % nXSize, nXSize, nYSize, flowDirection, upstreamProperty, algData,
+                                    dstNoDataValue, srcNoDataValue, pData);
+    }
+};
+
+//Share of neighbour n's flow that goes into the cell, the cell is the donor's neighbour 7 - n
+static inline float DonorProportion(const FlowReceivers& donor, int n)
+{
+    if (donor.neighbour[0] == 7 - n)
+        return donor.proportion[0];
+    if (donor.neighbour[1] == 7 - n)
+        return donor.proportion[1];
+    return 0;
+}
+
+//Find the donors of a cell and the share of their flow it gets, neighbours in the same order as the window kernels
+static inline int GetDonors(const std::vector<FlowReceivers>& receivers, int cellIndex, int nXSize, int nYSize,
+                            int* donorIndex, float* donorShare)
+{
+    int i = cellIndex / nXSize;
+    int j = cellIndex % nXSize;
+    int nDonors = 0;
+    for (int n = 0; n < 8; ++n)
+    {
+        if (checkOutofBounds(i + flowNbrI[n], j + flowNbrJ[n], nXSize, nYSize))
         {
-            outputWindow[cell] = inputData[(algDataIJLookup[cell][0]*nXsize) + algDataIJLookup[cell][1]];
+            int neighbourIndex = cellIndex + (flowNbrI[n]*nXSize) + flowNbrJ[n];
+            float upProp = DonorProportion(receivers[neighbourIndex], n);
+            if (upProp > 0)
+            {
+                donorIndex[nDonors] = neighbourIndex;
+                donorShare[nDonors] = upProp;
+                ++nDonors;
+            }
         }
-        else
+    }
+    return nDonors;
+}
+
+/*
+Upstream accumulation on the receiver table, the same sums as the RecursiveUpstream*Alg kernels.
+cellValues and algData hold nBands values per cell (band interleaved) so the donors are found once for all bands.
+*/
+struct UpstreamAccumulationCell
+{
+    const std::vector<FlowReceivers>* receivers;
+    UpstreamAccumulationType type;
+    double cellArea;
+    const float* cellValues; //Failure depth or property, not used for area
+    float* algData;
+    int nBands;
+    int nXSize, nYSize;
+    void operator()(int cellIndex) const
+    {
+        int donorIndex[8];
+        float donorShare[8];
+        int nDonors = GetDonors(*receivers, cellIndex, nXSize, nYSize, donorIndex, donorShare);
+
+        //Many bands over a large raster run past an int, so the band interleaved offsets are size_t
+        size_t cellOffset = (size_t) cellIndex*nBands;
+        size_t donorOffset[8];
+        for (int k = 0; k < nDonors; ++k)
+        {
+            donorOffset[k] = (size_t) donorIndex[k]*nBands;
+        }
+
+        for (int b = 0; b < nBands; ++b)
         {
-            outputWindow[cell] = 0;
+            float value;
+            if (type == UPSTREAM_AREA)
+            {
+                value = cellArea;
+                value = -value;
+            }
+            else if (type == UPSTREAM_FAILURE_VOLUME)
+            {
+                value = cellArea*MAX(cellValues[cellOffset + b], 0);
+                value = -value;
+            }
+            else
+            {
+                value = cellValues[cellOffset + b];
+            }
+
+            for (int k = 0; k < nDonors; ++k)
+            {
+                value += donorShare[k]*algData[donorOffset[k] + b];
+            }
+            algData[cellOffset + b] = value;
+        }
+    }
+};
+
+//Sorts basins largest first
+struct LargerBasin
+{
+    const std::vector<int>* basinStart;
+    bool operator()(int a, int b) const
+    {
+        return ((*basinStart)[a + 1] - (*basinStart)[a]) > ((*basinStart)[b + 1] - (*basinStart)[b]);
+    }
+};
+
+template <class CellAlg>
+static void ComputeFlowAlgebra(float* flowDirection, const std::vector<FlowReceivers>& receivers, int nXSize, int nYSize,
+                               float srcNoDataValue, const CellAlg& cellAlg, int nThreads)
+{
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#else
+    nThreads = 1;
+#endif
+    bool bBasins = nThreads > 1;
+
+    std::vector<int> order;
+    std::vector<int> basins;
+    int nLoopCells = GetTopologicalFlowOrder(flowDirection, receivers, nXSize, nYSize, srcNoDataValue, order, bBasins ? &basins : NULL);
+    if (nLoopCells > 0)
+    {
+        std::cout << QString("WARNING: %1 cells are on flow loops, their upstream values are incomplete").arg(nLoopCells) + "\n";
+    }
+
+    if (!bBasins)
+    {
+        for (size_t k = 0; k < order.size(); ++k)
+        {
+            int cellIndex = order[k];
+            if (flowDirection[cellIndex] != srcNoDataValue)
+            {
+                cellAlg(cellIndex);
+            }
+        }
+        return;
+    }
+
+    //Group the cells by basin (counting sort), each basin keeps the topological order
+    int nBasins = 0;
+    for (size_t k = 0; k < basins.size(); ++k)
+    {
+        nBasins = MAX(nBasins, basins[k] + 1);
+    }
+    std::vector<int> basinStart(nBasins + 1, 0);
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        int cellIndex = order[k];
+        if (basins[cellIndex] >= 0)
+        {
+            basinStart[basins[cellIndex] + 1]++;
+        }
+    }
+    for (int b = 0; b < nBasins; ++b)
+    {
+        basinStart[b + 1] += basinStart[b];
+    }
+    std::vector<int> basinCells(basinStart[nBasins]);
+    std::vector<int> basinFill(basinStart.begin(), basinStart.end() - 1);
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        int cellIndex = order[k];
+        if (basins[cellIndex] >= 0)
+        {
+            basinCells[basinFill[basins[cellIndex]]++] = cellIndex;
+        }
+    }
+
+    //Largest basins first so a big catchment is not left running alone at the end
+    std::vector<int> basinOrder(nBasins);
+    for (int b = 0; b < nBasins; ++b)
+    {
+        basinOrder[b] = b;
+    }
+    LargerBasin larger = {&basinStart};
+    std::stable_sort(basinOrder.begin(), basinOrder.end(), larger);
+
+    std::cout << QString("Accumulating %1 drainage basins on %2 threads").arg(nBasins).arg(nThreads) + "\n";
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int b = 0; b < nBasins; ++b)
+    {
+        int basin = basinOrder[b];
+        for (int k = basinStart[basin]; k < basinStart[basin + 1]; ++k)
+        {
+            cellAlg(basinCells[k]);
         }
     }
 }
 
+/*
+The window kernels read all eight neighbours of algData, not just the donors. At a basin edge those neighbours
+belong to another basin that may be written at the same time, so the generic processors always run on one thread
+and only the receiver table accumulation (UpstreamAccumulationCell reads donors only) goes basin parallel.
+*/
+static int GenericFlowAlgebraThreads(int nThreads)
+{
+    if (nThreads != 1)
+    {
+        std::cout << QString("WARNING: Generic flow algebra runs on one thread, use UpstreamAccumulationProcessor for threads") + "\n";
+    }
+    return 1;
+}
+
 CPLErr GenericRecursiveFlowAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursiveFlowAlgebraAlg pfnAlg,
-                                                void* pData)
+                                                void* pData,
+                                                int nThreads)
 {
     CPLErr eErr;
 
-    int i,j;//Cell index
-
     
     int nXSize = GDALGetRasterBandXSize(srcFlowBand);//Get length of raster
     int nYSize = GDALGetRasterBandYSize(srcFlowBand);
@@ -342,8 +639,7 @@ CPLErr GenericRecursiveFlowAlgebraProcessor(GDALRasterBandH srcFlowBand,
     float dstNoDataValue = srcNoDataValue;
 
     float* flowDirection = new float[nXSize*nYSize];
-    bool* algCalc = new bool[nXSize*nYSize]();//Initialise as 0
-    float* algData = new float[nXSize*nYSize];
+    float* algData = new float[nXSize*nYSize]();//Initialise as 0
     std::cout << QString("Created empty output arrays") + "\n";
     //Read the inputData
     GDALRasterIO(srcFlowBand, GF_Read,
@@ -357,14 +653,11 @@ CPLErr GenericRecursiveFlowAlgebraProcessor(GDALRasterBandH srcFlowBand,
     std::cout << QString("Read input array") + "\n";
         
 
-    for (i = 0; i < nYSize; ++i)//rows
-    {
-        for (j = 0; j < nXSize; ++j)//cols
-        {
-            ComputeFlowAlgebraValues(srcNoDataValue, dstNoDataValue, i, j, nXSize, nYSize,
-                                        flowDirection, algData, algCalc, transform, pfnAlg, pData);
-        }
-    }
+    std::vector<FlowReceivers> receivers;
+    BuildFlowReceiverTable(flowDirection, nXSize, nYSize, srcNoDataValue, receivers);
+
+    FlowAlgebraCell cellAlg = {pfnAlg, flowDirection, algData, nXSize, nYSize, dstNoDataValue, srcNoDataValue, pData};
+    ComputeFlowAlgebra(flowDirection, receivers, nXSize, nYSize, srcNoDataValue, cellAlg, GenericFlowAlgebraThreads(nThreads));
 
     //Write
     eErr = GDALRasterIO (dstAlgBand,
@@ -376,6 +669,9 @@ CPLErr GenericRecursiveFlowAlgebraProcessor(GDALRasterBandH srcFlowBand,
                             GDT_Float32,
                             0,0);
 
+    delete[] flowDirection;
+    delete[] algData;
+
     return eErr;
 }
 
@@ -384,12 +680,11 @@ CPLErr GenericRecursiveFailureAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursiveFailureAlgebraAlg pfnAlg,
-                                                void* pData)
+                                                void* pData,
+                                                int nThreads)
 {
     CPLErr eErr;
 
-    int i,j;//Cell index
-
     
     int nXSize = GDALGetRasterBandXSize(srcFlowBand);//Get length of raster
     int nYSize = GDALGetRasterBandYSize(srcFlowBand);
@@ -402,8 +697,7 @@ CPLErr GenericRecursiveFailureAlgebraProcessor(GDALRasterBandH srcFlowBand,
 
     float* flowDirection = new float[nXSize*nYSize];
     float* failureDepth = new float[nXSize*nYSize];
-    bool* algCalc = new bool[nXSize*nYSize]();//Initialise as 0
-    float* algData = new float[nXSize*nYSize];
+    float* algData = new float[nXSize*nYSize]();//Initialise as 0
     std::cout << QString("Created empty output arrays") + "\n";
     //Read the inputData
     GDALRasterIO(srcFlowBand, GF_Read,
@@ -425,14 +719,11 @@ CPLErr GenericRecursiveFailureAlgebraProcessor(GDALRasterBandH srcFlowBand,
     std::cout << QString("Read input arrays of size %1, %2").arg(nXSize).arg(nYSize) + "\n";
 
 
-    for (i = 0; i < nYSize; ++i)//rows
-    {
-        for (j = 0; j < nXSize; ++j)//cols
-        {
-            ComputeFailureAlgebraValues(srcNoDataValue, dstNoDataValue, i, j, nXSize, nYSize,
-                                        flowDirection, failureDepth, algData, algCalc, transform, pfnAlg, pData);
-        }
-    }
+    std::vector<FlowReceivers> receivers;
+    BuildFlowReceiverTable(flowDirection, nXSize, nYSize, srcNoDataValue, receivers);
+
+    FailureAlgebraCell cellAlg = {pfnAlg, flowDirection, failureDepth, algData, nXSize, nYSize, dstNoDataValue, srcNoDataValue, pData};
+    ComputeFlowAlgebra(flowDirection, receivers, nXSize, nYSize, srcNoDataValue, cellAlg, GenericFlowAlgebraThreads(nThreads));
 
     //Write
     eErr = GDALRasterIO (dstAlgBand,
@@ -444,6 +735,10 @@ CPLErr GenericRecursiveFailureAlgebraProcessor(GDALRasterBandH srcFlowBand,
                             GDT_Float32,
                             0,0);
 
+    delete[] flowDirection;
+    delete[] failureDepth;
+    delete[] algData;
+
     return eErr;
 }
 
@@ -452,12 +747,11 @@ CPLErr GenericRecursivePropertyAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursivePropertyAlgebraAlg pfnAlg,
-                                                void* pData)
+                                                void* pData,
+                                                int nThreads)
 {
     CPLErr eErr;
 
-    int i,j;//Cell index
-
     
     int nXSize = GDALGetRasterBandXSize(srcFlowBand);//Get length of raster
     int nYSize = GDALGetRasterBandYSize(srcFlowBand);
@@ -470,8 +764,7 @@ CPLErr GenericRecursivePropertyAlgebraProcessor(GDALRasterBandH srcFlowBand,
 
     float* flowDirection = new float[nXSize*nYSize];
     float* upstreamProperty = new float[nXSize*nYSize];
-    bool* algCalc = new bool[nXSize*nYSize]();//Initialise as 0
-    float* algData = new float[nXSize*nYSize];
+    float* algData = new float[nXSize*nYSize]();//Initialise as 0
     std::cout << QString("Created empty output arrays") + "\n";
     //Read the inputData
     GDALRasterIO(srcFlowBand, GF_Read,
@@ -493,14 +786,11 @@ CPLErr GenericRecursivePropertyAlgebraProcessor(GDALRasterBandH srcFlowBand,
     std::cout << QString("Read input arrays of size %1, %2").arg(nXSize).arg(nYSize) + "\n";
 
 
-    for (i = 0; i < nYSize; ++i)//rows
-    {
-        for (j = 0; j < nXSize; ++j)//cols
-        {
-            ComputePropertyAlgebraValues(srcNoDataValue, dstNoDataValue, i, j, nXSize, nYSize,
-                                        flowDirection, upstreamProperty, algData, algCalc, transform, pfnAlg, pData);
-        }
-    }
+    std::vector<FlowReceivers> receivers;
+    BuildFlowReceiverTable(flowDirection, nXSize, nYSize, srcNoDataValue, receivers);
+
+    PropertyAlgebraCell cellAlg = {pfnAlg, flowDirection, upstreamProperty, algData, nXSize, nYSize, dstNoDataValue, srcNoDataValue, pData};
+    ComputeFlowAlgebra(flowDirection, receivers, nXSize, nYSize, srcNoDataValue, cellAlg, GenericFlowAlgebraThreads(nThreads));
 
     //Write
     eErr = GDALRasterIO (dstAlgBand,
@@ -512,9 +802,107 @@ CPLErr GenericRecursivePropertyAlgebraProcessor(GDALRasterBandH srcFlowBand,
                             GDT_Float32,
                             0,0);
 
+    delete[] flowDirection;
+    delete[] upstreamProperty;
+    delete[] algData;
+
     return eErr;
 }
 
+/*
+UpstreamAccumulationProcessor: Upslope area, failure volume or property totals straight from the receiver table,
+no windows or angle comparisons per cell. The multi band version reads the flow directions, builds the table and
+orders the cells once for all nBands pairs of cell and output bands (pahCellBands can be NULL for area).
+*/
+CPLErr UpstreamAccumulationMultiProcessor(GDALRasterBandH srcFlowBand,
+                                            int nBands,
+                                            GDALRasterBandH* pahCellBands,
+                                            GDALRasterBandH* pahDstBands,
+                                            double* transform,
+                                            UpstreamAccumulationType type,
+                                            int nThreads)
+{
+    CPLErr eErr = CE_None;
+
+    int nXSize = GDALGetRasterBandXSize(srcFlowBand);//Get length of raster
+    int nYSize = GDALGetRasterBandYSize(srcFlowBand);
+
+    float srcNoDataValue;
+    int srcNoData;
+
+    srcNoDataValue = (float) GDALGetRasterNoDataValue(srcFlowBand, &srcNoData);
+
+    //Cell and output values are band interleaved, sizes and spacing in size_t/GSpacing as they pass 2^31 with many bands
+    size_t nCells = (size_t) nXSize*nYSize;
+    GSpacing nPixelSpace = (GSpacing) nBands*sizeof(float);
+    GSpacing nLineSpace = nPixelSpace*nXSize;
+
+    float* flowDirection = new float[nCells];
+    float* cellValues = NULL;
+    float* algData = new float[nCells*nBands]();//Initialise as 0
+    //Read the inputData
+    GDALRasterIO(srcFlowBand, GF_Read,
+            0, 0, //X,Y offset in cells
+            nXSize, nYSize, //X,Y length in cells
+            flowDirection, //data
+            nXSize, nYSize, //Number of cells in new dataset
+            GDT_Float32, //Type
+            0, 0);
+
+    if (type != UPSTREAM_AREA)
+    {
+        cellValues = new float[nCells*nBands];
+        for (int b = 0; b < nBands; ++b)
+        {
+            GDALRasterIOEx(pahCellBands[b], GF_Read,
+                0, 0, //X,Y offset in cells
+                nXSize, nYSize, //X,Y length in cells
+                cellValues + b, //data
+                nXSize, nYSize, //Number of cells in new dataset
+                GDT_Float32, //Type
+                nPixelSpace, nLineSpace,
+                NULL);
+        }
+    }
+
+    std::vector<FlowReceivers> receivers;
+    BuildFlowReceiverTable(flowDirection, nXSize, nYSize, srcNoDataValue, receivers);
+    std::cout << QString("Built receiver table of size %1, %2 for %3 bands").arg(nXSize).arg(nYSize).arg(nBands) + "\n";
+
+    UpstreamAccumulationCell cellAlg = {&receivers, type, transform[5]*transform[1], cellValues, algData, nBands, nXSize, nYSize};
+    ComputeFlowAlgebra(flowDirection, receivers, nXSize, nYSize, srcNoDataValue, cellAlg, nThreads);
+
+    //Write
+    for (int b = 0; b < nBands && eErr == CE_None; ++b)
+    {
+        eErr = GDALRasterIOEx (pahDstBands[b],
+                                GF_Write,
+                                0,0,
+                                nXSize,nYSize,
+                                algData + b,
+                                nXSize,nYSize,
+                                GDT_Float32,
+                                nPixelSpace, nLineSpace,
+                                NULL);
+    }
+
+    delete[] flowDirection;
+    delete[] cellValues;
+    delete[] algData;
+
+    return eErr;
+}
+
+CPLErr UpstreamAccumulationProcessor(GDALRasterBandH srcFlowBand,
+                                        GDALRasterBandH cellBand,
+                                        GDALRasterBandH dstAlgBand,
+                                        double* transform,
+                                        UpstreamAccumulationType type,
+                                        int nThreads)
+{
+    return UpstreamAccumulationMultiProcessor(srcFlowBand, 1, &cellBand, &dstAlgBand, transform, type, nThreads);
+}
+
 /***************************************************************
 Takahashi - this one doesn't make sense.
 ***************************************************************/
@@ -574,10 +962,8 @@ float RecursiveUpstreamFlowAlg (int i, int j, int nXsize, int nYsize, float* flo
     accumulatedFlow = -accumulatedFlow;
 
     
-    float* aFlowWindow = new float[9];
-    float* aAlgWindow = new float[9];
+    float aAlgWindow[9];//On the stack, this runs once per cell
 
-    GenericGetIJWindow(i,j,nXsize, nYsize, flowDirections, aFlowWindow);
     GenericGetIJWindow(i,j,nXsize, nYsize, algData, aAlgWindow);
 
     int algDataIJLookup[9][2] = {i-1,j-1,//0
@@ -664,6 +1050,185 @@ double determineUnsteadyFOS(double time, double duration, double waterWeight, do
     return fos;
 }
 
+void IversonCellSetup(double slopeAngleRad, double frictionAngleRad, double cohesion, double satSoilWeight, double waterWeight,
+                      double hydraulicDiffusivity, double IzkSat, IversonCellTerms& terms)
+{
+    terms.sinSlope = sin(slopeAngleRad);
+    terms.cosSlope = cos(slopeAngleRad);
+    terms.cosSlope2 = pow(terms.cosSlope,2);
+    terms.tanFriction = tan(frictionAngleRad);
+    terms.frictionFOS = terms.tanFriction/tan(slopeAngleRad);
+    terms.unsteadyScale = -(waterWeight/satSoilWeight)*(terms.tanFriction/(terms.sinSlope*terms.cosSlope))*IzkSat;
+    terms.D_eff = 4*hydraulicDiffusivity*terms.cosSlope2;
+    terms.cohesion = cohesion;
+    terms.satSoilWeight = satSoilWeight;
+    terms.waterWeight = waterWeight;
+}
+
+/*
+The depths are done a batch at a time, deepest first, each pass a plain loop over the batch so the compiler
+can vectorise it: the static FOS, then the normalised times, then the responses (the erfc/exp calls), then the
+sum. Each depth gets the same arithmetic as IversonFOS, the batches just keep the depth loop free of branches.
+*/
+float IversonFailureDepthScan(const IversonCellTerms& terms, double depositThickness, double waterTable,
+                              int zIncrements, double time, double duration)
+{
+    double inc = (1/(float)zIncrements)*depositThickness;
+    bool afterRainfall = !(time <= duration);
+
+    double depth[IVERSON_DEPTH_BATCH];
+    double fos[IVERSON_DEPTH_BATCH];
+    double nTime[IVERSON_DEPTH_BATCH];
+    double nDuration[IVERSON_DEPTH_BATCH];
+    double resp[IVERSON_DEPTH_BATCH];
+
+    for (int zTop = zIncrements - 1; zTop > 0; zTop -= IVERSON_DEPTH_BATCH)
+    {
+        int nDepths = MIN(zTop, IVERSON_DEPTH_BATCH);
+        for (int k = 0; k < nDepths; ++k)
+        {
+            depth[k] = (zTop - k) * inc;
+        }
+        for (int k = 0; k < nDepths; ++k)
+        {
+            fos[k] = IversonStaticFOS(terms, depth[k], waterTable);
+        }
+        //The unsteady term only lowers the FOS, so the responses are only worked out down to the next depth
+        //failing on its static FOS alone, the deepest failure is at or below it
+        for (int kStart = 0; kStart < nDepths; )
+        {
+            int kEnd = kStart;
+            while (kEnd < nDepths && !(fos[kEnd] < 1))
+            {
+                ++kEnd;
+            }
+            kEnd = MIN(kEnd + 1, nDepths);
+
+            for (int k = kStart; k < kEnd; ++k)
+            {
+                //normaliseTime
+                double timeScale = pow(depth[k],2)/terms.D_eff;
+                nTime[k] = depth[k] > 0 ? time/timeScale : 0;
+                nDuration[k] = depth[k] > 0 ? duration/timeScale : 0;
+            }
+            for (int k = kStart; k < kEnd; ++k)
+            {
+                resp[k] = response(nTime[k]);
+            }
+            if (afterRainfall)
+            {
+                for (int k = kStart; k < kEnd; ++k)
+                {
+                    resp[k] = resp[k] - response(nTime[k] - nDuration[k]);
+                }
+            }
+            for (int k = kStart; k < kEnd; ++k)
+            {
+                fos[k] = fos[k]+terms.unsteadyScale*resp[k];
+            }
+
+            for (int k = kStart; k < kEnd; ++k)
+            {
+                if (fos[k] < 1)
+                {
+                    return (float) depth[k];
+                }
+            }
+            kStart = kEnd;
+        }
+    }
+    return -1.0f;
+}
+
+float IversonFailureDepthRoot(const IversonCellTerms& terms, double depositThickness, double waterTable,
+                              int nBrackets, double tolerance, double time, double duration)
+{
+    //f < 0 fails
+    double zHi = depositThickness;
+    double fHi = IversonFOS(terms, zHi, waterTable, time, duration) - 1;
+    if (fHi < 0)
+    {
+        return (float) zHi;
+    }
+
+    //The top bracket stops at the tolerance, FOS is undefined at the surface
+    double inc = depositThickness/MAX(nBrackets, 1);
+    for (int k = MAX(nBrackets, 1) - 1; k >= 0; --k)
+    {
+        double zLo = k > 0 ? k * inc : MIN(tolerance, inc/2);
+        double fLo = IversonFOS(terms, zLo, waterTable, time, duration) - 1;
+        if (!(fLo < 0))
+        {
+            zHi = zLo;
+            fHi = fLo;
+            continue;
+        }
+        if (!(fHi == fHi))
+        {
+            return (float) zLo;//No bracket to refine
+        }
+
+        //Brent's method on [zLo, zHi], b is the best estimate
+        double a = zLo, fa = fLo, b = zHi, fb = fHi;
+        if (fabs(fa) < fabs(fb))
+        {
+            std::swap(a, b);
+            std::swap(fa, fb);
+        }
+        double c = a, fc = fa, d = 0;
+        bool bisected = true;
+        for (int iter = 0; iter < 100 && fb != 0 && fabs(b - a) > tolerance; ++iter)
+        {
+            double s;
+            if (fa != fc && fb != fc)
+            {
+                //Inverse quadratic interpolation
+                s = a*fb*fc/((fa - fb)*(fa - fc)) + b*fa*fc/((fb - fa)*(fb - fc)) + c*fa*fb/((fc - fa)*(fc - fb));
+            }
+            else
+            {
+                //Secant
+                s = b - fb*(b - a)/(fb - fa);
+            }
+            double quarter = (3*a + b)/4;
+            if (!((s > quarter && s < b) || (s < quarter && s > b)) ||
+                (bisected && fabs(s - b) >= fabs(b - c)/2) ||
+                (!bisected && fabs(s - b) >= fabs(c - d)/2) ||
+                (bisected && fabs(b - c) < tolerance) ||
+                (!bisected && fabs(c - d) < tolerance))
+            {
+                s = (a + b)/2;
+                bisected = true;
+            }
+            else
+            {
+                bisected = false;
+            }
+            double fs = IversonFOS(terms, s, waterTable, time, duration) - 1;
+            d = c;
+            c = b;
+            fc = fb;
+            if ((fa < 0) != (fs < 0))
+            {
+                b = s;
+                fb = fs;
+            }
+            else
+            {
+                a = s;
+                fa = fs;
+            }
+            if (fabs(fa) < fabs(fb))
+            {
+                std::swap(a, b);
+                std::swap(fa, fb);
+            }
+        }
+        return (float) b;
+    }
+    return -1.0f;
+}
+
 /**************************************************************
 Upslope failure volume calc
 **************************************************************/
@@ -676,11 +1241,9 @@ float RecursiveUpstreamFailureAlg (int i, int j, int nXsize, int nYsize, float*
     double nsres = psData->nsres;
     
     
-    float* aFlowWindow = new float[9];
-    float* aFailureWindow = new float[9];
-    float* aAlgWindow = new float[9];
+    float aFailureWindow[9];//On the stack, this runs once per cell
+    float aAlgWindow[9];
 
-    GenericGetIJWindow(i,j,nXsize, nYsize, flowDirections, aFlowWindow);
     GenericGetIJWindow(i,j,nXsize, nYsize, failureDepth, aFailureWindow);
     GenericGetIJWindow(i,j,nXsize, nYsize, algData, aAlgWindow);
 
@@ -737,11 +1300,9 @@ float RecursiveUpstreamPropAlg (int i, int j, int nXsize, int nYsize, float* flo
     double nsres = psData->nsres;
     
     
-    float* aFlowWindow = new float[9];
-    float* aPropertyWindow = new float[9];
-    float* aAlgWindow = new float[9];
+    float aPropertyWindow[9];//On the stack, this runs once per cell
+    float aAlgWindow[9];
 
-    GenericGetIJWindow(i,j,nXsize, nYsize, flowDirections, aFlowWindow);
     GenericGetIJWindow(i,j,nXsize, nYsize, upstreamProperty, aPropertyWindow);
     GenericGetIJWindow(i,j,nXsize, nYsize, algData, aAlgWindow);
 
@@ -13,6 +13,8 @@
 #ifndef RF_EROSIONUTILS_H
 #define RF_EROSIONUTILS_H
 
+#include <vector>
+
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "cpl_conv.h"
@@ -47,37 +49,76 @@ float upstreamProportion(float* flowWindow, int neighBour, int* ijlookup, int nX
 std::vector<float> FloatArraytoVector(float* fIn);
 
 
-//Compute the values using the algo
-void ComputeFlowAlgebraValues(float srcNoDataValue, float dstNoDataValue,
-                                        int i, int j, int nXSize, int nYSize,
-                                        float* flowDirections,
-                                        float* algData,
-                                        bool* algCalc,
-                                        double* transform,
-                                        GenericRecursiveFlowAlgebraAlg pfnAlg,
-                                        void* pData);
+//Proportion of the flow out of neighbour (0-7, the 3x3 window without the centre) that goes into cell i,j
+float NeighbourInflowProportion(float* flowDirections, int i, int j, int neighbour, int nXSize, int nYSize, float srcNoDataValue);
+
+//Where a cell's flow goes: up to two neighbours (0-7, -1 for none) and the proportion to each
+typedef struct
+{
+    signed char neighbour[2];
+    float proportion[2];
+} FlowReceivers;
+
+//Convert the D-inf angles to a receiver per cell, once, so the flow algebra needs no angle comparisons
+void BuildFlowReceiverTable(float* flowDirections, int nXSize, int nYSize, float srcNoDataValue, std::vector<FlowReceivers>& receivers);
 
-//Generic recursive processor
+//Order the cells so each comes after all the cells flowing into it, returns the number of cells on flow loops.
+//pBasins (optional) gets the drainage basin number of each cell, -1 for nodata
+int GetTopologicalFlowOrder(float* flowDirections, const std::vector<FlowReceivers>& receivers, int nXSize, int nYSize,
+                            float srcNoDataValue, std::vector<int>& order, std::vector<int>* pBasins = NULL);
+
+//Generic flow algebra processors, cells are computed in topological order (no recursion).
+//The kernels read whole 3x3 windows of the output so these run on one thread, nThreads other than 1 only logs a warning
 CPLErr GenericRecursiveFlowAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursiveFlowAlgebraAlg pfnAlg,
-                                                void* pData);
+                                                void* pData,
+                                                int nThreads = 1);
 
 CPLErr GenericRecursiveFailureAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH failFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursiveFailureAlgebraAlg pfnAlg,
-                                                void* pData);
+                                                void* pData,
+                                                int nThreads = 1);
 
 CPLErr GenericRecursivePropertyAlgebraProcessor(GDALRasterBandH srcFlowBand,
                                                 GDALRasterBandH propFlowBand,
                                                 GDALRasterBandH dstAlgBand,
                                                 double* transform,
                                                 GenericRecursivePropertyAlgebraAlg pfnAlg,
-                                                void* pData);
+                                                void* pData,
+                                                int nThreads = 1);
 
+//What each cell adds to the upstream total
+typedef enum
+{
+    UPSTREAM_AREA,
+    UPSTREAM_FAILURE_VOLUME,
+    UPSTREAM_PROPERTY
+} UpstreamAccumulationType;
+
+//Upstream totals computed on the receiver table, cellBand is the failure depth or property band (unused for area).
+//nThreads other than 1 accumulates each drainage basin on its own thread (<= 0 uses all cores)
+CPLErr UpstreamAccumulationProcessor(GDALRasterBandH srcFlowBand,
+                                        GDALRasterBandH cellBand,
+                                        GDALRasterBandH dstAlgBand,
+                                        double* transform,
+                                        UpstreamAccumulationType type,
+                                        int nThreads = 1);
+
+//Upstream totals of nBands cell bands in one pass over the flow directions (pahCellBands can be NULL for area)
+CPLErr UpstreamAccumulationMultiProcessor(GDALRasterBandH srcFlowBand,
+                                            int nBands,
+                                            GDALRasterBandH* pahCellBands,
+                                            GDALRasterBandH* pahDstBands,
+                                            double* transform,
+                                            UpstreamAccumulationType type,
+                                            int nThreads = 1);
+
+//Copy the 3x3 window around i,j into outputWindow (9 floats, usually on the stack), 0 outside the raster
 void GenericGetIJWindow(int i, int j, int nXsize, int nYsize, float* inputData, float* outputWindow);
 
 /****************************************************************
@@ -122,6 +163,75 @@ double determineResponse(double t, double duration, double Z, double D_eff);
 
 double determineUnsteadyFOS(double time, double duration, double waterWeight, double satSoilWeight, double frictionAngleRad, double slopeAngleRad, double IzkSat, double Z, double D_eff);
 
+inline double degreesToRadians(double theta)
+{
+    return theta * (M_PI/180);
+}
+
+//determineResponse with the normalised time and duration already worked out
+inline double determineResponseNormalised(bool afterRainfall, double nTime, double nDuration)
+{
+    double resp = response(nTime);
+    if (afterRainfall)
+    {
+        resp = resp - response(nTime - nDuration);
+    }
+    return resp;
+}
+
+//Terms of a cell's factor of safety that do not change with depth
+typedef struct
+{
+    double sinSlope;
+    double cosSlope;
+    double cosSlope2;     //cos^2(slope)
+    double tanFriction;
+    double frictionFOS;   //tan(friction)/tan(slope)
+    double unsteadyScale; //-(waterWeight/satSoilWeight)*(tan(friction)/(sin*cos))*IzKsat
+    double D_eff;         //4*diffusivity*cos^2(slope)
+    double cohesion;
+    double satSoilWeight;
+    double waterWeight;
+} IversonCellTerms;
+
+void IversonCellSetup(double slopeAngleRad, double frictionAngleRad, double cohesion, double satSoilWeight, double waterWeight,
+                      double hydraulicDiffusivity, double IzkSat, IversonCellTerms& terms);
+
+//Rainfall independent part of the factor of safety at depth Z, frictionFOS + cohesionFOS - porePressureFOS
+inline double IversonStaticFOS(const IversonCellTerms& terms, double Z, double waterTable)
+{
+    double backgroundHead = terms.cosSlope2*(1-(waterTable/Z));
+    double cohesionFOS = terms.cohesion/(terms.satSoilWeight*Z*terms.sinSlope*terms.cosSlope);
+    double porePressureFOS = (backgroundHead*Z*terms.waterWeight*terms.tanFriction)/(terms.satSoilWeight*Z*terms.sinSlope*terms.cosSlope);
+    return terms.frictionFOS+cohesionFOS-porePressureFOS;
+}
+
+//Factor of safety at depth Z, the same sum as frictionFOS + cohesionFOS - porePressureFOS + determineUnsteadyFOS
+inline double IversonFOS(const IversonCellTerms& terms, double Z, double waterTable, double time, double duration)
+{
+    double unsteadyFOS = terms.unsteadyScale*determineResponse(time, duration, Z, terms.D_eff);
+    return IversonStaticFOS(terms, Z, waterTable)+unsteadyFOS;
+}
+
+//Depths IversonFailureDepthScan works out together, its buffers are on the stack
+#define IVERSON_DEPTH_BATCH 8
+
+/*
+Deepest of zIncrements evenly spaced depths (0 to the deposit thickness) with FOS < 1, -1 if none fail.
+Scans up from the bottom a batch of depths at a time and stops at the batch with the first failure,
+depth 0 never fails
+*/
+float IversonFailureDepthScan(const IversonCellTerms& terms, double depositThickness, double waterTable,
+                              int zIncrements, double time, double duration);
+
+/*
+Deepest depth in (0, depositThickness] where FOS crosses 1, -1 if none fail.
+The column (from the tolerance down) is split into nBrackets intervals, scanned up from the bottom so the
+deepest of several crossings is found, and the crossing is refined with Brent's method to within tolerance
+*/
+float IversonFailureDepthRoot(const IversonCellTerms& terms, double depositThickness, double waterTable,
+                              int nBrackets, double tolerance, double time, double duration);
+
 /**************************************************************
 Upslope failure volume calc
 **************************************************************/
@@ -11,6 +11,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
 
@@ -44,16 +45,22 @@ namespace RF
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataGDALDataset_;
         CSIRO::DataExecution::TypedObject< int >           dataRasterBand_;
         CSIRO::DataExecution::TypedObject< bool >          dataComputeEdges_;
+        CSIRO::DataExecution::TypedObject< RF::FillMethod > dataFillMethod_;
+        CSIRO::DataExecution::TypedObject< double >        dataEpsilon_;
         CSIRO::DataExecution::TypedObject< QString >       dataDestinationFileName_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataOutputDataset_;
+        CSIRO::DataExecution::TypedObject< int >           dataCellsChanged_;
 
 
         // Inputs and outputs
         CSIRO::DataExecution::InputScalar inputGDALDataset_;
         CSIRO::DataExecution::InputScalar inputRasterBand_;
         CSIRO::DataExecution::InputScalar inputComputeEdges_;
+        CSIRO::DataExecution::InputScalar inputFillMethod_;
+        CSIRO::DataExecution::InputScalar inputEpsilon_;
         CSIRO::DataExecution::InputScalar      inputDestinationFileName_;
         CSIRO::DataExecution::Output      inputOutputDataset_;
+        CSIRO::DataExecution::Output      outputCellsChanged_;
 
 
         FillDepressionsImpl(FillDepressions& op);
@@ -71,14 +78,22 @@ namespace RF
         dataGDALDataset_(),
         dataRasterBand_(1),
         dataComputeEdges_(true),
+        dataFillMethod_(RF::FillMethod::FLOODEPSILON),
+        dataEpsilon_(0.0),
         dataDestinationFileName_(),
         dataOutputDataset_(),
+        dataCellsChanged_(0),
         inputGDALDataset_("GDAL Dataset", dataGDALDataset_, op_),
         inputRasterBand_("Raster Band", dataRasterBand_, op_),
         inputComputeEdges_("Compute Edges", dataComputeEdges_, op_),
+        inputFillMethod_("Fill method", dataFillMethod_, op_),
+        inputEpsilon_("Epsilon", dataEpsilon_, op_),
         inputDestinationFileName_("Destination File Name", dataDestinationFileName_, op_),
-        inputOutputDataset_("Output Dataset", dataOutputDataset_, op_)
+        inputOutputDataset_("Output Dataset", dataOutputDataset_, op_),
+        outputCellsChanged_("Cells changed", dataCellsChanged_, op_)
     {
+        inputComputeEdges_.setDescription("Only used by the single cell pits method");
+        inputEpsilon_.setDescription("Rise per cell across filled areas for the priority-flood (epsilon) method, 0 uses the smallest float step");
     }
 
 
@@ -92,6 +107,8 @@ namespace RF
         bool&         computeEdges        = *dataComputeEdges_;
         QString&      destinationFileName = *dataDestinationFileName_;
         GDALDatasetH& outputDataset       = *dataOutputDataset_;
+        RF::FillMethod& fillMethod        = *dataFillMethod_;
+        int&          cellsChanged        = *dataCellsChanged_;
         
         GDALAllRegister();
 
@@ -112,12 +129,6 @@ namespace RF
 
         dstNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
 
-        void *pData;
-
-        GDALGeneric3x3ProcessingAlg pfnAlg = NULL;
-
-        pfnAlg = GDALFillDepressionsAlg;
-
         outputDataset = GDALCreate(GDALGetDatasetDriver(gDALDataset),
                                     destinationFileName.toLocal8Bit().constData(),
                                     GDALGetRasterXSize(gDALDataset),
@@ -131,7 +142,38 @@ namespace RF
 
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-        GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+        cellsChanged = 0;
+        if (fillMethod == RF::FillMethod::SINGLECELL)
+        {
+            //Single pass that only raises one cell pits
+            if (GDALGeneric3x3Processing(hBand, destBand, GDALFillDepressionsAlg, NULL, computeEdges) != CE_None)
+            {
+                return false;
+            }
+
+            int nXSize = GDALGetRasterBandXSize(hBand);
+            std::vector<float> srcLine(nXSize), dstLine(nXSize);
+            for (int i = 0; i < GDALGetRasterBandYSize(hBand); ++i)
+            {
+                GDALRasterIO(hBand, GF_Read, 0, i, nXSize, 1, &srcLine[0], nXSize, 1, GDT_Float32, 0, 0);
+                GDALRasterIO(destBand, GF_Read, 0, i, nXSize, 1, &dstLine[0], nXSize, 1, GDT_Float32, 0, 0);
+                for (int j = 0; j < nXSize; ++j)
+                {
+                    if (dstLine[j] > srcLine[j])
+                    {
+                        ++cellsChanged;
+                    }
+                }
+            }
+            return true;
+        }
+
+        size_t nChanged = 0;
+        if (GDALPriorityFloodFill(hBand, destBand, fillMethod, *dataEpsilon_, &nChanged) != CE_None)
+        {
+            return false;
+        }
+        cellsChanged = (int) nChanged;
 
         return true;
     }
@@ -121,8 +121,6 @@ namespace RF
 
         pData = GDALCreateFlowDirectionData(transform);
 
-        GDALGeneric3x3ProcessingAlg pfnAlg = NULL;
-
         if (*dataFlowDirType_==RF::FlowDirType::DINF)
         {
             outputDataset = GDALCreate(GDALGetDatasetDriver(gDALDataset),
@@ -137,8 +135,7 @@ namespace RF
             GDALSetProjection(outputDataset, GDALGetProjectionRef(gDALDataset));
 
             GDALSetRasterNoDataValue(destBand, dstNoDataValue);
-            pfnAlg = GDALFlowDirectionInfAlg;
-            GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALFlowDirectionInfKernel(*(GDALFlowDirAlgData*)pData), computeEdges);
         }
         else if (*dataFlowDirType_==RF::FlowDirType::D8)
         {
@@ -155,8 +152,7 @@ namespace RF
 
             GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-            pfnAlg = GDALFlowDirection8Alg;
-            GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALFlowDirection8Kernel(*(GDALFlowDirAlgData*)pData), computeEdges);
             
             int count = 0;
             int countUndef = 0;
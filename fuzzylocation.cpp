@@ -11,7 +11,9 @@
 */
 
 #include <cassert>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
 
@@ -30,8 +32,43 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 
+//Largest number of distinct values treated as categories, beyond this the map is probably continuous
+#define FUZZY_MAX_CATEGORIES 256
+//Output values held in memory at once when writing every category
+#define FUZZY_CATEGORY_BLOCK_VALUES (1 << 24)
+
 namespace RF
 {
+	//Cone kernel, 1 at the centre falling linearly to 0 at the corners
+	static void linearKernel(cv::Mat& kernel)
+	{
+		int kernelSize = kernel.rows;
+		double length = (int)(kernelSize / 2); //Cast to int should floor without negative infinite
+		double dist = sqrt(length*length + length*length);
+		double m = -1.0 / dist; //Calculate slope, is negative to go from 0 to distance
+		//Generate kernel
+		for (int ki = 0; ki < kernel.rows; ++ki) {
+			double rlength = fabs(ki - (int)(kernelSize / 2)); //Cast to int should floor without negative infinite
+			for (int kj = 0; kj < kernel.cols; ++kj) {
+				double clength = fabs(kj - (int)(kernelSize / 2));
+				//Calculate distance
+				double kdist = sqrt(rlength*rlength + clength*clength);
+				kernel.at<float>(ki, kj) = float(m*kdist + 1.0);
+			}
+		}
+	}
+
+	//1D gaussian scaled to 1 at the centre, the 2D kernel is its outer product
+	static std::vector<float> gaussianWeights(int kernelSize)
+	{
+		cv::Mat gaussian = cv::getGaussianKernel(kernelSize, -1, CV_32F);
+		std::vector<float> weights(kernelSize);
+		for (int k = 0; k < kernelSize; ++k) {
+			weights[k] = gaussian.at<float>(k) / gaussian.at<float>((kernelSize - 1) / 2);
+		}
+		return weights;
+	}
+
     /**
      * \internal
      */
@@ -51,6 +88,7 @@ namespace RF
 		CSIRO::DataExecution::SimpleInput< bool > threshold_;
 		CSIRO::DataExecution::SimpleInput< double > thresholdVal_;
 		CSIRO::DataExecution::SimpleInput< int > kernelSize_;
+		CSIRO::DataExecution::SimpleInput< bool > allCategories_;
         CSIRO::DataExecution::TypedObject< RF::FuzzyMembershipType > memberType_;
         CSIRO::DataExecution::SimpleInput< QString > outputName_;
         CSIRO::DataExecution::SimpleOutput< GDALDatasetH > outputDataset_;
@@ -60,6 +98,7 @@ namespace RF
         FuzzyLocationImpl(FuzzyLocation& op);
 
         bool  execute();
+        bool  executeCategories(const float* data, int nXSize, int nYSize, int srcNoData, float srcNoDataValue);
         void  logText(const QString& msg)   { op_.logText(msg); }
     };
 
@@ -73,6 +112,7 @@ namespace RF
 		threshold_("Threshold data", op_),
 		thresholdVal_("Threshold value", op_),
 		kernelSize_("Kernel size", op_),
+		allCategories_("Membership of every category", op_),
         memberType_(RF::FuzzyMembershipType::GAUSSIAN),
         outputName_("Output dataset name",  op_),
         outputDataset_("Output dataset",  op_),
@@ -83,6 +123,7 @@ namespace RF
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
 		threshold_.input_.setDescription(tr("Create a boolean threshold for everything above the given value."));
+		allCategories_.input_.setDescription(tr("Treat each distinct value as a category and write its dilation and erosion as a pair of bands (threshold is ignored)."));
         // Recommend setting a description of the operation and each input / output here:
         // op_.setDescription(tr("My operation does this, that and this other thing."));
         // input1_.input_.setDescription(tr("Used for such and such."));
@@ -128,6 +169,12 @@ namespace RF
 		//Convert float array to an openCV mat (assuming rows = Y)
 		cv::Mat dataToMat(GDALGetRasterBandYSize(hBand), GDALGetRasterBandXSize(hBand), CV_32F, data);
 
+		if (*allCategories_) {
+			bool ok = executeCategories(data, GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand), srcNoData, srcNoDataValue);
+			delete[] data;
+			return ok;
+		}
+
 		//Thresholding
 		if (*threshold_) {
 			cv::threshold(dataToMat.clone(), dataToMat, *thresholdVal_, 1.0, CV_THRESH_BINARY);
@@ -139,92 +186,14 @@ namespace RF
 
 		//Create kernel input for erosion and dilation
 		cv::Mat kernel = cv::Mat::zeros(cv::Size(kernelSize,kernelSize), CV_32F);
-		//Create dilation and erosion doubles
-		double dilation, erosion;
 
 		if (memberType == RF::FuzzyMembershipType::LINEAR) {
-			double length = (int)(kernelSize / 2); //Cast to int should floor without negative infinite
-			double dist = sqrt(length*length + length*length);
-			double m = -1.0 / dist; //Calculate slope, is negative to go from 0 to distance
-			//Generate kernel
-			for (int ki = 0; ki < kernel.rows; ++ki) {
-				double rlength = fabs(ki - (int)(kernelSize / 2)); //Cast to int should floor without negative infinite
-				for (int kj = 0; kj < kernel.cols; ++kj) {
-					double clength = fabs(kj - (int)(kernelSize / 2));
-					//Calculate distance
-					double kdist = sqrt(rlength*rlength + clength*clength);
-					kernel.at<float>(ki, kj) = float(m*kdist + 1.0);
-				}
-			}
+			linearKernel(kernel);
 			std::cout << "Linear Mat = " << std::endl << kernel << std::endl;
-			//Now convolve the kernels
-			for (int i = 0; i < dataToMat.rows; ++i) {
-				int rowStart = std::max(i - ((kernelSize - 1) / 2), 0);
-				int rowEnd = std::min(i + ((kernelSize - 1) / 2) + 1, dataToMat.rows);
-				for (int j = 0; j < dataToMat.cols; ++j) {
-					int colStart = std::max(j - ((kernelSize - 1) / 2), 0);
-					int colEnd = std::min(j + ((kernelSize - 1) / 2) + 1, dataToMat.cols);
-
-					cv::Mat R = dataToMat(cv::Range(rowStart, rowEnd), cv::Range(colStart, colEnd));
-
-					if (R.total() != kernel.total()) { /*
-													   if (rowStart == 0) {
-													   if (colStart == 0) {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-													   cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   else if (colEnd == dataToMat.cols) {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-													   cv::Range(0, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   else {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-													   cv::Range::all()), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   }
-													   else if (rowEnd == dataToMat.rows) {
-													   if (colStart == 0) {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-													   cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   else if (colEnd == dataToMat.cols) {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-													   cv::Range(0, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   else {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-													   cv::Range::all()), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   }
-													   else if (colStart == 0) {
-													   //Rowstart and end cases dealth with
-													   cv::minMaxLoc(R.mul(kernel(cv::Range::all(), //Rows
-													   cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   else if (colEnd == dataToMat.cols) {
-													   cv::minMaxLoc(R.mul(kernel(cv::Range::all(), //Rows
-													   cv::Range(0, R.size().width)), scaleFactor), //Cols
-													   &erosion, &dilation, NULL, NULL);
-													   }
-													   */
-						dilation = 0;
-						erosion = 0;
-					}
-					else {
-						cv::minMaxLoc(R.mul(kernel), &erosion, &dilation, NULL, NULL);
-					}
-
-					dilationCategory.at<float>(i, j) = float(dilation);
-					erosionCategory.at<float>(i, j) = float(erosion);
-				}
-			}
+			//Radial weights do not separate, run the whole kernel (clipped at the edges) on every cell
+			weightedMorphology(dataToMat.ptr<float>(), dataToMat.cols, dataToMat.rows,
+				kernel.ptr<float>(), kernelSize,
+				dilationCategory.ptr<float>(), erosionCategory.ptr<float>());
 		}
 		else if (memberType == RF::FuzzyMembershipType::CONSTANT) {
 			kernel = cv::getStructuringElement(cv::MorphShapes::MORPH_RECT, kernel.size());
@@ -234,78 +203,11 @@ namespace RF
 			cv::erode(dataToMat, erosionCategory, kernel);
 		}
 		else if (memberType == RF::FuzzyMembershipType::GAUSSIAN) {
-			kernel = cv::getGaussianKernel(kernelSize, -1, CV_32F) * cv::getGaussianKernel(kernelSize, -1, CV_32F).t();
-			float scaleFactor = 1.0 / kernel.at<float>((kernelSize - 1) / 2, (kernelSize - 1) / 2);
-			//std::cout << "Mat = " << std::endl << kernel << std::endl;
-			//Run convolution
-			for (int i = 0; i < dataToMat.rows; ++i) {
-				int rowStart = std::max(i - ((kernelSize - 1) / 2), 0);
-				int rowEnd = std::min(i + ((kernelSize - 1) / 2) + 1, dataToMat.rows);
-				for (int j = 0; j < dataToMat.cols; ++j) {
-					int colStart = std::max(j - ((kernelSize - 1) / 2), 0);
-					int colEnd = std::min(j + ((kernelSize - 1) / 2) + 1, dataToMat.cols);
-
-					cv::Mat R = dataToMat(cv::Range(rowStart, rowEnd), cv::Range(colStart, colEnd));
-					
-					if (R.total() != kernel.total()) { /*
-						if (rowStart == 0) {
-							if (colStart == 0) {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-									cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL); 
-							}
-							else if (colEnd == dataToMat.cols) {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-									cv::Range(0, R.size().width)), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL);
-							}
-							else {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(kernelSize - R.size().height, R.size().height), //Rows
-									cv::Range::all()), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL);
-							}
-						}
-						else if (rowEnd == dataToMat.rows) {
-							if (colStart == 0) {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-									cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL);
-							}
-							else if (colEnd == dataToMat.cols) {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-									cv::Range(0, R.size().width)), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL);
-							}
-							else {
-								cv::minMaxLoc(R.mul(kernel(cv::Range(0, R.size().height), //Rows
-									cv::Range::all()), scaleFactor), //Cols
-									&erosion, &dilation, NULL, NULL);
-							}
-						}
-						else if (colStart == 0) {
-							//Rowstart and end cases dealth with
-							cv::minMaxLoc(R.mul(kernel(cv::Range::all(), //Rows
-								cv::Range(kernelSize - R.size().width, R.size().width)), scaleFactor), //Cols
-								&erosion, &dilation, NULL, NULL);
-						}
-						else if (colEnd == dataToMat.cols) {
-							cv::minMaxLoc(R.mul(kernel(cv::Range::all(), //Rows
-								cv::Range(0, R.size().width)), scaleFactor), //Cols
-								&erosion, &dilation, NULL, NULL);
-						}
-						*/
-						dilation = 0;
-						erosion = 0;
-					}
-					else {
-						cv::minMaxLoc(R.mul(kernel, scaleFactor), &erosion, &dilation, NULL, NULL);
-					}
-					
-					dilationCategory.at<float>(i, j) = float(dilation);
-					erosionCategory.at<float>(i, j) = float(erosion);
-				}
-			}
-
+			//The kernel is the outer product of the weights, so it separates
+			std::vector<float> weights = gaussianWeights(kernelSize);
+			separableWeightedMorphology(dataToMat.ptr<float>(), dataToMat.cols, dataToMat.rows,
+				&weights[0], &weights[0], kernelSize,
+				dilationCategory.ptr<float>(), erosionCategory.ptr<float>());
 		}
 
 		outputDataset = GDALCreate(GDALGetDriverByName("GTiff"),//GDALGetDatasetDriver(categoricalMap),
@@ -340,12 +242,135 @@ namespace RF
 			GDT_Float32,
 			0, 0);
 
+		delete[] data;
+
 		GDALClose(outputDataset);
 
         return true;
     }
 
 
+    /**
+     *
+     */
+    bool FuzzyLocationImpl::executeCategories(const float* data, int nXSize, int nYSize, int srcNoData, float srcNoDataValue)
+    {
+        const GDALDatasetH&     categoricalMap = *categoricalMap_;
+        const RF::FuzzyMembershipType& memberType     = *memberType_;
+        const QString&          outputName     = *outputName_;
+		const int& kernelSize = *kernelSize_;
+        GDALDatasetH&     outputDataset  = *outputDataset_;
+
+		size_t nCells = (size_t)nXSize*nYSize;
+
+		//Distinct values, ascending, are the categories
+		std::vector<float> values;
+		for (size_t i = 0; i < nCells; ++i) {
+			if (data[i] != data[i] || (srcNoData && data[i] == srcNoDataValue)) {
+				continue;
+			}
+			values.push_back(data[i]);
+			//Keep the list short so a continuous map fails early
+			if (values.size() > 4 * FUZZY_MAX_CATEGORIES) {
+				std::sort(values.begin(), values.end());
+				values.erase(std::unique(values.begin(), values.end()), values.end());
+				if (values.size() > FUZZY_MAX_CATEGORIES) {
+					break;
+				}
+			}
+		}
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+
+		int nCategories = (int)values.size();
+		if (nCategories == 0) {
+			std::cout << QString("ERROR: No categories found, every cell is no data") + "\n";
+			return false;
+		}
+		if (nCategories > FUZZY_MAX_CATEGORIES) {
+			std::cout << QString("ERROR: More than %1 distinct values, map does not look categorical").arg(FUZZY_MAX_CATEGORIES) + "\n";
+			return false;
+		}
+
+		//Category index of each cell, -1 for no data
+		std::vector<int> categories(nCells);
+		for (size_t i = 0; i < nCells; ++i) {
+			if (data[i] != data[i] || (srcNoData && data[i] == srcNoDataValue)) {
+				categories[i] = -1;
+			}
+			else {
+				categories[i] = (int)(std::lower_bound(values.begin(), values.end(), data[i]) - values.begin());
+			}
+		}
+
+		//Full kernel, the histogram needs every weight
+		cv::Mat kernel = cv::Mat::ones(cv::Size(kernelSize, kernelSize), CV_32F);
+		if (memberType == RF::FuzzyMembershipType::LINEAR) {
+			linearKernel(kernel);
+		}
+		else if (memberType == RF::FuzzyMembershipType::GAUSSIAN) {
+			std::vector<float> weights = gaussianWeights(kernelSize);
+			for (int ki = 0; ki < kernelSize; ++ki) {
+				for (int kj = 0; kj < kernelSize; ++kj) {
+					kernel.at<float>(ki, kj) = weights[ki] * weights[kj];
+				}
+			}
+		}
+
+		outputDataset = GDALCreate(GDALGetDriverByName("GTiff"),
+			outputName.toLocal8Bit().constData(),
+			nXSize, nYSize,
+			2 * nCategories,//Dilation and erosion for each category
+			GDT_Float32, NULL);
+		if (outputDataset == NULL) {
+			std::cout << QString("ERROR: Could not create output dataset %1").arg(outputName) + "\n";
+			return false;
+		}
+		double transform[6];
+		GDALGetGeoTransform(categoricalMap, transform);
+		GDALSetGeoTransform(outputDataset, transform);
+		GDALSetProjection(outputDataset, GDALGetProjectionRef(categoricalMap));
+
+		for (int c = 0; c < nCategories; ++c) {
+			GDALSetDescription(GDALGetRasterBand(outputDataset, 2 * c + 1), QString("category_%1_dilation").arg(values[c]).toLocal8Bit().constData());
+			GDALSetDescription(GDALGetRasterBand(outputDataset, 2 * c + 2), QString("category_%1_erosion").arg(values[c]).toLocal8Bit().constData());
+		}
+
+		//Rows in blocks, so memory holds a block of every band rather than every band
+		int blockRows = (int)MAX(1, MIN((size_t)nYSize, FUZZY_CATEGORY_BLOCK_VALUES / (2 * (size_t)nCategories*nXSize)));
+		std::vector<float> dilation((size_t)nCategories*blockRows*nXSize);
+		std::vector<float> erosion((size_t)nCategories*blockRows*nXSize);
+
+		for (int rowStart = 0; rowStart < nYSize; rowStart += blockRows) {
+			int nRows = MIN(blockRows, nYSize - rowStart);
+			size_t bandSize = (size_t)nRows*nXSize;
+
+			categoricalMorphology(&categories[0], nXSize, nYSize, nCategories,
+				kernel.ptr<float>(), kernelSize, rowStart, nRows,
+				&dilation[0], &erosion[0]);
+
+			for (int c = 0; c < nCategories; ++c) {
+				CPLErr eErr = GDALRasterIO(GDALGetRasterBand(outputDataset, 2 * c + 1), GF_Write,
+					0, rowStart, nXSize, nRows,
+					&dilation[c*bandSize], nXSize, nRows,
+					GDT_Float32, 0, 0);
+				if (eErr == CE_None) {
+					eErr = GDALRasterIO(GDALGetRasterBand(outputDataset, 2 * c + 2), GF_Write,
+						0, rowStart, nXSize, nRows,
+						&erosion[c*bandSize], nXSize, nRows,
+						GDT_Float32, 0, 0);
+				}
+				if (eErr != CE_None) {
+					std::cout << QString("ERROR: Could not write category %1 at row %2").arg(values[c]).arg(rowStart) + "\n";
+					return false;
+				}
+			}
+		}
+
+		return true;
+    }
+
+
     /**
      *
      */
@@ -0,0 +1,454 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <qstring.h>
+#include <qvector.h>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+#include "erosionutils.h"
+#include "volcanoplugin.h"
+#include "iversonfailuresweep.h"
+
+//Values (cells x bands, inputs and outputs) held for a block of rows
+#define SWEEP_BLOCK_VALUES (1 << 24)
+
+namespace RF
+{
+    /**
+     * \internal
+     */
+    class IversonFailureSweepImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::IversonFailureSweepImpl)
+
+    public:
+        IversonFailureSweep&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataSlopeAngleDataset_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataDepthOfDeposit_;
+        CSIRO::DataExecution::TypedObject< int >              dataDepthIncrement_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataWaterTableDepth_;
+        CSIRO::DataExecution::TypedObject< double >           dataFrictionAngle_;
+        CSIRO::DataExecution::TypedObject< double >           dataCohesion_;
+        CSIRO::DataExecution::TypedObject< double >           dataSaturatedSoilWeight_;
+        CSIRO::DataExecution::TypedObject< double >           dataWaterWeight_;
+        CSIRO::DataExecution::TypedObject< double >           dataHydraulicConductivity_;
+        CSIRO::DataExecution::TypedObject< double >           dataHydralicDiffusivity_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataRainfallIntensities_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataRainfallDurations_;
+        CSIRO::DataExecution::TypedObject< double >           dataTotalTime_;
+        CSIRO::DataExecution::TypedObject< bool >             dataWriteCube_;
+        CSIRO::DataExecution::TypedObject< int >              dataNumThreads_;
+        CSIRO::DataExecution::TypedObject< QString >          dataSummaryName_;
+        CSIRO::DataExecution::TypedObject< QString >          dataCubeName_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataFailureSummary_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataFailureCube_;
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputSlopeAngleDataset_;
+        CSIRO::DataExecution::InputScalar inputDepthOfDeposit_;
+        CSIRO::DataExecution::InputScalar inputDepthIncrement_;
+        CSIRO::DataExecution::InputScalar inputWaterTableDepth_;
+        CSIRO::DataExecution::InputScalar inputFrictionAngle_;
+        CSIRO::DataExecution::InputScalar inputCohesion_;
+        CSIRO::DataExecution::InputScalar inputSaturatedSoilWeight_;
+        CSIRO::DataExecution::InputScalar inputWaterWeight_;
+        CSIRO::DataExecution::InputScalar inputHydraulicConductivity_;
+        CSIRO::DataExecution::InputScalar inputHydralicDiffusivity_;
+        CSIRO::DataExecution::InputScalar inputRainfallIntensities_;
+        CSIRO::DataExecution::InputScalar inputRainfallDurations_;
+        CSIRO::DataExecution::InputScalar inputTotalTime_;
+        CSIRO::DataExecution::InputScalar inputWriteCube_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
+        CSIRO::DataExecution::InputScalar inputSummaryName_;
+        CSIRO::DataExecution::InputScalar inputCubeName_;
+        CSIRO::DataExecution::Output      outputFailureSummary_;
+        CSIRO::DataExecution::Output      outputFailureCube_;
+
+
+        IversonFailureSweepImpl(IversonFailureSweep& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    IversonFailureSweepImpl::IversonFailureSweepImpl(IversonFailureSweep& op) :
+        op_(op),
+        dataSlopeAngleDataset_(),
+        dataDepthOfDeposit_(),
+        dataDepthIncrement_(20),
+        dataWaterTableDepth_(),
+        dataFrictionAngle_(),
+        dataCohesion_(),
+        dataSaturatedSoilWeight_(),
+        dataWaterWeight_(),
+        dataHydraulicConductivity_(),
+        dataHydralicDiffusivity_(),
+        dataRainfallIntensities_(),
+        dataRainfallDurations_(),
+        dataTotalTime_(),
+        dataWriteCube_(false),
+        dataNumThreads_(0),
+        dataSummaryName_(),
+        dataCubeName_(),
+        dataFailureSummary_(),
+        dataFailureCube_(),
+        inputSlopeAngleDataset_("Slope angle dataset", dataSlopeAngleDataset_, op_),
+        inputDepthOfDeposit_("Depth of deposit", dataDepthOfDeposit_, op_),
+        inputDepthIncrement_("Number of depth increments", dataDepthIncrement_, op_),
+        inputWaterTableDepth_("Water table depth", dataWaterTableDepth_, op_),
+        inputFrictionAngle_("Friction angle", dataFrictionAngle_, op_),
+        inputCohesion_("Cohesion", dataCohesion_, op_),
+        inputSaturatedSoilWeight_("Saturated soil weight", dataSaturatedSoilWeight_, op_),
+        inputWaterWeight_("Water weight", dataWaterWeight_, op_),
+        inputHydraulicConductivity_("Hydraulic Conductivity", dataHydraulicConductivity_, op_),
+        inputHydralicDiffusivity_("Hydralic Diffusivity", dataHydralicDiffusivity_, op_),
+        inputRainfallIntensities_("Rainfall Intensities", dataRainfallIntensities_, op_),
+        inputRainfallDurations_("Rainfall Durations", dataRainfallDurations_, op_),
+        inputTotalTime_("Total time", dataTotalTime_, op_),
+        inputWriteCube_("Write failure depth cube", dataWriteCube_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
+        inputSummaryName_("Output raster name", dataSummaryName_, op_),
+        inputCubeName_("Cube raster name", dataCubeName_, op_),
+        outputFailureSummary_("Failure summary", dataFailureSummary_, op_),
+        outputFailureCube_("Failure depth cube", dataFailureCube_, op_)
+    {
+        inputRainfallIntensities_.setDescription(tr("Rainfall intensity of each scenario, the same length as the durations"));
+        inputRainfallDurations_.setDescription(tr("Rainfall duration of each scenario"));
+        inputWriteCube_.setDescription(tr("Also write the failure depth of every scenario, one band each"));
+        inputNumThreads_.setDescription(tr("Rows of cells are solved in parallel (0 uses all cores)"));
+        outputFailureSummary_.setDescription(tr("Band 1 fraction of scenarios that fail, band 2 maximum and band 3 mean failure depth of the failing scenarios (-1 if none fail)"));
+        outputFailureCube_.setDescription(tr("Failure depth of each scenario in turn, -1 where it does not fail"));
+    }
+
+
+    /**
+     *
+     */
+    bool IversonFailureSweepImpl::execute()
+    {
+        GDALDatasetH& slopeAngleDataset     = *dataSlopeAngleDataset_;
+        GDALDatasetH& depthOfDeposit        = *dataDepthOfDeposit_;
+        int&          zIncrements           = *dataDepthIncrement_;
+        GDALDatasetH& waterTableDepth       = *dataWaterTableDepth_;
+        double&       frictionAngle         = *dataFrictionAngle_;
+        double&       cohesion              = *dataCohesion_;
+        double&       saturatedSoilWeight   = *dataSaturatedSoilWeight_;
+        double&       waterWeight           = *dataWaterWeight_;
+        double&       hydraulicConductivity = *dataHydraulicConductivity_;
+        double&       hydralicDiffusivity   = *dataHydralicDiffusivity_;
+        double&       totalTime             = *dataTotalTime_;
+        bool&         writeCube             = *dataWriteCube_;
+        GDALDatasetH& failureSummary        = *dataFailureSummary_;
+        GDALDatasetH& failureCube           = *dataFailureCube_;
+
+        const QVector<double>& intensities = *dataRainfallIntensities_;
+        const QVector<double>& durations   = *dataRainfallDurations_;
+
+        GDALAllRegister();
+
+        if (intensities.size() != durations.size() || intensities.empty())
+        {
+            std::cout << QString("ERROR: Need the same number of rainfall intensities and durations, have %1 and %2").arg(intensities.size()).arg(durations.size()) + "\n";
+            return false;
+        }
+
+        GDALDatasetH datasets[3] = {slopeAngleDataset, depthOfDeposit, waterTableDepth};
+        GDALRasterBandH srcBands[3];
+        float srcNoDataValues[3];
+        int srcNoData;
+        for (int d = 0; d < 3; ++d)
+        {
+            if (1 > GDALGetRasterCount(datasets[d]))
+            {
+                std::cout << QString("ERROR: Not enough raster bands, number of bands is %1, band selected is %2").arg(GDALGetRasterCount(datasets[d])).arg(1) + "\n";
+                return false;
+            }
+            srcBands[d] = GDALGetRasterBand(datasets[d], 1);
+            srcNoDataValues[d] = (float) GDALGetRasterNoDataValue(srcBands[d], &srcNoData);
+        }
+
+        int nXSize = GDALGetRasterBandXSize(srcBands[0]);
+        int nYSize = GDALGetRasterBandYSize(srcBands[0]);
+        for (int d = 1; d < 3; ++d)
+        {
+            if (GDALGetRasterBandXSize(srcBands[d]) != nXSize || GDALGetRasterBandYSize(srcBands[d]) != nYSize)
+            {
+                std::cout << QString("ERROR: Input rasters differ in size, slope is %1 x %2 but another is %3 x %4").arg(nXSize).arg(nYSize)
+                    .arg(GDALGetRasterBandXSize(srcBands[d])).arg(GDALGetRasterBandYSize(srcBands[d])) + "\n";
+                return false;
+            }
+        }
+        float dstNoDataValue = srcNoDataValues[0];
+
+        double transform[6];
+        GDALGetGeoTransform(slopeAngleDataset, transform);
+
+        //Scenarios share the response of each distinct duration, only IzKsat differs between intensities
+        int nScenarios = intensities.size();
+        std::vector<double> izKsat(nScenarios);
+        std::vector<double> uniqueDurations;
+        std::vector<int> durationIndex(nScenarios);
+        for (int s = 0; s < nScenarios; ++s)
+        {
+            if (intensities[s] > hydraulicConductivity)
+            {
+                izKsat[s] = 1;
+            } else
+            {
+                izKsat[s] = intensities[s]/hydraulicConductivity;
+            }
+            std::vector<double>::iterator found = std::find(uniqueDurations.begin(), uniqueDurations.end(), durations[s]);
+            durationIndex[s] = (int) (found - uniqueDurations.begin());
+            if (found == uniqueDurations.end())
+            {
+                uniqueDurations.push_back(durations[s]);
+            }
+        }
+        int nDurations = (int) uniqueDurations.size();
+        std::cout << QString("Running %1 rainfall scenarios, %2 distinct durations").arg(nScenarios).arg(nDurations) + "\n";
+
+        failureSummary = GDALCreate(GDALGetDatasetDriver(slopeAngleDataset),
+                                    dataSummaryName_->toLocal8Bit().constData(),
+                                    nXSize, nYSize,
+                                    3,
+                                    GDT_Float32,
+                                    NULL);
+        GDALSetGeoTransform(failureSummary, transform);
+        GDALSetProjection(failureSummary, GDALGetProjectionRef(slopeAngleDataset));
+
+        GDALRasterBandH summaryBands[3];
+        const char* bandNames[3] = {"failure_fraction", "max_failure_depth", "mean_failure_depth"};
+        for (int b = 0; b < 3; ++b)
+        {
+            summaryBands[b] = GDALGetRasterBand(failureSummary, b + 1);
+            GDALSetDescription(summaryBands[b], bandNames[b]);
+            GDALSetRasterNoDataValue(summaryBands[b], dstNoDataValue);
+        }
+
+        int nCubeBands = 0;
+        failureCube = NULL;
+        if (writeCube)
+        {
+            nCubeBands = nScenarios;
+            failureCube = GDALCreate(GDALGetDatasetDriver(slopeAngleDataset),
+                                     dataCubeName_->toLocal8Bit().constData(),
+                                     nXSize, nYSize,
+                                     nCubeBands,
+                                     GDT_Float32,
+                                     NULL);
+            GDALSetGeoTransform(failureCube, transform);
+            GDALSetProjection(failureCube, GDALGetProjectionRef(slopeAngleDataset));
+            for (int s = 0; s < nScenarios; ++s)
+            {
+                GDALRasterBandH cubeBand = GDALGetRasterBand(failureCube, s + 1);
+                GDALSetDescription(cubeBand, QString("intensity_%1_duration_%2").arg(intensities[s]).arg(durations[s]).toLocal8Bit().constData());
+                GDALSetRasterNoDataValue(cubeBand, dstNoDataValue);
+            }
+        }
+
+        int nThreads = *dataNumThreads_;
+#ifdef _OPENMP
+        if (nThreads <= 0)
+        {
+            nThreads = omp_get_max_threads();
+        }
+#endif
+
+        //Inputs, summary and cube are only held for a block of rows
+        int nBlockRows = MAX(1, MIN(nYSize, SWEEP_BLOCK_VALUES / (nXSize*(6 + nCubeBands))));
+        size_t blockCells = (size_t) nBlockRows*nXSize;
+        std::vector<float> inputs(3*blockCells);
+        std::vector<float> summary(3*blockCells);
+        std::vector<float> cube(nCubeBands*blockCells);
+
+        double frictAngleRad = degreesToRadians(frictionAngle);
+
+        CPLErr eErr = CE_None;
+        for (int blockRow = 0; blockRow < nYSize && eErr == CE_None; blockRow += nBlockRows)
+        {
+            int nRows = MIN(nBlockRows, nYSize - blockRow);
+            for (int d = 0; d < 3 && eErr == CE_None; ++d)
+            {
+                eErr = GDALRasterIO(srcBands[d], GF_Read,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &inputs[d*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+            if (eErr != CE_None)
+            {
+                break;
+            }
+            const float* angleData = &inputs[0];
+            const float* depthData = &inputs[blockCells];
+            const float* wtDepth = &inputs[2*blockCells];
+
+            #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+            for (int L = 0; L < nRows; ++L)
+            {
+                //Per depth static FOS and per duration and depth response, reused by every scenario of a cell
+                std::vector<double> staticFOS(MAX(zIncrements, 0));
+                std::vector<double> responses(nDurations*staticFOS.size());
+                std::vector<char> responseDone(responses.size());
+                IversonCellTerms terms;
+
+                for (size_t i = (size_t) L*nXSize; i < (size_t) (L+1)*nXSize; ++i)
+                {
+                    if (angleData[i] == srcNoDataValues[0] || depthData[i] == srcNoDataValues[1] || wtDepth[i] == srcNoDataValues[2])
+                    {
+                        summary[i] = summary[blockCells + i] = summary[2*blockCells + i] = dstNoDataValue;
+                        for (int s = 0; s < nCubeBands; ++s)
+                        {
+                            cube[s*blockCells + i] = dstNoDataValue;
+                        }
+                        continue;
+                    }
+
+                    //IzKsat of 1 leaves the intensity out of the unsteady scale
+                    IversonCellSetup(degreesToRadians(angleData[i]), frictAngleRad, cohesion, saturatedSoilWeight, waterWeight,
+                                     hydralicDiffusivity, 1, terms);
+                    double depositThickness = depthData[i];
+                    double waterTable = wtDepth[i];
+                    double inc = (1/(float)zIncrements)*depositThickness;
+                    for (int zLev = 1; zLev < zIncrements; ++zLev)
+                    {
+                        staticFOS[zLev] = IversonStaticFOS(terms, zLev * inc, waterTable);
+                    }
+                    std::fill(responseDone.begin(), responseDone.end(), 0);
+
+                    int nFail = 0;
+                    float maxFailure = -1.0f;
+                    double failureSum = 0;
+                    for (int s = 0; s < nScenarios; ++s)
+                    {
+                        //Deepest failing depth, as IversonFailureDepthScan
+                        double unsteadyScale = terms.unsteadyScale*izKsat[s];
+                        float failure = -1.0f;
+                        bool failed = false;
+                        for (int zLev = zIncrements - 1; zLev > 0; --zLev)
+                        {
+                            size_t r = (size_t) durationIndex[s]*zIncrements + zLev;
+                            if (!responseDone[r])
+                            {
+                                responses[r] = determineResponse(totalTime, uniqueDurations[durationIndex[s]], zLev * inc, terms.D_eff);
+                                responseDone[r] = 1;
+                            }
+                            if (staticFOS[zLev]+unsteadyScale*responses[r] < 1)
+                            {
+                                failure = (float) (zLev * inc);
+                                failed = true;
+                                break;
+                            }
+                        }
+                        if (failed)
+                        {
+                            failureSum += failure;
+                            maxFailure = nFail == 0 ? failure : std::max(maxFailure, failure);
+                            ++nFail;
+                        }
+                        if (nCubeBands > 0)
+                        {
+                            cube[s*blockCells + i] = failure;
+                        }
+                    }
+                    summary[i] = (float) nFail / nScenarios;
+                    summary[blockCells + i] = maxFailure;
+                    summary[2*blockCells + i] = nFail > 0 ? (float) (failureSum / nFail) : -1.0f;
+                }
+            }
+
+            for (int b = 0; b < 3 && eErr == CE_None; ++b)
+            {
+                eErr = GDALRasterIO(summaryBands[b], GF_Write,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &summary[b*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+            for (int s = 0; s < nCubeBands && eErr == CE_None; ++s)
+            {
+                eErr = GDALRasterIO(GDALGetRasterBand(failureCube, s + 1), GF_Write,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &cube[s*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+        }
+
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not run the rainfall sweep, raster read or write failed") + "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     *
+     */
+    IversonFailureSweep::IversonFailureSweep() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< IversonFailureSweep >::getInstance(),
+            tr("Calculate failure depth over rainfall scenarios"))
+    {
+        pImpl_ = new IversonFailureSweepImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    IversonFailureSweep::~IversonFailureSweep()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  IversonFailureSweep::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(IversonFailureSweep,
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
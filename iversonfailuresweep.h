@@ -0,0 +1,59 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_IVERSONFAILURESWEEP_H
+#define RF_IVERSONFAILURESWEEP_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class IversonFailureSweepImpl;
+
+    /**
+     * \brief Iverson (2000) failure depth over many rainfall scenarios.
+     *
+     * Reads the slope, deposit depth and water table once and solves every
+     * rainfall intensity/duration pair for each cell, sharing the rainfall
+     * independent terms. Writes the fraction of scenarios that fail and the
+     * maximum and mean failure depth, and optionally one band per scenario.
+     */
+    class RF_API IversonFailureSweep : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::IversonFailureSweep)
+
+        IversonFailureSweepImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        IversonFailureSweep(const IversonFailureSweep&);
+        IversonFailureSweep& operator=(const IversonFailureSweep&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        IversonFailureSweep();
+        virtual ~IversonFailureSweep();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::IversonFailureSweep, RF_API)
+
+#endif
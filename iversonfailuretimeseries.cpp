@@ -0,0 +1,459 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <qstring.h>
+#include <qvector.h>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+#include "erosionutils.h"
+#include "volcanoplugin.h"
+#include "iversonfailuretimeseries.h"
+
+//Values (cells x bands, inputs and outputs) held for a block of rows
+#define TIMESERIES_BLOCK_VALUES (1 << 24)
+
+namespace RF
+{
+    //Sorts time indices by time
+    struct TimeOrder
+    {
+        const QVector<double>& times_;
+        TimeOrder(const QVector<double>& times) : times_(times) {}
+        bool operator()(int a, int b) const { return times_[a] < times_[b]; }
+    };
+
+    /**
+     * \internal
+     */
+    class IversonFailureTimeSeriesImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::IversonFailureTimeSeriesImpl)
+
+    public:
+        IversonFailureTimeSeries&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataSlopeAngleDataset_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataDepthOfDeposit_;
+        CSIRO::DataExecution::TypedObject< int >              dataDepthIncrement_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataWaterTableDepth_;
+        CSIRO::DataExecution::TypedObject< double >           dataFrictionAngle_;
+        CSIRO::DataExecution::TypedObject< double >           dataCohesion_;
+        CSIRO::DataExecution::TypedObject< double >           dataSaturatedSoilWeight_;
+        CSIRO::DataExecution::TypedObject< double >           dataWaterWeight_;
+        CSIRO::DataExecution::TypedObject< double >           dataHydraulicConductivity_;
+        CSIRO::DataExecution::TypedObject< double >           dataHydralicDiffusivity_;
+        CSIRO::DataExecution::TypedObject< double >           dataRainfallIntensity_;
+        CSIRO::DataExecution::TypedObject< double >           dataRainfallDuration_;
+        CSIRO::DataExecution::TypedObject< QVector<double> >  dataTimes_;
+        CSIRO::DataExecution::TypedObject< bool >             dataWriteCube_;
+        CSIRO::DataExecution::TypedObject< int >              dataNumThreads_;
+        CSIRO::DataExecution::TypedObject< QString >          dataSummaryName_;
+        CSIRO::DataExecution::TypedObject< QString >          dataCubeName_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataFailureSummary_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataFailureCube_;
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputSlopeAngleDataset_;
+        CSIRO::DataExecution::InputScalar inputDepthOfDeposit_;
+        CSIRO::DataExecution::InputScalar inputDepthIncrement_;
+        CSIRO::DataExecution::InputScalar inputWaterTableDepth_;
+        CSIRO::DataExecution::InputScalar inputFrictionAngle_;
+        CSIRO::DataExecution::InputScalar inputCohesion_;
+        CSIRO::DataExecution::InputScalar inputSaturatedSoilWeight_;
+        CSIRO::DataExecution::InputScalar inputWaterWeight_;
+        CSIRO::DataExecution::InputScalar inputHydraulicConductivity_;
+        CSIRO::DataExecution::InputScalar inputHydralicDiffusivity_;
+        CSIRO::DataExecution::InputScalar inputRainfallIntensity_;
+        CSIRO::DataExecution::InputScalar inputRainfallDuration_;
+        CSIRO::DataExecution::InputScalar inputTimes_;
+        CSIRO::DataExecution::InputScalar inputWriteCube_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
+        CSIRO::DataExecution::InputScalar inputSummaryName_;
+        CSIRO::DataExecution::InputScalar inputCubeName_;
+        CSIRO::DataExecution::Output      outputFailureSummary_;
+        CSIRO::DataExecution::Output      outputFailureCube_;
+
+
+        IversonFailureTimeSeriesImpl(IversonFailureTimeSeries& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    IversonFailureTimeSeriesImpl::IversonFailureTimeSeriesImpl(IversonFailureTimeSeries& op) :
+        op_(op),
+        dataSlopeAngleDataset_(),
+        dataDepthOfDeposit_(),
+        dataDepthIncrement_(20),
+        dataWaterTableDepth_(),
+        dataFrictionAngle_(),
+        dataCohesion_(),
+        dataSaturatedSoilWeight_(),
+        dataWaterWeight_(),
+        dataHydraulicConductivity_(),
+        dataHydralicDiffusivity_(),
+        dataRainfallIntensity_(),
+        dataRainfallDuration_(),
+        dataTimes_(),
+        dataWriteCube_(false),
+        dataNumThreads_(0),
+        dataSummaryName_(),
+        dataCubeName_(),
+        dataFailureSummary_(),
+        dataFailureCube_(),
+        inputSlopeAngleDataset_("Slope angle dataset", dataSlopeAngleDataset_, op_),
+        inputDepthOfDeposit_("Depth of deposit", dataDepthOfDeposit_, op_),
+        inputDepthIncrement_("Number of depth increments", dataDepthIncrement_, op_),
+        inputWaterTableDepth_("Water table depth", dataWaterTableDepth_, op_),
+        inputFrictionAngle_("Friction angle", dataFrictionAngle_, op_),
+        inputCohesion_("Cohesion", dataCohesion_, op_),
+        inputSaturatedSoilWeight_("Saturated soil weight", dataSaturatedSoilWeight_, op_),
+        inputWaterWeight_("Water weight", dataWaterWeight_, op_),
+        inputHydraulicConductivity_("Hydraulic Conductivity", dataHydraulicConductivity_, op_),
+        inputHydralicDiffusivity_("Hydralic Diffusivity", dataHydralicDiffusivity_, op_),
+        inputRainfallIntensity_("Rainfall Intensity", dataRainfallIntensity_, op_),
+        inputRainfallDuration_("Rainfall Duration", dataRainfallDuration_, op_),
+        inputTimes_("Evaluation times", dataTimes_, op_),
+        inputWriteCube_("Write failure depth cube", dataWriteCube_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
+        inputSummaryName_("Output raster name", dataSummaryName_, op_),
+        inputCubeName_("Cube raster name", dataCubeName_, op_),
+        outputFailureSummary_("Failure history", dataFailureSummary_, op_),
+        outputFailureCube_("Failure depth cube", dataFailureCube_, op_)
+    {
+        inputTimes_.setDescription(tr("Times since the start of rainfall to solve at, each as the total time of IversonFailureVolume"));
+        inputWriteCube_.setDescription(tr("Also write the failure depth at every time, one band each"));
+        inputNumThreads_.setDescription(tr("Rows of cells are solved in parallel (0 uses all cores)"));
+        outputFailureSummary_.setDescription(tr("Band 1 earliest time a cell fails and band 2 maximum failure depth over all times (-1 if it never fails)"));
+        outputFailureCube_.setDescription(tr("Failure depth at each time in turn, -1 where it does not fail"));
+    }
+
+
+    /**
+     *
+     */
+    bool IversonFailureTimeSeriesImpl::execute()
+    {
+        GDALDatasetH& slopeAngleDataset     = *dataSlopeAngleDataset_;
+        GDALDatasetH& depthOfDeposit        = *dataDepthOfDeposit_;
+        int&          zIncrements           = *dataDepthIncrement_;
+        GDALDatasetH& waterTableDepth       = *dataWaterTableDepth_;
+        double&       frictionAngle         = *dataFrictionAngle_;
+        double&       cohesion              = *dataCohesion_;
+        double&       saturatedSoilWeight   = *dataSaturatedSoilWeight_;
+        double&       waterWeight           = *dataWaterWeight_;
+        double&       hydraulicConductivity = *dataHydraulicConductivity_;
+        double&       hydralicDiffusivity   = *dataHydralicDiffusivity_;
+        double&       rainfallIntensity     = *dataRainfallIntensity_;
+        double&       rainfallDuration      = *dataRainfallDuration_;
+        bool&         writeCube             = *dataWriteCube_;
+        GDALDatasetH& failureSummary        = *dataFailureSummary_;
+        GDALDatasetH& failureCube           = *dataFailureCube_;
+
+        const QVector<double>& times = *dataTimes_;
+
+        GDALAllRegister();
+
+        if (times.empty())
+        {
+            std::cout << QString("ERROR: No evaluation times given") + "\n";
+            return false;
+        }
+
+        GDALDatasetH datasets[3] = {slopeAngleDataset, depthOfDeposit, waterTableDepth};
+        GDALRasterBandH srcBands[3];
+        float srcNoDataValues[3];
+        int srcNoData;
+        for (int d = 0; d < 3; ++d)
+        {
+            if (1 > GDALGetRasterCount(datasets[d]))
+            {
+                std::cout << QString("ERROR: Not enough raster bands, number of bands is %1, band selected is %2").arg(GDALGetRasterCount(datasets[d])).arg(1) + "\n";
+                return false;
+            }
+            srcBands[d] = GDALGetRasterBand(datasets[d], 1);
+            srcNoDataValues[d] = (float) GDALGetRasterNoDataValue(srcBands[d], &srcNoData);
+        }
+
+        int nXSize = GDALGetRasterBandXSize(srcBands[0]);
+        int nYSize = GDALGetRasterBandYSize(srcBands[0]);
+        for (int d = 1; d < 3; ++d)
+        {
+            if (GDALGetRasterBandXSize(srcBands[d]) != nXSize || GDALGetRasterBandYSize(srcBands[d]) != nYSize)
+            {
+                std::cout << QString("ERROR: Input rasters differ in size, slope is %1 x %2 but another is %3 x %4").arg(nXSize).arg(nYSize)
+                    .arg(GDALGetRasterBandXSize(srcBands[d])).arg(GDALGetRasterBandYSize(srcBands[d])) + "\n";
+                return false;
+            }
+        }
+        float dstNoDataValue = srcNoDataValues[0];
+
+        double transform[6];
+        GDALGetGeoTransform(slopeAngleDataset, transform);
+
+        //While it rains FOS only falls with time, so solving the latest time first bounds the failure depth of earlier ones
+        int nTimes = times.size();
+        std::vector<int> timeOrder(nTimes);
+        for (int t = 0; t < nTimes; ++t)
+        {
+            timeOrder[t] = t;
+        }
+        std::stable_sort(timeOrder.begin(), timeOrder.end(), TimeOrder(times));
+        std::cout << QString("Running %1 time steps").arg(nTimes) + "\n";
+
+        failureSummary = GDALCreate(GDALGetDatasetDriver(slopeAngleDataset),
+                                    dataSummaryName_->toLocal8Bit().constData(),
+                                    nXSize, nYSize,
+                                    2,
+                                    GDT_Float32,
+                                    NULL);
+        GDALSetGeoTransform(failureSummary, transform);
+        GDALSetProjection(failureSummary, GDALGetProjectionRef(slopeAngleDataset));
+
+        GDALRasterBandH summaryBands[2];
+        const char* bandNames[2] = {"first_failure_time", "max_failure_depth"};
+        for (int b = 0; b < 2; ++b)
+        {
+            summaryBands[b] = GDALGetRasterBand(failureSummary, b + 1);
+            GDALSetDescription(summaryBands[b], bandNames[b]);
+            GDALSetRasterNoDataValue(summaryBands[b], dstNoDataValue);
+        }
+
+        int nCubeBands = 0;
+        failureCube = NULL;
+        if (writeCube)
+        {
+            nCubeBands = nTimes;
+            failureCube = GDALCreate(GDALGetDatasetDriver(slopeAngleDataset),
+                                     dataCubeName_->toLocal8Bit().constData(),
+                                     nXSize, nYSize,
+                                     nCubeBands,
+                                     GDT_Float32,
+                                     NULL);
+            GDALSetGeoTransform(failureCube, transform);
+            GDALSetProjection(failureCube, GDALGetProjectionRef(slopeAngleDataset));
+            for (int t = 0; t < nTimes; ++t)
+            {
+                GDALRasterBandH cubeBand = GDALGetRasterBand(failureCube, t + 1);
+                GDALSetDescription(cubeBand, QString("time_%1").arg(times[t]).toLocal8Bit().constData());
+                GDALSetRasterNoDataValue(cubeBand, dstNoDataValue);
+            }
+        }
+
+        int nThreads = *dataNumThreads_;
+#ifdef _OPENMP
+        if (nThreads <= 0)
+        {
+            nThreads = omp_get_max_threads();
+        }
+#endif
+
+        //Inputs, summary and cube are only held for a block of rows
+        int nBlockRows = MAX(1, MIN(nYSize, TIMESERIES_BLOCK_VALUES / (nXSize*(5 + nCubeBands))));
+        size_t blockCells = (size_t) nBlockRows*nXSize;
+        std::vector<float> inputs(3*blockCells);
+        std::vector<float> summary(2*blockCells);
+        std::vector<float> cube(nCubeBands*blockCells);
+
+        double frictAngleRad = degreesToRadians(frictionAngle);
+        double izKsat;
+        if (rainfallIntensity > hydraulicConductivity)
+        {
+            izKsat = 1;
+        } else
+        {
+            izKsat = rainfallIntensity/hydraulicConductivity;
+        }
+
+        CPLErr eErr = CE_None;
+        for (int blockRow = 0; blockRow < nYSize && eErr == CE_None; blockRow += nBlockRows)
+        {
+            int nRows = MIN(nBlockRows, nYSize - blockRow);
+            for (int d = 0; d < 3 && eErr == CE_None; ++d)
+            {
+                eErr = GDALRasterIO(srcBands[d], GF_Read,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &inputs[d*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+            if (eErr != CE_None)
+            {
+                break;
+            }
+            const float* angleData = &inputs[0];
+            const float* depthData = &inputs[blockCells];
+            const float* wtDepth = &inputs[2*blockCells];
+
+            #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+            for (int L = 0; L < nRows; ++L)
+            {
+                //Per depth static FOS and time scale (Z^2/D_eff), reused at every time of a cell
+                std::vector<double> staticFOS(MAX(zIncrements, 0));
+                std::vector<double> timeScale(staticFOS.size());
+                std::vector<double> normalisedDuration(staticFOS.size());
+                IversonCellTerms terms;
+
+                for (size_t i = (size_t) L*nXSize; i < (size_t) (L+1)*nXSize; ++i)
+                {
+                    if (angleData[i] == srcNoDataValues[0] || depthData[i] == srcNoDataValues[1] || wtDepth[i] == srcNoDataValues[2])
+                    {
+                        summary[i] = summary[blockCells + i] = dstNoDataValue;
+                        for (int t = 0; t < nCubeBands; ++t)
+                        {
+                            cube[t*blockCells + i] = dstNoDataValue;
+                        }
+                        continue;
+                    }
+
+                    IversonCellSetup(degreesToRadians(angleData[i]), frictAngleRad, cohesion, saturatedSoilWeight, waterWeight,
+                                     hydralicDiffusivity, izKsat, terms);
+                    double depositThickness = depthData[i];
+                    double waterTable = wtDepth[i];
+                    double inc = (1/(float)zIncrements)*depositThickness;
+                    for (int zLev = 1; zLev < zIncrements; ++zLev)
+                    {
+                        double depth = zLev * inc;
+                        staticFOS[zLev] = IversonStaticFOS(terms, depth, waterTable);
+                        timeScale[zLev] = pow(depth,2)/terms.D_eff;
+                        normalisedDuration[zLev] = depth > 0 ? rainfallDuration/timeScale[zLev] : 0;
+                    }
+
+                    float firstFailure = -1.0f;
+                    float maxFailure = -1.0f;
+                    bool failedBefore = false;
+                    int rainFailLevel = zIncrements - 1;//Nothing deeper fails at earlier times while raining
+                    for (int k = nTimes - 1; k >= 0; --k)
+                    {
+                        //Deepest failing depth at this time, as IversonFailureDepthScan
+                        int t = timeOrder[k];
+                        bool afterRainfall = !(times[t] <= rainfallDuration);
+                        int failLevel = 0;
+                        for (int zLev = afterRainfall ? zIncrements - 1 : rainFailLevel; zLev > 0; --zLev)
+                        {
+                            double depth = zLev * inc;
+                            double nTime = depth > 0 ? times[t]/timeScale[zLev] : 0;
+                            double unsteadyFOS = terms.unsteadyScale*determineResponseNormalised(afterRainfall, nTime, normalisedDuration[zLev]);
+                            if (staticFOS[zLev]+unsteadyFOS < 1)
+                            {
+                                failLevel = zLev;
+                                break;
+                            }
+                        }
+                        if (!afterRainfall)
+                        {
+                            rainFailLevel = failLevel;
+                        }
+
+                        float failure = -1.0f;
+                        if (failLevel > 0)
+                        {
+                            failure = (float) (failLevel * inc);
+                            firstFailure = (float) times[t];
+                            maxFailure = failedBefore ? std::max(maxFailure, failure) : failure;
+                            failedBefore = true;
+                        }
+                        if (nCubeBands > 0)
+                        {
+                            cube[t*blockCells + i] = failure;
+                        }
+                    }
+                    summary[i] = firstFailure;
+                    summary[blockCells + i] = maxFailure;
+                }
+            }
+
+            for (int b = 0; b < 2 && eErr == CE_None; ++b)
+            {
+                eErr = GDALRasterIO(summaryBands[b], GF_Write,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &summary[b*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+            for (int t = 0; t < nCubeBands && eErr == CE_None; ++t)
+            {
+                eErr = GDALRasterIO(GDALGetRasterBand(failureCube, t + 1), GF_Write,
+                                    0, blockRow,
+                                    nXSize, nRows,
+                                    &cube[t*blockCells],
+                                    nXSize, nRows,
+                                    GDT_Float32,
+                                    0, 0);
+            }
+        }
+
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not run the time series, raster read or write failed") + "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     *
+     */
+    IversonFailureTimeSeries::IversonFailureTimeSeries() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< IversonFailureTimeSeries >::getInstance(),
+            tr("Calculate failure depth through a storm"))
+    {
+        pImpl_ = new IversonFailureTimeSeriesImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    IversonFailureTimeSeries::~IversonFailureTimeSeries()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  IversonFailureTimeSeries::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(IversonFailureTimeSeries,
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
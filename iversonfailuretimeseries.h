@@ -0,0 +1,58 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_IVERSONFAILURETIMESERIES_H
+#define RF_IVERSONFAILURETIMESERIES_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class IversonFailureTimeSeriesImpl;
+
+    /**
+     * \brief Iverson (2000) failure depth through a storm.
+     *
+     * Solves each cell at every evaluation time in one pass, sharing the
+     * time independent terms of each depth. Writes the time of first failure
+     * and the maximum failure depth, and optionally one band per time.
+     */
+    class RF_API IversonFailureTimeSeries : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::IversonFailureTimeSeries)
+
+        IversonFailureTimeSeriesImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        IversonFailureTimeSeries(const IversonFailureTimeSeries&);
+        IversonFailureTimeSeries& operator=(const IversonFailureTimeSeries&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        IversonFailureTimeSeries();
+        virtual ~IversonFailureTimeSeries();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::IversonFailureTimeSeries, RF_API)
+
+#endif
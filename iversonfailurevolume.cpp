@@ -44,6 +44,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< GDALDatasetH >   dataSlopeAngleDataset_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >   dataDepthOfDeposit_;
         CSIRO::DataExecution::TypedObject< int >            dataDepthIncrement_;
+        CSIRO::DataExecution::TypedObject< double >         dataDepthTolerance_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >   dataWaterTableDepth_;//Dataset
         CSIRO::DataExecution::TypedObject< double >        dataWaterInflux_;//Dataset
         CSIRO::DataExecution::TypedObject< double >        dataFrictionAngle_;//Dataset
@@ -56,6 +57,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< double >        dataRainfallDuration_;
         CSIRO::DataExecution::TypedObject< double >        dataTotalTime_;
         CSIRO::DataExecution::TypedObject< QString >       dataFailureName_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataFailureDepth_;
         CSIRO::DataExecution::TypedObject< QVector<double> >  dataXVec_;
         CSIRO::DataExecution::TypedObject< QVector<double> >  dataYVec_;
@@ -66,6 +68,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputSlopeAngleDataset_;
         CSIRO::DataExecution::InputScalar inputDepthOfDeposit_;
         CSIRO::DataExecution::InputScalar inputDepthIncrement_;
+        CSIRO::DataExecution::InputScalar inputDepthTolerance_;
         CSIRO::DataExecution::InputScalar inputWaterTableDepth_;
         CSIRO::DataExecution::InputScalar inputWaterInflux_;
         CSIRO::DataExecution::InputScalar inputFrictionAngle_;
@@ -78,6 +81,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputRainfallDuration_;
         CSIRO::DataExecution::InputScalar inputTotalTime_;
         CSIRO::DataExecution::InputScalar inputFailureName_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputFailureDepth_;
         CSIRO::DataExecution::Output      outputXVec_;
         CSIRO::DataExecution::Output      outputYVec_;
@@ -98,6 +102,7 @@ namespace RF
         dataSlopeAngleDataset_(),
         dataDepthOfDeposit_(),
         dataDepthIncrement_(20),
+        dataDepthTolerance_(0.0),
         dataWaterTableDepth_(),
         dataWaterInflux_(),
         dataFrictionAngle_(),
@@ -110,12 +115,14 @@ namespace RF
         dataRainfallDuration_(),
         dataTotalTime_(),
         dataFailureName_(),
+        dataNumThreads_(0),
         dataFailureDepth_(),
         dataXVec_(),
         dataYVec_(),
         inputSlopeAngleDataset_("Slope angle dataset", dataSlopeAngleDataset_, op_),
         inputDepthOfDeposit_("Depth of deposit", dataDepthOfDeposit_, op_),
         inputDepthIncrement_("Number of depth increments", dataDepthIncrement_, op_),
+        inputDepthTolerance_("Failure depth tolerance", dataDepthTolerance_, op_),
         inputWaterTableDepth_("Water table depth", dataWaterTableDepth_, op_),
         inputWaterInflux_("Steady state water influx", dataWaterInflux_, op_),
         inputFrictionAngle_("Friction angle", dataFrictionAngle_, op_),
@@ -128,22 +135,20 @@ namespace RF
         inputRainfallDuration_("Rainfall Duration", dataRainfallDuration_, op_),
         inputTotalTime_("Total time", dataTotalTime_, op_),
         inputFailureName_("Output raster name", dataFailureName_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputFailureDepth_("Failure depth", dataFailureDepth_, op_),
         outputXVec_("X Vector", dataXVec_, op_),
         outputYVec_("Y Vector", dataYVec_, op_)
     {
+        inputDepthIncrement_.setDescription(tr("Depths tested through the deposit, or the intervals searched for a crossing when a tolerance is set"));
+        inputDepthTolerance_.setDescription(tr("0 keeps the deepest failing increment, otherwise the deepest FOS = 1 crossing is found to this tolerance"));
+        inputNumThreads_.setDescription(tr("Rows of cells are solved in parallel (0 uses all cores)"));
     }
 
 
     /**
      *
      */
-    
-    double degreesToRadians(double theta)
-    {
-        return theta * (M_PI/180);
-    }
-
     bool IversonFailureVolumeImpl::execute()
     {
         GDALDatasetH& slopeAngleDataset     = *dataSlopeAngleDataset_;
@@ -253,91 +258,64 @@ namespace RF
 
         wtNodataValue = (float) GDALGetRasterNoDataValue(waterTableBand, &srcNoData);
 
-        double slopeAngleRad, frictAngleRad,frictionFOS,cohesionFOS,porePressureFOS, unsteadyFOS, depositThickness, waterTable;
-        double runOff = 0;
+        int nXSize = GDALGetRasterBandXSize(slopeBand);
+        int nYSize = GDALGetRasterBandYSize(slopeBand);
 
+        //Constant over the raster
+        double frictAngleRad = degreesToRadians(frictionAngle);
+        double izKsat;
+        if (rainfallIntensity > hydraulicConductivity)
+        {
+            izKsat = 1;
+        } else
+        {
+            izKsat = rainfallIntensity/hydraulicConductivity;
+        }
+
+        double tolerance = *dataDepthTolerance_;
 
         float * failureDepthData;
-        failureDepthData = new float [GDALGetRasterBandXSize(slopeBand)*GDALGetRasterBandYSize(slopeBand)];
+        failureDepthData = new float [nXSize*nYSize];
 
-        for (int i = 0; i < GDALGetRasterBandXSize(slopeBand)*GDALGetRasterBandYSize(slopeBand); ++i)
+        int nThreads = *dataNumThreads_;
+#ifdef _OPENMP
+        if (nThreads <= 0)
         {
-            if (angleData[i] == dstNoDataValue || depthData[i] == depthNodataValue || wtDepth[i] == wtNodataValue)
-            {
-                failureDepthData[i] = dstNoDataValue;
-            }
-            else
+            nThreads = omp_get_max_threads();
+        }
+#endif
+
+        //Each cell only needs its own depth independent terms, nothing is allocated in the loop
+        #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+        for (int j = 0; j < nYSize; ++j)
+        {
+            IversonCellTerms terms;
+            for (int i = j*nXSize; i < (j+1)*nXSize; ++i)
             {
-                slopeAngleRad = degreesToRadians(angleData[i]);
-                depositThickness = depthData[i];
-                waterTable = wtDepth[i];
-                frictAngleRad = degreesToRadians(frictionAngle);
-                frictionFOS = tan(frictAngleRad)/tan(slopeAngleRad);
-                double D_eff = 4*hydralicDiffusivity*pow(cos(slopeAngleRad),2);
-                //Determine izKz
-                double izKsat;
-                if (rainfallIntensity > hydraulicConductivity)
+                if (angleData[i] == dstNoDataValue || depthData[i] == depthNodataValue || wtDepth[i] == wtNodataValue)
                 {
-                    izKsat = 1;
-                    runOff += rainfallIntensity - hydraulicConductivity;
-                } else
-                {
-                    izKsat = rainfallIntensity/hydraulicConductivity;
+                    failureDepthData[i] = dstNoDataValue;
+                    continue;
                 }
-                //Initialise depth increment
-                std::vector<double> Z;
-                double inc = (1/(float)zIncrements)*depositThickness;
-                for (int zLev = 0; zLev < zIncrements; ++zLev)
+                IversonCellSetup(degreesToRadians(angleData[i]), frictAngleRad, cohesion, saturatedSoilWeight, waterWeight,
+                                 hydralicDiffusivity, izKsat, terms);
+                if (tolerance > 0)
                 {
-                    Z.push_back(zLev * inc);
+                    failureDepthData[i] = IversonFailureDepthRoot(terms, depthData[i], wtDepth[i], zIncrements, tolerance,
+                                                                  totalTime, rainfallDuration);
                 }
-                
-                /*if (i % 100000 == 0)
-                {
-                    std::cout << QString("Depth is %1").arg( depthData[i]) + "\n";
-                    std::cout << QString("Increment is %1, zlev[0] is %2").arg(inc).arg(Z[0]) + "\n";
-                    std::cout << QString("Calculated as 1/%1 * %2").arg(zIncrements).arg(depositThickness) + "\n";
-                }*/
-
-                std::vector<double> fosCell;
-                float failure = -1.0f; //This is very bad
-                for (int zCalc = 0; zCalc < Z.size(); ++zCalc)
+                else
                 {
-                    double depth = Z[zCalc];
-                    double backgroundHead = pow(cos(slopeAngleRad),2)*(1-(waterTable/depth));
-                    cohesionFOS = cohesion/(saturatedSoilWeight*depth*sin(slopeAngleRad)*cos(slopeAngleRad));
-                    porePressureFOS = (backgroundHead*depth*waterWeight*tan(frictAngleRad))/(saturatedSoilWeight*depth*sin(slopeAngleRad)*cos(slopeAngleRad));
-                    unsteadyFOS = determineUnsteadyFOS(totalTime, rainfallDuration, waterWeight, saturatedSoilWeight, frictAngleRad, slopeAngleRad, izKsat, depth, D_eff);
-                    double totalFOS = frictionFOS+cohesionFOS-porePressureFOS+unsteadyFOS;
-                    /*if (i % 100000 == 0)
-                    {
-                        std::cout << QString("Background head is %1").arg( backgroundHead) + "\n";
-                        std::cout << QString("Friction FOS is %1").arg(frictionFOS) + "\n";
-                        std::cout << QString("Cohesion FOS is %1").arg(cohesionFOS) + "\n";
-                        std::cout << QString("Pore FOS is %1").arg(porePressureFOS) + "\n";
-                        std::cout << QString("Unsteady FOS is %1").arg(unsteadyFOS) + "\n";
-                    }*/
-
-                    if (totalFOS < 1)
-                    {
-                        if (depth > failure)
-                        {
-                            failure = depth;
-                        }
-                    }
-                    fosCell.push_back(frictionFOS+cohesionFOS+porePressureFOS+unsteadyFOS);
+                    failureDepthData[i] = IversonFailureDepthScan(terms, depthData[i], wtDepth[i], zIncrements,
+                                                                  totalTime, rainfallDuration);
                 }
-                failureDepthData[i] = failure;
-				/*
-				if (i % 100000 == 0)
-                {
-                    std::cout << QString("Depth is %1").arg( depthData[i]) + "\n";
-                    std::cout << QString("Failure depth is %1").arg(failureDepthData[i]) + "\n";
-                }
-				*/
             }
         }
 
+        delete [] angleData;
+        delete [] depthData;
+        delete [] wtDepth;
+
         //Write failure depth
 
         failureDepth = GDALCreate(GDALGetDatasetDriver(slopeAngleDataset),
@@ -360,7 +338,8 @@ namespace RF
                 GDALGetRasterBandXSize(slopeBand), GDALGetRasterBandYSize(slopeBand),
                 GDT_Float32,
                 0,0);
- 
+
+        delete [] failureDepthData;
 
         return true;
     }
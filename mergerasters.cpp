@@ -6,13 +6,14 @@
 #include "Workspace/Application/LanguageUtils/streamqstring.h"
 #include "Workspace/DataExecution/DataObjects/typedobject.h"
 #include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
 #include "Workspace/DataExecution/InputOutput/simpleoperationio.h"
 #include "Workspace/DataExecution/Operations/typedoperationfactory.h"
 
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 
 #include "mergerasters.h"
-#include "opencv2/opencv.hpp"
 
 
 namespace RF
@@ -37,9 +38,15 @@ namespace RF
         CSIRO::DataExecution::SimpleInput< double > baseWeight_;
         CSIRO::DataExecution::SimpleInput< double > overlayWeighting_;
 		CSIRO::DataExecution::SimpleInput< double > gamma_;
+		CSIRO::DataExecution::SimpleInput< double > featherDistance_;
+		CSIRO::DataExecution::SimpleInput< int > numThreads_;
 		CSIRO::DataExecution::SimpleInput< QString > mergedDatasetFilename_;
         CSIRO::DataExecution::SimpleOutput< GDALDatasetH > mergedDataset_;
-		
+		CSIRO::DataExecution::TypedObject< RF::BlendMethod > blendMethod_;
+		CSIRO::DataExecution::TypedObject< GDALRIOResampleAlg > resampleAlg_;
+
+		CSIRO::DataExecution::InputScalar inputBlendMethod_;
+		CSIRO::DataExecution::InputScalar inputResampleAlg_;
 
         MergeRastersImpl(MergeRasters& op);
 
@@ -58,18 +65,27 @@ namespace RF
         baseWeight_("Base weighting", 0.1,  op_),
 		overlayWeighting_("Overlay weighting", 0.9,  op_),
 		gamma_("Additional height", 0.0, op_),
+		featherDistance_("Feather distance", 0.0, op_),
+		numThreads_("Number of threads", 0, op_),
 		mergedDatasetFilename_("Merged dataset filename", op_),
-        mergedDataset_("Merged dataset",  op_)
+        mergedDataset_("Merged dataset",  op_),
+		blendMethod_(RF::WEIGHTEDBLEND),
+		resampleAlg_(GRIORA_Bilinear),
+		inputBlendMethod_("Blend method", blendMethod_, op_),
+		inputResampleAlg_("Overlay resampling", resampleAlg_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
         // large data structure as input, you may wish to remove this call and replace it
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
 
-        // Recommend setting a description of the operation and each input / output here:
-        // op_.setDescription(tr("My operation does this, that and this other thing."));
-        // input1_.input_.setDescription(tr("Used for such and such."));
-        // output1_.output_.setDescription(tr("Results of the blah-di-blah."));
+        baseWeight_.input_.setDescription(tr("Weighted sum only: weight of the base where both layers have data."));
+        overlayWeighting_.input_.setDescription(tr("Weighted sum only: weight of the overlay where both layers have data."));
+        gamma_.input_.setDescription(tr("Weighted sum only: added to the weighted sum."));
+        featherDistance_.input_.setDescription(tr("Feathered only: distance in base units over which the overlay fades in from the edge of its data."));
+        numThreads_.input_.setDescription(tr("Tiles are blended in parallel (0 uses all cores)."));
+        inputBlendMethod_.setDescription(tr("How cells covered by both layers are combined, cells covered by one take that layer."));
+        inputResampleAlg_.setDescription(tr("Resampling used to warp the overlay onto the base grid (Gaussian uses bilinear)."));
     }
 
 
@@ -88,90 +104,31 @@ namespace RF
         
 		GDALRasterBandH baseBand = GDALGetRasterBand(baseLayer, 1);
 
-		float *baseData;
-		baseData = new float[GDALGetRasterBandXSize(baseLayer)*GDALGetRasterBandYSize(baseLayer)];
-
-		GDALRasterIO(baseBand, GF_Read,
-			0, 0,
-			GDALGetRasterBandXSize(baseBand), GDALGetRasterBandYSize(baseBand),
-			baseData,
-			GDALGetRasterBandXSize(baseBand), GDALGetRasterBandYSize(baseBand),
-			GDT_Float32,
-			0, 0);
-
 		int srcNoData;
 		float srcNoDataValue;
 
 		srcNoDataValue = (float)GDALGetRasterNoDataValue(baseBand, &srcNoData);
 
-		//Overlay
-		GDALRasterBandH overlayBand = GDALGetRasterBand(overlayLayer, 1);
-
-		float *overlayData;
-		overlayData = new float[GDALGetRasterBandXSize(overlayLayer)*GDALGetRasterBandYSize(overlayLayer)];
-
-		GDALRasterIO(overlayBand, GF_Read,
-			0, 0,
-			GDALGetRasterBandXSize(overlayBand), GDALGetRasterBandYSize(overlayBand),
-			overlayData,
-			GDALGetRasterBandXSize(overlayBand), GDALGetRasterBandYSize(overlayBand),
-			GDT_Float32,
-			0, 0);
-
-
-		double baseTransform[6], overlayTransform[6];
+		double baseTransform[6];
 		GDALGetGeoTransform(baseLayer, baseTransform);
-		GDALGetGeoTransform(overlayLayer, overlayTransform);
-		/******Geo Transform is
-		adfGeoTransform[0] /* top left x
-		adfGeoTransform[1] /* w-e pixel resolution
-		adfGeoTransform[2] /* 0
-		adfGeoTransform[3] /* top left y
-		adfGeoTransform[4] /* 0
-		adfGeoTransform[5] /* n-s pixel resolution (negative value)
-		*/
-
-		//Check that overlay is same size or smaller
-		/*
-		if (baseTransform[0] < overlayTransform[0] || //X min smaller
-			baseTransform[0] + baseTransform[1] * GDALGetRasterBandXSize(baseBand) < overlayTransform[0] + overlayTransform[1] * GDALGetRasterBandXSize(overlayBand)) //X max
-		{
-			std::cout << QString("ERROR: Base raster is not bigger or equal to overlay raster in X") + "\n";
-			return false;
+
+		//Feathering is in base cells
+		int featherCells = 0;
+		if (*blendMethod_ == RF::FEATHERBLEND) {
+			featherCells = (int)ceil(*featherDistance_ / fabs(baseTransform[1]));
 		}
-		if (baseTransform[3] < overlayTransform[3] || //Y min smaller
-			baseTransform[3] + baseTransform[5] * GDALGetRasterBandYSize(baseBand) < overlayTransform[3] + overlayTransform[5] * GDALGetRasterBandYSize(overlayBand)) //X max
-		{
-			std::cout << QString("ERROR: Base raster is not bigger or equal to overlay raster in Y") + "\n";
-			return false;
+
+		GDALResampleAlg resampleAlg;
+		switch (*resampleAlg_) {
+		case GRIORA_NearestNeighbour: resampleAlg = GRA_NearestNeighbour; break;
+		case GRIORA_Cubic: resampleAlg = GRA_Cubic; break;
+		case GRIORA_CubicSpline: resampleAlg = GRA_CubicSpline; break;
+		case GRIORA_Lanczos: resampleAlg = GRA_Lanczos; break;
+		case GRIORA_Average: resampleAlg = GRA_Average; break;
+		case GRIORA_Mode: resampleAlg = GRA_Mode; break;
+		default: resampleAlg = GRA_Bilinear; break;
 		}
-		*/
-		//Convert float array to an openCV mat (assuming rows = Y)
-		cv::Mat baseMat(GDALGetRasterBandYSize(baseBand), GDALGetRasterBandXSize(baseBand), CV_32F, baseData);
-		cv::Mat overlayMat(GDALGetRasterBandYSize(overlayBand), GDALGetRasterBandXSize(overlayBand), CV_32F, overlayData);
-
-		//Resize (most likely downsample) overlay to baseData size
-		int overlayResizeY = floor((overlayTransform[5] * GDALGetRasterBandYSize(overlayBand)) / baseTransform[5]);
-		int overlayResizeX = floor((overlayTransform[1] * GDALGetRasterBandXSize(overlayBand)) / baseTransform[1]);
-		std::cout << QString("Resizing to %1 X and %2 Y").arg(overlayResizeX).arg(overlayResizeY) + "\n";
-		cv::Mat overlayMatSize(overlayResizeY, overlayResizeX, CV_32F);
-		cv::resize(overlayMat, overlayMatSize, overlayMatSize.size(), 0, 0, CV_INTER_LINEAR);
-
-
-		//Get Transform and invert to get pixel/line
-		double invTransform[6];
-		GDALInvGeoTransform(baseTransform, invTransform);
-
-		//Work out the pixel centre, pixel size of data
-		int x_off = (int)floor(invTransform[0] + invTransform[1] * overlayTransform[0] + invTransform[2] * overlayTransform[3])+1;
-		int y_off = (int)floor(invTransform[3] + invTransform[4] * overlayTransform[0] + invTransform[5] * overlayTransform[3])+1;
-		std::cout << QString("Offset is %1 X and %2 Y").arg(x_off).arg(y_off) + "\n";
-		cv::Rect roi = cv::Rect(x_off, y_off, overlayMatSize.cols, overlayMatSize.rows);
-		
-		//Now do linear addition
-		cv::Mat outputMat = baseMat.clone();
-		cv::addWeighted(outputMat(roi), baseWeight, overlayMatSize, overlayWeighting, gamma, outputMat(roi));
-		
+
 		mergedDataset = GDALCreate(GDALGetDatasetDriver(baseLayer),
 			filename.toLocal8Bit().constData(),
 			GDALGetRasterXSize(baseLayer), GDALGetRasterYSize(baseLayer),
@@ -183,13 +140,14 @@ namespace RF
 		GDALSetProjection(mergedDataset, GDALGetProjectionRef(baseLayer));
 		GDALSetRasterNoDataValue(destBand, srcNoDataValue);
 
-		GDALRasterIO(destBand, GF_Write,
-			0, 0,
-			GDALGetRasterBandXSize(baseBand), GDALGetRasterBandYSize(baseBand),
-			outputMat.data,
-			GDALGetRasterBandXSize(baseBand), GDALGetRasterBandYSize(baseBand),
-			GDT_Float32,
-			0, 0);
+		//Overlay is warped onto the base grid a tile at a time
+		CPLErr eErr = GDALBlendOverlay(baseLayer, overlayLayer, destBand,
+			*blendMethod_, baseWeight, overlayWeighting, gamma, featherCells,
+			resampleAlg, srcNoDataValue, *numThreads_);
+		if (eErr != CE_None) {
+			std::cout << QString("ERROR: Could not merge overlay into base") + "\n";
+			return false;
+		}
 		    
         return true;
     }
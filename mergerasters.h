@@ -16,11 +16,11 @@ namespace RF
     class MergeRastersImpl;
 
     /**
-     * \brief Put a one-line description of your operation here
+     * \brief Merges an overlay raster into a base raster.
      *
-     * Add a more detailed description of your operation here
-     * or remove these lines if the brief description above
-     * is sufficient.
+     * The overlay is placed by its georeferencing and warped onto the base
+     * grid, then blended by weighted sum, maximum, minimum or feathering.
+     * Both rasters are streamed a tile at a time.
      */
     class RF_API MergeRasters : public CSIRO::DataExecution::Operation
     {
@@ -21,13 +21,24 @@
 #include "Workspace/DataExecution/Operations/typedoperationfactory.h"
 
 #include "volcanoplugin.h"
-
-#include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "multiplyrasters.h"
 
 
 namespace RF
 {
+    //Product of two bands
+    struct MultiplyRastersKernel
+    {
+        inline void operator()(const float* const* papafSrc, float* pafDst, int nCount) const
+        {
+            for (int i = 0; i < nCount; ++i)
+            {
+                pafDst[i] = papafSrc[0][i]*papafSrc[1][i];
+            }
+        }
+    };
+
     /**
      * \internal
      */
@@ -98,10 +109,10 @@ namespace RF
         
         GDALAllRegister();
 
-        GDALRasterBandH hBand1, hBand2;
+        GDALRasterBandH hBands[2];
 
-        hBand1 = GDALGetRasterBand(raster1,1);
-        hBand2 = GDALGetRasterBand(raster2,1);
+        hBands[0] = GDALGetRasterBand(raster1,1);
+        hBands[1] = GDALGetRasterBand(raster2,1);
 
         double transform1[6];
         GDALGetGeoTransform(raster1, transform1);
@@ -121,37 +132,7 @@ namespace RF
         int srcNodata;
         float dstNodataValue;
 
-        dstNodataValue = (float) GDALGetRasterNoDataValue(hBand1, &srcNodata);
-        
-        float * data1;
-        float * data2;
-        data1 = new float [GDALGetRasterBandXSize(hBand1)*GDALGetRasterBandYSize(hBand1)];
-        data2 = new float [GDALGetRasterBandXSize(hBand2)*GDALGetRasterBandYSize(hBand2)];
-
-        GDALRasterIO(hBand1, GF_Read,
-                0,0,
-                GDALGetRasterBandXSize(hBand1),GDALGetRasterBandYSize(hBand1),
-                data1,
-                GDALGetRasterBandXSize(hBand1),GDALGetRasterBandYSize(hBand1),
-                GDT_Float32,
-                0,0);
-
-        GDALRasterIO(hBand2, GF_Read,
-                0,0,
-                GDALGetRasterBandXSize(hBand2),GDALGetRasterBandYSize(hBand2),
-                data2,
-                GDALGetRasterBandXSize(hBand2),GDALGetRasterBandYSize(hBand2),
-                GDT_Float32,
-                0,0);
-
-        //Multiply Rasters
-        float * multipliedRaster;
-        multipliedRaster = new float [GDALGetRasterBandXSize(hBand1)*GDALGetRasterBandYSize(hBand1)];
-
-        for (int i = 0; i < GDALGetRasterBandXSize(hBand1)*GDALGetRasterBandYSize(hBand1); ++i)
-        {
-            multipliedRaster[i] = data1[i]*data2[i];
-        }
+        dstNodataValue = (float) GDALGetRasterNoDataValue(hBands[0], &srcNodata);
 
         outputRaster = GDALCreate(GDALGetDatasetDriver(raster1),
                                     outputRasterFileName.toLocal8Bit().constData(),
@@ -167,13 +148,12 @@ namespace RF
         GDALSetProjection(outputRaster, GDALGetProjectionRef(raster1));
         GDALSetRasterNoDataValue(destBand, dstNodataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand1), GDALGetRasterBandYSize(hBand1),
-                        multipliedRaster,
-                        GDALGetRasterBandXSize(hBand1), GDALGetRasterBandYSize(hBand1),
-                        GDT_Float32,
-                        0,0);
+        //Multiply Rasters
+        if (GDALPixelwiseProcessing(2, hBands, destBand, MultiplyRastersKernel()) != CE_None)
+        {
+            std::cout << QString("ERROR: Could not multiply rasters") + "\n";
+            return false;
+        }
 
         return true;
     }
@@ -42,11 +42,35 @@ Created by: Stuart Mead
 
 
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "rastersum.h"
 
 
 namespace RF
 {
+    //Sum of two bands, nodata where either is nodata
+    struct RasterSumKernel
+    {
+        float dstNoDataValue;
+
+        RasterSumKernel(float noData) : dstNoDataValue(noData) {}
+
+        inline void operator()(const float* const* papafSrc, float* pafDst, int nCount) const
+        {
+            for (int it = 0; it < nCount; ++it)
+            {
+                if (papafSrc[0][it] != dstNoDataValue && papafSrc[1][it] != dstNoDataValue)
+                {
+                    pafDst[it] = papafSrc[0][it] + papafSrc[1][it];
+                }
+                else
+                {
+                    pafDst[it] = dstNoDataValue;
+                }
+            }
+        }
+    };
+
     /**
      * \internal
      */
@@ -118,8 +142,7 @@ namespace RF
         
         GDALAllRegister();
 
-        GDALRasterBandH band1;
-        GDALRasterBandH band2;
+        GDALRasterBandH bands[2];
 
         if (rasterBand > GDALGetRasterCount(dataset1))
         {
@@ -133,64 +156,25 @@ namespace RF
             return false;
         }
 
-        band1 = GDALGetRasterBand(dataset1, rasterBand);
-        band2 = GDALGetRasterBand(dataset2, rasterBand2);
-
-        //Setup
-        int srcNoData;
-        float dstNoDataValue;
-
-        dstNoDataValue = (float) GDALGetRasterNoDataValue(band1, &srcNoData);
-
-        std::cout << QString("GDAL data type is %1").arg(GDALGetRasterDataType(band1)) + "\n";
-
-        float * band1Data;
-        band1Data = new float [GDALGetRasterBandXSize(band1)*GDALGetRasterBandYSize(band1)];
-        float * band2Data;
-        band2Data = new float [GDALGetRasterBandXSize(band2)*GDALGetRasterBandYSize(band2)];
-
-       GDALRasterIO( band1, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(band1), GDALGetRasterBandYSize(band1),
-            band1Data,
-            GDALGetRasterBandXSize(band1), GDALGetRasterBandYSize(band1),
-            GDALGetRasterDataType(band1),
-            0,0);
-      
-        GDALRasterIO( band2, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(band2), GDALGetRasterBandYSize(band2),
-            band2Data,
-            GDALGetRasterBandXSize(band2), GDALGetRasterBandYSize(band2),
-            GDALGetRasterDataType(band2),
-            0,0);
-           
-        std::cout << QString("Read in raster bands") + "\n";
+        bands[0] = GDALGetRasterBand(dataset1, rasterBand);
+        bands[1] = GDALGetRasterBand(dataset2, rasterBand2);
 
-        
-        if (GDALGetRasterBandXSize(band1) != GDALGetRasterBandXSize(band2))
+        if (GDALGetRasterBandXSize(bands[0]) != GDALGetRasterBandXSize(bands[1]))
         {
-            std::cout << QString("ERROR: Raster band x sizes are not equal, are %1, %2").arg(GDALGetRasterBandXSize(band1)).arg(GDALGetRasterBandXSize(band2)) + "\n";
+            std::cout << QString("ERROR: Raster band x sizes are not equal, are %1, %2").arg(GDALGetRasterBandXSize(bands[0])).arg(GDALGetRasterBandXSize(bands[1])) + "\n";
             return false;
         }
-        if (GDALGetRasterBandYSize(band1) != GDALGetRasterBandYSize(band2))
+        if (GDALGetRasterBandYSize(bands[0]) != GDALGetRasterBandYSize(bands[1]))
         {
-            std::cout << QString("ERROR: Raster band y sizes are not equal, are %1, %2").arg(GDALGetRasterBandYSize(band1)).arg(GDALGetRasterBandYSize(band2)) + "\n";
+            std::cout << QString("ERROR: Raster band y sizes are not equal, are %1, %2").arg(GDALGetRasterBandYSize(bands[0])).arg(GDALGetRasterBandYSize(bands[1])) + "\n";
             return false;
         }
 
-        
-        float * ouputData;
-        ouputData = new float [GDALGetRasterBandXSize(band1)*GDALGetRasterBandYSize(band1)];
-        
-        for (int it = 0; it < GDALGetRasterBandXSize(band1)*GDALGetRasterBandYSize(band1); ++it)
-        {
-            if (band1Data[it] != dstNoDataValue && band2Data[it] != dstNoDataValue)
-            {
-                ouputData[it] = band1Data[it] + band2Data[it];
-            }
-        }
-        
+        //Setup
+        int srcNoData;
+        float dstNoDataValue;
+
+        dstNoDataValue = (float) GDALGetRasterNoDataValue(bands[0], &srcNoData);
 
         sum = GDALCreate(GDALGetDatasetDriver(dataset1),
                                 outputFileName.toLocal8Bit().constData(),
@@ -198,26 +182,19 @@ namespace RF
                                 1,
                                 GDT_Float32, NULL);
 
-       
-                                
-    
         double transform[6];
         GDALGetGeoTransform(dataset1, transform);
         GDALSetGeoTransform(sum, transform);
         GDALSetProjection(sum, GDALGetProjectionRef(dataset1));
-        
 
         GDALRasterBandH destBand = GDALGetRasterBand(sum, 1);
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(band1), GDALGetRasterBandYSize(band1),
-                        ouputData,
-                        GDALGetRasterBandXSize(band1), GDALGetRasterBandYSize(band1),
-                        GDT_Float32,
-                        0,0);
-                        
+        if (GDALPixelwiseProcessing(2, bands, destBand, RasterSumKernel(dstNoDataValue)) != CE_None)
+        {
+            std::cout << QString("ERROR: Could not sum raster bands") + "\n";
+            return false;
+        }
 
         return true;
     }
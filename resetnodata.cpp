@@ -23,11 +23,29 @@
 #include "Workspace/DataExecution/Operations/typedoperationfactory.h"
 
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "resetnodata.h"
 
 
 namespace RF
 {
+    //Cells at or below the minimum become nodata
+    struct ResetNoDataKernel
+    {
+        double minimumCellValue;
+        float noDataValue;
+
+        ResetNoDataKernel(double minimum, float noData) : minimumCellValue(minimum), noDataValue(noData) {}
+
+        inline void operator()(const float* const* papafSrc, float* pafDst, int nCount) const
+        {
+            for (int it = 0; it < nCount; ++it)
+            {
+                pafDst[it] = papafSrc[0][it] <= minimumCellValue ? noDataValue : papafSrc[0][it];
+            }
+        }
+    };
+
     /**
      * \internal
      */
@@ -100,30 +118,11 @@ namespace RF
 
         GDALRasterBandH hBand = GDALGetRasterBand(gDALDataset, rasterBand);
 
-        float *data;
-        data = new float [GDALGetRasterBandYSize(hBand)*GDALGetRasterBandXSize(hBand)];
-
-        GDALRasterIO( hBand, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            data,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            GDT_Float32,
-            0,0);
-
         int srcNoData;
         float srcNoDataValue;
 
         srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
         std::cout << QString("Band nodata value is %1").arg(srcNoDataValue) + "\n";
-        
-        for (int it = 0; it < GDALGetRasterBandYSize(hBand)*GDALGetRasterBandXSize(hBand); ++it)
-        {
-                if (data[it] <= minimumCellValue)
-                {
-                    data[it] = srcNoDataValue;
-                }
-        }
 
         outputDataset = GDALCreate( GDALGetDatasetDriver(gDALDataset),
                                 destinationFileName.toLocal8Bit().constData(),
@@ -138,13 +137,11 @@ namespace RF
         GDALSetProjection(outputDataset, GDALGetProjectionRef(gDALDataset));
         GDALSetRasterNoDataValue(destBand, srcNoDataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        data,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        GDT_Float32,
-                        0,0);
+        if (GDALPixelwiseProcessing(1, &hBand, destBand, ResetNoDataKernel(minimumCellValue, srcNoDataValue)) != CE_None)
+        {
+            std::cout << QString("ERROR: Could not reset nodata") + "\n";
+            return false;
+        }
 
         return true;
     }
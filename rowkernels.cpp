@@ -0,0 +1,167 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+  SSE2 row kernels and the runtime instruction set selection.
+*/
+
+#include "rowkernels_impl.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+/***************************************
+SSE2
+***************************************/
+
+int SlopeRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       bool bHorn, double ewres, double nsres, double scale, int slopeFormat)
+{
+#ifdef RF_ROWKERNELS_SSE2
+    return SlopeRowDispatch<RowOpsSSE2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                        bHorn, ewres, nsres, scale, slopeFormat);
+#else
+    return 0;
+#endif
+}
+
+int AspectRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                        float* pafOutput, int nCount, const Row3x3NoData& noData,
+                        bool bHorn, bool useAngleAsAzimuth)
+{
+#ifdef RF_ROWKERNELS_SSE2
+    return AspectRowDispatch<RowOpsSSE2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                         bHorn, useAngleAsAzimuth);
+#else
+    return 0;
+#endif
+}
+
+int CurvatureRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                           float* pafOutput, int nCount, const Row3x3NoData& noData,
+                           int curvatureType, double ewres, double nsres,
+                           double zxxDenom, double zyyDenom, double zxyDenom)
+{
+#ifdef RF_ROWKERNELS_SSE2
+    return CurvatureRowDispatch<RowOpsSSE2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                            curvatureType, ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+#else
+    return 0;
+#endif
+}
+
+/***************************************
+RUNTIME SELECTION
+***************************************/
+
+enum RowKernelLevel
+{
+    ROWKERNEL_NONE,
+    ROWKERNEL_SSE2,
+    ROWKERNEL_AVX2
+};
+
+//Does the CPU and OS support AVX2
+static bool CPUHasAVX2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) //OS must save the YMM registers
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+static RowKernelLevel DetectRowKernelLevel()
+{
+    if (RowKernelsBuiltWithAVX2() && CPUHasAVX2())
+    {
+        return ROWKERNEL_AVX2;
+    }
+#ifdef RF_ROWKERNELS_SSE2
+    return ROWKERNEL_SSE2;
+#else
+    return ROWKERNEL_NONE;
+#endif
+}
+
+static RowKernelLevel GetRowKernelLevel()
+{
+    static const RowKernelLevel level = DetectRowKernelLevel();
+    return level;
+}
+
+int SlopeRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                   float* pafOutput, int nCount, const Row3x3NoData& noData,
+                   bool bHorn, double ewres, double nsres, double scale, int slopeFormat)
+{
+    switch (GetRowKernelLevel())
+    {
+    case ROWKERNEL_AVX2:
+        return SlopeRowKernelAVX2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                  bHorn, ewres, nsres, scale, slopeFormat);
+    case ROWKERNEL_SSE2:
+        return SlopeRowKernelSSE2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                  bHorn, ewres, nsres, scale, slopeFormat);
+    default:
+        return 0;
+    }
+}
+
+int AspectRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                    float* pafOutput, int nCount, const Row3x3NoData& noData,
+                    bool bHorn, bool useAngleAsAzimuth)
+{
+    switch (GetRowKernelLevel())
+    {
+    case ROWKERNEL_AVX2:
+        return AspectRowKernelAVX2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                   bHorn, useAngleAsAzimuth);
+    case ROWKERNEL_SSE2:
+        return AspectRowKernelSSE2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                   bHorn, useAngleAsAzimuth);
+    default:
+        return 0;
+    }
+}
+
+int CurvatureRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       int curvatureType, double ewres, double nsres,
+                       double zxxDenom, double zyyDenom, double zxyDenom)
+{
+    switch (GetRowKernelLevel())
+    {
+    case ROWKERNEL_AVX2:
+        return CurvatureRowKernelAVX2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                      curvatureType, ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+    case ROWKERNEL_SSE2:
+        return CurvatureRowKernelSSE2(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                      curvatureType, ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+  Vectorised (SSE2/AVX2) row kernels for the 3x3 terrain derivatives.
+  Each kernel computes a run of interior cells of one output line from the
+  three source lines around it, the instruction set is picked at runtime.
+*/
+
+#ifndef RF_ROWKERNELS_H
+#define RF_ROWKERNELS_H
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI  3.1415926535897932384626433832795
+#endif
+
+//Nodata handling for a row, the same rules as ComputeVal
+typedef struct
+{
+    int srcNoData; //Really a bool
+    float srcNoDataValue;
+    float dstNoDataValue;
+    bool computeEdges;
+} Row3x3NoData;
+
+/*
+Row kernels: pafLine1-3 point at the first output cell on the lines above, at and below it,
+cells -1 to nCount are read. They return the number of cells written (a whole number of vectors,
+0 if there is no vector unit), the caller finishes the rest of the row cell by cell.
+*/
+int SlopeRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                   float* pafOutput, int nCount, const Row3x3NoData& noData,
+                   bool bHorn, double ewres, double nsres, double scale, int slopeFormat);
+
+int AspectRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                    float* pafOutput, int nCount, const Row3x3NoData& noData,
+                    bool bHorn, bool useAngleAsAzimuth);
+
+int CurvatureRowKernel(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       int curvatureType, double ewres, double nsres,
+                       double zxxDenom, double zyyDenom, double zxyDenom);
+
+/*
+Scalar tails shared by the cell kernels and the row kernels so both give the same answer.
+Static so the AVX2 build of them is never picked up by the other files.
+*/
+
+//Slope from the gradient magnitude over the cell spacing (rise/run)
+static inline float SlopeFromRise(double rise, int slopeFormat)
+{
+    const double radiansToDegrees = 180.0 / M_PI;
+    if (slopeFormat == 1)
+        return (float) (atan(rise) * radiansToDegrees);
+    else
+        return (float) (100*rise);
+}
+
+//Aspect from the east-west and north-south gradient
+static inline float AspectFromGradient(double dx, double dy, bool useAngleAsAzimuth, float dstNoDataValue)
+{
+    const double degreesToRadians = M_PI / 180.0;
+    float aspect;
+
+    aspect = (float) (atan2(dy,-dx) / degreesToRadians);
+
+    if (dx == 0 && dy == 0)
+    {
+        /* Flat area */
+        aspect = dstNoDataValue;
+    }
+    else if ( useAngleAsAzimuth )
+    {
+        if (aspect > 90.0)
+            aspect = 450.0f - aspect;
+        else
+            aspect = 90.0f - aspect;
+    }
+    else
+    {
+        if (aspect < 0)
+            aspect += 360.0;
+    }
+
+    if (aspect == 360.0)
+        aspect = 0.0;
+
+    return aspect;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+  AVX2 row kernels, this file is compiled with AVX2 enabled (see CMakeLists.txt)
+  and is only called when the CPU supports it.
+*/
+
+#include "rowkernels_impl.h"
+
+bool RowKernelsBuiltWithAVX2()
+{
+#ifdef RF_ROWKERNELS_AVX2
+    return true;
+#else
+    return false;
+#endif
+}
+
+int SlopeRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       bool bHorn, double ewres, double nsres, double scale, int slopeFormat)
+{
+#ifdef RF_ROWKERNELS_AVX2
+    return SlopeRowDispatch<RowOpsAVX2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                        bHorn, ewres, nsres, scale, slopeFormat);
+#else
+    return 0;
+#endif
+}
+
+int AspectRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                        float* pafOutput, int nCount, const Row3x3NoData& noData,
+                        bool bHorn, bool useAngleAsAzimuth)
+{
+#ifdef RF_ROWKERNELS_AVX2
+    return AspectRowDispatch<RowOpsAVX2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                         bHorn, useAngleAsAzimuth);
+#else
+    return 0;
+#endif
+}
+
+int CurvatureRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                           float* pafOutput, int nCount, const Row3x3NoData& noData,
+                           int curvatureType, double ewres, double nsres,
+                           double zxxDenom, double zyyDenom, double zxyDenom)
+{
+#ifdef RF_ROWKERNELS_AVX2
+    return CurvatureRowDispatch<RowOpsAVX2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                            curvatureType, ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+#else
+    return 0;
+#endif
+}
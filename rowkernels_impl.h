@@ -0,0 +1,455 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+  Internal to the row kernels - the vector width independent kernel bodies.
+  Included by rowkernels.cpp (SSE2) and rowkernels_avx2.cpp (AVX2), each of which
+  is compiled for its own instruction set, so everything here has internal linkage.
+
+  The arithmetic is done in the same order and precision as the cell kernels
+  (float sums of the window, double for everything after the resolution divide)
+  so the vector and scalar paths give identical results.
+*/
+
+#ifndef RF_ROWKERNELS_IMPL_H
+#define RF_ROWKERNELS_IMPL_H
+
+#include "rowkernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RF_ROWKERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define RF_ROWKERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+//Cells buffered before the scalar (atan/atan2) tails are run
+#define ROWKERNEL_CHUNK 64
+
+//Instruction set specific entry points, the AVX2 ones return 0 if that file was not built for AVX2
+int SlopeRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       bool bHorn, double ewres, double nsres, double scale, int slopeFormat);
+int AspectRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                        float* pafOutput, int nCount, const Row3x3NoData& noData,
+                        bool bHorn, bool useAngleAsAzimuth);
+int CurvatureRowKernelSSE2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                           float* pafOutput, int nCount, const Row3x3NoData& noData,
+                           int curvatureType, double ewres, double nsres,
+                           double zxxDenom, double zyyDenom, double zxyDenom);
+
+bool RowKernelsBuiltWithAVX2();
+int SlopeRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                       float* pafOutput, int nCount, const Row3x3NoData& noData,
+                       bool bHorn, double ewres, double nsres, double scale, int slopeFormat);
+int AspectRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                        float* pafOutput, int nCount, const Row3x3NoData& noData,
+                        bool bHorn, bool useAngleAsAzimuth);
+int CurvatureRowKernelAVX2(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                           float* pafOutput, int nCount, const Row3x3NoData& noData,
+                           int curvatureType, double ewres, double nsres,
+                           double zxxDenom, double zyyDenom, double zxyDenom);
+
+namespace
+{
+
+/***************************************
+VECTOR OPERATIONS
+F is a vector of W floats, D is a vector of W/2 doubles (lo/hi halves of an F)
+***************************************/
+
+#ifdef RF_ROWKERNELS_SSE2
+struct RowOpsSSE2
+{
+    typedef __m128 F;
+    typedef __m128d D;
+    enum { W = 4 };
+
+    static inline F load(const float* p) { return _mm_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm_storeu_ps(p, a); }
+    static inline F set1(float a) { return _mm_set1_ps(a); }
+    static inline F zero() { return _mm_setzero_ps(); }
+    static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static inline F cmpeq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+    static inline F or_(F a, F b) { return _mm_or_ps(a, b); }
+    static inline F and_(F a, F b) { return _mm_and_ps(a, b); }
+    static inline F blend(F a, F b, F mask) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+    static inline int movemask(F a) { return _mm_movemask_ps(a); }
+
+    static inline D lo(F a) { return _mm_cvtps_pd(a); }
+    static inline D hi(F a) { return _mm_cvtps_pd(_mm_movehl_ps(a, a)); }
+    static inline F pack(D a, D b) { return _mm_movelh_ps(_mm_cvtpd_ps(a), _mm_cvtpd_ps(b)); }
+    static inline D tofloat(D a) { return _mm_cvtps_pd(_mm_cvtpd_ps(a)); }
+    static inline void stored(double* p, D a, D b) { _mm_storeu_pd(p, a); _mm_storeu_pd(p + 2, b); }
+    static inline D set1d(double a) { return _mm_set1_pd(a); }
+    static inline D addd(D a, D b) { return _mm_add_pd(a, b); }
+    static inline D subd(D a, D b) { return _mm_sub_pd(a, b); }
+    static inline D muld(D a, D b) { return _mm_mul_pd(a, b); }
+    static inline D divd(D a, D b) { return _mm_div_pd(a, b); }
+    static inline D sqrtd(D a) { return _mm_sqrt_pd(a); }
+    static inline D absd(D a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+};
+#endif
+
+#ifdef RF_ROWKERNELS_AVX2
+struct RowOpsAVX2
+{
+    typedef __m256 F;
+    typedef __m256d D;
+    enum { W = 8 };
+
+    static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static inline F set1(float a) { return _mm256_set1_ps(a); }
+    static inline F zero() { return _mm256_setzero_ps(); }
+    static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static inline F cmpeq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static inline F or_(F a, F b) { return _mm256_or_ps(a, b); }
+    static inline F and_(F a, F b) { return _mm256_and_ps(a, b); }
+    static inline F blend(F a, F b, F mask) { return _mm256_blendv_ps(a, b, mask); }
+    static inline int movemask(F a) { return _mm256_movemask_ps(a); }
+
+    static inline D lo(F a) { return _mm256_cvtps_pd(_mm256_castps256_ps128(a)); }
+    static inline D hi(F a) { return _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)); }
+    static inline F pack(D a, D b) { return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(a)), _mm256_cvtpd_ps(b), 1); }
+    static inline D tofloat(D a) { return _mm256_cvtps_pd(_mm256_cvtpd_ps(a)); }
+    static inline void stored(double* p, D a, D b) { _mm256_storeu_pd(p, a); _mm256_storeu_pd(p + 4, b); }
+    static inline D set1d(double a) { return _mm256_set1_pd(a); }
+    static inline D addd(D a, D b) { return _mm256_add_pd(a, b); }
+    static inline D subd(D a, D b) { return _mm256_sub_pd(a, b); }
+    static inline D muld(D a, D b) { return _mm256_mul_pd(a, b); }
+    static inline D divd(D a, D b) { return _mm256_div_pd(a, b); }
+    static inline D sqrtd(D a) { return _mm256_sqrt_pd(a); }
+    static inline D absd(D a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+};
+#endif
+
+/*
+LoadRowWindow: Loads the 9 window vectors for cells k to k+W-1 and applies the ComputeVal nodata rules
+with masks - nodata neighbours take the centre value (computeEdges) and invalid flags the cells that
+must be set to the destination nodata value
+*/
+template <class V>
+inline void LoadRowWindow(const float* pafLine1, const float* pafLine2, const float* pafLine3, int k,
+                          const Row3x3NoData& noData, typename V::F srcNoDataValue,
+                          typename V::F* w, typename V::F& invalid)
+{
+    typedef typename V::F F;
+
+    w[0] = V::load(pafLine1 + k - 1);
+    w[1] = V::load(pafLine1 + k);
+    w[2] = V::load(pafLine1 + k + 1);
+    w[3] = V::load(pafLine2 + k - 1);
+    w[4] = V::load(pafLine2 + k);
+    w[5] = V::load(pafLine2 + k + 1);
+    w[6] = V::load(pafLine3 + k - 1);
+    w[7] = V::load(pafLine3 + k);
+    w[8] = V::load(pafLine3 + k + 1);
+
+    invalid = V::zero();
+    if (noData.srcNoData)
+    {
+        F centreNoData = V::cmpeq(w[4], srcNoDataValue);
+        F anyNoData = centreNoData;
+        for (int c = 0; c < 9; ++c)
+        {
+            if (c == 4)
+            {
+                continue;
+            }
+            F cellNoData = V::cmpeq(w[c], srcNoDataValue);
+            anyNoData = V::or_(anyNoData, cellNoData);
+            if (noData.computeEdges)
+            {
+                w[c] = V::blend(w[c], w[4], cellNoData);
+            }
+        }
+        invalid = noData.computeEdges ? centreNoData : anyNoData;
+    }
+}
+
+//Unpacks a lane mask to one flag per cell
+template <class V>
+inline void StoreRowMask(unsigned char* pabyMask, typename V::F mask)
+{
+    int bits = V::movemask(mask);
+    for (int l = 0; l < V::W; ++l)
+    {
+        pabyMask[l] = (unsigned char) ((bits >> l) & 1);
+    }
+}
+
+/***************************************
+SLOPE
+***************************************/
+template <class V, bool bHorn>
+int SlopeRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+             float* pafOutput, int nCount, const Row3x3NoData& noData,
+             double ewres, double nsres, double scale, int slopeFormat)
+{
+    typedef typename V::F F;
+    typedef typename V::D D;
+
+    const int nVecCount = (nCount / V::W) * V::W;
+    const F srcNoDataValue = V::set1(noData.srcNoDataValue);
+    const F dstNoDataValue = V::set1(noData.dstNoDataValue);
+    const D vEwres = V::set1d(ewres);
+    const D vNsres = V::set1d(nsres);
+    const D vRun = V::set1d((bHorn ? 8 : 2)*scale);
+    const D vHundred = V::set1d(100);
+
+    double adfRise[ROWKERNEL_CHUNK];
+    unsigned char abyInvalid[ROWKERNEL_CHUNK];
+
+    for (int nChunk = 0; nChunk < nVecCount; nChunk += ROWKERNEL_CHUNK)
+    {
+        int nChunkEnd = (nChunk + ROWKERNEL_CHUNK < nVecCount) ? nChunk + ROWKERNEL_CHUNK : nVecCount;
+
+        for (int k = nChunk; k < nChunkEnd; k += V::W)
+        {
+            F w[9], invalid;
+            LoadRowWindow<V>(pafLine1, pafLine2, pafLine3, k, noData, srcNoDataValue, w, invalid);
+
+            F dx, dy;
+            if (bHorn)
+            {
+                dx = V::sub(V::add(V::add(V::add(w[0], w[3]), w[3]), w[6]),
+                            V::add(V::add(V::add(w[2], w[5]), w[5]), w[8]));
+                dy = V::sub(V::add(V::add(V::add(w[6], w[7]), w[7]), w[8]),
+                            V::add(V::add(V::add(w[0], w[1]), w[1]), w[2]));
+            }
+            else
+            {
+                dx = V::sub(w[3], w[5]);
+                dy = V::sub(w[7], w[1]);
+            }
+
+            D dxLo = V::divd(V::lo(dx), vEwres), dxHi = V::divd(V::hi(dx), vEwres);
+            D dyLo = V::divd(V::lo(dy), vNsres), dyHi = V::divd(V::hi(dy), vNsres);
+            D riseLo = V::divd(V::sqrtd(V::addd(V::muld(dxLo, dxLo), V::muld(dyLo, dyLo))), vRun);
+            D riseHi = V::divd(V::sqrtd(V::addd(V::muld(dxHi, dxHi), V::muld(dyHi, dyHi))), vRun);
+
+            if (slopeFormat == 1)
+            {
+                //Degrees need atan, done below for the chunk
+                V::stored(adfRise + (k - nChunk), riseLo, riseHi);
+                StoreRowMask<V>(abyInvalid + (k - nChunk), invalid);
+            }
+            else
+            {
+                F slope = V::pack(V::muld(vHundred, riseLo), V::muld(vHundred, riseHi));
+                V::store(pafOutput + k, V::blend(slope, dstNoDataValue, invalid));
+            }
+        }
+
+        if (slopeFormat == 1)
+        {
+            for (int k = nChunk; k < nChunkEnd; ++k)
+            {
+                pafOutput[k] = abyInvalid[k - nChunk] ? noData.dstNoDataValue
+                                                      : SlopeFromRise(adfRise[k - nChunk], 1);
+            }
+        }
+    }
+
+    return nVecCount;
+}
+
+/***************************************
+ASPECT
+***************************************/
+template <class V, bool bHorn>
+int AspectRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+              float* pafOutput, int nCount, const Row3x3NoData& noData,
+              bool useAngleAsAzimuth)
+{
+    typedef typename V::F F;
+
+    const int nVecCount = (nCount / V::W) * V::W;
+    const F srcNoDataValue = V::set1(noData.srcNoDataValue);
+
+    float afDx[ROWKERNEL_CHUNK];
+    float afDy[ROWKERNEL_CHUNK];
+    unsigned char abyInvalid[ROWKERNEL_CHUNK];
+
+    for (int nChunk = 0; nChunk < nVecCount; nChunk += ROWKERNEL_CHUNK)
+    {
+        int nChunkEnd = (nChunk + ROWKERNEL_CHUNK < nVecCount) ? nChunk + ROWKERNEL_CHUNK : nVecCount;
+
+        for (int k = nChunk; k < nChunkEnd; k += V::W)
+        {
+            F w[9], invalid;
+            LoadRowWindow<V>(pafLine1, pafLine2, pafLine3, k, noData, srcNoDataValue, w, invalid);
+
+            F dx, dy;
+            if (bHorn)
+            {
+                dx = V::sub(V::add(V::add(V::add(w[2], w[5]), w[5]), w[8]),
+                            V::add(V::add(V::add(w[0], w[3]), w[3]), w[6]));
+                dy = V::sub(V::add(V::add(V::add(w[6], w[7]), w[7]), w[8]),
+                            V::add(V::add(V::add(w[0], w[1]), w[1]), w[2]));
+            }
+            else
+            {
+                dx = V::sub(w[5], w[3]);
+                dy = V::sub(w[7], w[1]);
+            }
+
+            V::store(afDx + (k - nChunk), dx);
+            V::store(afDy + (k - nChunk), dy);
+            StoreRowMask<V>(abyInvalid + (k - nChunk), invalid);
+        }
+
+        //atan2 and the azimuth conversion
+        for (int k = nChunk; k < nChunkEnd; ++k)
+        {
+            pafOutput[k] = abyInvalid[k - nChunk] ? noData.dstNoDataValue
+                                                  : AspectFromGradient(afDx[k - nChunk], afDy[k - nChunk],
+                                                                       useAngleAsAzimuth, noData.dstNoDataValue);
+        }
+    }
+
+    return nVecCount;
+}
+
+/***************************************
+CURVATURE
+eType follows RF::CurvatureType - 0 profile, 1 contour, 2 tangential
+***************************************/
+template <class V, int eType>
+int CurvatureRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                 float* pafOutput, int nCount, const Row3x3NoData& noData,
+                 double ewres, double nsres, double zxxDenom, double zyyDenom, double zxyDenom)
+{
+    typedef typename V::F F;
+    typedef typename V::D D;
+
+    const int nVecCount = (nCount / V::W) * V::W;
+    const F srcNoDataValue = V::set1(noData.srcNoDataValue);
+    const F dstNoDataValue = V::set1(noData.dstNoDataValue);
+    const F fZero = V::zero();
+    const D vZxDenom = V::set1d(6*ewres);
+    const D vZyDenom = V::set1d(6*nsres);
+    const D vZxxDenom = V::set1d(zxxDenom);
+    const D vZyyDenom = V::set1d(zyyDenom);
+    const D vZxyDenom = V::set1d(zxyDenom);
+    const D vOne = V::set1d(1);
+    const D vTwo = V::set1d(2);
+
+    for (int k = 0; k < nVecCount; k += V::W)
+    {
+        F w[9], invalid;
+        LoadRowWindow<V>(pafLine1, pafLine2, pafLine3, k, noData, srcNoDataValue, w, invalid);
+
+        F sx = V::sub(V::sub(V::sub(V::add(V::add(w[2], w[5]), w[8]), w[0]), w[3]), w[6]);
+        F sy = V::sub(V::sub(V::sub(V::add(V::add(w[0], w[1]), w[2]), w[6]), w[7]), w[8]);
+        F sCol = V::add(V::add(w[1], w[4]), w[7]);
+        F sRow = V::add(V::add(w[3], w[4]), w[5]);
+        F sxx = V::sub(V::add(V::add(V::add(V::add(V::add(w[0], w[2]), w[3]), w[5]), w[6]), w[8]), V::add(sCol, sCol));
+        F syy = V::sub(V::add(V::add(V::add(V::add(V::add(w[0], w[1]), w[2]), w[6]), w[7]), w[8]), V::add(sRow, sRow));
+        F sxy = V::sub(V::sub(V::add(w[2], w[6]), w[0]), w[8]);
+
+        //Flat area, zx and zy are both 0
+        F flat = V::and_(V::cmpeq(sx, fZero), V::cmpeq(sy, fZero));
+
+        D result[2];
+        for (int h = 0; h < 2; ++h)
+        {
+            D zx = V::divd(h ? V::hi(sx) : V::lo(sx), vZxDenom);
+            D zy = V::divd(h ? V::hi(sy) : V::lo(sy), vZyDenom);
+            D zxx = V::divd(h ? V::hi(sxx) : V::lo(sxx), vZxxDenom);
+            D zyy = V::divd(h ? V::hi(syy) : V::lo(syy), vZyyDenom);
+            D zxy = V::divd(h ? V::hi(sxy) : V::lo(sxy), vZxyDenom);
+            D z2x = V::muld(zx, zx);
+            D z2y = V::muld(zy, zy);
+            D cross = V::muld(V::muld(V::muld(vTwo, zxy), zx), zy);
+
+            if (eType == 0)
+            {
+                D num = V::tofloat(V::addd(V::addd(V::muld(zxx, z2x), cross), V::muld(zyy, z2y)));
+                D root = V::sqrtd(V::absd(V::addd(V::addd(vOne, z2x), z2y)));
+                result[h] = V::divd(num, V::muld(V::addd(z2x, z2y), V::muld(V::muld(root, root), root)));
+            }
+            else if (eType == 1)
+            {
+                D num = V::tofloat(V::addd(V::subd(V::muld(zxx, z2x), cross), V::muld(zyy, z2y)));
+                D root = V::sqrtd(V::absd(V::addd(z2x, z2y)));
+                result[h] = V::divd(num, V::muld(V::muld(root, root), root));
+            }
+            else
+            {
+                D num = V::tofloat(V::addd(V::subd(V::muld(zxx, z2x), cross), V::muld(zyy, z2y)));
+                D root = V::sqrtd(V::absd(V::addd(V::addd(vOne, z2x), z2y)));
+                result[h] = V::divd(num, V::addd(V::addd(z2x, z2y), root));
+            }
+        }
+
+        F curvature = V::pack(result[0], result[1]);
+        V::store(pafOutput + k, V::blend(curvature, dstNoDataValue, V::or_(invalid, flat)));
+    }
+
+    return nVecCount;
+}
+
+/***************************************
+ENTRY POINTS
+***************************************/
+template <class V>
+int SlopeRowDispatch(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                     float* pafOutput, int nCount, const Row3x3NoData& noData,
+                     bool bHorn, double ewres, double nsres, double scale, int slopeFormat)
+{
+    if (bHorn)
+    {
+        return SlopeRow<V, true>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                 ewres, nsres, scale, slopeFormat);
+    }
+    return SlopeRow<V, false>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                              ewres, nsres, scale, slopeFormat);
+}
+
+template <class V>
+int AspectRowDispatch(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                      float* pafOutput, int nCount, const Row3x3NoData& noData,
+                      bool bHorn, bool useAngleAsAzimuth)
+{
+    if (bHorn)
+    {
+        return AspectRow<V, true>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData, useAngleAsAzimuth);
+    }
+    return AspectRow<V, false>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData, useAngleAsAzimuth);
+}
+
+template <class V>
+int CurvatureRowDispatch(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                         float* pafOutput, int nCount, const Row3x3NoData& noData,
+                         int curvatureType, double ewres, double nsres,
+                         double zxxDenom, double zyyDenom, double zxyDenom)
+{
+    if (curvatureType == 0)
+    {
+        return CurvatureRow<V, 0>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                  ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+    }
+    else if (curvatureType == 1)
+    {
+        return CurvatureRow<V, 1>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                  ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+    }
+    return CurvatureRow<V, 2>(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                              ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+}
+
+}
+
+#endif
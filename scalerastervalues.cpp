@@ -21,11 +21,28 @@
 #include "Workspace/DataExecution/Operations/typedoperationfactory.h"
 
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "scalerastervalues.h"
 
 
 namespace RF
 {
+    //Band times a scaling factor
+    struct ScaleRasterValuesKernel
+    {
+        double scalingFactor;
+
+        ScaleRasterValuesKernel(double factor) : scalingFactor(factor) {}
+
+        inline void operator()(const float* const* papafSrc, float* pafDst, int nCount) const
+        {
+            for (int it = 0; it < nCount; ++it)
+            {
+                pafDst[it] = papafSrc[0][it]*scalingFactor;
+            }
+        }
+    };
+
     /**
      * \internal
      */
@@ -97,30 +114,13 @@ namespace RF
             
         GDALRasterBandH hBand = GDALGetRasterBand(inputDataset, 1);
 
-        float *data;
-        data = new float[GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand)];
-
-        GDALRasterIO( hBand, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            data,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            GDT_Float32,
-            0,0);
-        
         int srcNoData;
         float srcNoDataValue;
 
         srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
         std::cout << QString("Band nodata value is %1").arg(srcNoDataValue) + "\n";
-        
-        for (int it = 0; it < GDALGetRasterBandYSize(hBand)*GDALGetRasterBandXSize(hBand); ++it)
-        {
-            
-            data[it] = data[it]*scalingFactor;            
-        }
 
-                outputDataset = GDALCreate( GDALGetDatasetDriver(inputDataset),
+        outputDataset = GDALCreate( GDALGetDatasetDriver(inputDataset),
                                 outputDatasetName.toLocal8Bit().constData(),
                                 GDALGetRasterXSize(inputDataset), GDALGetRasterYSize(inputDataset),
                                 1,
@@ -133,15 +133,12 @@ namespace RF
         GDALSetProjection(outputDataset, GDALGetProjectionRef(inputDataset));
         GDALSetRasterNoDataValue(destBand, srcNoDataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        data,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        GDT_Float32,
-                        0,0);
+        if (GDALPixelwiseProcessing(1, &hBand, destBand, ScaleRasterValuesKernel(scalingFactor)) != CE_None)
+        {
+            std::cout << QString("ERROR: Could not scale raster values") + "\n";
+            return false;
+        }
 
-       
         return true;
     }
 
@@ -137,16 +137,6 @@ namespace RF
 
         pData = GDALCreateSlopeData(transform, *dataScale_, slopeFormat);
 
-        GDALGeneric3x3ProcessingAlg pfnAlg = NULL;
-
-        if (slopeAlg == RF::SlopeAlgType::THORNE)
-        {
-            pfnAlg = GDALSlopeHornAlg;
-        }
-        else if (slopeAlg == RF::SlopeAlgType::ZEVTHORNE)
-        {
-            pfnAlg = GDALSlopeZevenbergenThorneAlg;
-        }
 
 
         slopeRaster = GDALCreate ( GDALGetDatasetDriver(gDALDataset),
@@ -162,7 +152,16 @@ namespace RF
 
         GDALSetRasterNoDataValue(destBand, dstNoDataValue);
 
-        GDALGeneric3x3Processing(hBand, destBand, pfnAlg, pData, computeEdges);
+        GDALSlopeAlgData& slopeData = *(GDALSlopeAlgData*)pData;
+        if (slopeAlg == RF::SlopeAlgType::THORNE)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALSlopeHornKernel(slopeData), computeEdges);
+        }
+        else if (slopeAlg == RF::SlopeAlgType::ZEVTHORNE)
+        {
+            GDALGeneric3x3KernelProcessing(hBand, destBand, GDALSlopeZevenbergenThorneKernel(slopeData), computeEdges);
+        }
+        CPLFree(pData);
 
                                     
 
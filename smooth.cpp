@@ -10,6 +10,7 @@
 */
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include <qstring.h>
 
@@ -24,6 +25,7 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "volcanoplugin.h"
+#include "volcanoutils.h"
 #include "smooth.h"
 
 
@@ -45,6 +47,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< QString >       dataOutputDatasetFilename_;
         CSIRO::DataExecution::TypedObject< double >        dataKernelSize_;
         CSIRO::DataExecution::TypedObject< double >        dataSigma_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataOutputDataset_;
 
 
@@ -53,6 +56,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputOutputDatasetFilename_;
         CSIRO::DataExecution::InputScalar inputKernelSize_;
         CSIRO::DataExecution::InputScalar inputSigma_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputOutputDataset_;
 
 
@@ -72,17 +76,20 @@ namespace RF
         dataOutputDatasetFilename_(),
         dataKernelSize_(),
         dataSigma_(),
+        dataNumThreads_(0),
         dataOutputDataset_(),
         inputInputDataset_("Input dataset", dataInputDataset_, op_),
         inputOutputDatasetFilename_("Output dataset filename", dataOutputDatasetFilename_, op_),
         inputKernelSize_("Kernel Size", dataKernelSize_, op_),
         inputSigma_("Sigma", dataSigma_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputOutputDataset_("Output dataset", dataOutputDataset_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
         // large data structure as input, you may wish to remove this call and replace it
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
+        inputNumThreads_.setDescription(tr("Tiles are smoothed in parallel (0 uses all cores)"));
 
         // Recommend setting a description of the operation and each input / output here:
         // op_.setDescription(tr("My operation does this, that and this other thing."));
@@ -104,27 +111,25 @@ namespace RF
         
         GDALRasterBandH hBand = GDALGetRasterBand(inputDataset, 1);
 
-        float *data;
-        data = new float[GDALGetRasterBandXSize(hBand)*GDALGetRasterBandYSize(hBand)];
+        int kSize = (int) kernelSize;
+        if (kSize <= 0 || !(kSize & 1))
+        {
+            std::cout << QString("ERROR: Kernel size must be a positive odd number, is %1").arg(kernelSize) + "\n";
+            return false;
+        }
+
+        //Separable gaussian weights, OpenCV works sigma out from the kernel size if it is not positive
+        cv::Mat gaussian = cv::getGaussianKernel(kSize, sigma, CV_32F);
+        std::vector<float> weights(kSize);
+        for (int k = 0; k < kSize; ++k)
+        {
+            weights[k] = gaussian.at<float>(k);
+        }
 
-        GDALRasterIO( hBand, GF_Read,
-            0,0,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            data,
-            GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-            GDT_Float32,
-            0,0);
-        
         int srcNoData;
         float srcNoDataValue;
 
         srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
-        
-        //Convert float array to an openCV mat (assuming rows = Y)
-        cv::Mat dataToMat(GDALGetRasterBandYSize(hBand),GDALGetRasterBandXSize(hBand), CV_32F, data);
-        cv::Mat blurredData = dataToMat.clone();
-
-        cv::GaussianBlur(dataToMat, blurredData, cv::Size(kernelSize, kernelSize), sigma);
 
         outputDataset = GDALCreate( GDALGetDatasetDriver(inputDataset),
                                 outputDatasetFilename.toLocal8Bit().constData(),
@@ -139,13 +144,15 @@ namespace RF
         GDALSetProjection(outputDataset, GDALGetProjectionRef(inputDataset));
         GDALSetRasterNoDataValue(destBand, srcNoDataValue);
 
-        GDALRasterIO(destBand, GF_Write,
-                        0,0,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        blurredData.data,
-                        GDALGetRasterBandXSize(hBand), GDALGetRasterBandYSize(hBand),
-                        GDT_Float32,
-                        0,0);
+        //Streamed in tiles, no data cells are left out of their neighbours' averages
+        CPLErr eErr = GDALNormalisedConvolution(hBand, destBand, &weights[0], &weights[0], kSize,
+                                                srcNoDataValue, *dataNumThreads_);
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not smooth dataset") + "\n";
+            return false;
+        }
+
         return true;
     }
 
@@ -0,0 +1,413 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include <qstring.h>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+
+#include "volcanoplugin.h"
+#include "volcanoutils.h"
+#include "terrainderivatives.h"
+
+
+namespace RF
+{
+    //Derivatives the operation can produce, in output band order
+    enum TerrainProduct
+    {
+        TERRAIN_SLOPE,
+        TERRAIN_ASPECT,
+        TERRAIN_PROFILE,
+        TERRAIN_PLANFORM,
+        TERRAIN_TANGENTIAL,
+        TERRAIN_PRODUCTS
+    };
+
+    static const char* terrainProductNames[TERRAIN_PRODUCTS] = {"Slope", "Aspect", "Profile curvature",
+                                                                "Planform curvature", "Tangential curvature"};
+    static const char* terrainProductSuffixes[TERRAIN_PRODUCTS] = {"_slope", "_aspect", "_profile",
+                                                                   "_planform", "_tangential"};
+
+    /**
+     * \internal
+     * Runs the kernel for each requested derivative on a tile read once by GDALGeneric3x3MultiProcessing
+     */
+    struct TerrainDerivativesTileFn
+    {
+        std::vector<int> products;
+        bool horn;
+        GDALSlopeHornKernel slopeHorn;
+        GDALSlopeZevenbergenThorneKernel slopeZT;
+        GDALAspectKernel aspectHorn;
+        GDALAspectZevenbergenThorneKernel aspectZT;
+        GDALCurvatureProfileKernel profile;
+        GDALCurvatureContourKernel planform;
+        GDALCurvatureTangentKernel tangential;
+
+        TerrainDerivativesTileFn(const std::vector<int>& p, bool h,
+                                 const GDALSlopeAlgData& slopeData,
+                                 const GDALAspectAlgData& aspectData,
+                                 const GDALCurvatureAlgData& curvatureData) :
+            products(p),
+            horn(h),
+            slopeHorn(slopeData),
+            slopeZT(slopeData),
+            aspectHorn(aspectData),
+            aspectZT(aspectData),
+            profile(curvatureData),
+            planform(curvatureData),
+            tangential(curvatureData)
+        {}
+
+        void operator()(int iBand, const GDALGeneric3x3Tile& tile, float dstNoDataValue, float* pafOutput) const
+        {
+            switch (products[iBand])
+            {
+            case TERRAIN_SLOPE:
+                if (horn)
+                    Run3x3KernelOnTile(tile, slopeHorn, dstNoDataValue, pafOutput);
+                else
+                    Run3x3KernelOnTile(tile, slopeZT, dstNoDataValue, pafOutput);
+                break;
+            case TERRAIN_ASPECT:
+                if (horn)
+                    Run3x3KernelOnTile(tile, aspectHorn, dstNoDataValue, pafOutput);
+                else
+                    Run3x3KernelOnTile(tile, aspectZT, dstNoDataValue, pafOutput);
+                break;
+            case TERRAIN_PROFILE:
+                Run3x3KernelOnTile(tile, profile, dstNoDataValue, pafOutput);
+                break;
+            case TERRAIN_PLANFORM:
+                Run3x3KernelOnTile(tile, planform, dstNoDataValue, pafOutput);
+                break;
+            case TERRAIN_TANGENTIAL:
+                Run3x3KernelOnTile(tile, tangential, dstNoDataValue, pafOutput);
+                break;
+            }
+        }
+    };
+
+    /**
+     * \internal
+     */
+    class TerrainDerivativesImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::TerrainDerivativesImpl)
+
+    public:
+        TerrainDerivatives&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataGDALDataset_;
+        CSIRO::DataExecution::TypedObject< int >              dataRasterBand_;
+        CSIRO::DataExecution::TypedObject< RF::SlopeAlgType > dataSlopeAlgorithim_;
+        CSIRO::DataExecution::TypedObject< double >           dataScale_;
+        CSIRO::DataExecution::TypedObject< bool >             dataComputeEdges_;
+        CSIRO::DataExecution::TypedObject< bool >             dataPercentSlope_;
+        CSIRO::DataExecution::TypedObject< bool >             dataUseAngeAsAzimuth_;
+        CSIRO::DataExecution::TypedObject< bool >             dataSetFlatAresToNODATA_;
+        CSIRO::DataExecution::TypedObject< bool >             dataCalcSlope_;
+        CSIRO::DataExecution::TypedObject< bool >             dataCalcAspect_;
+        CSIRO::DataExecution::TypedObject< bool >             dataCalcProfile_;
+        CSIRO::DataExecution::TypedObject< bool >             dataCalcPlanform_;
+        CSIRO::DataExecution::TypedObject< bool >             dataCalcTangential_;
+        CSIRO::DataExecution::TypedObject< bool >             dataSingleDataset_;
+        CSIRO::DataExecution::TypedObject< QString >          dataOutputRasterFilename_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataDerivativesRaster_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataSlopeRaster_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataAspectRaster_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataProfileRaster_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataPlanformRaster_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >     dataTangentialRaster_;
+
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputGDALDataset_;
+        CSIRO::DataExecution::InputScalar inputRasterBand_;
+        CSIRO::DataExecution::InputScalar inputSlopeAlgorithim_;
+        CSIRO::DataExecution::InputScalar inputScale_;
+        CSIRO::DataExecution::InputScalar inputComputeEdges_;
+        CSIRO::DataExecution::InputScalar inputPercentSlope_;
+        CSIRO::DataExecution::InputScalar inputUseAngeAsAzimuth_;
+        CSIRO::DataExecution::InputScalar inputSetFlatAresToNODATA_;
+        CSIRO::DataExecution::InputScalar inputCalcSlope_;
+        CSIRO::DataExecution::InputScalar inputCalcAspect_;
+        CSIRO::DataExecution::InputScalar inputCalcProfile_;
+        CSIRO::DataExecution::InputScalar inputCalcPlanform_;
+        CSIRO::DataExecution::InputScalar inputCalcTangential_;
+        CSIRO::DataExecution::InputScalar inputSingleDataset_;
+        CSIRO::DataExecution::InputScalar inputOutputRasterFilename_;
+        CSIRO::DataExecution::Output      outputDerivativesRaster_;
+        CSIRO::DataExecution::Output      outputSlopeRaster_;
+        CSIRO::DataExecution::Output      outputAspectRaster_;
+        CSIRO::DataExecution::Output      outputProfileRaster_;
+        CSIRO::DataExecution::Output      outputPlanformRaster_;
+        CSIRO::DataExecution::Output      outputTangentialRaster_;
+
+
+        TerrainDerivativesImpl(TerrainDerivatives& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    TerrainDerivativesImpl::TerrainDerivativesImpl(TerrainDerivatives& op) :
+        op_(op),
+        dataGDALDataset_(),
+        dataRasterBand_(1),
+        dataSlopeAlgorithim_(RF::SlopeAlgType::THORNE),
+        dataScale_(1),
+        dataComputeEdges_(1),
+        dataPercentSlope_(0),
+        dataUseAngeAsAzimuth_(TRUE),
+        dataSetFlatAresToNODATA_(TRUE),
+        dataCalcSlope_(TRUE),
+        dataCalcAspect_(TRUE),
+        dataCalcProfile_(TRUE),
+        dataCalcPlanform_(TRUE),
+        dataCalcTangential_(TRUE),
+        dataSingleDataset_(TRUE),
+        dataOutputRasterFilename_(),
+        dataDerivativesRaster_(),
+        dataSlopeRaster_(),
+        dataAspectRaster_(),
+        dataProfileRaster_(),
+        dataPlanformRaster_(),
+        dataTangentialRaster_(),
+        inputGDALDataset_("GDAL Dataset", dataGDALDataset_, op_),
+        inputRasterBand_("Raster Band", dataRasterBand_, op_),
+        inputSlopeAlgorithim_("Slope Algorithim", dataSlopeAlgorithim_, op_),
+        inputScale_("Scale", dataScale_, op_),
+        inputComputeEdges_("Compute edges", dataComputeEdges_, op_),
+        inputPercentSlope_("Return slope as a percentage", dataPercentSlope_, op_),
+        inputUseAngeAsAzimuth_("Use angle as azimuth", dataUseAngeAsAzimuth_, op_),
+        inputSetFlatAresToNODATA_("Set flat ares to NODATA", dataSetFlatAresToNODATA_, op_),
+        inputCalcSlope_("Calculate slope", dataCalcSlope_, op_),
+        inputCalcAspect_("Calculate aspect", dataCalcAspect_, op_),
+        inputCalcProfile_("Calculate profile curvature", dataCalcProfile_, op_),
+        inputCalcPlanform_("Calculate planform curvature", dataCalcPlanform_, op_),
+        inputCalcTangential_("Calculate tangential curvature", dataCalcTangential_, op_),
+        inputSingleDataset_("Write as bands of one dataset", dataSingleDataset_, op_),
+        inputOutputRasterFilename_("Output raster filename", dataOutputRasterFilename_, op_),
+        outputDerivativesRaster_("Terrain derivatives raster", dataDerivativesRaster_, op_),
+        outputSlopeRaster_("Slope raster", dataSlopeRaster_, op_),
+        outputAspectRaster_("Aspect raster", dataAspectRaster_, op_),
+        outputProfileRaster_("Profile curvature raster", dataProfileRaster_, op_),
+        outputPlanformRaster_("Planform curvature raster", dataPlanformRaster_, op_),
+        outputTangentialRaster_("Tangential curvature raster", dataTangentialRaster_, op_)
+    {
+        inputScale_.setDescription("Scale is the ratio of vertical units to horizontal, for Feet:Latlong use scale=370400, for Meters:LatLong use scale=111120");
+        inputSingleDataset_.setDescription("Write the derivatives as bands of one dataset (in the order slope, aspect, profile, planform, tangential), otherwise each is written to its own dataset with a _slope, _aspect, etc. suffix on the filename");
+    }
+
+
+    /**
+     *
+     */
+    bool TerrainDerivativesImpl::execute()
+    {
+        GDALDatasetH&     gDALDataset  = *dataGDALDataset_;
+        int&              rasterBand   = *dataRasterBand_;
+        RF::SlopeAlgType& slopeAlg     = *dataSlopeAlgorithim_;
+        bool&             computeEdges = *dataComputeEdges_;
+        QString&          dstFilename  = *dataOutputRasterFilename_;
+
+        GDALDatasetH* productRasters[TERRAIN_PRODUCTS] = {&(*dataSlopeRaster_), &(*dataAspectRaster_),
+                                                          &(*dataProfileRaster_), &(*dataPlanformRaster_),
+                                                          &(*dataTangentialRaster_)};
+        bool calcProduct[TERRAIN_PRODUCTS] = {*dataCalcSlope_, *dataCalcAspect_, *dataCalcProfile_,
+                                              *dataCalcPlanform_, *dataCalcTangential_};
+
+        //Get raster input band and transform
+        GDALAllRegister();
+
+        GDALRasterBandH hBand;
+        if(rasterBand > GDALGetRasterCount(gDALDataset))
+        {
+            std::cout << QString("ERROR: Not enough raster bands, number of bands is %1, band selected is %2").arg(GDALGetRasterCount(gDALDataset)).arg(rasterBand) + "\n";
+            return false;
+        }
+        hBand = GDALGetRasterBand(gDALDataset, rasterBand);
+
+        double transform[6];
+        GDALGetGeoTransform(gDALDataset,transform);
+
+        std::vector<int> products;
+        for (int p = 0; p < TERRAIN_PRODUCTS; ++p)
+        {
+            *productRasters[p] = NULL;
+            if (calcProduct[p])
+            {
+                products.push_back(p);
+            }
+        }
+        *dataDerivativesRaster_ = NULL;
+
+        if (products.empty())
+        {
+            std::cout << QString("ERROR: No terrain derivatives selected") + "\n";
+            return false;
+        }
+
+        //Setup - nodata follows SlopeCalc, AspectCalc and CalcCurvature
+        int srcNoData;
+        float srcNoDataValue = (float) GDALGetRasterNoDataValue(hBand, &srcNoData);
+        float aspectNoDataValue = *dataSetFlatAresToNODATA_ ? srcNoDataValue : 0.0f;
+
+        int slopeFormat = 1;
+        if (*dataPercentSlope_)
+        {
+            slopeFormat = 0;
+        }
+
+        void* pSlopeData = GDALCreateSlopeData(transform, *dataScale_, slopeFormat);
+        void* pAspectData = GDALCreateAspectData(*dataUseAngeAsAzimuth_);
+        void* pCurvatureData = GDALCreateCurvatureData(transform);
+
+        int nXSize = GDALGetRasterXSize(gDALDataset);
+        int nYSize = GDALGetRasterYSize(gDALDataset);
+        GDALDriverH hDriver = GDALGetDatasetDriver(gDALDataset);
+
+        std::vector<GDALRasterBandH> dstBands;
+        if (*dataSingleDataset_)
+        {
+            GDALDatasetH& derivativesRaster = *dataDerivativesRaster_;
+            derivativesRaster = GDALCreate(hDriver,
+                                           dstFilename.toLocal8Bit().constData(),
+                                           nXSize, nYSize,
+                                           (int) products.size(),
+                                           GDT_Float32, NULL);
+            if (derivativesRaster == NULL)
+            {
+                std::cout << QString("ERROR: Cannot create GDAL dataset %1").arg(dstFilename) + "\n";
+                CPLFree(pSlopeData);
+                CPLFree(pAspectData);
+                CPLFree(pCurvatureData);
+                return false;
+            }
+            GDALSetGeoTransform(derivativesRaster, transform);
+            GDALSetProjection(derivativesRaster, GDALGetProjectionRef(gDALDataset));
+
+            for (size_t b = 0; b < products.size(); ++b)
+            {
+                dstBands.push_back(GDALGetRasterBand(derivativesRaster, (int) b + 1));
+            }
+        }
+        else
+        {
+            //Separate datasets, named with a suffix before the extension
+            int nDot = dstFilename.lastIndexOf('.');
+            if (nDot <= dstFilename.lastIndexOf('/') || nDot <= dstFilename.lastIndexOf('\\'))
+            {
+                nDot = dstFilename.length();
+            }
+
+            for (size_t b = 0; b < products.size(); ++b)
+            {
+                QString productFilename = dstFilename;
+                if (!dstFilename.isEmpty())
+                {
+                    productFilename.insert(nDot, terrainProductSuffixes[products[b]]);
+                }
+
+                GDALDatasetH& productRaster = *productRasters[products[b]];
+                productRaster = GDALCreate(hDriver,
+                                           productFilename.toLocal8Bit().constData(),
+                                           nXSize, nYSize,
+                                           1,
+                                           GDT_Float32, NULL);
+                if (productRaster == NULL)
+                {
+                    std::cout << QString("ERROR: Cannot create GDAL dataset %1").arg(productFilename) + "\n";
+                    CPLFree(pSlopeData);
+                    CPLFree(pAspectData);
+                    CPLFree(pCurvatureData);
+                    return false;
+                }
+                GDALSetGeoTransform(productRaster, transform);
+                GDALSetProjection(productRaster, GDALGetProjectionRef(gDALDataset));
+
+                dstBands.push_back(GDALGetRasterBand(productRaster, 1));
+            }
+        }
+
+        for (size_t b = 0; b < products.size(); ++b)
+        {
+            GDALSetDescription(dstBands[b], terrainProductNames[products[b]]);
+            GDALSetRasterNoDataValue(dstBands[b], products[b] == TERRAIN_ASPECT ? aspectNoDataValue : srcNoDataValue);
+        }
+
+        TerrainDerivativesTileFn tileFn(products, slopeAlg == RF::SlopeAlgType::THORNE,
+                                        *(GDALSlopeAlgData*)pSlopeData,
+                                        *(GDALAspectAlgData*)pAspectData,
+                                        *(GDALCurvatureAlgData*)pCurvatureData);
+
+        CPLErr eErr = GDALGeneric3x3MultiProcessing(hBand, (int) dstBands.size(), &dstBands[0], tileFn, computeEdges);
+
+        CPLFree(pSlopeData);
+        CPLFree(pAspectData);
+        CPLFree(pCurvatureData);
+
+        return eErr == CE_None;
+    }
+
+
+    /**
+     *
+     */
+    TerrainDerivatives::TerrainDerivatives() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< TerrainDerivatives >::getInstance(),
+            tr("Calculate Terrain Derivatives"))
+    {
+        pImpl_ = new TerrainDerivativesImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    TerrainDerivatives::~TerrainDerivatives()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  TerrainDerivatives::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(TerrainDerivatives,
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
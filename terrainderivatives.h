@@ -0,0 +1,56 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+  
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_TERRAINDERIVATIVES_H
+#define RF_TERRAINDERIVATIVES_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class TerrainDerivativesImpl;
+
+    /**
+     * \brief Calculates slope, aspect and curvature from one read of a DEM.
+     *
+     */
+    class RF_API TerrainDerivatives : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::TerrainDerivatives)
+
+        TerrainDerivativesImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        TerrainDerivatives(const TerrainDerivatives&);
+        TerrainDerivatives& operator=(const TerrainDerivatives&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        TerrainDerivatives();
+        virtual ~TerrainDerivatives();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::TerrainDerivatives, RF_API)
+
+#endif
+
@@ -0,0 +1,212 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include "Workspace/Application/LanguageUtils/streamqstring.h"
+#include "Workspace/DataExecution/DataObjects/typedobject.h"
+#include "Workspace/DataExecution/InputOutput/inputscalar.h"
+#include "Workspace/DataExecution/InputOutput/inputarray.h"
+#include "Workspace/DataExecution/InputOutput/output.h"
+#include "Workspace/DataExecution/Operations/typedoperationfactory.h"
+
+#include "volcanoplugin.h"
+#include "totalupstreamproperties.h"
+#include "erosionutils.h"
+
+namespace RF
+{
+    /**
+     * \internal
+     */
+    class TotalUpstreamPropertiesImpl
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::TotalUpstreamPropertiesImpl)
+
+    public:
+        TotalUpstreamProperties&  op_;
+
+        // Data objects
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataFlowDirectionDataset_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataPropertyDatasets_;
+        CSIRO::DataExecution::TypedObject< bool >          dataMultiplyByArea_;
+        CSIRO::DataExecution::TypedObject< QString >       dataOutputRasterName_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
+        CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataUpstreamProperties_;
+
+
+        // Inputs and outputs
+        CSIRO::DataExecution::InputScalar inputFlowDirectionDataset_;
+        CSIRO::DataExecution::InputArray  inputPropertyDatasets_;
+        CSIRO::DataExecution::InputScalar inputMultiplyByArea_;
+        CSIRO::DataExecution::InputScalar inputOutputRasterName_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
+        CSIRO::DataExecution::Output      outputUpstreamProperties_;
+
+
+        TotalUpstreamPropertiesImpl(TotalUpstreamProperties& op);
+
+        bool  execute();
+        void  logText(const QString& msg)   { op_.logText(msg); }
+    };
+
+
+    /**
+     *
+     */
+    TotalUpstreamPropertiesImpl::TotalUpstreamPropertiesImpl(TotalUpstreamProperties& op) :
+        op_(op),
+        dataFlowDirectionDataset_(),
+        dataPropertyDatasets_(),
+        dataMultiplyByArea_(false),
+        dataOutputRasterName_(),
+        dataNumThreads_(1),
+        dataUpstreamProperties_(),
+        inputFlowDirectionDataset_("Flow direction dataset", dataFlowDirectionDataset_, op_),
+        inputPropertyDatasets_("Property datasets", dataPropertyDatasets_, op_),
+        inputMultiplyByArea_("Multiply by cell area", dataMultiplyByArea_, op_),
+        inputOutputRasterName_("Output Raster Name", dataOutputRasterName_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
+        outputUpstreamProperties_("Upstream properties", dataUpstreamProperties_, op_)
+    {
+        inputPropertyDatasets_.setDescription(tr("Every band of every dataset is accumulated, in order, to a band of the output"));
+        inputMultiplyByArea_.setDescription(tr("Accumulate cell area x value (positive values only), as for failure volume"));
+        inputNumThreads_.setDescription(tr("1 accumulates serially, otherwise each drainage basin runs on its own thread (0 uses all cores)"));
+    }
+
+
+    /**
+     *
+     */
+    bool TotalUpstreamPropertiesImpl::execute()
+    {
+        GDALDatasetH& flowDirectionDataset = *dataFlowDirectionDataset_;
+        bool&         multiplyByArea       = *dataMultiplyByArea_;
+        QString&      outputRasterName     = *dataOutputRasterName_;
+        GDALDatasetH& upstreamProperties   = *dataUpstreamProperties_;
+
+        GDALRasterBandH fBand = GDALGetRasterBand(flowDirectionDataset, 1);
+
+        double transformf[6];
+        GDALGetGeoTransform(flowDirectionDataset, transformf);
+
+        int xSize = GDALGetRasterBandXSize(fBand);
+        int ySize = GDALGetRasterBandYSize(fBand);
+
+        //Every band of every property dataset
+        std::vector<GDALRasterBandH> propertyBands;
+        for (int rasters = 0; rasters < (int) inputPropertyDatasets_.size(); ++rasters)
+        {
+            GDALDatasetH propertyDataset = inputPropertyDatasets_.getInput(rasters).getDataObject().getRawData<GDALDatasetH>();
+
+            if (GDALGetRasterXSize(propertyDataset) != xSize || GDALGetRasterYSize(propertyDataset) != ySize)
+            {
+                std::cout << QString("ERROR: Property dataset %1 is %2 x %3 cells, flow direction is %4 x %5").arg(rasters)
+                    .arg(GDALGetRasterXSize(propertyDataset)).arg(GDALGetRasterYSize(propertyDataset)).arg(xSize).arg(ySize) + "\n";
+                return false;
+            }
+
+            double transformd[6];
+            GDALGetGeoTransform(propertyDataset, transformd);
+            for (int i = 0; i < 6; ++i)
+            {
+                if (transformf[i] != transformd[i])
+                {
+                    std::cout << QString("ERROR: Transforms are not equal between rasters. Index %1 is %2 for flow direction but %3 for property dataset %4").arg(i).arg(transformf[i]).arg(transformd[i]).arg(rasters) + "\n";
+                }
+            }
+
+            for (int band = 1; band <= GDALGetRasterCount(propertyDataset); ++band)
+            {
+                propertyBands.push_back(GDALGetRasterBand(propertyDataset, band));
+            }
+        }
+
+        if (propertyBands.empty())
+        {
+            std::cout << QString("ERROR: No property bands to accumulate") + "\n";
+            return false;
+        }
+
+        //Setup
+        float srcNodataValue;
+        int srcNoData;
+
+        srcNodataValue = (float)GDALGetRasterNoDataValue(fBand, &srcNoData);
+        float dstNoDataValue = srcNodataValue;
+
+        int nBands = (int) propertyBands.size();
+        upstreamProperties = GDALCreate( GDALGetDatasetDriver(flowDirectionDataset),
+                                    outputRasterName.toLocal8Bit().constData(),
+                                    GDALGetRasterXSize(flowDirectionDataset),
+                                    GDALGetRasterYSize(flowDirectionDataset),
+                                    nBands,
+                                    GDT_Float32, NULL);
+        GDALSetGeoTransform(upstreamProperties, transformf);
+        GDALSetProjection(upstreamProperties, GDALGetProjectionRef(flowDirectionDataset));
+
+        std::vector<GDALRasterBandH> algBands(nBands);
+        for (int band = 0; band < nBands; ++band)
+        {
+            algBands[band] = GDALGetRasterBand(upstreamProperties, band + 1);
+            GDALSetRasterNoDataValue(algBands[band], dstNoDataValue);
+        }
+
+        CPLErr eErr = UpstreamAccumulationMultiProcessor(fBand, nBands, &propertyBands[0], &algBands[0], transformf,
+                                                         multiplyByArea ? UPSTREAM_FAILURE_VOLUME : UPSTREAM_PROPERTY,
+                                                         *dataNumThreads_);
+        if (eErr != CE_None)
+        {
+            std::cout << QString("ERROR: Could not write upstream properties") + "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     *
+     */
+    TotalUpstreamProperties::TotalUpstreamProperties() :
+        CSIRO::DataExecution::Operation(
+            CSIRO::DataExecution::OperationFactoryTraits< TotalUpstreamProperties >::getInstance(),
+            tr("Calculate sum of upstream values for many properties"))
+    {
+        pImpl_ = new TotalUpstreamPropertiesImpl(*this);
+    }
+
+
+    /**
+     *
+     */
+    TotalUpstreamProperties::~TotalUpstreamProperties()
+    {
+        delete pImpl_;
+    }
+
+
+    /**
+     *
+     */
+    bool  TotalUpstreamProperties::execute()
+    {
+        return pImpl_->execute();
+    }
+}
+
+
+using namespace RF;
+DEFINE_WORKSPACE_OPERATION_FACTORY(TotalUpstreamProperties,
+                                   RF::VolcanoPlugin::getInstance(),
+                                   CSIRO::DataExecution::Operation::tr("Geospatial"))
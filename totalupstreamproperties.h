@@ -0,0 +1,56 @@
+/*
+  Created by: Stuart Mead
+  Creation date: 2014-02-03
+  
+  Released under BSD 3 clause.
+  Use it however you want, but I cannot guarantee it is right.
+  Also don't use my name, the name of collaborators and my/their affiliations
+  as endorsement.
+
+*/
+
+/**
+ * \file
+ */
+
+#ifndef RF_TOTALUPSTREAMPROPERTIES_H
+#define RF_TOTALUPSTREAMPROPERTIES_H
+
+#include "Workspace/DataExecution/Operations/operation.h"
+#include "Workspace/DataExecution/Operations/operationfactorytraits.h"
+
+#include "volcanoplugin.h"
+
+
+namespace RF
+{
+    class TotalUpstreamPropertiesImpl;
+
+    /**
+     * \brief Calculates upstream values of many properties in one pass over the flow directions.
+     *
+     */
+    class RF_API TotalUpstreamProperties : public CSIRO::DataExecution::Operation
+    {
+        // Allow string translation to work properly
+        Q_DECLARE_TR_FUNCTIONS(RF::TotalUpstreamProperties)
+
+        TotalUpstreamPropertiesImpl*  pImpl_;
+
+        // Prevent copy and assignment - these should not be implemented
+        TotalUpstreamProperties(const TotalUpstreamProperties&);
+        TotalUpstreamProperties& operator=(const TotalUpstreamProperties&);
+
+    protected:
+        virtual bool  execute();
+
+    public:
+        TotalUpstreamProperties();
+        virtual ~TotalUpstreamProperties();
+    };
+}
+
+DECLARE_WORKSPACE_OPERATION_FACTORY(RF::TotalUpstreamProperties, RF_API)
+
+#endif
+
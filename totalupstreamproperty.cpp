@@ -41,6 +41,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataSlopeDirectionDataset_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataPropertyDataset_;
         CSIRO::DataExecution::TypedObject< QString >       dataOutputRasterName_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataUpstreamProperties_;
 
 
@@ -48,6 +49,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputSlopeDirectionDataset_;
         CSIRO::DataExecution::InputScalar inputPropertyDataset_;
         CSIRO::DataExecution::InputScalar inputOutputRasterName_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputUpstreamProperties_;
 
 
@@ -66,10 +68,12 @@ namespace RF
         dataSlopeDirectionDataset_(),
         dataPropertyDataset_(),
         dataOutputRasterName_(),
+        dataNumThreads_(1),
         dataUpstreamProperties_(),
         inputSlopeDirectionDataset_("Slope direction dataset", dataSlopeDirectionDataset_, op_),
         inputPropertyDataset_("Property dataset", dataPropertyDataset_, op_),
         inputOutputRasterName_("Output Raster Name", dataOutputRasterName_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputUpstreamProperties_("Upstream properties", dataUpstreamProperties_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
@@ -77,6 +81,8 @@ namespace RF
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
 
+        inputNumThreads_.setDescription(tr("1 accumulates serially, otherwise each drainage basin runs on its own thread (0 uses all cores)"));
+
         // Recommend setting a description of the operation and each input / output here:
         // op_.setDescription(tr("My operation does this, that and this other thing."));
         // input_.setDescription(tr("Used for such and such."));
@@ -122,24 +128,6 @@ namespace RF
         float dstNoDataValue = srcNodataValue;
         
 
-        void *pData;
-
-        pData = RecursiveCreateInputData(transformf);
-
-        GenericRecursivePropertyAlgebraAlg pfnAlg = RecursiveUpstreamPropAlg;
-
-        int xSize = GDALGetRasterBandXSize(fBand);
-        int ySize = GDALGetRasterBandYSize(fBand);
-        float* propertyValues = new float[xSize*ySize];
-
-
-        GDALRasterIO(propertyBand, GF_Read,
-            0, 0, //X,Y offset in cells
-            xSize, ySize, //X,Y length in cells
-            propertyValues, //data
-            ySize, xSize, //Number of cells in new dataset
-            GDT_Float32, //Type
-            0, 0);
 
             upstreamProperties = GDALCreate( GDALGetDatasetDriver(slopeDirectionDataset),
                                         outputRasterName.toLocal8Bit().constData(),
@@ -153,7 +141,7 @@ namespace RF
             GDALSetProjection(upstreamProperties, GDALGetProjectionRef(slopeDirectionDataset));
             GDALSetRasterNoDataValue(algBand, dstNoDataValue);
 
-            GenericRecursivePropertyAlgebraProcessor(fBand, propertyBand, algBand, transformf, pfnAlg, pData);
+            UpstreamAccumulationProcessor(fBand, propertyBand, algBand, transformf, UPSTREAM_PROPERTY, *dataNumThreads_);
 
         return true;
     }
@@ -39,6 +39,7 @@ namespace RF
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataFlowDirectionDataset_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataFailureDepthDataset_;
         CSIRO::DataExecution::TypedObject< QString >       dataOutputRasterFilename_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataAccumulatedFailureVolume_;
 
 
@@ -46,6 +47,7 @@ namespace RF
         CSIRO::DataExecution::InputScalar inputFlowDirectionDataset_;
         CSIRO::DataExecution::InputScalar inputFailureDepthDataset_;
         CSIRO::DataExecution::InputScalar inputOutputRasterFilename_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputAccumulatedFailureVolume_;
 
 
@@ -64,10 +66,12 @@ namespace RF
         dataFlowDirectionDataset_(),
         dataFailureDepthDataset_(),
         dataOutputRasterFilename_(),
+        dataNumThreads_(1),
         dataAccumulatedFailureVolume_(),
         inputFlowDirectionDataset_("Flow direction dataset", dataFlowDirectionDataset_, op_),
         inputFailureDepthDataset_("Failure depth dataset", dataFailureDepthDataset_, op_),
         inputOutputRasterFilename_("Output raster filename", dataOutputRasterFilename_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputAccumulatedFailureVolume_("Accumulated failure volume", dataAccumulatedFailureVolume_, op_)
     {
         // Make sure all of our inputs have data by default. If your operation accepts a
@@ -75,6 +79,8 @@ namespace RF
         // with constructors for each input in the initialisation list above.
         op_.ensureHasData();
 
+        inputNumThreads_.setDescription(tr("1 accumulates serially, otherwise each drainage basin runs on its own thread (0 uses all cores)"));
+
         // Recommend setting a description of the operation and each input / output here:
         // op_.setDescription(tr("My operation does this, that and this other thing."));
         // input_.setDescription(tr("Used for such and such."));
@@ -121,23 +127,6 @@ namespace RF
         float dstNoDataValue = srcNodataValue;
         
 
-        void *pData;
-
-        pData = RecursiveCreateInputData(transformf);
-
-        GenericRecursiveFailureAlgebraAlg pfnAlg = RecursiveUpstreamFailureAlg;
-
-        int xSize = GDALGetRasterBandXSize(fBand);
-        int ySize = GDALGetRasterBandYSize(fBand);
-        float* failureDepth = new float[xSize*ySize];
-
-        GDALRasterIO(depthBand, GF_Read,
-            0, 0, //X,Y offset in cells
-            xSize, ySize, //X,Y length in cells
-            failureDepth, //data
-            ySize, xSize, //Number of cells in new dataset
-            GDT_Float32, //Type
-            0, 0);
 
         accumulatedFailureVolume = GDALCreate( GDALGetDatasetDriver(flowDirectionDataset),
                                             outputRasterFilename.toLocal8Bit().constData(),
@@ -151,7 +140,7 @@ namespace RF
         GDALSetProjection(accumulatedFailureVolume, GDALGetProjectionRef(flowDirectionDataset));
         GDALSetRasterNoDataValue(algBand, dstNoDataValue);
 
-        GenericRecursiveFailureAlgebraProcessor(fBand, depthBand, algBand, transformf, pfnAlg, pData);
+        UpstreamAccumulationProcessor(fBand, depthBand, algBand, transformf, UPSTREAM_FAILURE_VOLUME, *dataNumThreads_);
 
         return true;
     }
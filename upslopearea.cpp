@@ -46,11 +46,13 @@ namespace RF
         CSIRO::DataExecution::TypedObject< int >                dataRasterBand_;
         CSIRO::DataExecution::TypedObject< GDALDatasetH >  dataAccumulationDataset_;
         CSIRO::DataExecution::TypedObject< QString >            dataSlopeName_;
+        CSIRO::DataExecution::TypedObject< int >           dataNumThreads_;
 
         // Inputs and outputs
         CSIRO::DataExecution::InputScalar inputFlowDirectionDataset_;
         CSIRO::DataExecution::InputScalar inputRasterBand_;
         CSIRO::DataExecution::InputScalar inputSlopeName_;
+        CSIRO::DataExecution::InputScalar inputNumThreads_;
         CSIRO::DataExecution::Output      outputAccumulationDataset_;
 
 
@@ -68,13 +70,16 @@ namespace RF
         op_(op),
         dataFlowDirectionDataset_(),
         dataRasterBand_(1),
-        dataSlopeName_(),
         dataAccumulationDataset_(),
+        dataSlopeName_(),
+        dataNumThreads_(1),
         inputFlowDirectionDataset_("Flow direction dataset", dataFlowDirectionDataset_, op_),
         inputRasterBand_("Raster Band", dataRasterBand_, op_),
         inputSlopeName_("Raster Name", dataSlopeName_, op_),
+        inputNumThreads_("Number of threads", dataNumThreads_, op_),
         outputAccumulationDataset_("Accumulation dataset", dataAccumulationDataset_, op_)
     {
+        inputNumThreads_.setDescription(tr("1 accumulates serially, otherwise each drainage basin runs on its own thread (0 uses all cores)"));
     }
         
     /**
@@ -112,11 +117,6 @@ namespace RF
         float dstNoDataValue = srcNodataValue;
         
 
-        void *pData;
-
-        pData = RecursiveCreateInputData(transform);
-
-        GenericRecursiveFlowAlgebraAlg pfnAlg = RecursiveUpstreamFlowAlg;
 
 
 
@@ -137,7 +137,7 @@ namespace RF
         GDALSetProjection(accumulationDataset, GDALGetProjectionRef(flowDirectionDataset));
         GDALSetRasterNoDataValue(algBand, dstNoDataValue);
 
-        GenericRecursiveFlowAlgebraProcessor(fBand, algBand, transform, pfnAlg, pData);
+        UpstreamAccumulationProcessor(fBand, NULL, algBand, transform, UPSTREAM_AREA, *dataNumThreads_);
   
         return true;
     }
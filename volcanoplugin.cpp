@@ -33,18 +33,23 @@
 //#include "titanh5reader.h"
 #include "deionise.h"
 #include "energyconoid.h"
+#include "energyconoidensemble.h"
 #include "ellipticalpile.h"
 #include "totalupstreamproperty.h"
+#include "totalupstreamproperties.h"
 #include "getpixelvalue.h"
 #include "uplsopefailurevolume.h"
 #include "multiplyrasters.h"
 #include "boxfilter.h"
 #include "smooth.h"
+#include "denoiseraster.h"
 #include "scalerastervalues.h"
 #include "projtooffset.h"
 #include "warp.h"
 #include "energycone.h"
 #include "iversonfailurevolume.h"
+#include "iversonfailuresweep.h"
+#include "iversonfailuretimeseries.h"
 #include "rasterdifference.h"
 #include "rastersum.h"
 #include "fd8totheta.h"
@@ -60,6 +65,7 @@
 #include "aspectcalc.h"
 #include "volcanoutils.h"
 #include "slopecalc.h"
+#include "terrainderivatives.h"
 #include "rastertoimage.h"
 #include "rasterbandsummary.h"
 #include "gdalinfo.h"
@@ -133,6 +139,8 @@ namespace RF
         addFactory(CSIRO::DataExecution::DataFactoryTraits<RF::BoundsofRaster>::getInstance());
 		addFactory(CSIRO::DataExecution::DataFactoryTraits<RF::FuzzyMembershipType>::getInstance());
 		addFactory(CSIRO::DataExecution::DataFactoryTraits<GDALRIOResampleAlg>::getInstance());
+        addFactory(CSIRO::DataExecution::DataFactoryTraits<RF::FillMethod>::getInstance());
+        addFactory(CSIRO::DataExecution::DataFactoryTraits<RF::BlendMethod>::getInstance());
         
         // Add your operation factories like this:
         //addFactory( CSIRO::DataExecution::OperationFactoryTraits<MyOperation>::getInstance() );
@@ -142,6 +150,7 @@ namespace RF
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<SlopeCalc>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<AspectCalc>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<CalcCurvature>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<TerrainDerivatives>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<DebrisEmergence>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<Create3dModel>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<FillDepressions>::getInstance());
@@ -154,6 +163,8 @@ namespace RF
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<RasterDifference>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<RasterSum>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<IversonFailureVolume>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<IversonFailureSweep>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<IversonFailureTimeSeries>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<EnergyCone>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<Warp>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<ProjToOffset>::getInstance());
@@ -165,13 +176,16 @@ namespace RF
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<VTIReader>::getInstance());
 		addFactory(CSIRO::DataExecution::OperationFactoryTraits<Deionise>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<Smooth>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<DenoiseRaster>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<BoxFilter>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<MultiplyRasters>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<UplsopeFailureVolume>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<GetPixelValue>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<TotalUpstreamProperty>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<TotalUpstreamProperties>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<EllipticalPile>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<EnergyConoid>::getInstance());
+        addFactory(CSIRO::DataExecution::OperationFactoryTraits<EnergyConoidEnsemble>::getInstance());
 		//addFactory(CSIRO::DataExecution::OperationFactoryTraits<TitanH5Reader>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<MergeRasters>::getInstance());
         addFactory(CSIRO::DataExecution::OperationFactoryTraits<FuzzyLocation>::getInstance());
@@ -188,6 +202,10 @@ namespace RF
 		addFactory(fuzzyMembershipTypeWidgetFact);
 		static CSIRO::Widgets::EnumComboBoxFactory<GDALRIOResampleAlg> rasterResampleTypeWidgetFact;
 		addFactory(rasterResampleTypeWidgetFact);
+        static CSIRO::Widgets::EnumComboBoxFactory<RF::FillMethod> fillMethodWidgetFact;
+        addFactory(fillMethodWidgetFact);
+        static CSIRO::Widgets::EnumComboBoxFactory<RF::BlendMethod> blendMethodWidgetFact;
+        addFactory(blendMethodWidgetFact);
 
         return true;
     }
@@ -36,9 +36,15 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <queue>
+#include <functional>
+#include <limits>
 
 #include "gdal.h"
 #include "gdal_priv.h"
+#include "gdal_alg.h"
+#include "gdalwarper.h"
 #include "ogr_spatialref.h"
 
 
@@ -47,15 +53,6 @@
 #include "volcanoutils.h"
 
 
-#ifndef M_PI
-#define M_PI  3.1415926535897932384626433832795
-#endif
-
-#define INTERPOL(a,b) ((srcNoData && (ARE_REAL_EQUAL(a, srcNoDataValue) || ARE_REAL_EQUAL(b, srcNoDataValue))) ? srcNoDataValue : 2 * (a) - (b))
-
-#ifndef ROOT_2
-#define ROOT_2 sqrtf(2)
-#endif
 
 /*
 Write out raster band
@@ -151,6 +148,48 @@ float * getRasterData(GDALDatasetH raster, float dstNodataValue,
 	}
 }
 
+/*
+getRadiusWindow: Pixel window covering a circle, from the pixel position of the corners of its bounding square
+*/
+bool getRadiusWindow(double * transform, int rasterXsize, int rasterYsize,
+    double x, double y, double radius, int * window)
+{
+    double invTransform[6];
+    if (!GDALInvGeoTransform(transform, invTransform))
+    {
+        return false;
+    }
+
+    double minP = 0, maxP = 0, minL = 0, maxL = 0;
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        double cx = x + ((corner & 1) ? radius : -radius);
+        double cy = y + ((corner & 2) ? radius : -radius);
+        double P = invTransform[0] + invTransform[1] * cx + invTransform[2] * cy;
+        double L = invTransform[3] + invTransform[4] * cx + invTransform[5] * cy;
+        if (corner == 0 || P < minP) minP = P;
+        if (corner == 0 || P > maxP) maxP = P;
+        if (corner == 0 || L < minL) minL = L;
+        if (corner == 0 || L > maxL) maxL = L;
+    }
+
+    //Pad by a cell so cell centres on the edge are kept, clipped before the cast to int
+    int xStart = (int) MAX(0.0, floor(minP) - 1);
+    int yStart = (int) MAX(0.0, floor(minL) - 1);
+    int xEnd = (int) MIN((double) rasterXsize, ceil(maxP) + 1);
+    int yEnd = (int) MIN((double) rasterYsize, ceil(maxL) + 1);
+    if (xEnd <= xStart || yEnd <= yStart)
+    {
+        return false;
+    }
+
+    window[0] = xStart;
+    window[1] = yStart;
+    window[2] = xEnd - xStart;
+    window[3] = yEnd - yStart;
+    return true;
+}
+
 /*
 ComputeVal: Computes the value using a processing algorithim defined here - checking for nodata
 */
@@ -425,48 +464,41 @@ CPLErr GDALGeneric3x3Processing (GDALRasterBandH srcBand,
     return eErr;
 }
 
-
 /*
-Horn Slope algorithim
+Tiled 3x3 grid processor for algorithms - output matches GDALGeneric3x3Processing
 */
-float GDALSlopeHornAlg (float* afWin, float dstNoDataValue, void* pData)
+CPLErr GDALGeneric3x3TiledProcessing (GDALRasterBandH srcBand,
+                                      GDALRasterBandH dstBand,
+                                      GDALGeneric3x3ProcessingAlg pfnAlg,
+                                      void* pData,
+                                      bool computeEdges,
+                                      int nThreads)
 {
-    const double radiansToDegrees = 180.0 / M_PI;
-    GDALSlopeAlgData* psData = (GDALSlopeAlgData*)pData;
-    double dx, dy, key;
-    
-    dx = ((afWin[0] + afWin[3] + afWin[3] + afWin[6]) - 
-          (afWin[2] + afWin[5] + afWin[5] + afWin[8]))/psData->ewres;
+    //In place runs depend on the scanline read/write order, keep them there
+    if (srcBand == dstBand)
+    {
+        return GDALGeneric3x3Processing(srcBand, dstBand, pfnAlg, pData, computeEdges);
+    }
 
-    dy = ((afWin[6] + afWin[7] + afWin[7] + afWin[8]) - 
-          (afWin[0] + afWin[1] + afWin[1] + afWin[2]))/psData->nsres;
+    return GDALGeneric3x3KernelProcessing(srcBand, dstBand,
+                                          GDALGeneric3x3AlgKernel(pfnAlg, pData),
+                                          computeEdges, nThreads);
+}
 
-    key = (dx * dx + dy * dy);
 
-    if (psData->slopeFormat == 1) 
-        return (float) (atan(sqrt(key) / (8*psData->scale)) * radiansToDegrees);
-    else
-        return (float) (100*(sqrt(key) / (8*psData->scale)));
+/*
+Horn Slope algorithim
+*/
+float GDALSlopeHornAlg (float* afWin, float dstNoDataValue, void* pData)
+{
+    return GDALSlopeHornKernel(*(GDALSlopeAlgData*)pData)(afWin, dstNoDataValue);
 }
 /*
 Zevenbergen-Thorne Slope algorithim
 */
 float GDALSlopeZevenbergenThorneAlg (float* afWin, float dsNoDataValue, void* pData)
 {
-    const double radiansToDegrees = 180.0 / M_PI;
-    GDALSlopeAlgData* psData = (GDALSlopeAlgData*)pData;
-    double dx, dy, key;
-    
-    dx = (afWin[3] - afWin[5])/psData->ewres;
-
-    dy = (afWin[7] - afWin[1])/psData->nsres;
-
-    key = (dx * dx + dy * dy);
-
-    if (psData->slopeFormat == 1) 
-        return (float) (atan(sqrt(key) / (2*psData->scale)) * radiansToDegrees);
-    else
-        return (float) (100*(sqrt(key) / (2*psData->scale)));
+    return GDALSlopeZevenbergenThorneKernel(*(GDALSlopeAlgData*)pData)(afWin, dsNoDataValue);
 }
 /*
 Slope data functions
@@ -489,41 +521,7 @@ Horne like aspect
 */
 float GDALAspectAlg (float* afWin, float dstNoDataValue, void* pData)
 {
-    const double degreesToRadians = M_PI / 180.0;
-    GDALAspectAlgData* psData = (GDALAspectAlgData*)pData;
-    double dx, dy;
-    float aspect;
-    
-    dx = ((afWin[2] + afWin[5] + afWin[5] + afWin[8]) -
-          (afWin[0] + afWin[3] + afWin[3] + afWin[6]));
-
-    dy = ((afWin[6] + afWin[7] + afWin[7] + afWin[8]) - 
-          (afWin[0] + afWin[1] + afWin[1] + afWin[2]));
-
-    aspect = (float) (atan2(dy,-dx) / degreesToRadians);
-
-    if (dx == 0 && dy == 0)
-    {
-        /* Flat area */
-        aspect = dstNoDataValue;
-    } 
-    else if ( psData->useAngleAsAzimuth )
-    {
-        if (aspect > 90.0) 
-            aspect = 450.0f - aspect;
-        else
-            aspect = 90.0f - aspect;
-    }
-    else
-    {
-        if (aspect < 0)
-            aspect += 360.0;
-    }
-
-    if (aspect == 360.0) 
-        aspect = 0.0;
-
-    return aspect;
+    return GDALAspectKernel(*(GDALAspectAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 /*
@@ -531,39 +529,7 @@ Zev-Thorne
 */
 float GDALAspectZevenbergenThorneAlg (float* afWin, float dstNoDataValue, void* pData)
 {
-    const double degreesToRadians = M_PI / 180.0;
-    GDALAspectAlgData* psData = (GDALAspectAlgData*)pData;
-    double dx, dy;
-    float aspect;
-    
-    dx = (afWin[5] - afWin[3]);
-
-    dy = (afWin[7] - afWin[1]);
-
-    aspect = (float) (atan2(dy,-dx) / degreesToRadians);
-
-    if (dx == 0 && dy == 0)
-    {
-        /* Flat area */
-        aspect = dstNoDataValue;
-    } 
-    else if ( psData->useAngleAsAzimuth)
-    {
-        if (aspect > 90.0) 
-            aspect = 450.0f - aspect;
-        else
-            aspect = 90.0f - aspect;
-    }
-    else
-    {
-        if (aspect < 0)
-            aspect += 360.0;
-    }
-
-    if (aspect == 360.0) 
-        aspect = 0.0;
-
-    return aspect;
+    return GDALAspectZevenbergenThorneKernel(*(GDALAspectAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 //Create data
@@ -592,83 +558,17 @@ void* GDALCreateCurvatureData(double* adfTransform)
 
 float GDALCurvatureProfileAlg(float* afWin, float dstNoDataValue, void*pData)
 {
-    double zx, zy, zxx, zyy, zxy, z2x, z2y;
-    GDALCurvatureAlgData* psData = (GDALCurvatureAlgData*)pData;
-
-    double ewres = psData->ewres;
-    double nsres = psData->nsres;
-
-    zx = (afWin[2] + afWin[5] + afWin[8] - afWin[0] - afWin[3] - afWin[6])/(6*ewres);
-    zy = (afWin[0] + afWin[1] +afWin[2] - afWin[6] - afWin[7] - afWin[8])/(6*nsres);
-    zxx = (afWin[0] + afWin[2] + afWin[3] + afWin[5] + afWin[6] + afWin[8] - 2*(afWin[1]+afWin[4]+afWin[7]))/(3*pow(ewres, 2));
-    zyy = (afWin[0] + afWin[1] + afWin[2] + afWin[6] + afWin[7] + afWin[8] - 2*(afWin[3]+afWin[4]+afWin[5]))/(3*pow(nsres, 2));
-    zxy = (afWin[2] + afWin[6] - afWin[0] - afWin[8])/(4*(pow(ewres,2)));
-    z2x = pow(zx,2);
-    z2y = pow(zy,2);
-
-    if (zx == 0 && zy == 0)
-    {
-        /* Flat area */
-        return dstNoDataValue;
-    }
-    else
-    {
-        return (float) ((zxx*z2x)+(2*zxy*zx*zy)+(zyy*z2y))/((z2x + z2y)*pow(sqrt(abs(1+z2x+z2y)),3));
-    }
+    return GDALCurvatureProfileKernel(*(GDALCurvatureAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 float GDALCurvatureContourAlg(float* afWin, float dstNoDataValue, void* pData)
 {
-    double zx, zy, zxx, zyy, zxy, z2x, z2y;
-    GDALCurvatureAlgData* psData = (GDALCurvatureAlgData*)pData;
-
-    double ewres = psData->ewres;
-    double nsres = psData->nsres;
-
-    zx = (afWin[2] + afWin[5] + afWin[8] - afWin[0] - afWin[3] - afWin[6])/(6*ewres);
-    zy = (afWin[0] + afWin[1] +afWin[2] - afWin[6] - afWin[7] - afWin[8])/(6*nsres);
-    zxx = (afWin[0] + afWin[2] + afWin[3] + afWin[5] + afWin[6] + afWin[8] - 2*(afWin[1]+afWin[4]+afWin[7]))/(3*pow(ewres, 2));
-    zyy = (afWin[0] + afWin[1] + afWin[2] + afWin[6] + afWin[7] + afWin[8] - 2*(afWin[3]+afWin[4]+afWin[5]))/(3*pow(nsres, 2));
-    zxy = (afWin[2] + afWin[6] - afWin[0] - afWin[8])/(4*(pow(ewres,2)));
-    z2x = pow(zx,2);
-    z2y = pow(zy,2);
-
-    if (zx == 0 && zy == 0)
-    {
-        /* Flat area */
-        return dstNoDataValue;
-    }
-    else
-    {
-        return (float) ((zxx*z2x)-(2*zxy*zx*zy)+(zyy*z2y))/pow(sqrt(abs(z2x+z2y)),3);
-    }
+    return GDALCurvatureContourKernel(*(GDALCurvatureAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 float GDALCurvatureTangentAlg(float* afWin, float dstNoDataValue, void* pData)
 {
-    double zx, zy, zxx, zyy, zxy, z2x, z2y;
-    GDALCurvatureAlgData* psData = (GDALCurvatureAlgData*)pData;
-
-    double ewres = psData->ewres;
-    double nsres = psData->nsres;
-
-    zx = (afWin[2] + afWin[5] + afWin[8] - afWin[0] - afWin[3] - afWin[6])/(6*ewres);
-    zy = (afWin[0] + afWin[1] +afWin[2] - afWin[6] - afWin[7] - afWin[8])/(6*nsres);
-    zxx = (afWin[0] + afWin[2] + afWin[3] + afWin[5] + afWin[6] + afWin[8] - 2*(afWin[1]+afWin[4]+afWin[7]))/(3*pow(ewres, 2));
-    zyy = (afWin[0] + afWin[1] + afWin[2] + afWin[6] + afWin[7] + afWin[8] - 2*(afWin[3]+afWin[4]+afWin[5]))/(3*pow(nsres, 2));
-    zxy = (afWin[2] + afWin[6] - afWin[0] - afWin[8])/(4*(pow(ewres,2)));
-    z2x = pow(zx,2);
-    z2y = pow(zy,2);
-
-    if (zx == 0 && zy == 0)
-    {
-        /* Flat area */
-        return dstNoDataValue;
-    }
-    else
-    {
-    return (float) ((zxx*z2x)-(2*zxy*zx*zy)+(zyy*z2y))/((z2x+z2y)+sqrt(abs(1+z2x+z2y)));
-    }
+    return GDALCurvatureTangentKernel(*(GDALCurvatureAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 /*
@@ -686,213 +586,12 @@ void* GDALCreateFlowDirectionData(double* adfTransform)
 
 float GDALFlowDirectionInfAlg(float* afWin, float dstNoDataValue, void* pData)
 {
-    const double radiansToDegrees = 180.0 / M_PI;
-
-    GDALFlowDirAlgData* psData = (GDALFlowDirAlgData*)pData;
-
-    double ewres = psData->ewres;
-    double nsres = psData->nsres;
-    nsres = -nsres;
-
-    struct facet facets[8];
-    
-    facets[0].e1 = 5;
-    facets[0].e2 = 2;
-    facets[0].ac = 0;
-    facets[0].af = 1;
-
-    facets[1].e1 = 1;
-    facets[1].e2 = 2;
-    facets[1].ac = 1;
-    facets[1].af = -1;
-
-    facets[2].e1 = 1;
-    facets[2].e2 = 0;
-    facets[2].ac = 1;
-    facets[2].af = 1;
-
-    facets[3].e1 = 3;
-    facets[3].e2 = 0;
-    facets[3].ac = 2;
-    facets[3].af = -1;
-
-    facets[4].e1 = 3;
-    facets[4].e2 = 6;
-    facets[4].ac = 2;
-    facets[4].af = 1;
-
-    facets[5].e1 = 7;
-    facets[5].e2 = 6;
-    facets[5].ac = 3;
-    facets[5].af = -1;
-
-    facets[6].e1 = 7;
-    facets[6].e2 = 8;
-    facets[6].ac = 3;
-    facets[6].af = 1;
-
-    facets[7].e1 = 5;
-    facets[7].e2 = 8;
-    facets[7].ac = 4;
-    facets[7].af = -1;
-
-    //Facets initialised loop through
-    double flowDir = -9999;
-    double maxS = -999999;
-    int maxFacet = -1;
-    for (int i = 0; i < 8; ++i)
-    {
-        //Calculate slope for each facet
-        facets[i].s[0] = (afWin[4] - afWin[facets[i].e1])/ewres;//SRM
-        facets[i].s[1] = (afWin[facets[i].e1] - afWin[facets[i].e2])/nsres;//SRM
-
-        
-        facets[i].fdir = atan2(facets[i].s[1],facets[i].s[0]);
-        if (facets[i].fdir <= 0)
-        {
-            facets[i].fdir = 0;
-            facets[i].s_mag = facets[i].s[0];
-        }
-        else if (facets[i].fdir > atan(nsres/ewres))
-        {
-            facets[i].fdir = atan(nsres/ewres);
-            facets[i].s_mag = (afWin[4] - afWin[facets[i].e2])/sqrt(abs(pow(facets[i].s[0],2) + pow(facets[i].s[1],2)));
-        }
-        else
-        {
-            facets[i].fdir = atan2(facets[i].s[1],facets[i].s[0]);
-            facets[i].s_mag = sqrt(abs(pow(facets[i].s[0],2)+pow(facets[i].s[1],2)));//THis will break if I have a -slope but IDK.
-
-        }
-        
-
-        if(facets[i].s_mag > maxS)
-        {
-            maxS = facets[i].s_mag;
-            flowDir = facets[i].fdir;
-            maxFacet = i;
-        }
-  
-    }
-    
-    double ccwEastangle;
-
-    if (maxS > 0)
-    {
-        ccwEastangle = (facets[maxFacet].af*flowDir) + (facets[maxFacet].ac*(M_PI/2));
-    }
-    else
-    {
-        ccwEastangle = -1;
-    }
-
-    return ccwEastangle;
+    return GDALFlowDirectionInfKernel(*(GDALFlowDirAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 float GDALFlowDirection8Alg(float* afWin, float dstNoDataValue, void* pData)
 {
-    double* dWDrop;
-
-    const double radiansToDegrees = 180.0 / M_PI;
-
-    GDALFlowDirAlgData* psData = (GDALFlowDirAlgData*)pData;
-
-    double ewres = psData->ewres;
-    double nsres = -psData->nsres;
-
-    dWDrop = new double [9];
-    double dWDropmax = 0;
-    for (int i = 0; i < 9; ++i)
-    {
-        if (i % 2 == 0 && i != 4)
-        {
-            dWDrop[i] = (afWin[4] - afWin[i])/ROOT_2;
-            if (dWDrop[i] > dWDropmax)
-            {
-                dWDropmax = dWDrop[i];
-            }
-        }
-        else
-        {
-            dWDrop[i] = (afWin[4] - afWin[i]);
-            if (dWDrop[i] > dWDropmax)
-            {
-                dWDropmax = dWDrop[i];
-            }
-        }
-    }
-
-    int flowDir = 0;
-    int flowDCodes[9] = {1 , 2, 4, 128, 0, 8, 64, 32, 16};
-
-    int flowAngles[9] = {32, 64, 128, 
-                        16, -1, 1,
-                        8, 4, 2};
-
-    /*float flowAngles[9] = {3*M_PI_4, M_PI_2, M_PI_4,
-                         M_PI, -1, 0,
-                         5*M_PI_4, 3*M_PI_2, 7*M_PI_4};*/
-    int nNeighbours = 0;
-    std::vector<int> maxCell;
-    for (int i = 0; i < 9; ++i)
-    {
-        if (dWDrop[i] >= dWDropmax)
-        {
-            ++nNeighbours;
-            flowDir = flowDir + flowDCodes[i];//should give a unique value.
-            maxCell.push_back(i);
-        }
-    }
-
-    float direction;
-    if (nNeighbours == 0)
-    {
-        std::cout << QString("ERROR: Condition 1 cell, ensure depressions have been filled") + "\n";
-        direction = -1;
-    }
-    else if (nNeighbours == 1)
-    {
-        //Condition 2 cells - only 1 neighbour.
-        direction = flowAngles[maxCell[0]];
-    }
-    else if (nNeighbours > 1 && dWDropmax > 0.0)
-    {
-        //Condition 3 cells - 2 neighbours with equal drop - look up table
-        if (maxCell.size() < 3)//2 neighbours - arbitrary
-        {
-            direction = flowAngles[maxCell[0]];
-        }
-        else
-        {
-            if (maxCell[0] == 0 && maxCell[1] == 1 && maxCell[2] == 2)
-                direction = flowAngles[1];
-            if (maxCell[0] == 1 && maxCell[1] == 2 && maxCell[2] == 5)
-                direction = flowAngles[2];
-            if (maxCell[0] == 2 && maxCell[1] == 5 && maxCell[2] == 8)
-                direction = flowAngles[5];
-            if (maxCell[0] == 5 && maxCell[1] == 7 && maxCell[2] == 8)
-                direction = flowAngles[8];
-            if (maxCell[0] == 6 && maxCell[1] == 7 && maxCell[2] == 8)
-                direction = flowAngles[7];
-            if (maxCell[0] == 3 && maxCell[1] == 6 && maxCell[2] == 7)
-                direction = flowAngles[6];
-            if (maxCell[0] == 0 && maxCell[1] == 3 && maxCell[2] == 6)
-                direction = flowAngles[3];
-            if (maxCell[0] == 0 && maxCell[1] == 1 && maxCell[2] == 3)
-                direction = flowAngles[0];
-        }
-    }
-    else if (nNeighbours > 1 && dWDropmax == 0.0)
-    {
-        //Condition 4 cells - 0 drop cells
-        direction = 0;
-        for (int dirIt = 0; dirIt < maxCell.size(); ++dirIt)
-        {
-            direction += maxCell[dirIt];
-        }
-    }
-
-   return direction;
+    return GDALFlowDirection8Kernel(*(GDALFlowDirAlgData*)pData)(afWin, dstNoDataValue);
 }
 
 float GDALFlowDirection8IterativeAlg(float* afWin, float dstNoDataValue, void* pData)
@@ -968,17 +667,1170 @@ float GDALFillDepressionsAlg(float* afWin, float dstNoDataValue, void* pData)
 }
 
 
-DEFINE_WORKSPACE_DATA_FACTORY(RF::SlopeAlgType, RF::VolcanoPlugin::getInstance())
-DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::SlopeAlgType, RF::VolcanoPlugin::getInstance())
+/*
+Cells waiting in the priority-flood open queue, ordered lowest first
+*/
+typedef struct PriorityFloodCell
+{
+    float elevation;
+    size_t index;
 
-DEFINE_WORKSPACE_DATA_FACTORY(RF::CurvatureType, RF::VolcanoPlugin::getInstance())
-DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::CurvatureType, RF::VolcanoPlugin::getInstance())
+    bool operator>(const PriorityFloodCell& other) const
+    {
+        return elevation > other.elevation || (elevation == other.elevation && index > other.index);
+    }
+} PriorityFloodCell;
 
-DEFINE_WORKSPACE_DATA_FACTORY(RF::FlowDirType, RF::VolcanoPlugin::getInstance())
-DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::FlowDirType, RF::VolcanoPlugin::getInstance())
+CPLErr GDALPriorityFloodFill(GDALRasterBandH srcBand,
+                             GDALRasterBandH dstBand,
+                             RF::FillMethod fillMethod,
+                             double epsilon,
+                             size_t* pnChanged)
+{
+    if (pnChanged)
+    {
+        *pnChanged = 0;
+    }
 
-DEFINE_WORKSPACE_DATA_FACTORY(RF::FuzzyMembershipType, RF::VolcanoPlugin::getInstance())
-DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::FuzzyMembershipType, RF::VolcanoPlugin::getInstance())
+    int srcNoData; //Really a bool
+    float srcNoDataValue = (float) GDALGetRasterNoDataValue(srcBand, &srcNoData);
+
+    int nXSize = GDALGetRasterBandXSize(srcBand);
+    int nYSize = GDALGetRasterBandYSize(srcBand);
+    size_t nCells = (size_t) nXSize * nYSize;
+    if (nCells == 0)
+    {
+        return CE_None;
+    }
+
+    std::vector<float> dem(nCells);
+    if (GDALRasterIO(srcBand, GF_Read, 0, 0, nXSize, nYSize, &dem[0], nXSize, nYSize, GDT_Float32, 0, 0) != CE_None)
+    {
+        std::cout << QString("ERROR: Cannot read raster for depression filling") + "\n";
+        return CE_Failure;
+    }
+
+    //Closed cells are done, nodata (and NaN) cells are closed from the start and never change
+    std::vector<unsigned char> closed(nCells, 0);
+    for (size_t i = 0; i < nCells; ++i)
+    {
+        if (dem[i] != dem[i] || (srcNoData && ARE_REAL_EQUAL(dem[i], srcNoDataValue)))
+        {
+            closed[i] = 2;
+        }
+    }
+
+    static const int nbrX[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int nbrY[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+    std::priority_queue<PriorityFloodCell, std::vector<PriorityFloodCell>, std::greater<PriorityFloodCell> > open;
+    std::queue<size_t> pit;
+
+    //Seed with the cells that drain out - the raster edge and anything next to nodata
+    for (int i = 0; i < nYSize; ++i)
+    {
+        for (int j = 0; j < nXSize; ++j)
+        {
+            size_t index = (size_t) i * nXSize + j;
+            if (closed[index])
+            {
+                continue;
+            }
+            bool outlet = (i == 0 || j == 0 || i == nYSize - 1 || j == nXSize - 1);
+            for (int n = 0; n < 8 && !outlet; ++n)
+            {
+                outlet = (closed[index + (ptrdiff_t) nbrY[n] * nXSize + nbrX[n]] == 2);
+            }
+            if (outlet)
+            {
+                closed[index] = 1;
+                PriorityFloodCell cell = {dem[index], index};
+                open.push(cell);
+            }
+        }
+    }
+
+    size_t nChanged = 0;
+    while (!open.empty() || !pit.empty())
+    {
+        //Cells raised in a depression are finished first, in the order they were reached
+        size_t index;
+        if (!pit.empty())
+        {
+            index = pit.front();
+            pit.pop();
+        }
+        else
+        {
+            index = open.top().index;
+            open.pop();
+        }
+
+        int i = (int) (index / nXSize);
+        int j = (int) (index % nXSize);
+
+        //Height a neighbour in a depression is raised to so it drains through this cell
+        float spill = dem[index];
+        if (fillMethod == RF::FLOODEPSILON)
+        {
+            float next = nextafterf(spill, HUGE_VALF);
+            spill = (epsilon > 0) ? MAX((float) (spill + epsilon), next) : next;
+        }
+
+        for (int n = 0; n < 8; ++n)
+        {
+            int ni = i + nbrY[n];
+            int nj = j + nbrX[n];
+            if (ni < 0 || nj < 0 || ni >= nYSize || nj >= nXSize)
+            {
+                continue;
+            }
+            size_t nIndex = (size_t) ni * nXSize + nj;
+            if (closed[nIndex])
+            {
+                continue;
+            }
+            closed[nIndex] = 1;
+
+            //Only neighbours no higher than this cell are in a depression, higher ones already drain
+            if (dem[nIndex] <= dem[index])
+            {
+                if (dem[nIndex] < spill)
+                {
+                    dem[nIndex] = spill;
+                    ++nChanged;
+                }
+                pit.push(nIndex);
+            }
+            else
+            {
+                PriorityFloodCell cell = {dem[nIndex], nIndex};
+                open.push(cell);
+            }
+        }
+    }
+
+    if (GDALRasterIO(dstBand, GF_Write, 0, 0, nXSize, nYSize, &dem[0], nXSize, nYSize, GDT_Float32, 0, 0) != CE_None)
+    {
+        std::cout << QString("ERROR: Cannot write filled raster") + "\n";
+        return CE_Failure;
+    }
+
+    if (pnChanged)
+    {
+        *pnChanged = nChanged;
+    }
+    return CE_None;
+}
+
+
+/***************************************
+ENERGY CONOID
+***************************************/
+double l_max(double phi, double fr, double A, double w_s, double g_p, bool axisymmetric)
+{
+    if (axisymmetric)
+    {
+        return{
+            pow((8 * sqrt(phi)) /
+            (pow(fr*sqrt(g_p*pow(2 * A,3.0)),-1.0)*w_s), 1.0/4.0)
+        };
+    }
+    else
+    {
+        return{
+            pow((5 * sqrt(phi)) /
+            (pow(fr*sqrt(g_p*pow(A,3.0)),-1.0)*w_s), 2.0 / 5.0)
+        };
+    }
+}
+
+double h_max_cyl(double grav, double C, double linf, double x) //Cylindrical h_max
+{
+    return{
+        (1 / (2 * grav))*
+        pow(0.5*C*pow(linf, 1.0 / 3.0)*(sqrt(1 - pow(x,4.0)) / x)
+            ,2.0)
+    };
+}
+
+/***************************************
+ENERGY CONE
+***************************************/
+//Sources kept per cell, the 3D distance means a cell's best source need not be its neighbour's best
+#define ENERGY_CONE_LABELS 3
+#define ENERGY_CONE_MAX_SWEEPS 8
+
+//Energy line of source k over cell (P, L), nodata cells only compare the horizontal distance
+static inline double energyConeLine(const std::vector<int>& sources, const std::vector<float>& sourceHeights, int k,
+    int P, int L, const float* elevation, int nXSize, bool noData, double ewres, double nsres, double multiplier)
+{
+    double dx = ((sources[k] % nXSize) - P)*ewres;
+    double dy = ((sources[k] / nXSize) - L)*nsres;
+    double dz = noData ? 0.0 : sourceHeights[k] - elevation[(L*nXSize) + P];
+    return sourceHeights[k] - (sqrt((dx*dx) + (dy*dy) + (dz*dz))*multiplier) - (noData ? 0.0 : elevation[(L*nXSize) + P]);
+}
+
+//Insert source k into the cell's list (highest energy line first) if it is one of the best, returns true if it was
+static inline bool energyConeInsert(int* cellLabels, double* cellLines, int k, double value)
+{
+    int slot = ENERGY_CONE_LABELS;
+    for (int j = 0; j < ENERGY_CONE_LABELS; ++j)
+    {
+        if (cellLabels[j] == k)
+        {
+            return false;
+        }
+        if (slot == ENERGY_CONE_LABELS && (cellLabels[j] < 0 || value > cellLines[j]))
+        {
+            slot = j;
+        }
+    }
+    if (slot == ENERGY_CONE_LABELS)
+    {
+        return false;
+    }
+    for (int j = ENERGY_CONE_LABELS - 1; j > slot; --j)
+    {
+        cellLabels[j] = cellLabels[j - 1];
+        cellLines[j] = cellLines[j - 1];
+    }
+    cellLabels[slot] = k;
+    cellLines[slot] = value;
+    return true;
+}
+
+//Offer the sources of a neighbour to this cell
+static inline bool energyConeCandidates(int P, int L, int nbrP, int nbrL, const float* elevation, int nXSize, int nYSize,
+    int srcNoData, float srcNoDataValue, double ewres, double nsres, double multiplier,
+    const std::vector<int>& sources, const std::vector<float>& sourceHeights,
+    std::vector<int>& labels, std::vector<double>& lines)
+{
+    if (nbrP < 0 || nbrP >= nXSize || nbrL < 0 || nbrL >= nYSize)
+    {
+        return false;
+    }
+    size_t i = (size_t) ((L*nXSize) + P)*ENERGY_CONE_LABELS;
+    size_t nbr = (size_t) ((nbrL*nXSize) + nbrP)*ENERGY_CONE_LABELS;
+    bool noData = srcNoData && elevation[(L*nXSize) + P] == srcNoDataValue;
+    bool changed = false;
+    for (int j = 0; j < ENERGY_CONE_LABELS && labels[nbr + j] >= 0; ++j)
+    {
+        int k = labels[nbr + j];
+        double value = energyConeLine(sources, sourceHeights, k, P, L, elevation, nXSize, noData, ewres, nsres, multiplier);
+        changed |= energyConeInsert(&labels[i], &lines[i], k, value);
+    }
+    return changed;
+}
+
+void energyConeEnvelope(const float* elevation, int nXSize, int nYSize, int srcNoData, float srcNoDataValue,
+    double ewres, double nsres, double multiplier,
+    const std::vector<int>& sources, const std::vector<float>& sourceHeights, float* cone)
+{
+    std::vector<int> labels((size_t) nXSize*nYSize*ENERGY_CONE_LABELS, -1);
+    std::vector<double> lines((size_t) nXSize*nYSize*ENERGY_CONE_LABELS, 0.0);
+
+    //Seed the sources
+    for (int k = 0; k < (int) sources.size(); ++k)
+    {
+        int i = sources[k];
+        bool noData = srcNoData && elevation[i] == srcNoDataValue;
+        double value = energyConeLine(sources, sourceHeights, k, i % nXSize, i / nXSize, elevation, nXSize, noData, ewres, nsres, multiplier);
+        energyConeInsert(&labels[(size_t) i*ENERGY_CONE_LABELS], &lines[(size_t) i*ENERGY_CONE_LABELS], k, value);
+    }
+
+#define ENERGY_CONE_CANDIDATES(dP, dL) changed |= energyConeCandidates(P, L, P + (dP), L + (dL), elevation, nXSize, nYSize, \
+    srcNoData, srcNoDataValue, ewres, nsres, multiplier, sources, sourceHeights, labels, lines)
+
+    //Sweep until no cell takes a new source
+    for (int sweep = 0; sweep < ENERGY_CONE_MAX_SWEEPS; ++sweep)
+    {
+        bool changed = false;
+
+        //Forward, from the line above and the left, then back along the line from the right
+        for (int L = 0; L < nYSize; ++L)
+        {
+            for (int P = 0; P < nXSize; ++P)
+            {
+                ENERGY_CONE_CANDIDATES(-1, -1);
+                ENERGY_CONE_CANDIDATES(0, -1);
+                ENERGY_CONE_CANDIDATES(1, -1);
+                ENERGY_CONE_CANDIDATES(-1, 0);
+            }
+            for (int P = nXSize - 2; P >= 0; --P)
+            {
+                ENERGY_CONE_CANDIDATES(1, 0);
+            }
+        }
+
+        //Backward, from the line below and the right, then back along the line from the left
+        for (int L = nYSize - 1; L >= 0; --L)
+        {
+            for (int P = nXSize - 1; P >= 0; --P)
+            {
+                ENERGY_CONE_CANDIDATES(1, 1);
+                ENERGY_CONE_CANDIDATES(0, 1);
+                ENERGY_CONE_CANDIDATES(-1, 1);
+                ENERGY_CONE_CANDIDATES(1, 0);
+            }
+            for (int P = 1; P < nXSize; ++P)
+            {
+                ENERGY_CONE_CANDIDATES(-1, 0);
+            }
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+    }
+
+#undef ENERGY_CONE_CANDIDATES
+
+    for (size_t i = 0; i < (size_t) nXSize*nYSize; ++i)
+    {
+        if (srcNoData && elevation[i] == srcNoDataValue)
+        {
+            cone[i] = srcNoDataValue;
+        }
+        else if (labels[i*ENERGY_CONE_LABELS] < 0)
+        {
+            cone[i] = 0.0;
+        }
+        else
+        {
+            cone[i] = (float) MAX(0.0, lines[i*ENERGY_CONE_LABELS]);
+        }
+    }
+}
+
+//The energy line of the highest source after a path length, blocked once it is at the ground
+struct EnergyConeBlocked
+{
+    const float* elevation;
+    int srcNoData;
+    float srcNoDataValue;
+    double highestSource;
+    double multiplier;
+
+    inline bool operator()(int cell, float distance) const
+    {
+        return (srcNoData && elevation[cell] == srcNoDataValue) ||
+            highestSource - (multiplier*distance) <= elevation[cell];
+    }
+};
+
+void energyConeGeodesic(const float* elevation, int nXSize, int nYSize, int srcNoData, float srcNoDataValue,
+    double ewres, double nsres, double multiplier,
+    const std::vector<int>& sources, const std::vector<float>& sourceHeights, float* cone)
+{
+    //Lower sources start further along the path of the highest, so one front carries them all
+    double highestSource = *std::max_element(sourceHeights.begin(), sourceHeights.end());
+    std::vector<float> sourceDistances(sources.size());
+    for (size_t k = 0; k < sources.size(); ++k)
+    {
+        sourceDistances[k] = (float) ((highestSource - sourceHeights[k]) / multiplier);
+    }
+
+    EnergyConeBlocked blocked = {elevation, srcNoData, srcNoDataValue, highestSource, multiplier};
+    GeodesicDistance(nXSize, nYSize, ewres, nsres, sources, sourceDistances, blocked, cone);
+
+    for (size_t i = 0; i < (size_t) nXSize*nYSize; ++i)
+    {
+        if (srcNoData && elevation[i] == srcNoDataValue)
+        {
+            cone[i] = srcNoDataValue;
+        }
+        else if (cone[i] < 0)
+        {
+            cone[i] = 0.0;
+        }
+        else
+        {
+            cone[i] = (float) MAX(0.0, highestSource - (multiplier*cone[i]) - elevation[i]);
+        }
+    }
+}
+
+/***************************************
+FUZZY MORPHOLOGY
+***************************************/
+
+void weightedMorphology(const float* data, int nXSize, int nYSize,
+    const float* kernel, int kernelSize,
+    float* dilation, float* erosion, int nThreads)
+{
+    int half = kernelSize / 2;
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int i = 0; i < nYSize; ++i)
+    {
+        int rowStart = MAX(i - half, 0);
+        int rowEnd = MIN(i + half + 1, nYSize);
+        for (int j = 0; j < nXSize; ++j)
+        {
+            int colStart = MAX(j - half, 0);
+            int colEnd = MIN(j + half + 1, nXSize);
+
+            float dilated = -std::numeric_limits<float>::max();
+            float eroded = std::numeric_limits<float>::max();
+            for (int r = rowStart; r < rowEnd; ++r)
+            {
+                const float* dataRow = data + ((size_t) r*nXSize);
+                const float* kernelRow = kernel + ((r - i + half)*kernelSize);
+                for (int c = colStart; c < colEnd; ++c)
+                {
+                    float v = dataRow[c]*kernelRow[c - j + half];
+                    dilated = MAX(dilated, v);
+                    eroded = MIN(eroded, v);
+                }
+            }
+            if (dilation)
+            {
+                dilation[((size_t) i*nXSize) + j] = dilated;
+            }
+            if (erosion)
+            {
+                erosion[((size_t) i*nXSize) + j] = eroded;
+            }
+        }
+    }
+}
+
+void separableWeightedMorphology(const float* data, int nXSize, int nYSize,
+    const float* rowWeights, const float* colWeights, int kernelSize,
+    float* dilation, float* erosion, int nThreads)
+{
+    int half = kernelSize / 2;
+    size_t nCells = (size_t) nXSize*nYSize;
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    //Positive weights commute with max and min, so the columns are done first along each row...
+    std::vector<float> rowMax(dilation ? nCells : 0);
+    std::vector<float> rowMin(erosion ? nCells : 0);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int i = 0; i < nYSize; ++i)
+    {
+        const float* dataRow = data + ((size_t) i*nXSize);
+        for (int j = 0; j < nXSize; ++j)
+        {
+            int colStart = MAX(j - half, 0);
+            int colEnd = MIN(j + half + 1, nXSize);
+            float dilated = -std::numeric_limits<float>::max();
+            float eroded = std::numeric_limits<float>::max();
+            for (int c = colStart; c < colEnd; ++c)
+            {
+                float v = dataRow[c]*colWeights[c - j + half];
+                dilated = MAX(dilated, v);
+                eroded = MIN(eroded, v);
+            }
+            if (dilation)
+            {
+                rowMax[((size_t) i*nXSize) + j] = dilated;
+            }
+            if (erosion)
+            {
+                rowMin[((size_t) i*nXSize) + j] = eroded;
+            }
+        }
+    }
+
+    //...then down the columns, a whole row of cells at a time
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int i = 0; i < nYSize; ++i)
+    {
+        int rowStart = MAX(i - half, 0);
+        int rowEnd = MIN(i + half + 1, nYSize);
+        float* dilationRow = dilation ? dilation + ((size_t) i*nXSize) : NULL;
+        float* erosionRow = erosion ? erosion + ((size_t) i*nXSize) : NULL;
+        for (int j = 0; j < nXSize; ++j)
+        {
+            if (dilationRow)
+            {
+                dilationRow[j] = -std::numeric_limits<float>::max();
+            }
+            if (erosionRow)
+            {
+                erosionRow[j] = std::numeric_limits<float>::max();
+            }
+        }
+        for (int r = rowStart; r < rowEnd; ++r)
+        {
+            float weight = rowWeights[r - i + half];
+            if (dilationRow)
+            {
+                const float* src = &rowMax[(size_t) r*nXSize];
+                for (int j = 0; j < nXSize; ++j)
+                {
+                    dilationRow[j] = MAX(dilationRow[j], src[j]*weight);
+                }
+            }
+            if (erosionRow)
+            {
+                const float* src = &rowMin[(size_t) r*nXSize];
+                for (int j = 0; j < nXSize; ++j)
+                {
+                    erosionRow[j] = MIN(erosionRow[j], src[j]*weight);
+                }
+            }
+        }
+    }
+}
+
+void categoricalMorphology(const int* categories, int nXSize, int nYSize, int nCategories,
+    const float* kernel, int kernelSize, int rowStart, int nRows,
+    float* dilation, float* erosion, int nThreads)
+{
+    int half = kernelSize / 2;
+    size_t bandSize = (size_t) nRows*nXSize;
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    #pragma omp parallel num_threads(nThreads)
+    {
+        //Window histogram: number of cells and max/min kernel weight for each category
+        std::vector<int> count(nCategories);
+        std::vector<float> maxWeight(nCategories);
+        std::vector<float> minWeight(nCategories);
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < nRows; ++i)
+        {
+            int row = rowStart + i;
+            int windowRowStart = MAX(row - half, 0);
+            int windowRowEnd = MIN(row + half + 1, nYSize);
+            for (int j = 0; j < nXSize; ++j)
+            {
+                int windowColStart = MAX(j - half, 0);
+                int windowColEnd = MIN(j + half + 1, nXSize);
+
+                for (int c = 0; c < nCategories; ++c)
+                {
+                    count[c] = 0;
+                    maxWeight[c] = -std::numeric_limits<float>::max();
+                    minWeight[c] = std::numeric_limits<float>::max();
+                }
+                for (int r = windowRowStart; r < windowRowEnd; ++r)
+                {
+                    const int* categoryRow = categories + ((size_t) r*nXSize);
+                    const float* kernelRow = kernel + ((r - row + half)*kernelSize);
+                    for (int c = windowColStart; c < windowColEnd; ++c)
+                    {
+                        int category = categoryRow[c];
+                        if (category >= 0)
+                        {
+                            float weight = kernelRow[c - j + half];
+                            ++count[category];
+                            maxWeight[category] = MAX(maxWeight[category], weight);
+                            minWeight[category] = MIN(minWeight[category], weight);
+                        }
+                    }
+                }
+
+                //Cells outside a category are 0 in its indicator, so contribute 0 x weight
+                int windowCells = (windowRowEnd - windowRowStart)*(windowColEnd - windowColStart);
+                size_t index = ((size_t) i*nXSize) + j;
+                for (int c = 0; c < nCategories; ++c)
+                {
+                    bool full = count[c] == windowCells;
+                    if (dilation)
+                    {
+                        dilation[(c*bandSize) + index] = full ? maxWeight[c] : MAX(maxWeight[c], 0.0f);
+                    }
+                    if (erosion)
+                    {
+                        erosion[(c*bandSize) + index] = full ? minWeight[c] : MIN(minWeight[c], 0.0f);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/***************************************
+SMOOTHING
+***************************************/
+
+//Normalised convolution of a halo tile: separable weighted sums of value and of weight
+struct NormalisedConvolutionKernel
+{
+    const float* rowWeights;
+    const float* colWeights;
+    int half;
+    float dstNoDataValue;
+
+    void operator()(const float* pafSrc, const HaloTile& tile, float* pafDst, std::vector<double>& scratch) const
+    {
+        //Weighted sums of value and weight along the rows, for each halo row and tile column
+        size_t nRowSums = (size_t) tile.nHaloYLen*tile.nXLen;
+        scratch.resize(2*nRowSums);
+        double* rowValue = &scratch[0];
+        double* rowWeight = &scratch[nRowSums];
+
+        int haloXEnd = tile.nHaloXOff + tile.nHaloXLen;
+        int haloYEnd = tile.nHaloYOff + tile.nHaloYLen;
+
+        //Along the rows...
+        for (int r = 0; r < tile.nHaloYLen; ++r)
+        {
+            const float* srcRow = pafSrc + ((size_t) r*tile.nHaloXLen);
+            for (int j = 0; j < tile.nXLen; ++j)
+            {
+                int x = tile.nXOff + j;
+                int colStart = MAX(x - half, tile.nHaloXOff);
+                int colEnd = MIN(x + half + 1, haloXEnd);
+                double value = 0.0;
+                double weight = 0.0;
+                for (int c = colStart; c < colEnd; ++c)
+                {
+                    float v = srcRow[c - tile.nHaloXOff];
+                    if (v == v)
+                    {
+                        value += colWeights[c - x + half]*v;
+                        weight += colWeights[c - x + half];
+                    }
+                }
+                rowValue[((size_t) r*tile.nXLen) + j] = value;
+                rowWeight[((size_t) r*tile.nXLen) + j] = weight;
+            }
+        }
+
+        //...then down the columns
+        for (int i = 0; i < tile.nYLen; ++i)
+        {
+            int y = tile.nYOff + i;
+            int rowStart = MAX(y - half, tile.nHaloYOff);
+            int rowEnd = MIN(y + half + 1, haloYEnd);
+            const float* srcRow = pafSrc + ((size_t) (y - tile.nHaloYOff)*tile.nHaloXLen) + (tile.nXOff - tile.nHaloXOff);
+            float* dstRow = pafDst + ((size_t) i*tile.nXLen);
+            for (int j = 0; j < tile.nXLen; ++j)
+            {
+                if (srcRow[j] != srcRow[j])
+                {
+                    dstRow[j] = dstNoDataValue;
+                    continue;
+                }
+                double value = 0.0;
+                double weight = 0.0;
+                for (int r = rowStart; r < rowEnd; ++r)
+                {
+                    size_t index = ((size_t) (r - tile.nHaloYOff)*tile.nXLen) + j;
+                    value += rowWeights[r - y + half]*rowValue[index];
+                    weight += rowWeights[r - y + half]*rowWeight[index];
+                }
+                dstRow[j] = weight > 0.0 ? (float) (value / weight) : dstNoDataValue;
+            }
+        }
+    }
+};
+
+CPLErr GDALNormalisedConvolution(GDALRasterBandH srcBand, GDALRasterBandH dstBand,
+    const float* rowWeights, const float* colWeights, int kernelSize,
+    float dstNoDataValue, int nThreads)
+{
+    NormalisedConvolutionKernel kernel;
+    kernel.rowWeights = rowWeights;
+    kernel.colWeights = colWeights;
+    kernel.half = kernelSize / 2;
+    kernel.dstNoDataValue = dstNoDataValue;
+
+    return GDALHaloTileProcessing(srcBand, dstBand, kernel.half, kernel, nThreads);
+}
+
+//Bilateral filter of a halo tile, spatial weights are precomputed for the whole kernel
+struct BilateralKernel
+{
+    const float* spatialWeights;
+    int kernelSize;
+    double rangeScale;
+    float dstNoDataValue;
+
+    void operator()(const float* pafSrc, const HaloTile& tile, float* pafDst, std::vector<double>&) const
+    {
+        int half = kernelSize / 2;
+        int haloXEnd = tile.nHaloXOff + tile.nHaloXLen;
+        int haloYEnd = tile.nHaloYOff + tile.nHaloYLen;
+
+        for (int i = 0; i < tile.nYLen; ++i)
+        {
+            int y = tile.nYOff + i;
+            int rowStart = MAX(y - half, tile.nHaloYOff);
+            int rowEnd = MIN(y + half + 1, haloYEnd);
+            float* dstRow = pafDst + ((size_t) i*tile.nXLen);
+            for (int j = 0; j < tile.nXLen; ++j)
+            {
+                int x = tile.nXOff + j;
+                float centre = pafSrc[((size_t) (y - tile.nHaloYOff)*tile.nHaloXLen) + (x - tile.nHaloXOff)];
+                if (centre != centre)
+                {
+                    dstRow[j] = dstNoDataValue;
+                    continue;
+                }
+                int colStart = MAX(x - half, tile.nHaloXOff);
+                int colEnd = MIN(x + half + 1, haloXEnd);
+                double value = 0.0;
+                double weight = 0.0;
+                for (int r = rowStart; r < rowEnd; ++r)
+                {
+                    const float* srcRow = pafSrc + ((size_t) (r - tile.nHaloYOff)*tile.nHaloXLen);
+                    const float* kernelRow = spatialWeights + ((r - y + half)*kernelSize);
+                    for (int c = colStart; c < colEnd; ++c)
+                    {
+                        float v = srcRow[c - tile.nHaloXOff];
+                        if (v == v)
+                        {
+                            double difference = v - centre;
+                            double w = kernelRow[c - x + half]*exp(difference*difference*rangeScale);
+                            value += w*v;
+                            weight += w;
+                        }
+                    }
+                }
+                //The centre always has weight 1
+                dstRow[j] = (float) (value / weight);
+            }
+        }
+    }
+};
+
+CPLErr GDALBilateralFilter(GDALRasterBandH srcBand, GDALRasterBandH dstBand,
+    int kernelSize, double spatialSigma, double rangeSigma,
+    float dstNoDataValue, int nThreads)
+{
+    int half = kernelSize / 2;
+    std::vector<float> spatialWeights((size_t) kernelSize*kernelSize);
+    for (int r = 0; r < kernelSize; ++r)
+    {
+        for (int c = 0; c < kernelSize; ++c)
+        {
+            double distance2 = (double) ((r - half)*(r - half) + (c - half)*(c - half));
+            spatialWeights[(r*kernelSize) + c] = (float) exp(-distance2 / (2.0*spatialSigma*spatialSigma));
+        }
+    }
+
+    BilateralKernel kernel;
+    kernel.spatialWeights = &spatialWeights[0];
+    kernel.kernelSize = kernelSize;
+    kernel.rangeScale = -1.0 / (2.0*rangeSigma*rangeSigma);
+    kernel.dstNoDataValue = dstNoDataValue;
+
+    return GDALHaloTileProcessing(srcBand, dstBand, half, kernel, nThreads);
+}
+
+/***************************************
+BLENDING
+***************************************/
+
+//Blend of a base tile with the warped overlay under it, read with a halo for feathering
+struct BlendKernel
+{
+    //Warped overlay for each thread, or one shared by all when serialiseOverlay is set
+    std::vector<GDALRasterBandH> overlayBands;
+    bool serialiseOverlay;
+    bool overlayIsBase;
+    int footprint[4];
+    float overlayNoDataValue;
+    RF::BlendMethod method;
+    double baseWeight;
+    double overlayWeight;
+    double offset;
+    int featherCells;
+    float dstNoDataValue;
+
+    //Warping happens in the read, so it only takes a lock when the overlay handle is shared
+    CPLErr readOverlay(int nXOff, int nYOff, int nXLen, int nYLen, double* pafData, int nLineSpace) const
+    {
+        CPLErr eErr;
+        if (!serialiseOverlay)
+        {
+            int thread = 0;
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            eErr = GDALRasterIO(overlayBands[thread], GF_Read, nXOff, nYOff, nXLen, nYLen,
+                                pafData, nXLen, nYLen, GDT_Float64, 0, nLineSpace);
+        }
+        else if (overlayIsBase)
+        {
+            #pragma omp critical(HaloTileIO)
+            {
+                eErr = GDALRasterIO(overlayBands[0], GF_Read, nXOff, nYOff, nXLen, nYLen,
+                                    pafData, nXLen, nYLen, GDT_Float64, 0, nLineSpace);
+            }
+        }
+        else
+        {
+            #pragma omp critical(BlendOverlayIO)
+            {
+                eErr = GDALRasterIO(overlayBands[0], GF_Read, nXOff, nYOff, nXLen, nYLen,
+                                    pafData, nXLen, nYLen, GDT_Float64, 0, nLineSpace);
+            }
+        }
+        return eErr;
+    }
+
+    void operator()(const float* pafSrc, const HaloTile& tile, float* pafDst, std::vector<double>& scratch) const
+    {
+        size_t nHaloCells = (size_t) tile.nHaloXLen*tile.nHaloYLen;
+        scratch.resize(2*nHaloCells);
+        double* overlay = &scratch[0];
+        double* rowDistance = &scratch[nHaloCells];
+
+        //Overlay under the halo, NaN off its footprint
+        for (size_t i = 0; i < nHaloCells; ++i)
+        {
+            overlay[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+        int nXStart = MAX(tile.nHaloXOff, footprint[0]);
+        int nYStart = MAX(tile.nHaloYOff, footprint[1]);
+        int nXEnd = MIN(tile.nHaloXOff + tile.nHaloXLen, footprint[0] + footprint[2]);
+        int nYEnd = MIN(tile.nHaloYOff + tile.nHaloYLen, footprint[1] + footprint[3]);
+        if (!overlayBands.empty() && nXStart < nXEnd && nYStart < nYEnd)
+        {
+            CPLErr eErr = readOverlay(nXStart - footprint[0], nYStart - footprint[1],
+                                      nXEnd - nXStart, nYEnd - nYStart,
+                                      overlay + ((size_t) (nYStart - tile.nHaloYOff)*tile.nHaloXLen) + (nXStart - tile.nHaloXOff),
+                                      (int) (sizeof(double)*tile.nHaloXLen));
+            if (eErr != CE_None)
+            {
+                #pragma omp critical(HaloTileErr)
+                {
+                    std::cout << QString("ERROR: Cannot read overlay at %1, %2, using base only").arg(nXStart).arg(nYStart) + "\n";
+                }
+                for (size_t i = 0; i < nHaloCells; ++i)
+                {
+                    overlay[i] = std::numeric_limits<double>::quiet_NaN();
+                }
+            }
+            for (size_t i = 0; i < nHaloCells; ++i)
+            {
+                if (overlay[i] == overlayNoDataValue)
+                {
+                    overlay[i] = std::numeric_limits<double>::quiet_NaN();
+                }
+            }
+        }
+
+        bool feather = method == RF::FEATHERBLEND && featherCells > 0;
+        if (feather)
+        {
+            //Distance along each row to the nearest cell without overlay, capped past featherCells
+            double farDistance = featherCells + 1.0;
+            for (int r = 0; r < tile.nHaloYLen; ++r)
+            {
+                const double* overlayRow = overlay + ((size_t) r*tile.nHaloXLen);
+                double* distanceRow = rowDistance + ((size_t) r*tile.nHaloXLen);
+                double distance = farDistance;
+                for (int c = 0; c < tile.nHaloXLen; ++c)
+                {
+                    distance = overlayRow[c] == overlayRow[c] ? MIN(distance + 1.0, farDistance) : 0.0;
+                    distanceRow[c] = distance;
+                }
+                distance = farDistance;
+                for (int c = tile.nHaloXLen - 1; c >= 0; --c)
+                {
+                    distance = overlayRow[c] == overlayRow[c] ? MIN(distance + 1.0, farDistance) : 0.0;
+                    distanceRow[c] = MIN(distanceRow[c], distance);
+                }
+            }
+        }
+
+        for (int i = 0; i < tile.nYLen; ++i)
+        {
+            int y = tile.nYOff + i;
+            const float* baseRow = pafSrc + ((size_t) (y - tile.nHaloYOff)*tile.nHaloXLen) + (tile.nXOff - tile.nHaloXOff);
+            const double* overlayRow = overlay + ((size_t) (y - tile.nHaloYOff)*tile.nHaloXLen) + (tile.nXOff - tile.nHaloXOff);
+            float* dstRow = pafDst + ((size_t) i*tile.nXLen);
+            for (int j = 0; j < tile.nXLen; ++j)
+            {
+                float base = baseRow[j];
+                double over = overlayRow[j];
+                if (over != over)
+                {
+                    dstRow[j] = base == base ? base : dstNoDataValue;
+                    continue;
+                }
+                if (base != base)
+                {
+                    dstRow[j] = (float) over;
+                    continue;
+                }
+                switch (method)
+                {
+                case RF::WEIGHTEDBLEND:
+                    dstRow[j] = (float) (baseWeight*base + overlayWeight*over + offset);
+                    break;
+                case RF::MAXBLEND:
+                    dstRow[j] = (float) MAX((double) base, over);
+                    break;
+                case RF::MINBLEND:
+                    dstRow[j] = (float) MIN((double) base, over);
+                    break;
+                case RF::FEATHERBLEND:
+                {
+                    double weight = 1.0;
+                    if (feather)
+                    {
+                        //Nearest cell without overlay, from the row distances above and below
+                        int x = tile.nXOff + j - tile.nHaloXOff;
+                        int rowStart = MAX(y - featherCells, tile.nHaloYOff);
+                        int rowEnd = MIN(y + featherCells + 1, tile.nHaloYOff + tile.nHaloYLen);
+                        double distance2 = (double) featherCells*featherCells;
+                        for (int r = rowStart; r < rowEnd; ++r)
+                        {
+                            double dx = rowDistance[((size_t) (r - tile.nHaloYOff)*tile.nHaloXLen) + x];
+                            distance2 = MIN(distance2, (r - y)*(r - y) + dx*dx);
+                        }
+                        weight = sqrt(distance2) / featherCells;
+                    }
+                    dstRow[j] = (float) (base + weight*(over - base));
+                    break;
+                }
+                }
+            }
+        }
+    }
+};
+
+CPLErr GDALBlendOverlay(GDALDatasetH baseDataset, GDALDatasetH overlayDataset, GDALRasterBandH dstBand,
+    RF::BlendMethod method, double baseWeight, double overlayWeight, double offset, int featherCells,
+    GDALResampleAlg resampleAlg, float dstNoDataValue, int nThreads)
+{
+    int nXSize = GDALGetRasterXSize(baseDataset);
+    int nYSize = GDALGetRasterYSize(baseDataset);
+
+    double baseTransform[6], overlayTransform[6];
+    GDALGetGeoTransform(baseDataset, baseTransform);
+    GDALGetGeoTransform(overlayDataset, overlayTransform);
+
+    //Reproject only when both layers have a coordinate system and they differ
+    const char* baseWkt = GDALGetProjectionRef(baseDataset);
+    const char* overlayWkt = GDALGetProjectionRef(overlayDataset);
+    if (baseWkt == NULL || overlayWkt == NULL || strlen(baseWkt) == 0 || strlen(overlayWkt) == 0 || EQUAL(baseWkt, overlayWkt))
+    {
+        baseWkt = NULL;
+        overlayWkt = NULL;
+    }
+
+    //Footprint of the overlay on the base grid, from points around its edge
+    void* hTransformArg = GDALCreateGenImgProjTransformer3(overlayWkt, overlayTransform, baseWkt, baseTransform);
+    if (hTransformArg == NULL)
+    {
+        std::cout << QString("ERROR: Cannot transform overlay coordinates to base coordinates") + "\n";
+        return CE_Failure;
+    }
+    const int nEdgeSamples = 21;
+    double overlayXSize = GDALGetRasterXSize(overlayDataset);
+    double overlayYSize = GDALGetRasterYSize(overlayDataset);
+    std::vector<double> x, y, z;
+    for (int s = 0; s < nEdgeSamples; ++s)
+    {
+        double t = (double) s / (nEdgeSamples - 1);
+        x.push_back(t*overlayXSize); y.push_back(0.0);
+        x.push_back(t*overlayXSize); y.push_back(overlayYSize);
+        x.push_back(0.0);            y.push_back(t*overlayYSize);
+        x.push_back(overlayXSize);   y.push_back(t*overlayYSize);
+    }
+    z.resize(x.size(), 0.0);
+    std::vector<int> success(x.size(), FALSE);
+    GDALGenImgProjTransform(hTransformArg, FALSE, (int) x.size(), &x[0], &y[0], &z[0], &success[0]);
+    GDALDestroyGenImgProjTransformer(hTransformArg);
+
+    double minX = std::numeric_limits<double>::max(), maxX = -std::numeric_limits<double>::max();
+    double minY = std::numeric_limits<double>::max(), maxY = -std::numeric_limits<double>::max();
+    for (size_t p = 0; p < x.size(); ++p)
+    {
+        if (success[p])
+        {
+            minX = MIN(minX, x[p]); maxX = MAX(maxX, x[p]);
+            minY = MIN(minY, y[p]); maxY = MAX(maxY, y[p]);
+        }
+    }
+
+    BlendKernel kernel;
+    kernel.footprint[0] = (int) MAX(floor(minX), 0.0);
+    kernel.footprint[1] = (int) MAX(floor(minY), 0.0);
+    kernel.footprint[2] = (int) MIN(ceil(maxX), (double) nXSize) - kernel.footprint[0];
+    kernel.footprint[3] = (int) MIN(ceil(maxY), (double) nYSize) - kernel.footprint[1];
+    kernel.method = method;
+    kernel.baseWeight = baseWeight;
+    kernel.overlayWeight = overlayWeight;
+    kernel.offset = offset;
+    kernel.featherCells = method == RF::FEATHERBLEND ? MAX(featherCells, 0) : 0;
+    kernel.dstNoDataValue = dstNoDataValue;
+
+    int overlayNoData;
+    kernel.overlayNoDataValue = (float) GDALGetRasterNoDataValue(GDALGetRasterBand(overlayDataset, 1), &overlayNoData);
+    if (!overlayNoData)
+    {
+        kernel.overlayNoDataValue = -std::numeric_limits<float>::max();
+    }
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#else
+    nThreads = 1;
+#endif
+
+    //Overlay handles reopened for threads after the first, and the warped VRT over each handle
+    std::vector<GDALDatasetH> overlayCopies;
+    std::vector<GDALDatasetH> warped;
+    kernel.overlayIsBase = overlayDataset == baseDataset;
+    kernel.serialiseOverlay = false;
+
+    if (minX > maxX || kernel.footprint[2] <= 0 || kernel.footprint[3] <= 0)
+    {
+        std::cout << QString("WARNING: Overlay does not overlap the base, output is the base") + "\n";
+        kernel.footprint[2] = 0;
+        kernel.footprint[3] = 0;
+    }
+    else
+    {
+        //A GDAL handle can only be read by one thread at a time, so each thread warps its own copy.
+        //Overlays that cannot be reopened (in memory, or the base itself) share one behind a lock
+        const char* overlayName = GDALGetDescription(overlayDataset);
+        bool reopened = !kernel.overlayIsBase && nThreads > 1 && overlayName != NULL && strlen(overlayName) > 0;
+        if (reopened)
+        {
+            //Overlays straight from an upstream GDALCreate may not be on disk yet
+            GDALFlushCache(overlayDataset);
+        }
+        for (int t = 1; t < nThreads && reopened; ++t)
+        {
+            GDALDatasetH hCopy = GDALOpen(overlayName, GA_ReadOnly);
+            if (hCopy == NULL)
+            {
+                reopened = false;
+                continue;
+            }
+            overlayCopies.push_back(hCopy);
+
+            //A copy that is not the same grid is a different (or stale) file
+            double copyTransform[6];
+            if (GDALGetRasterXSize(hCopy) != GDALGetRasterXSize(overlayDataset) ||
+                GDALGetRasterYSize(hCopy) != GDALGetRasterYSize(overlayDataset) ||
+                GDALGetRasterCount(hCopy) < 1 ||
+                GDALGetGeoTransform(hCopy, copyTransform) != CE_None ||
+                memcmp(copyTransform, overlayTransform, sizeof(copyTransform)) != 0)
+            {
+                reopened = false;
+            }
+        }
+        if (!reopened)
+        {
+            for (size_t c = 0; c < overlayCopies.size(); ++c)
+            {
+                GDALClose(overlayCopies[c]);
+            }
+            overlayCopies.clear();
+            kernel.serialiseOverlay = nThreads > 1;
+        }
+
+        //Base grid over the footprint
+        double footprintTransform[6];
+        memcpy(footprintTransform, baseTransform, sizeof(footprintTransform));
+        footprintTransform[0] = baseTransform[0] + kernel.footprint[0]*baseTransform[1] + kernel.footprint[1]*baseTransform[2];
+        footprintTransform[3] = baseTransform[3] + kernel.footprint[0]*baseTransform[4] + kernel.footprint[1]*baseTransform[5];
+
+        for (size_t v = 0; v <= overlayCopies.size(); ++v)
+        {
+            GDALDatasetH hSource = v == 0 ? overlayDataset : overlayCopies[v - 1];
+
+            GDALWarpOptions* psWarpOptions = GDALCreateWarpOptions();
+            psWarpOptions->hSrcDS = hSource;
+            psWarpOptions->nBandCount = 1;
+            psWarpOptions->panSrcBands = (int *) CPLMalloc(sizeof(int));
+            psWarpOptions->panSrcBands[0] = 1;
+            psWarpOptions->panDstBands = (int *) CPLMalloc(sizeof(int));
+            psWarpOptions->panDstBands[0] = 1;
+            psWarpOptions->eResampleAlg = resampleAlg;
+            psWarpOptions->eWorkingDataType = GDT_Float32;
+            if (overlayNoData)
+            {
+                psWarpOptions->padfSrcNoDataReal = (double *) CPLMalloc(sizeof(double));
+                psWarpOptions->padfSrcNoDataReal[0] = kernel.overlayNoDataValue;
+            }
+            //Cells the overlay does not reach come back as no data
+            psWarpOptions->padfDstNoDataReal = (double *) CPLMalloc(sizeof(double));
+            psWarpOptions->padfDstNoDataReal[0] = kernel.overlayNoDataValue;
+            psWarpOptions->papszWarpOptions = CSLSetNameValue(psWarpOptions->papszWarpOptions, "INIT_DEST", "NO_DATA");
+
+            //The warped VRT owns the transformer
+            psWarpOptions->pTransformerArg = GDALCreateGenImgProjTransformer3(overlayWkt, overlayTransform, baseWkt, footprintTransform);
+            psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
+
+            GDALDatasetH hWarped = GDALCreateWarpedVRT(hSource, kernel.footprint[2], kernel.footprint[3], footprintTransform, psWarpOptions);
+            GDALDestroyWarpOptions(psWarpOptions);
+            if (hWarped == NULL)
+            {
+                break;
+            }
+            warped.push_back(hWarped);
+            kernel.overlayBands.push_back(GDALGetRasterBand(hWarped, 1));
+        }
+    }
+
+    CPLErr eErr = CE_None;
+    if (warped.size() != (kernel.footprint[2] > 0 ? overlayCopies.size() + 1 : 0))
+    {
+        std::cout << QString("ERROR: Cannot warp overlay onto the base grid") + "\n";
+        eErr = CE_Failure;
+    }
+    else
+    {
+        eErr = GDALHaloTileProcessing(GDALGetRasterBand(baseDataset, 1), dstBand, kernel.featherCells, kernel, nThreads);
+    }
+
+    for (size_t v = 0; v < warped.size(); ++v)
+    {
+        GDALClose(warped[v]);
+    }
+    for (size_t c = 0; c < overlayCopies.size(); ++c)
+    {
+        GDALClose(overlayCopies[c]);
+    }
+    return eErr;
+}
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::SlopeAlgType, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::SlopeAlgType, RF::VolcanoPlugin::getInstance())
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::CurvatureType, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::CurvatureType, RF::VolcanoPlugin::getInstance())
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::FlowDirType, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::FlowDirType, RF::VolcanoPlugin::getInstance())
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::FuzzyMembershipType, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::FuzzyMembershipType, RF::VolcanoPlugin::getInstance())
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::FillMethod, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::FillMethod, RF::VolcanoPlugin::getInstance())
+
+DEFINE_WORKSPACE_DATA_FACTORY(RF::BlendMethod, RF::VolcanoPlugin::getInstance())
+DEFINE_WORKSPACE_ENUMTOINTADAPTOR(RF::BlendMethod, RF::VolcanoPlugin::getInstance())
 
 DEFINE_WORKSPACE_DATA_FACTORY(GDALRIOResampleAlg, RF::VolcanoPlugin::getInstance())
 DEFINE_WORKSPACE_ENUMTOINTADAPTOR(GDALRIOResampleAlg, RF::VolcanoPlugin::getInstance())
\ No newline at end of file
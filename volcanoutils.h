@@ -39,6 +39,17 @@
 #define RF_VOLCANOUTILS_H
 
 #include <iostream>
+#include <math.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <qstring.h>
 
@@ -47,10 +58,12 @@
 
 #include "gdal.h"
 #include "gdal_priv.h"
+#include "gdalwarper.h"
 #include "cpl_conv.h"
 #include "cpl_string.h"
 
 #include "volcanoplugin.h"
+#include "rowkernels.h"
 
 #include "Workspace/DataExecution/DataObjects/datafactorytraits.h"
 #include "Workspace/DataExecution/DataObjects/enumtointadaptor.h"
@@ -83,6 +96,21 @@ namespace RF
 		GAUSSIAN
 	};
 
+    enum FillMethod
+    {
+        SINGLECELL,
+        FLOODFLAT,
+        FLOODEPSILON
+    };
+
+    enum BlendMethod
+    {
+        WEIGHTEDBLEND,
+        MAXBLEND,
+        MINBLEND,
+        FEATHERBLEND
+    };
+
 
 	
 }
@@ -117,6 +145,21 @@ namespace CSIRO
 			names.push_back("Gaussian");
 		}
 
+        template <> inline void getEnumNames<RF::FillMethod>(QStringList& names)
+        {
+            names.push_back("Single cell pits (3x3)");
+            names.push_back("Priority-flood (flat)");
+            names.push_back("Priority-flood (epsilon)");
+        }
+
+        template <> inline void getEnumNames<RF::BlendMethod>(QStringList& names)
+        {
+            names.push_back("Weighted sum");
+            names.push_back("Maximum");
+            names.push_back("Minimum");
+            names.push_back("Feathered");
+        }
+
 		template <> inline void getEnumNames<GDALRIOResampleAlg>(QStringList& names)
 		{
 			names.push_back("Nearest neighbour");
@@ -133,6 +176,19 @@ namespace CSIRO
 
 
 
+#ifndef M_PI
+#define M_PI  3.1415926535897932384626433832795
+#endif
+
+#ifndef ROOT_2
+#define ROOT_2 sqrtf(2)
+#endif
+
+#define INTERPOL(a,b) ((srcNoData && (ARE_REAL_EQUAL(a, srcNoDataValue) || ARE_REAL_EQUAL(b, srcNoDataValue))) ? srcNoDataValue : 2 * (a) - (b))
+
+//Target tile edge in cells for the tiled 3x3 processors, rounded up to whole blocks
+#define GENERIC3X3_TILE_SIZE 256
+
 typedef float (*GDALGeneric3x3ProcessingAlg) (float* pafWindow, float fDstNoDataValue, void* pData);//A datatype contatining the 3 line buffer, nodata value and data
 
 //Generic value computer for 3x3 windows
@@ -149,6 +205,712 @@ CPLErr GDALGeneric3x3Processing (GDALRasterBandH srcBand,
                                    void* pData,
                                    bool computeEdges);//Could use progress
 
+//Tiled 3x3 Processor - block aligned tiles with a one cell halo, processed on nThreads (<= 0 uses all cores)
+CPLErr GDALGeneric3x3TiledProcessing (GDALRasterBandH srcBand,
+                                      GDALRasterBandH dstBand,
+                                      GDALGeneric3x3ProcessingAlg pfnAlg,
+                                      void* pData,
+                                      bool computeEdges,
+                                      int nThreads = 0);
+
+/***************************************
+TEMPLATED 3x3 PROCESSING
+Kernels are functors with float operator()(float* afWin, float dstNoDataValue) const,
+passed by type so the compiler can inline them into the cell loop.
+***************************************/
+
+//Base for kernel functors. processRow can be hidden by a kernel with a vectorised version
+//that does a run of interior cells in one go, it returns how many it did
+struct GDALGeneric3x3Kernel
+{
+    inline int processRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                          float* pafOutput, int nCount, const Row3x3NoData& noData) const
+    {
+        return 0;
+    }
+};
+
+/*
+Fill3x3Window: Builds the 3x3 window for cell i,j from a buffer of source rows/columns around it,
+using the same edge rules as GDALGeneric3x3Processing. Returns false if the cell is an uncomputed edge.
+*/
+inline bool Fill3x3Window(const float* pafBuf, int nBufXSize, int nBufXOff, int nBufYOff,
+                          int i, int j, int nXSize, int nYSize,
+                          bool computeEdges, int srcNoData, float srcNoDataValue,
+                          float* afWin)
+{
+#define BUFVAL(r,c) pafBuf[((r) - nBufYOff)*nBufXSize + ((c) - nBufXOff)]
+
+    if (i == 0 || i == nYSize - 1) //First and last lines, interpolate vertically
+    {
+        if (!computeEdges || nXSize < 2 || nYSize < 2)
+        {
+            return false;
+        }
+        int jmin = (j == 0) ? j : j - 1;
+        int jmax = (j == nXSize - 1) ? j : j + 1;
+
+        if (i == 0)
+        {
+            afWin[0] = INTERPOL(BUFVAL(0, jmin), BUFVAL(1, jmin));
+            afWin[1] = INTERPOL(BUFVAL(0, j),    BUFVAL(1, j));
+            afWin[2] = INTERPOL(BUFVAL(0, jmax), BUFVAL(1, jmax));
+            afWin[3] = BUFVAL(0, jmin);
+            afWin[4] = BUFVAL(0, j);
+            afWin[5] = BUFVAL(0, jmax);
+            afWin[6] = BUFVAL(1, jmin);
+            afWin[7] = BUFVAL(1, j);
+            afWin[8] = BUFVAL(1, jmax);
+        }
+        else
+        {
+            afWin[0] = BUFVAL(i-1, jmin);
+            afWin[1] = BUFVAL(i-1, j);
+            afWin[2] = BUFVAL(i-1, jmax);
+            afWin[3] = BUFVAL(i, jmin);
+            afWin[4] = BUFVAL(i, j);
+            afWin[5] = BUFVAL(i, jmax);
+            afWin[6] = INTERPOL(BUFVAL(i, jmin), BUFVAL(i-1, jmin));
+            afWin[7] = INTERPOL(BUFVAL(i, j),    BUFVAL(i-1, j));
+            afWin[8] = INTERPOL(BUFVAL(i, jmax), BUFVAL(i-1, jmax));
+        }
+        return true;
+    }
+
+    if (j == 0 || j == nXSize - 1) //First and last columns, interpolate horizontally
+    {
+        if (!computeEdges || nXSize < 2)
+        {
+            return false;
+        }
+        if (j == 0)
+        {
+            afWin[0] = INTERPOL(BUFVAL(i-1, j), BUFVAL(i-1, j+1));
+            afWin[1] = BUFVAL(i-1, j);
+            afWin[2] = BUFVAL(i-1, j+1);
+            afWin[3] = INTERPOL(BUFVAL(i, j), BUFVAL(i, j+1));
+            afWin[4] = BUFVAL(i, j);
+            afWin[5] = BUFVAL(i, j+1);
+            afWin[6] = INTERPOL(BUFVAL(i+1, j), BUFVAL(i+1, j+1));
+            afWin[7] = BUFVAL(i+1, j);
+            afWin[8] = BUFVAL(i+1, j+1);
+        }
+        else
+        {
+            afWin[0] = BUFVAL(i-1, j-1);
+            afWin[1] = BUFVAL(i-1, j);
+            afWin[2] = INTERPOL(BUFVAL(i-1, j), BUFVAL(i-1, j-1));
+            afWin[3] = BUFVAL(i, j-1);
+            afWin[4] = BUFVAL(i, j);
+            afWin[5] = INTERPOL(BUFVAL(i, j), BUFVAL(i, j-1));
+            afWin[6] = BUFVAL(i+1, j-1);
+            afWin[7] = BUFVAL(i+1, j);
+            afWin[8] = INTERPOL(BUFVAL(i+1, j), BUFVAL(i+1, j-1));
+        }
+        return true;
+    }
+
+    afWin[0] = BUFVAL(i-1, j-1);
+    afWin[1] = BUFVAL(i-1, j);
+    afWin[2] = BUFVAL(i-1, j+1);
+    afWin[3] = BUFVAL(i, j-1);
+    afWin[4] = BUFVAL(i, j);
+    afWin[5] = BUFVAL(i, j+1);
+    afWin[6] = BUFVAL(i+1, j-1);
+    afWin[7] = BUFVAL(i+1, j);
+    afWin[8] = BUFVAL(i+1, j+1);
+    return true;
+
+#undef BUFVAL
+}
+
+/*
+ComputeKernelVal: ComputeVal for kernel functors, the nodata test is resolved at compile time
+*/
+template <bool bSrcNoData, class Kernel>
+inline float ComputeKernelVal(float srcNoDataValue, float* afWin, float dstNoDataValue,
+                              const Kernel& kernel, bool computeEdges)
+{
+    if (bSrcNoData)
+    {
+        if (ARE_REAL_EQUAL(afWin[4], srcNoDataValue))//Do not calculate if no data
+        {
+            return dstNoDataValue;
+        }
+        for (int k = 0; k < 9; k++)
+        {
+            if (ARE_REAL_EQUAL(afWin[k], srcNoDataValue))//Check each cell for nodata
+            {
+                if (computeEdges)
+                {
+                    afWin[k] = afWin[4]; //Set the edge to the centre cell value (ok for gradient)
+                }
+                else
+                {
+                    return dstNoDataValue;
+                }
+            }
+        }
+    }
+    return kernel(afWin, dstNoDataValue);
+}
+
+/*
+Process3x3KernelTile: Runs the kernel over one tile of nXLen x nYLen cells at nXOff, nYOff
+*/
+template <bool bSrcNoData, class Kernel>
+void Process3x3KernelTile(const float* pafBuf, int nBufXSize, int nBufXOff, int nBufYOff,
+                          int nXOff, int nYOff, int nXLen, int nYLen, int nXSize, int nYSize,
+                          float srcNoDataValue, float dstNoDataValue,
+                          const Kernel& kernel, bool computeEdges, float* pafOutput)
+{
+    Row3x3NoData rowNoData;
+    rowNoData.srcNoData = bSrcNoData;
+    rowNoData.srcNoDataValue = srcNoDataValue;
+    rowNoData.dstNoDataValue = dstNoDataValue;
+    rowNoData.computeEdges = computeEdges;
+
+    for (int i = nYOff; i < nYOff + nYLen; ++i)
+    {
+        float* pafOutputLine = pafOutput + (i - nYOff)*nXLen;
+        bool bEdgeLine = (i == 0 || i == nYSize - 1);
+
+        //Interior cells read straight from the three buffer lines
+        int jStart = bEdgeLine ? nXOff + nXLen : MAX(nXOff, 1);
+        int jEnd = bEdgeLine ? nXOff + nXLen : MIN(nXOff + nXLen, nXSize - 1);
+        if (!bEdgeLine)
+        {
+            const float* pafLine1 = pafBuf + (i - 1 - nBufYOff)*nBufXSize + (jStart - nBufXOff);
+            const float* pafLine2 = pafLine1 + nBufXSize;
+            const float* pafLine3 = pafLine2 + nBufXSize;
+            float* pafOut = pafOutputLine + (jStart - nXOff);
+            int nRowDone = kernel.processRow(pafLine1, pafLine2, pafLine3, pafOut, jEnd - jStart, rowNoData);
+            for (int k = nRowDone; k < jEnd - jStart; ++k)
+            {
+                float afWin[9];
+                afWin[0] = pafLine1[k-1];
+                afWin[1] = pafLine1[k];
+                afWin[2] = pafLine1[k+1];
+                afWin[3] = pafLine2[k-1];
+                afWin[4] = pafLine2[k];
+                afWin[5] = pafLine2[k+1];
+                afWin[6] = pafLine3[k-1];
+                afWin[7] = pafLine3[k];
+                afWin[8] = pafLine3[k+1];
+
+                pafOut[k] = ComputeKernelVal<bSrcNoData>(srcNoDataValue, afWin, dstNoDataValue,
+                                                         kernel, computeEdges);
+            }
+        }
+
+        //Edge cells go through the scanline edge rules
+        for (int j = nXOff; j < nXOff + nXLen; ++j)
+        {
+            if (j >= jStart && j < jEnd)
+            {
+                j = jEnd - 1;
+                continue;
+            }
+            float afWin[9];
+            if (Fill3x3Window(pafBuf, nBufXSize, nBufXOff, nBufYOff,
+                              i, j, nXSize, nYSize,
+                              computeEdges, bSrcNoData, srcNoDataValue, afWin))
+            {
+                pafOutputLine[j - nXOff] = ComputeKernelVal<bSrcNoData>(srcNoDataValue, afWin, dstNoDataValue,
+                                                                        kernel, computeEdges);
+            }
+            else
+            {
+                pafOutputLine[j - nXOff] = dstNoDataValue;
+            }
+        }
+    }
+}
+
+/*
+GDALGeneric3x3Tile: One tile read by GDALGeneric3x3MultiProcessing, the source buffer covers the tile plus halo
+*/
+typedef struct
+{
+    const float* pafBuf;
+    int nBufXSize;
+    int nBufXOff;
+    int nBufYOff;
+    int nXOff;          //Cells to compute
+    int nYOff;
+    int nXLen;
+    int nYLen;
+    int nXSize;         //Raster size
+    int nYSize;
+    int srcNoData;      //Really a bool
+    float srcNoDataValue;
+    bool computeEdges;
+} GDALGeneric3x3Tile;
+
+/*
+Run3x3KernelOnTile: Process3x3KernelTile with the nodata variant picked for the tile
+*/
+template <class Kernel>
+inline void Run3x3KernelOnTile(const GDALGeneric3x3Tile& tile, const Kernel& kernel,
+                               float dstNoDataValue, float* pafOutput)
+{
+    if (tile.srcNoData)
+    {
+        Process3x3KernelTile<true>(tile.pafBuf, tile.nBufXSize, tile.nBufXOff, tile.nBufYOff,
+                                   tile.nXOff, tile.nYOff, tile.nXLen, tile.nYLen, tile.nXSize, tile.nYSize,
+                                   tile.srcNoDataValue, dstNoDataValue, kernel, tile.computeEdges, pafOutput);
+    }
+    else
+    {
+        Process3x3KernelTile<false>(tile.pafBuf, tile.nBufXSize, tile.nBufXOff, tile.nBufYOff,
+                                    tile.nXOff, tile.nYOff, tile.nXLen, tile.nYLen, tile.nXSize, tile.nYSize,
+                                    tile.srcNoDataValue, dstNoDataValue, kernel, tile.computeEdges, pafOutput);
+    }
+}
+
+/*
+Tiled 3x3 grid processor writing several output bands from one read of the source.
+tileFn(iBand, tile, dstNoDataValue, pafOutput) fills the nXLen x nYLen cells of output iBand for the tile.
+The source band cannot be one of the outputs.
+*/
+template <class TileFn>
+CPLErr GDALGeneric3x3MultiProcessing (GDALRasterBandH srcBand,
+                                      int nDstBands,
+                                      GDALRasterBandH* pahDstBands,
+                                      const TileFn& tileFn,
+                                      bool computeEdges,
+                                      int nThreads = 0)
+{
+    for (int b = 0; b < nDstBands; ++b)
+    {
+        if (srcBand == pahDstBands[b])
+        {
+            std::cout << QString("ERROR: Tiled 3x3 processing cannot run in place") + "\n";
+            return CE_Failure;
+        }
+    }
+
+    int srcNoData; //Really a bool
+    float srcNoDataValue;
+
+    srcNoDataValue = (float) GDALGetRasterNoDataValue(srcBand, &srcNoData);
+
+    std::vector<float> dstNoDataValues(nDstBands);
+    for (int b = 0; b < nDstBands; ++b)
+    {
+        int dstNoData;
+        dstNoDataValues[b] = (float) GDALGetRasterNoDataValue(pahDstBands[b], &dstNoData);
+        if (!dstNoData)
+        {
+            dstNoDataValues[b] = 0.0;
+        }
+    }
+
+    int nXSize = GDALGetRasterBandXSize(srcBand); //Get length of raster
+    int nYSize = GDALGetRasterBandYSize(srcBand);
+
+    //Tiles are whole multiples of the source block size
+    int nBlockXSize, nBlockYSize;
+    GDALGetBlockSize(srcBand, &nBlockXSize, &nBlockYSize);
+    nBlockXSize = MAX(nBlockXSize, 1);
+    nBlockYSize = MAX(nBlockYSize, 1);
+
+    int nTileXSize = MIN(nXSize, ((GENERIC3X3_TILE_SIZE + nBlockXSize - 1)/nBlockXSize)*nBlockXSize);
+    int nTileYSize = MIN(nYSize, ((GENERIC3X3_TILE_SIZE + nBlockYSize - 1)/nBlockYSize)*nBlockYSize);
+    if (nTileXSize <= 0 || nTileYSize <= 0 || nDstBands <= 0)
+    {
+        return CE_None;
+    }
+
+    int nTilesX = (nXSize + nTileXSize - 1)/nTileXSize;
+    int nTilesY = (nYSize + nTileYSize - 1)/nTileYSize;
+    int nTiles = nTilesX*nTilesY;
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    CPLErr eErr = CE_None;
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int t = 0; t < nTiles; ++t)
+    {
+        GDALGeneric3x3Tile tile;
+        tile.nXOff = (t % nTilesX)*nTileXSize;
+        tile.nYOff = (t / nTilesX)*nTileYSize;
+        tile.nXLen = MIN(nTileXSize, nXSize - tile.nXOff);
+        tile.nYLen = MIN(nTileYSize, nYSize - tile.nYOff);
+        tile.nXSize = nXSize;
+        tile.nYSize = nYSize;
+        tile.srcNoData = srcNoData;
+        tile.srcNoDataValue = srcNoDataValue;
+        tile.computeEdges = computeEdges;
+
+        //Tile plus a one cell halo, clipped to the raster
+        tile.nBufXOff = MAX(tile.nXOff - 1, 0);
+        tile.nBufYOff = MAX(tile.nYOff - 1, 0);
+        tile.nBufXSize = MIN(tile.nXOff + tile.nXLen + 1, nXSize) - tile.nBufXOff;
+        int nBufYSize = MIN(tile.nYOff + tile.nYLen + 1, nYSize) - tile.nBufYOff;
+
+        std::vector<float> srcBuf(tile.nBufXSize*nBufYSize);
+        std::vector<float> dstBuf(tile.nXLen*tile.nYLen);
+        tile.pafBuf = &srcBuf[0];
+
+        CPLErr eTileErr;
+        #pragma omp critical(Generic3x3TiledIO)
+        {
+            eTileErr = GDALRasterIO(srcBand, GF_Read,
+                                    tile.nBufXOff, tile.nBufYOff,
+                                    tile.nBufXSize, nBufYSize,
+                                    &srcBuf[0],
+                                    tile.nBufXSize, nBufYSize,
+                                    GDT_Float32,
+                                    0, 0);
+        }
+        if (eTileErr != CE_None)
+        {
+            #pragma omp critical(Generic3x3TiledErr)
+            {
+                std::cout << QString("ERROR: Cannot read tile at %1, %2").arg(tile.nXOff).arg(tile.nYOff) + "\n";
+                eErr = eTileErr;
+            }
+            continue;
+        }
+
+        for (int b = 0; b < nDstBands; ++b)
+        {
+            tileFn(b, tile, dstNoDataValues[b], &dstBuf[0]);
+
+            #pragma omp critical(Generic3x3TiledIO)
+            {
+                eTileErr = GDALRasterIO(pahDstBands[b], GF_Write,
+                                        tile.nXOff, tile.nYOff,
+                                        tile.nXLen, tile.nYLen,
+                                        &dstBuf[0],
+                                        tile.nXLen, tile.nYLen,
+                                        GDT_Float32,
+                                        0, 0);
+            }
+            if (eTileErr != CE_None)
+            {
+                #pragma omp critical(Generic3x3TiledErr)
+                {
+                    std::cout << QString("ERROR: Cannot write tile at %1, %2").arg(tile.nXOff).arg(tile.nYOff) + "\n";
+                    eErr = eTileErr;
+                }
+            }
+        }
+    }
+
+    return eErr;
+}
+
+//Tile function running a single kernel
+template <class Kernel>
+struct GDALGeneric3x3KernelTileFn
+{
+    const Kernel& kernel;
+
+    explicit GDALGeneric3x3KernelTileFn(const Kernel& k) : kernel(k) {}
+
+    inline void operator()(int iBand, const GDALGeneric3x3Tile& tile, float dstNoDataValue, float* pafOutput) const
+    {
+        Run3x3KernelOnTile(tile, kernel, dstNoDataValue, pafOutput);
+    }
+};
+
+/*
+Tiled 3x3 grid processor for kernel functors - srcBand and dstBand must differ
+*/
+template <class Kernel>
+CPLErr GDALGeneric3x3KernelProcessing (GDALRasterBandH srcBand,
+                                       GDALRasterBandH dstBand,
+                                       const Kernel& kernel,
+                                       bool computeEdges,
+                                       int nThreads = 0)
+{
+    return GDALGeneric3x3MultiProcessing(srcBand, 1, &dstBand, GDALGeneric3x3KernelTileFn<Kernel>(kernel),
+                                         computeEdges, nThreads);
+}
+
+//Compatibility kernel wrapping a GDALGeneric3x3ProcessingAlg function pointer
+struct GDALGeneric3x3AlgKernel : public GDALGeneric3x3Kernel
+{
+    GDALGeneric3x3ProcessingAlg pfnAlg;
+    void* pData;
+
+    GDALGeneric3x3AlgKernel(GDALGeneric3x3ProcessingAlg alg, void* data) : pfnAlg(alg), pData(data) {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        return pfnAlg(afWin, dstNoDataValue, pData);
+    }
+};
+
+
+
+/***************************************
+PIXELWISE PROCESSING
+Kernels are functors with void operator()(const float* const* papafSrc, float* pafDst, int nCount) const,
+papafSrc[b] holds nCount cells of source band b read as float (GDAL converts other types).
+***************************************/
+
+//Cells in a chunk of the pixelwise processor, rounded to whole source blocks
+#define PIXELWISE_CHUNK_CELLS 65536
+
+/*
+Streams the source bands and dstBand through in chunks of whole source blocks, running the
+kernel on each chunk on nThreads (<= 0 uses all cores). Each thread keeps one set of chunk buffers,
+so memory does not grow with the raster. All bands must be the same size.
+*/
+template <class Kernel>
+CPLErr GDALPixelwiseProcessing (int nSrcBands,
+                                GDALRasterBandH* pahSrcBands,
+                                GDALRasterBandH dstBand,
+                                const Kernel& kernel,
+                                int nThreads = 0)
+{
+    int nXSize = GDALGetRasterBandXSize(dstBand);
+    int nYSize = GDALGetRasterBandYSize(dstBand);
+    for (int b = 0; b < nSrcBands; ++b)
+    {
+        if (GDALGetRasterBandXSize(pahSrcBands[b]) != nXSize || GDALGetRasterBandYSize(pahSrcBands[b]) != nYSize)
+        {
+            std::cout << QString("ERROR: Raster band sizes are not equal, band %1 is %2 x %3 and output is %4 x %5").arg(b + 1)
+                .arg(GDALGetRasterBandXSize(pahSrcBands[b])).arg(GDALGetRasterBandYSize(pahSrcBands[b])).arg(nXSize).arg(nYSize) + "\n";
+            return CE_Failure;
+        }
+    }
+
+    //Chunks are whole blocks of the first source (or the output), grown to PIXELWISE_CHUNK_CELLS
+    int nBlockXSize, nBlockYSize;
+    GDALGetBlockSize(nSrcBands > 0 ? pahSrcBands[0] : dstBand, &nBlockXSize, &nBlockYSize);
+    nBlockXSize = MAX(MIN(nBlockXSize, nXSize), 1);
+    nBlockYSize = MAX(MIN(nBlockYSize, nYSize), 1);
+    int nChunkXSize = nBlockXSize;
+    int nChunkYSize = nBlockYSize;
+    if (nChunkXSize == nXSize)
+    {
+        nChunkYSize = MIN(nYSize, MAX(1, PIXELWISE_CHUNK_CELLS / (nChunkXSize*nBlockYSize))*nBlockYSize);
+    }
+    if (nChunkXSize <= 0 || nChunkYSize <= 0)
+    {
+        return CE_None;
+    }
+
+    int nChunksX = (nXSize + nChunkXSize - 1)/nChunkXSize;
+    int nChunksY = (nYSize + nChunkYSize - 1)/nChunkYSize;
+    int nChunks = nChunksX*nChunksY;
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    CPLErr eErr = CE_None;
+
+    #pragma omp parallel num_threads(nThreads)
+    {
+        std::vector<float> buffers(((size_t) nSrcBands + 1)*nChunkXSize*nChunkYSize);
+        std::vector<const float*> papafSrc(MAX(nSrcBands, 1));
+
+        #pragma omp for schedule(dynamic)
+        for (int c = 0; c < nChunks; ++c)
+        {
+            int nXOff = (c % nChunksX)*nChunkXSize;
+            int nYOff = (c / nChunksX)*nChunkYSize;
+            int nXLen = MIN(nChunkXSize, nXSize - nXOff);
+            int nYLen = MIN(nChunkYSize, nYSize - nYOff);
+            int nCount = nXLen*nYLen;
+            float* pafDst = &buffers[(size_t) nSrcBands*nCount];
+
+            CPLErr eChunkErr = CE_None;
+            #pragma omp critical(PixelwiseIO)
+            {
+                for (int b = 0; b < nSrcBands && eChunkErr == CE_None; ++b)
+                {
+                    papafSrc[b] = &buffers[(size_t) b*nCount];
+                    eChunkErr = GDALRasterIO(pahSrcBands[b], GF_Read,
+                                             nXOff, nYOff,
+                                             nXLen, nYLen,
+                                             (void*) papafSrc[b],
+                                             nXLen, nYLen,
+                                             GDT_Float32,
+                                             0, 0);
+                }
+            }
+            if (eChunkErr == CE_None)
+            {
+                kernel(&papafSrc[0], pafDst, nCount);
+
+                #pragma omp critical(PixelwiseIO)
+                {
+                    eChunkErr = GDALRasterIO(dstBand, GF_Write,
+                                             nXOff, nYOff,
+                                             nXLen, nYLen,
+                                             pafDst,
+                                             nXLen, nYLen,
+                                             GDT_Float32,
+                                             0, 0);
+                }
+            }
+            if (eChunkErr != CE_None)
+            {
+                #pragma omp critical(PixelwiseErr)
+                {
+                    std::cout << QString("ERROR: Cannot read or write chunk at %1, %2").arg(nXOff).arg(nYOff) + "\n";
+                    eErr = eChunkErr;
+                }
+            }
+        }
+    }
+
+    return eErr;
+}
+
+
+/***************************************
+HALO TILE PROCESSING
+Kernels are functors with void operator()(const float* pafSrc, const HaloTile& tile, float* pafDst,
+std::vector<double>& scratch) const, pafSrc holds the tile and its halo (nHaloXLen x nHaloYLen, no
+data and NaN cells set to NaN), pafDst the nXLen x nYLen tile and scratch is kept per thread.
+***************************************/
+
+//A tile of cells and the window read around it, clipped to the raster
+struct HaloTile
+{
+    int nXOff, nYOff, nXLen, nYLen;
+    int nHaloXOff, nHaloYOff, nHaloXLen, nHaloYLen;
+};
+
+//Side of a halo tile in cells, rounded to whole source blocks where they are smaller
+#define HALO_TILE_SIZE 1024
+
+/*
+Streams srcBand to dstBand in tiles, reading nHalo extra cells around each so kernels can look at
+neighbours across tile edges. Tiles run on nThreads (<= 0 uses all cores), each thread keeps its
+own buffers, so memory is a few tiles per thread whatever the raster size.
+*/
+template <class Kernel>
+CPLErr GDALHaloTileProcessing (GDALRasterBandH srcBand,
+                               GDALRasterBandH dstBand,
+                               int nHalo,
+                               const Kernel& kernel,
+                               int nThreads = 0)
+{
+    int nXSize = GDALGetRasterBandXSize(srcBand);
+    int nYSize = GDALGetRasterBandYSize(srcBand);
+    if (GDALGetRasterBandXSize(dstBand) != nXSize || GDALGetRasterBandYSize(dstBand) != nYSize)
+    {
+        std::cout << QString("ERROR: Raster band sizes are not equal, source is %1 x %2 and output is %3 x %4").arg(nXSize).arg(nYSize)
+            .arg(GDALGetRasterBandXSize(dstBand)).arg(GDALGetRasterBandYSize(dstBand)) + "\n";
+        return CE_Failure;
+    }
+    if (nXSize <= 0 || nYSize <= 0)
+    {
+        return CE_None;
+    }
+
+    int srcNoData;
+    float srcNoDataValue = (float) GDALGetRasterNoDataValue(srcBand, &srcNoData);
+
+    //Tiles are whole source blocks where blocks are smaller than HALO_TILE_SIZE
+    int nBlockXSize, nBlockYSize;
+    GDALGetBlockSize(srcBand, &nBlockXSize, &nBlockYSize);
+    nBlockXSize = MAX(nBlockXSize, 1);
+    nBlockYSize = MAX(nBlockYSize, 1);
+    int nTileXSize = MIN(nXSize, nBlockXSize < HALO_TILE_SIZE ? (HALO_TILE_SIZE / nBlockXSize)*nBlockXSize : HALO_TILE_SIZE);
+    int nTileYSize = MIN(nYSize, nBlockYSize < HALO_TILE_SIZE ? (HALO_TILE_SIZE / nBlockYSize)*nBlockYSize : HALO_TILE_SIZE);
+
+    int nTilesX = (nXSize + nTileXSize - 1)/nTileXSize;
+    int nTilesY = (nYSize + nTileYSize - 1)/nTileYSize;
+    int nTiles = nTilesX*nTilesY;
+
+    //Largest tile with its halo
+    size_t nHaloXSize = MIN(nXSize, nTileXSize + 2*nHalo);
+    size_t nHaloYSize = MIN(nYSize, nTileYSize + 2*nHalo);
+
+#ifdef _OPENMP
+    if (nThreads <= 0)
+    {
+        nThreads = omp_get_max_threads();
+    }
+#endif
+
+    CPLErr eErr = CE_None;
+
+    #pragma omp parallel num_threads(nThreads)
+    {
+        std::vector<float> src(nHaloXSize*nHaloYSize);
+        std::vector<float> dst((size_t) nTileXSize*nTileYSize);
+        std::vector<double> scratch;
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < nTiles; ++t)
+        {
+            HaloTile tile;
+            tile.nXOff = (t % nTilesX)*nTileXSize;
+            tile.nYOff = (t / nTilesX)*nTileYSize;
+            tile.nXLen = MIN(nTileXSize, nXSize - tile.nXOff);
+            tile.nYLen = MIN(nTileYSize, nYSize - tile.nYOff);
+            tile.nHaloXOff = MAX(tile.nXOff - nHalo, 0);
+            tile.nHaloYOff = MAX(tile.nYOff - nHalo, 0);
+            tile.nHaloXLen = MIN(tile.nXOff + tile.nXLen + nHalo, nXSize) - tile.nHaloXOff;
+            tile.nHaloYLen = MIN(tile.nYOff + tile.nYLen + nHalo, nYSize) - tile.nHaloYOff;
+
+            CPLErr eTileErr;
+            #pragma omp critical(HaloTileIO)
+            {
+                eTileErr = GDALRasterIO(srcBand, GF_Read,
+                                        tile.nHaloXOff, tile.nHaloYOff,
+                                        tile.nHaloXLen, tile.nHaloYLen,
+                                        &src[0],
+                                        tile.nHaloXLen, tile.nHaloYLen,
+                                        GDT_Float32,
+                                        0, 0);
+            }
+
+            if (eTileErr == CE_None)
+            {
+                for (size_t i = 0; i < (size_t) tile.nHaloXLen*tile.nHaloYLen; ++i)
+                {
+                    if (srcNoData && src[i] == srcNoDataValue)
+                    {
+                        src[i] = std::numeric_limits<float>::quiet_NaN();
+                    }
+                }
+
+                kernel(&src[0], tile, &dst[0], scratch);
+
+                #pragma omp critical(HaloTileIO)
+                {
+                    eTileErr = GDALRasterIO(dstBand, GF_Write,
+                                            tile.nXOff, tile.nYOff,
+                                            tile.nXLen, tile.nYLen,
+                                            &dst[0],
+                                            tile.nXLen, tile.nYLen,
+                                            GDT_Float32,
+                                            0, 0);
+                }
+            }
+            if (eTileErr != CE_None)
+            {
+                #pragma omp critical(HaloTileErr)
+                {
+                    std::cout << QString("ERROR: Cannot read or write tile at %1, %2").arg(tile.nXOff).arg(tile.nYOff) + "\n";
+                    eErr = eTileErr;
+                }
+            }
+        }
+    }
+
+    return eErr;
+}
 
 
 float * getRasterData(GDALDatasetH raster, float dstNodataValue,
@@ -160,6 +922,13 @@ Write out raster band
 CPLErr writeRasterData(GDALDatasetH dataset, GDALDriverH driver, double * transform, 
     int rasterXsize, int rasterYsize, float noDataValue, float * data, const char * filename, const char * pJref);
 
+/*
+Pixel window {xOffset, yOffset, xSize, ySize} bounding a circle of radius around (x, y)
+in georeferenced units, clipped to the raster. Returns false if the circle misses the raster
+*/
+bool getRadiusWindow(double * transform, int rasterXsize, int rasterYsize,
+    double x, double y, double radius, int * window);
+
 /***************************************
 SLOPE
 ***************************************/
@@ -184,6 +953,63 @@ float GDALSlopeHornAlg (float* afWin, float dstNoDataValue, void* pData);
 //ZevenbergenThorneSlopeAlgorithim
 float GDALSlopeZevenbergenThorneAlg (float* afWin, float dsNoDataValue, void* pData);
 
+//Slope kernels
+struct GDALSlopeHornKernel : public GDALGeneric3x3Kernel
+{
+    GDALSlopeAlgData data;
+
+    explicit GDALSlopeHornKernel(const GDALSlopeAlgData& d) : data(d) {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        double dx, dy, key;
+
+        dx = ((afWin[0] + afWin[3] + afWin[3] + afWin[6]) - 
+              (afWin[2] + afWin[5] + afWin[5] + afWin[8]))/data.ewres;
+
+        dy = ((afWin[6] + afWin[7] + afWin[7] + afWin[8]) - 
+              (afWin[0] + afWin[1] + afWin[1] + afWin[2]))/data.nsres;
+
+        key = (dx * dx + dy * dy);
+
+        return SlopeFromRise(sqrt(key) / (8*data.scale), data.slopeFormat);
+    }
+
+    inline int processRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                          float* pafOutput, int nCount, const Row3x3NoData& noData) const
+    {
+        return SlopeRowKernel(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                              true, data.ewres, data.nsres, data.scale, data.slopeFormat);
+    }
+};
+
+struct GDALSlopeZevenbergenThorneKernel : public GDALGeneric3x3Kernel
+{
+    GDALSlopeAlgData data;
+
+    explicit GDALSlopeZevenbergenThorneKernel(const GDALSlopeAlgData& d) : data(d) {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        double dx, dy, key;
+
+        dx = (afWin[3] - afWin[5])/data.ewres;
+
+        dy = (afWin[7] - afWin[1])/data.nsres;
+
+        key = (dx * dx + dy * dy);
+
+        return SlopeFromRise(sqrt(key) / (2*data.scale), data.slopeFormat);
+    }
+
+    inline int processRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                          float* pafOutput, int nCount, const Row3x3NoData& noData) const
+    {
+        return SlopeRowKernel(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                              false, data.ewres, data.nsres, data.scale, data.slopeFormat);
+    }
+};
+
 /****************************************************
 ASPECT
 ****************************************************/
@@ -201,6 +1027,47 @@ float GDALAspectAlg (float* afWin, float dstNoDataValue, void* pData);
 //ZevenBergenThorneAlgo
 float GDALAspectZevenbergenThorneAlg (float* afWin, float dstNoDataValue, void* pData);
 
+//Aspect kernels, bZevenbergenThorne picks the 4 cell (ZT) or 8 cell (Horn) gradient
+template <bool bZevenbergenThorne>
+struct GDALAspectKernelT : public GDALGeneric3x3Kernel
+{
+    GDALAspectAlgData data;
+
+    explicit GDALAspectKernelT(const GDALAspectAlgData& d) : data(d) {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        double dx, dy;
+
+        if (bZevenbergenThorne)
+        {
+            dx = (afWin[5] - afWin[3]);
+
+            dy = (afWin[7] - afWin[1]);
+        }
+        else
+        {
+            dx = ((afWin[2] + afWin[5] + afWin[5] + afWin[8]) -
+                  (afWin[0] + afWin[3] + afWin[3] + afWin[6]));
+
+            dy = ((afWin[6] + afWin[7] + afWin[7] + afWin[8]) - 
+                  (afWin[0] + afWin[1] + afWin[1] + afWin[2]));
+        }
+
+        return AspectFromGradient(dx, dy, data.useAngleAsAzimuth, dstNoDataValue);
+    }
+
+    inline int processRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                          float* pafOutput, int nCount, const Row3x3NoData& noData) const
+    {
+        return AspectRowKernel(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                               !bZevenbergenThorne, data.useAngleAsAzimuth);
+    }
+};
+
+typedef GDALAspectKernelT<false> GDALAspectKernel;
+typedef GDALAspectKernelT<true>  GDALAspectZevenbergenThorneKernel;
+
 /***************************************************
 CURVATURE
 ***************************************************/
@@ -220,6 +1087,69 @@ float GDALCurvatureContourAlg(float* afWin, float dstNoDataValue, void* pData);
 //Tangential curvature
 float GDALCurvatureTangentAlg(float* afWin, float dstNoDataValue, void* pData);
 
+//Curvature kernels, the resolution terms are worked out once per run
+template <RF::CurvatureType eType>
+struct GDALCurvatureKernelT : public GDALGeneric3x3Kernel
+{
+    double ewres;
+    double nsres;
+    double zxxDenom;
+    double zyyDenom;
+    double zxyDenom;
+
+    explicit GDALCurvatureKernelT(const GDALCurvatureAlgData& d) :
+        ewres(d.ewres),
+        nsres(d.nsres),
+        zxxDenom(3*pow(d.ewres, 2)),
+        zyyDenom(3*pow(d.nsres, 2)),
+        zxyDenom(4*(pow(d.ewres,2)))
+    {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        double zx, zy, zxx, zyy, zxy, z2x, z2y;
+
+        zx = (afWin[2] + afWin[5] + afWin[8] - afWin[0] - afWin[3] - afWin[6])/(6*ewres);
+        zy = (afWin[0] + afWin[1] +afWin[2] - afWin[6] - afWin[7] - afWin[8])/(6*nsres);
+        zxx = (afWin[0] + afWin[2] + afWin[3] + afWin[5] + afWin[6] + afWin[8] - 2*(afWin[1]+afWin[4]+afWin[7]))/zxxDenom;
+        zyy = (afWin[0] + afWin[1] + afWin[2] + afWin[6] + afWin[7] + afWin[8] - 2*(afWin[3]+afWin[4]+afWin[5]))/zyyDenom;
+        zxy = (afWin[2] + afWin[6] - afWin[0] - afWin[8])/zxyDenom;
+        z2x = zx*zx;
+        z2y = zy*zy;
+
+        if (zx == 0 && zy == 0)
+        {
+            /* Flat area */
+            return dstNoDataValue;
+        }
+        else if (eType == RF::PROFILE)
+        {
+            double root = sqrt(fabs(1+z2x+z2y));
+            return (float) ((zxx*z2x)+(2*zxy*zx*zy)+(zyy*z2y))/((z2x + z2y)*(root*root*root));
+        }
+        else if (eType == RF::CONTOUR)
+        {
+            double root = sqrt(fabs(z2x+z2y));
+            return (float) ((zxx*z2x)-(2*zxy*zx*zy)+(zyy*z2y))/(root*root*root);
+        }
+        else
+        {
+            return (float) ((zxx*z2x)-(2*zxy*zx*zy)+(zyy*z2y))/((z2x+z2y)+sqrt(fabs(1+z2x+z2y)));
+        }
+    }
+
+    inline int processRow(const float* pafLine1, const float* pafLine2, const float* pafLine3,
+                          float* pafOutput, int nCount, const Row3x3NoData& noData) const
+    {
+        return CurvatureRowKernel(pafLine1, pafLine2, pafLine3, pafOutput, nCount, noData,
+                                  (int) eType, ewres, nsres, zxxDenom, zyyDenom, zxyDenom);
+    }
+};
+
+typedef GDALCurvatureKernelT<RF::PROFILE>    GDALCurvatureProfileKernel;
+typedef GDALCurvatureKernelT<RF::CONTOUR>    GDALCurvatureContourKernel;
+typedef GDALCurvatureKernelT<RF::TANGENTIAL> GDALCurvatureTangentKernel;
+
 /***************************************************
 FLOWDIR
 ***************************************************/
@@ -246,10 +1176,379 @@ float GDALFlowDirectionInfAlg(float* afWin, float dstNoDataValue, void* pData);
 
 float GDALFlowDirection8Alg(float* afWin, float dstNoDataValue, void* pData);
 
+//D-infinity flow direction kernel (Tarboton 1997), angles are counter clockwise from east
+struct GDALFlowDirectionInfKernel : public GDALGeneric3x3Kernel
+{
+    double ewres;
+    double nsres;
+    double maxFacetAngle;
+
+    explicit GDALFlowDirectionInfKernel(const GDALFlowDirAlgData& d) :
+        ewres(d.ewres),
+        nsres(-d.nsres),
+        maxFacetAngle(atan(-d.nsres/d.ewres))
+    {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        //Facet edge cells e1, e2 and the ac/af multipliers for each of the 8 facets
+        static const int facetE1[8] = {5, 1, 1, 3, 3, 7, 7, 5};
+        static const int facetE2[8] = {2, 2, 0, 0, 6, 6, 8, 8};
+        static const int facetAc[8] = {0, 1, 1, 2, 2, 3, 3, 4};
+        static const int facetAf[8] = {1, -1, 1, -1, 1, -1, 1, -1};
+
+        double flowDir = -9999;
+        double maxS = -999999;
+        int maxFacet = -1;
+        for (int i = 0; i < 8; ++i)
+        {
+            //Calculate slope for each facet
+            double s0 = (afWin[4] - afWin[facetE1[i]])/ewres;
+            double s1 = (afWin[facetE1[i]] - afWin[facetE2[i]])/nsres;
+            double fdir = atan2(s1, s0);
+            double s_mag;
+
+            if (fdir <= 0)
+            {
+                fdir = 0;
+                s_mag = s0;
+            }
+            else if (fdir > maxFacetAngle)
+            {
+                fdir = maxFacetAngle;
+                s_mag = (afWin[4] - afWin[facetE2[i]])/sqrt(fabs(s0*s0 + s1*s1));
+            }
+            else
+            {
+                s_mag = sqrt(fabs(s0*s0 + s1*s1));
+            }
+
+            if (s_mag > maxS)
+            {
+                maxS = s_mag;
+                flowDir = fdir;
+                maxFacet = i;
+            }
+        }
+
+        if (maxS > 0)
+        {
+            return (facetAf[maxFacet]*flowDir) + (facetAc[maxFacet]*(M_PI/2));
+        }
+        return -1;
+    }
+};
+
+//D8 flow direction kernel, returns the power of 2 direction code
+struct GDALFlowDirection8Kernel : public GDALGeneric3x3Kernel
+{
+    explicit GDALFlowDirection8Kernel(const GDALFlowDirAlgData& d) {}
+
+    inline float operator()(float* afWin, float dstNoDataValue) const
+    {
+        static const int flowAngles[9] = {32, 64, 128, 
+                                          16, -1, 1,
+                                          8, 4, 2};
+        double dWDrop[9];
+        double dWDropmax = 0;
+        for (int i = 0; i < 9; ++i)
+        {
+            if (i % 2 == 0 && i != 4)
+            {
+                dWDrop[i] = (afWin[4] - afWin[i])/ROOT_2;
+            }
+            else
+            {
+                dWDrop[i] = (afWin[4] - afWin[i]);
+            }
+            if (dWDrop[i] > dWDropmax)
+            {
+                dWDropmax = dWDrop[i];
+            }
+        }
+
+        int nNeighbours = 0;
+        int maxCell[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            if (dWDrop[i] >= dWDropmax)
+            {
+                maxCell[nNeighbours++] = i;
+            }
+        }
+
+        float direction = -1;
+        if (nNeighbours == 0)
+        {
+            std::cout << QString("ERROR: Condition 1 cell, ensure depressions have been filled") + "\n";
+        }
+        else if (nNeighbours == 1)
+        {
+            //Condition 2 cells - only 1 neighbour.
+            direction = flowAngles[maxCell[0]];
+        }
+        else if (dWDropmax > 0.0)
+        {
+            //Condition 3 cells - 2 neighbours with equal drop - look up table
+            if (nNeighbours < 3)//2 neighbours - arbitrary
+            {
+                direction = flowAngles[maxCell[0]];
+            }
+            else
+            {
+                if (maxCell[0] == 0 && maxCell[1] == 1 && maxCell[2] == 2)
+                    direction = flowAngles[1];
+                if (maxCell[0] == 1 && maxCell[1] == 2 && maxCell[2] == 5)
+                    direction = flowAngles[2];
+                if (maxCell[0] == 2 && maxCell[1] == 5 && maxCell[2] == 8)
+                    direction = flowAngles[5];
+                if (maxCell[0] == 5 && maxCell[1] == 7 && maxCell[2] == 8)
+                    direction = flowAngles[8];
+                if (maxCell[0] == 6 && maxCell[1] == 7 && maxCell[2] == 8)
+                    direction = flowAngles[7];
+                if (maxCell[0] == 3 && maxCell[1] == 6 && maxCell[2] == 7)
+                    direction = flowAngles[6];
+                if (maxCell[0] == 0 && maxCell[1] == 3 && maxCell[2] == 6)
+                    direction = flowAngles[3];
+                if (maxCell[0] == 0 && maxCell[1] == 1 && maxCell[2] == 3)
+                    direction = flowAngles[0];
+            }
+        }
+        else
+        {
+            //Condition 4 cells - 0 drop cells
+            direction = 0;
+            for (int dirIt = 0; dirIt < nNeighbours; ++dirIt)
+            {
+                direction += maxCell[dirIt];
+            }
+        }
+
+        return direction;
+    }
+};
+
 float GDALFlowDirection8IterativeAlg(float* afWin, float dstNoDataValue, void* pData);
 
 float GDALFillDepressionsAlg(float* afWin, float dstNoDataValue, void* pData);
 
+/*
+Priority-flood depression filling (Barnes, Lehman & Mulla 2014, Computers & Geosciences 62)
+Every cell is raised until it drains to the raster edge or a nodata cell. A cell is only raised when it
+is no higher than the cell it drains through; FLOODFLAT fills depressions flat to their spill level,
+FLOODEPSILON raises them to epsilon (or the smallest float step if epsilon <= 0) above that cell so
+they still drain. Cells above it are left as they are. pnChanged returns the number of cells raised.
+*/
+CPLErr GDALPriorityFloodFill(GDALRasterBandH srcBand,
+                             GDALRasterBandH dstBand,
+                             RF::FillMethod fillMethod,
+                             double epsilon,
+                             size_t* pnChanged);
+
+
+/***************************************
+ENERGY CONOID
+From Esposti Ongaro et al. (2016) 'A fast, calibrated model for pyroclastic
+density current kinematics and hazard' JVGR 327, pp. 257-272
+***************************************/
+
+//Maximum runout (Eq. 13), phi concentration, fr Froude number, A volume per radian, w_s settling velocity, g_p reduced gravity
+double l_max(double phi, double fr, double A, double w_s, double g_p, bool axisymmetric = true);
+
+//Cylindrical h_max (Eq. 12) at x, the distance over the maximum runout
+double h_max_cyl(double grav, double C, double linf, double x);
+
+/***************************************
+ENERGY CONE
+***************************************/
+
+/*
+Envelope of the energy cones of many sources, given as cell indices with their apex heights:
+the highest max(0, H - multiplier*d - z) over the sources at each cell, d the 3D distance to the apex.
+The best few sources are swept forward and back over the grid like a vector distance transform,
+a few passes whatever the number of sources (nearly exact, sources are only taken from neighbours)
+*/
+void energyConeEnvelope(const float* elevation, int nXSize, int nYSize, int srcNoData, float srcNoDataValue,
+    double ewres, double nsres, double multiplier,
+    const std::vector<int>& sources, const std::vector<float>& sourceHeights, float* cone);
+
+//A cell on the geodesic front, ordered so the heap pops the nearest first
+typedef struct GeodesicFront
+{
+    float distance;
+    int cell;
+
+    bool operator>(const GeodesicFront& other) const { return distance > other.distance; }
+} GeodesicFront;
+
+/*
+Geodesic (obstacle) distance from source cells with starting distances, Dijkstra over the
+8-connected grid with horizontal steps. A reached cell for which blocked(cell, distance) is true
+keeps its distance but does not pass it on, so the cells behind it are only reached around it
+(sources always pass theirs on). Unreached cells are -1. Grid steps make open-ground distances up to 8% long
+*/
+template <class Blocked>
+void GeodesicDistance(int nXSize, int nYSize, double ewres, double nsres,
+                      const std::vector<int>& sources, const std::vector<float>& sourceDistances,
+                      const Blocked& blocked, float* distance)
+{
+    static const int nbrP[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int nbrL[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+    const float step[8] = {(float) sqrt((ewres*ewres) + (nsres*nsres)), (float) nsres, (float) sqrt((ewres*ewres) + (nsres*nsres)),
+                           (float) ewres, (float) ewres,
+                           (float) sqrt((ewres*ewres) + (nsres*nsres)), (float) nsres, (float) sqrt((ewres*ewres) + (nsres*nsres))};
+
+    size_t nCells = (size_t) nXSize*nYSize;
+    std::fill(distance, distance + nCells, -1.0f);
+
+    //One bit per cell for settled cells and for sources
+    std::vector<unsigned int> settled((nCells + 31) / 32, 0);
+    std::vector<unsigned int> isSource((nCells + 31) / 32, 0);
+
+    std::vector<GeodesicFront> heapStorage;
+    heapStorage.reserve(MAX(sources.size(), (size_t) (nXSize + nYSize)*4));
+    std::priority_queue<GeodesicFront, std::vector<GeodesicFront>, std::greater<GeodesicFront> >
+        front(std::greater<GeodesicFront>(), std::move(heapStorage));
+
+    for (size_t k = 0; k < sources.size(); ++k)
+    {
+        int i = sources[k];
+        isSource[i >> 5] |= 1u << (i & 31);
+        if (distance[i] < 0 || sourceDistances[k] < distance[i])
+        {
+            distance[i] = sourceDistances[k];
+            GeodesicFront seed = {sourceDistances[k], i};
+            front.push(seed);
+        }
+    }
+
+    while (!front.empty())
+    {
+        GeodesicFront current = front.top();
+        front.pop();
+        int i = current.cell;
+        if ((settled[i >> 5] >> (i & 31)) & 1)
+        {
+            continue;//Already reached by a shorter path
+        }
+        settled[i >> 5] |= 1u << (i & 31);
+
+        if (!((isSource[i >> 5] >> (i & 31)) & 1) && blocked(i, current.distance))
+        {
+            continue;
+        }
+
+        int P = i % nXSize;
+        int L = i / nXSize;
+        for (int n = 0; n < 8; ++n)
+        {
+            int nP = P + nbrP[n];
+            int nL = L + nbrL[n];
+            if (nP < 0 || nP >= nXSize || nL < 0 || nL >= nYSize)
+            {
+                continue;
+            }
+            int j = (nL*nXSize) + nP;
+            float d = current.distance + step[n];
+            if (!((settled[j >> 5] >> (j & 31)) & 1) && (distance[j] < 0 || d < distance[j]))
+            {
+                distance[j] = d;
+                GeodesicFront next = {d, j};
+                front.push(next);
+            }
+        }
+    }
+}
+
+/*
+Geodesic energy cone: the energy line spreads from the sources around the terrain, losing
+multiplier x the path length, and stops at cells it meets at or below the ground, so ridges
+it cannot clear shadow the cells behind them
+*/
+void energyConeGeodesic(const float* elevation, int nXSize, int nYSize, int srcNoData, float srcNoDataValue,
+    double ewres, double nsres, double multiplier,
+    const std::vector<int>& sources, const std::vector<float>& sourceHeights, float* cone);
+
+/***************************************
+FUZZY MORPHOLOGY
+***************************************/
+
+/*
+Weighted dilation and erosion: the max and min of value x weight over a kernelSize square kernel
+(row major weights) around each cell. The kernel is clipped at the raster edge.
+Either output can be NULL. Rows run on nThreads (<= 0 uses all cores)
+*/
+void weightedMorphology(const float* data, int nXSize, int nYSize,
+    const float* kernel, int kernelSize,
+    float* dilation, float* erosion, int nThreads = 0);
+
+/*
+Weighted morphology for a separable kernel, weight(r, c) = rowWeights[r] x colWeights[c] with all
+weights positive, as two 1D passes: O(kernelSize) per cell instead of O(kernelSize^2)
+*/
+void separableWeightedMorphology(const float* data, int nXSize, int nYSize,
+    const float* rowWeights, const float* colWeights, int kernelSize,
+    float* dilation, float* erosion, int nThreads = 0);
+
+/*
+Weighted morphology of every category at once, matching weightedMorphology on each category's 0/1
+indicator. categories holds a category index per cell (< 0 for none). One pass over each window
+builds a per-category histogram of cell counts and max/min weights, so the window is traversed
+once for all nCategories. Computes rows rowStart to rowStart + nRows - 1, output is band
+sequential: category c of row i is at [(c x nRows + i - rowStart) x nXSize]
+*/
+void categoricalMorphology(const int* categories, int nXSize, int nYSize, int nCategories,
+    const float* kernel, int kernelSize, int rowStart, int nRows,
+    float* dilation, float* erosion, int nThreads = 0);
+
+/***************************************
+SMOOTHING
+***************************************/
+
+/*
+Normalised convolution of srcBand with the separable kernel rowWeights x colWeights (kernelSize,
+odd) into dstBand: each cell is sum(weight x value) / sum(weight) over the valid cells of its
+window, so no data and NaN cells are left out instead of bleeding into their neighbours. These
+cells, and any with no valid cell in the window, are written as dstNoDataValue. Streams through
+GDALHaloTileProcessing with a kernel radius halo on nThreads (<= 0 uses all cores)
+*/
+CPLErr GDALNormalisedConvolution(GDALRasterBandH srcBand, GDALRasterBandH dstBand,
+    const float* rowWeights, const float* colWeights, int kernelSize,
+    float dstNoDataValue, int nThreads = 0);
+
+/*
+Edge preserving bilateral filter of srcBand into dstBand: each cell is the average of the valid
+cells in its kernelSize (odd) window, weighted by a gaussian of distance (spatialSigma, cells) and
+of value difference from the cell (rangeSigma, data units), so steps larger than a few rangeSigma
+are kept while smaller noise is smoothed. No data and NaN cells are left out and written as
+dstNoDataValue. Streams through GDALHaloTileProcessing on nThreads (<= 0 uses all cores)
+*/
+CPLErr GDALBilateralFilter(GDALRasterBandH srcBand, GDALRasterBandH dstBand,
+    int kernelSize, double spatialSigma, double rangeSigma,
+    float dstNoDataValue, int nThreads = 0);
+
+/***************************************
+BLENDING
+***************************************/
+
+/*
+Blends band 1 of overlayDataset into band 1 of baseDataset, written to dstBand on the base grid.
+The overlay is placed by georeferencing (any projection, resolution or overlap) and warped through
+a warped VRT covering only its footprint, so only the part under each output tile is resampled
+(with resampleAlg). Cells where only one layer has data take that layer, where both do:
+WEIGHTEDBLEND  baseWeight x base + overlayWeight x overlay + offset
+MAXBLEND       the larger value
+MINBLEND       the smaller value
+FEATHERBLEND   overlay weight rising linearly from 0 at the edge of its data to 1 featherCells in
+Cells with neither are dstNoDataValue. Streams through GDALHaloTileProcessing on nThreads
+(<= 0 uses all cores), each thread warping its own copy of the overlay reopened after a flush.
+Overlays that cannot be reopened by name, or reopen as a different grid, are warped by one
+thread at a time
+*/
+CPLErr GDALBlendOverlay(GDALDatasetH baseDataset, GDALDatasetH overlayDataset, GDALRasterBandH dstBand,
+    RF::BlendMethod method, double baseWeight, double overlayWeight, double offset, int featherCells,
+    GDALResampleAlg resampleAlg, float dstNoDataValue, int nThreads = 0);
+
 
 
 DECLARE_WORKSPACE_DATA_FACTORY(RF::SlopeAlgType, RF_API)
@@ -264,6 +1563,12 @@ DECLARE_WORKSPACE_ENUMTOINTADAPTOR(RF::FlowDirType, RF_API)
 DECLARE_WORKSPACE_DATA_FACTORY(RF::FuzzyMembershipType, RF_API)
 DECLARE_WORKSPACE_ENUMTOINTADAPTOR(RF::FuzzyMembershipType, RF_API)
 
+DECLARE_WORKSPACE_DATA_FACTORY(RF::FillMethod, RF_API)
+DECLARE_WORKSPACE_ENUMTOINTADAPTOR(RF::FillMethod, RF_API)
+
+DECLARE_WORKSPACE_DATA_FACTORY(RF::BlendMethod, RF_API)
+DECLARE_WORKSPACE_ENUMTOINTADAPTOR(RF::BlendMethod, RF_API)
+
 DECLARE_WORKSPACE_DATA_FACTORY(GDALRIOResampleAlg, RF_API)
 DECLARE_WORKSPACE_ENUMTOINTADAPTOR(GDALRIOResampleAlg, RF_API)
 #endif